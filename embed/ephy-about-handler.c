@@ -21,26 +21,40 @@
 #include "config.h"
 #include "ephy-about-handler.h"
 
+#include "ephy-debug.h"
+#include "ephy-embed.h"
+#include "ephy-embed-container.h"
 #include "ephy-embed-shell.h"
 #include "ephy-embed-prefs.h"
 #include "ephy-embed-utils.h"
 #include "ephy-file-helpers.h"
 #include "ephy-flatpak-utils.h"
 #include "ephy-history-service.h"
+#include "ephy-metrics.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-smaps.h"
 #include "ephy-snapshot-service.h"
 #include "ephy-web-app-utils.h"
+#include "ephy-web-extension-proxy.h"
+#include "ephy-web-view.h"
 
 #include <gio/gio.h>
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
+#include <libsoup/soup.h>
 
 struct _EphyAboutHandler {
   GObject parent_instance;
 
   EphySMaps *smaps;
+
+  /* The last about:overview page, until history or thumbnails change. */
+  GBytes *overview_html;
+  GList *overview_requests;
+  guint overview_generation;
+  guint overview_query_generation;
+  gboolean overview_signals_connected;
 };
 
 G_DEFINE_TYPE (EphyAboutHandler, ephy_about_handler, G_TYPE_OBJECT)
@@ -56,6 +70,8 @@ ephy_about_handler_finalize (GObject *object)
   EphyAboutHandler *handler = EPHY_ABOUT_HANDLER (object);
 
   g_clear_object (&handler->smaps);
+  g_clear_pointer (&handler->overview_html, g_bytes_unref);
+  g_list_free_full (handler->overview_requests, g_object_unref);
 
   G_OBJECT_CLASS (ephy_about_handler_parent_class)->finalize (object);
 }
@@ -95,18 +111,53 @@ ephy_about_handler_finish_request (WebKitURISchemeRequest *request,
   g_object_unref (stream);
 }
 
+static void
+ephy_about_handler_finish_request_with_bytes (WebKitURISchemeRequest *request,
+                                              GBytes                 *data)
+{
+  g_autoptr(GInputStream) stream = NULL;
+
+  stream = g_memory_input_stream_new_from_bytes (data);
+  webkit_uri_scheme_request_finish (request, stream, g_bytes_get_size (data), "text/html");
+}
+
+typedef struct {
+  gboolean json;
+  EphySMapsSortOrder sort_order;
+  GPtrArray *tabs;
+} MemoryRequest;
+
+static void
+memory_request_free (MemoryRequest *data)
+{
+  g_ptr_array_unref (data->tabs);
+  g_free (data);
+}
+
 static void
 handle_memory_finished_cb (EphyAboutHandler       *handler,
                            GAsyncResult           *result,
                            WebKitURISchemeRequest *request)
 {
+  MemoryRequest *data = g_task_get_task_data (G_TASK (result));
   GString *data_str;
   gsize data_length;
   char *memory;
 
+  memory = g_task_propagate_pointer (G_TASK (result), NULL);
+
+  if (data->json) {
+    g_autoptr(GInputStream) stream = NULL;
+
+    data_length = strlen (memory);
+    stream = g_memory_input_stream_new_from_data (memory, data_length, g_free);
+    webkit_uri_scheme_request_finish (request, stream, data_length, "application/json");
+    g_object_unref (request);
+    return;
+  }
+
   data_str = g_string_new ("<html>");
 
-  memory = g_task_propagate_pointer (G_TASK (result), NULL);
   if (memory) {
     g_string_append_printf (data_str, "<head><title>%s</title>"
                             "<meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />"
@@ -116,6 +167,7 @@ handle_memory_finished_cb (EphyAboutHandler       *handler,
 
     g_string_append_printf (data_str, "<h1>%s</h1>", _("Memory usage"));
     g_string_append (data_str, memory);
+    g_string_append (data_str, "</body>");
     g_free (memory);
   }
 
@@ -133,27 +185,339 @@ handle_memory_sync (GTask        *task,
                     GCancellable *cancellable)
 {
   EphyAboutHandler *handler = EPHY_ABOUT_HANDLER (source_object);
+  MemoryRequest *data = task_data;
+  EphySMaps *smaps = ephy_about_handler_get_smaps (handler);
 
-  g_task_return_pointer (task,
-                         ephy_smaps_to_html (ephy_about_handler_get_smaps (handler)),
-                         g_free);
+  if (data->json)
+    g_task_return_pointer (task, ephy_smaps_to_json (smaps, data->tabs, data->sort_order), g_free);
+  else
+    g_task_return_pointer (task, ephy_smaps_to_html (smaps, data->tabs, data->sort_order), g_free);
+}
+
+/* about:memory?format=json returns the same data for monitoring scripts, and
+ * sort=pss, uss or title sorts the tabs.
+ */
+static void
+parse_memory_request_options (WebKitURISchemeRequest *request,
+                              MemoryRequest          *data)
+{
+  g_autoptr(SoupURI) uri = NULL;
+  g_autoptr(GHashTable) form = NULL;
+  const char *query;
+  const char *sort;
+
+  uri = soup_uri_new (webkit_uri_scheme_request_get_uri (request));
+  query = uri ? soup_uri_get_query (uri) : NULL;
+  if (!query)
+    return;
+
+  form = soup_form_decode (query);
+  data->json = g_strcmp0 (g_hash_table_lookup (form, "format"), "json") == 0;
+
+  sort = g_hash_table_lookup (form, "sort");
+  if (g_strcmp0 (sort, "uss") == 0)
+    data->sort_order = EPHY_SMAPS_SORT_USS;
+  else if (g_strcmp0 (sort, "title") == 0)
+    data->sort_order = EPHY_SMAPS_SORT_TITLE;
+}
+
+/* Web views can only be used in the main thread, so the tabs are listed
+ * before the memory is read.
+ */
+static GPtrArray *
+get_memory_tabs (void)
+{
+  GPtrArray *tabs = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_smaps_tab_free);
+  GList *windows;
+
+  windows = gtk_application_get_windows (GTK_APPLICATION (ephy_embed_shell_get_default ()));
+  for (GList *l = windows; l; l = l->next) {
+    g_autoptr(GList) embeds = NULL;
+
+    if (!EPHY_IS_EMBED_CONTAINER (l->data))
+      continue;
+
+    embeds = ephy_embed_container_get_children (EPHY_EMBED_CONTAINER (l->data));
+    for (GList *e = embeds; e; e = e->next) {
+      EphyEmbed *embed = e->data;
+      EphyWebView *view = ephy_embed_get_web_view (embed);
+
+      g_ptr_array_add (tabs, ephy_smaps_tab_new (ephy_embed_get_title (embed),
+                                                 ephy_web_view_get_display_address (view),
+                                                 ephy_web_view_get_web_process_pid (view)));
+    }
+  }
+
+  return tabs;
 }
 
 static gboolean
 ephy_about_handler_handle_memory (EphyAboutHandler       *handler,
                                   WebKitURISchemeRequest *request)
 {
+  MemoryRequest *data;
   GTask *task;
 
+  data = g_new0 (MemoryRequest, 1);
+  data->sort_order = EPHY_SMAPS_SORT_PSS;
+  data->tabs = get_memory_tabs ();
+  parse_memory_request_options (request, data);
+
   task = g_task_new (handler, NULL,
                      (GAsyncReadyCallback)handle_memory_finished_cb,
                      g_object_ref (request));
+  g_task_set_task_data (task, data, (GDestroyNotify)memory_request_free);
   g_task_run_in_thread (task, handle_memory_sync);
   g_object_unref (task);
 
   return TRUE;
 }
 
+typedef struct {
+  guint pid;
+  GVariant *metrics;
+} WebProcessMetrics;
+
+typedef struct {
+  WebKitURISchemeRequest *request;
+  GVariant *ui_metrics;
+  GArray *web_processes;
+  guint pending;
+} PerformanceRequest;
+
+static void
+web_process_metrics_clear (WebProcessMetrics *web_process)
+{
+  g_variant_unref (web_process->metrics);
+}
+
+static void
+performance_request_free (PerformanceRequest *data)
+{
+  g_object_unref (data->request);
+  g_variant_unref (data->ui_metrics);
+  g_array_unref (data->web_processes);
+  g_free (data);
+}
+
+static int
+compare_web_process_metrics (const WebProcessMetrics *a,
+                             const WebProcessMetrics *b)
+{
+  return a->pid < b->pid ? -1 : a->pid > b->pid;
+}
+
+static gboolean
+lookup_metric (GVariant   *metrics,
+               const char *category,
+               const char *name,
+               gint64     *value)
+{
+  GVariantIter iter;
+  const char *metric_category;
+  const char *metric_name;
+  gint64 metric_value;
+
+  g_variant_iter_init (&iter, metrics);
+  while (g_variant_iter_next (&iter, "(&s&sutxxxxx)", &metric_category, &metric_name,
+                              NULL, NULL, &metric_value, NULL, NULL, NULL, NULL)) {
+    if (strcmp (metric_category, category) == 0 && strcmp (metric_name, name) == 0) {
+      *value = metric_value;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* Rates that are not recorded as such, but are the first thing to look at
+ * when diagnosing a slowdown.
+ */
+static void
+append_derived_metrics_html (GString  *str,
+                             GVariant *metrics)
+{
+  gint64 no_match = 0, positive = 0, negative = 0, server = 0;
+  gint64 records = 0, decrypt_time = 0;
+  gboolean has_rows = FALSE;
+
+  lookup_metric (metrics, "safe-browsing", "no-match", &no_match);
+  lookup_metric (metrics, "safe-browsing", "positive-cache-hit", &positive);
+  lookup_metric (metrics, "safe-browsing", "negative-cache-hit", &negative);
+  lookup_metric (metrics, "safe-browsing", "server-lookup", &server);
+  lookup_metric (metrics, "sync", "records-downloaded", &records);
+  lookup_metric (metrics, "sync", "decrypt-page", &decrypt_time);
+
+  if (no_match + positive + negative + server > 0) {
+    g_string_append_printf (str, "<table class=\"memory-table\"><caption>%s</caption><tbody>", _("Summary"));
+    has_rows = TRUE;
+    g_string_append_printf (str, "<tr><td>%s</td><td>%.1f%%</td></tr>",
+                            _("Safe Browsing local hit rate"),
+                            100.0 * (no_match + positive + negative) / (no_match + positive + negative + server));
+  }
+
+  if (records > 0 && decrypt_time > 0) {
+    if (!has_rows)
+      g_string_append_printf (str, "<table class=\"memory-table\"><caption>%s</caption><tbody>", _("Summary"));
+    has_rows = TRUE;
+    g_string_append_printf (str, "<tr><td>%s</td><td>%.0f</td></tr>",
+                            _("Sync records decrypted per second"),
+                            records * (double)G_USEC_PER_SEC / decrypt_time);
+  }
+
+  if (has_rows)
+    g_string_append (str, "</tbody></table>");
+}
+
+static void
+append_metrics_html (GString  *str,
+                     GVariant *metrics)
+{
+  GVariantIter iter;
+  const char *category;
+  const char *name;
+  guint32 kind;
+  guint64 count;
+  gint64 value, max, p50, p90, p99;
+  g_autofree char *current_category = NULL;
+
+  if (g_variant_n_children (metrics) == 0) {
+    g_string_append_printf (str, "<p>%s</p>", _("Nothing recorded yet."));
+    return;
+  }
+
+  append_derived_metrics_html (str, metrics);
+
+  g_variant_iter_init (&iter, metrics);
+  while (g_variant_iter_next (&iter, "(&s&sutxxxxx)", &category, &name, &kind, &count, &value, &max, &p50, &p90, &p99)) {
+    g_autofree char *escaped_name = g_markup_escape_text (name, -1);
+
+    if (g_strcmp0 (category, current_category) != 0) {
+      g_autofree char *escaped_category = g_markup_escape_text (category, -1);
+
+      if (current_category)
+        g_string_append (str, "</tbody></table>");
+      g_free (current_category);
+      current_category = g_strdup (category);
+
+      g_string_append_printf (str, "<table class=\"memory-table\"><caption>%s</caption>"
+                              "<thead><tr><th></th><th>%s</th><th>%s</th><th>p50</th><th>p90</th><th>p99</th><th>%s</th></tr></thead><tbody>",
+                              escaped_category, _("Count"), _("Value"), _("Max"));
+    }
+
+    switch (kind) {
+      case EPHY_METRIC_DURATION:
+        g_string_append_printf (str, "<tr><td>%s</td><td>%" G_GUINT64_FORMAT "</td><td>%.2f ms</td>"
+                                "<td>%.2f ms</td><td>%.2f ms</td><td>%.2f ms</td><td>%.2f ms</td></tr>",
+                                escaped_name, count,
+                                count ? value / 1000.0 / count : 0.0,
+                                p50 / 1000.0, p90 / 1000.0, p99 / 1000.0, max / 1000.0);
+        break;
+      case EPHY_METRIC_COUNTER:
+        g_string_append_printf (str, "<tr><td>%s</td><td>%" G_GUINT64_FORMAT "</td><td>%" G_GINT64_FORMAT "</td>"
+                                "<td></td><td></td><td></td><td></td></tr>",
+                                escaped_name, count, value);
+        break;
+      case EPHY_METRIC_GAUGE:
+        g_string_append_printf (str, "<tr><td>%s</td><td>%" G_GUINT64_FORMAT "</td><td>%" G_GINT64_FORMAT "</td>"
+                                "<td></td><td></td><td></td><td>%" G_GINT64_FORMAT "</td></tr>",
+                                escaped_name, count, value, max);
+        break;
+      default:
+        break;
+    }
+  }
+
+  g_string_append (str, "</tbody></table>");
+}
+
+static void
+performance_request_finish (PerformanceRequest *data)
+{
+  GString *data_str;
+  gsize data_length;
+  guint i;
+
+  /* The page reloads itself to show live values. */
+  data_str = g_string_new (NULL);
+  g_string_append_printf (data_str, "<html><head><title>%s</title>"
+                          "<meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />"
+                          "<meta http-equiv=\"refresh\" content=\"2\" />"
+                          "<link href=\""EPHY_PAGE_TEMPLATE_ABOUT_CSS "\" rel=\"stylesheet\" type=\"text/css\">"
+                          "</head><body>",
+                          _("Performance"));
+  g_string_append_printf (data_str, "<h1>%s</h1>", _("Performance"));
+  g_string_append_printf (data_str, "<p>%s</p>",
+                          _("Durations are measured since the process started. Percentiles are accurate within 25%."));
+
+  g_string_append_printf (data_str, "<h2>%s</h2>", _("UI process"));
+  append_metrics_html (data_str, data->ui_metrics);
+
+  g_array_sort (data->web_processes, (GCompareFunc)compare_web_process_metrics);
+  for (i = 0; i < data->web_processes->len; i++) {
+    WebProcessMetrics *web_process = &g_array_index (data->web_processes, WebProcessMetrics, i);
+
+    g_string_append (data_str, "<h2>");
+    g_string_append_printf (data_str, _("Web process %u"), web_process->pid);
+    g_string_append (data_str, "</h2>");
+    append_metrics_html (data_str, web_process->metrics);
+  }
+
+  g_string_append (data_str, "</body></html>");
+
+  data_length = data_str->len;
+  ephy_about_handler_finish_request (data->request, g_string_free (data_str, FALSE), data_length);
+  performance_request_free (data);
+}
+
+static void
+get_performance_metrics_cb (EphyWebExtensionProxy *web_extension,
+                            GAsyncResult          *result,
+                            PerformanceRequest    *data)
+{
+  WebProcessMetrics web_process;
+  g_autoptr(GError) error = NULL;
+
+  web_process.pid = ephy_web_extension_proxy_get_pid (web_extension);
+  web_process.metrics = ephy_web_extension_proxy_get_performance_metrics_finish (web_extension, result, &error);
+  /* Busy web processes time out routinely, and the page reloads every two
+   * seconds, so this is not worth a warning.
+   */
+  if (web_process.metrics)
+    g_array_append_val (data->web_processes, web_process);
+  else
+    LOG ("Failed to get the metrics of web process %u: %s", web_process.pid, error->message);
+
+  if (--data->pending == 0)
+    performance_request_finish (data);
+}
+
+static gboolean
+ephy_about_handler_handle_performance (EphyAboutHandler       *handler,
+                                       WebKitURISchemeRequest *request)
+{
+  PerformanceRequest *data;
+  GList *l;
+
+  data = g_new0 (PerformanceRequest, 1);
+  data->request = g_object_ref (request);
+  data->ui_metrics = g_variant_ref_sink (ephy_metrics_get_snapshot ());
+  data->web_processes = g_array_new (FALSE, FALSE, sizeof (WebProcessMetrics));
+  g_array_set_clear_func (data->web_processes, (GDestroyNotify)web_process_metrics_clear);
+
+  for (l = ephy_embed_shell_get_web_extensions (ephy_embed_shell_get_default ()); l; l = l->next) {
+    data->pending++;
+    ephy_web_extension_proxy_get_performance_metrics (l->data, NULL,
+                                                      (GAsyncReadyCallback)get_performance_metrics_cb,
+                                                      data);
+  }
+
+  if (data->pending == 0)
+    performance_request_finish (data);
+
+  return TRUE;
+}
+
 static gboolean
 ephy_about_handler_handle_about (EphyAboutHandler       *handler,
                                  WebKitURISchemeRequest *request)
@@ -305,15 +669,16 @@ ephy_about_handler_handle_applications (EphyAboutHandler       *handler,
 }
 
 static void
-history_service_query_urls_cb (EphyHistoryService     *history,
-                               gboolean                success,
-                               GList                  *urls,
-                               WebKitURISchemeRequest *request)
+history_service_query_urls_cb (EphyHistoryService *history,
+                               gboolean            success,
+                               GList              *urls,
+                               EphyAboutHandler   *handler)
 {
   EphySnapshotService *snapshot_service;
   EphyEmbedShell *shell;
   GString *data_str;
-  gsize data_length;
+  g_autoptr(GBytes) data = NULL;
+  GList *requests;
   char *lang;
   GList *l;
 
@@ -370,6 +735,7 @@ history_service_query_urls_cb (EphyHistoryService     *history,
     EphyHistoryURL *url = (EphyHistoryURL *)l->data;
     const char *snapshot;
     char *thumbnail_style = NULL;
+    g_autofree char *escaped_title = NULL;
 
     snapshot = ephy_snapshot_service_lookup_cached_snapshot_path (snapshot_service, url->url);
     if (snapshot)
@@ -377,14 +743,15 @@ history_service_query_urls_cb (EphyHistoryService     *history,
     else
       ephy_embed_shell_schedule_thumbnail_update (shell, url);
 
+    escaped_title = g_markup_escape_text (url->title, -1);
     g_string_append_printf (data_str,
                             "<a class=\"overview-item\" title=\"%s\" href=\"%s\">"
                             "  <div class=\"overview-close-button\" title=\"%s\">&#10006;</div>"
                             "  <span class=\"overview-thumbnail\"%s></span>"
                             "  <span class=\"overview-title\">%s</span>"
                             "</a>",
-                            g_markup_escape_text (url->title, -1), url->url, _("Remove from overview"),
-                            thumbnail_style ? thumbnail_style : "", url->title);
+                            escaped_title, url->url, _("Remove from overview"),
+                            thumbnail_style ? thumbnail_style : "", escaped_title);
     g_free (thumbnail_style);
   }
 
@@ -393,9 +760,22 @@ history_service_query_urls_cb (EphyHistoryService     *history,
                               "</body></html>\n");
 
  out:
-  data_length = data_str->len;
-  ephy_about_handler_finish_request (request, g_string_free (data_str, FALSE), data_length);
-  g_object_unref (request);
+  data = g_string_free_to_bytes (data_str);
+
+  /* Requests made while the query was running get this page anyway, but it
+   * is only kept if nothing changed in the meantime.
+   */
+  if (success && handler->overview_query_generation == handler->overview_generation) {
+    g_clear_pointer (&handler->overview_html, g_bytes_unref);
+    handler->overview_html = g_bytes_ref (data);
+  }
+
+  requests = g_list_reverse (g_steal_pointer (&handler->overview_requests));
+  for (l = requests; l; l = g_list_next (l))
+    ephy_about_handler_finish_request_with_bytes (WEBKIT_URI_SCHEME_REQUEST (l->data), data);
+  g_list_free_full (requests, g_object_unref);
+
+  g_object_unref (handler);
 }
 
 EphyHistoryQuery *
@@ -412,18 +792,57 @@ ephy_history_query_new_for_overview (void)
   return query;
 }
 
+static void
+history_service_changed_cb (EphyAboutHandler *handler)
+{
+  ephy_about_handler_invalidate_overview (handler);
+}
+
 static gboolean
 ephy_about_handler_handle_html_overview (EphyAboutHandler       *handler,
                                          WebKitURISchemeRequest *request)
 {
   EphyHistoryService *history;
   EphyHistoryQuery *query;
+  gboolean query_pending;
 
   history = ephy_embed_shell_get_global_history_service (ephy_embed_shell_get_default ());
+
+  if (!handler->overview_signals_connected) {
+    g_signal_connect_object (history, "urls-visited",
+                             G_CALLBACK (history_service_changed_cb),
+                             handler, G_CONNECT_SWAPPED);
+    g_signal_connect_object (history, "url-title-changed",
+                             G_CALLBACK (history_service_changed_cb),
+                             handler, G_CONNECT_SWAPPED);
+    g_signal_connect_object (history, "url-deleted",
+                             G_CALLBACK (history_service_changed_cb),
+                             handler, G_CONNECT_SWAPPED);
+    g_signal_connect_object (history, "host-deleted",
+                             G_CALLBACK (history_service_changed_cb),
+                             handler, G_CONNECT_SWAPPED);
+    g_signal_connect_object (history, "cleared",
+                             G_CALLBACK (history_service_changed_cb),
+                             handler, G_CONNECT_SWAPPED);
+    handler->overview_signals_connected = TRUE;
+  }
+
+  if (handler->overview_html) {
+    ephy_about_handler_finish_request_with_bytes (request, handler->overview_html);
+    return TRUE;
+  }
+
+  /* Tabs opened while the page is being generated share the same query. */
+  query_pending = handler->overview_requests != NULL;
+  handler->overview_requests = g_list_prepend (handler->overview_requests, g_object_ref (request));
+  if (query_pending)
+    return TRUE;
+
+  handler->overview_query_generation = handler->overview_generation;
   query = ephy_history_query_new_for_overview ();
   ephy_history_service_query_urls (history, query, NULL,
                                    (EphyHistoryJobCallback)history_service_query_urls_cb,
-                                   g_object_ref (request));
+                                   g_object_ref (handler));
   ephy_history_query_free (query);
 
   return TRUE;
@@ -488,6 +907,24 @@ ephy_about_handler_new (void)
   return EPHY_ABOUT_HANDLER (g_object_new (EPHY_TYPE_ABOUT_HANDLER, NULL));
 }
 
+/**
+ * ephy_about_handler_invalidate_overview:
+ * @handler: an #EphyAboutHandler
+ *
+ * Drops the cached about:overview page, so that it is generated again the
+ * next time it is requested. Changes to the history are tracked by @handler
+ * itself, this is for the ones it can't see, like hidden URLs and new
+ * thumbnails.
+ **/
+void
+ephy_about_handler_invalidate_overview (EphyAboutHandler *handler)
+{
+  g_assert (EPHY_IS_ABOUT_HANDLER (handler));
+
+  handler->overview_generation++;
+  g_clear_pointer (&handler->overview_html, g_bytes_unref);
+}
+
 void
 ephy_about_handler_handle_request (EphyAboutHandler       *handler,
                                    WebKitURISchemeRequest *request)
@@ -499,6 +936,8 @@ ephy_about_handler_handle_request (EphyAboutHandler       *handler,
 
   if (!g_strcmp0 (path, "memory"))
     handled = ephy_about_handler_handle_memory (handler, request);
+  else if (!g_strcmp0 (path, "performance"))
+    handled = ephy_about_handler_handle_performance (handler, request);
   else if (!g_strcmp0 (path, "epiphany"))
     handled = ephy_about_handler_handle_epiphany (handler, request);
   else if (!g_strcmp0 (path, "applications") && !ephy_is_running_inside_flatpak ())
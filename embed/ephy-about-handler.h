@@ -33,9 +33,10 @@ G_DECLARE_FINAL_TYPE (EphyAboutHandler, ephy_about_handler, EPHY, ABOUT_HANDLER,
 #define EPHY_ABOUT_SCHEME "ephy-about"
 #define EPHY_ABOUT_SCHEME_LEN 10
 
-EphyAboutHandler *ephy_about_handler_new            (void);
-void              ephy_about_handler_handle_request (EphyAboutHandler       *handler,
-                                                     WebKitURISchemeRequest *request);
+EphyAboutHandler *ephy_about_handler_new                 (void);
+void              ephy_about_handler_handle_request      (EphyAboutHandler       *handler,
+                                                          WebKitURISchemeRequest *request);
+void              ephy_about_handler_invalidate_overview (EphyAboutHandler       *handler);
 
 EphyHistoryQuery *ephy_history_query_new_for_overview (void);
 
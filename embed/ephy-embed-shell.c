@@ -35,6 +35,7 @@
 #include "ephy-filters-manager.h"
 #include "ephy-flatpak-utils.h"
 #include "ephy-history-service.h"
+#include "ephy-overview-snapshot.h"
 #include "ephy-password-manager.h"
 #include "ephy-profile-utils.h"
 #include "ephy-settings.h"
@@ -49,6 +50,7 @@
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #define PAGE_SETUP_FILENAME "page-setup-gtk.ini"
 #define PRINT_SETTINGS_FILENAME "print-settings.ini"
@@ -70,6 +72,11 @@ typedef struct {
   char *guid;
   GDBusServer *dbus_server;
   GList *web_extensions;
+  GList *overview_urls;
+  GHashTable *overview_thumbnails;
+  guint overview_version;
+  int overview_fd;
+  guint overview_publish_id;
   EphyFiltersManager *filters_manager;
   EphySearchEngineManager *search_engine_manager;
   GCancellable *cancellable;
@@ -201,6 +208,15 @@ ephy_embed_shell_dispose (GObject *object)
     priv->web_extensions = NULL;
   }
 
+  g_clear_handle_id (&priv->overview_publish_id, g_source_remove);
+  ephy_history_url_list_free (priv->overview_urls);
+  priv->overview_urls = NULL;
+  g_clear_pointer (&priv->overview_thumbnails, g_hash_table_destroy);
+  if (priv->overview_fd != -1) {
+    close (priv->overview_fd);
+    priv->overview_fd = -1;
+  }
+
   g_clear_object (&priv->encodings);
   g_clear_object (&priv->page_setup);
   g_clear_object (&priv->print_settings);
@@ -239,6 +255,79 @@ web_extension_sensitive_form_focused_message_received_cb (WebKitUserContentManag
                  page_id, insecure_action);
 }
 
+static void
+ephy_embed_shell_send_overview_snapshot (EphyEmbedShell        *shell,
+                                         EphyWebExtensionProxy *web_extension)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  guint sent_version;
+
+  if (priv->overview_fd == -1)
+    return;
+
+  sent_version = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (web_extension), "overview-version"));
+  if (sent_version == priv->overview_version)
+    return;
+
+  if (ephy_web_extension_proxy_history_set_snapshot (web_extension, priv->overview_fd, priv->overview_version))
+    g_object_set_data (G_OBJECT (web_extension), "overview-version", GUINT_TO_POINTER (priv->overview_version));
+}
+
+static gboolean
+publish_overview_snapshot_cb (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(sss)"));
+  g_autoptr(GVariant) snapshot = NULL;
+  g_autoptr(GError) error = NULL;
+  GList *l;
+  int fd;
+
+  priv->overview_publish_id = 0;
+
+  for (l = priv->overview_urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+    const char *thumbnail = g_hash_table_lookup (priv->overview_thumbnails, url->url);
+
+    g_variant_builder_add (&builder, "(sss)", url->url, url->title ?: "", thumbnail ?: "");
+  }
+
+  snapshot = g_variant_ref_sink (g_variant_new ("(ta(sss))", (guint64)priv->overview_version + 1, &builder));
+  fd = ephy_overview_snapshot_to_fd (snapshot, &error);
+  if (fd == -1) {
+    g_warning ("Failed to publish overview snapshot: %s", error->message);
+    return G_SOURCE_REMOVE;
+  }
+
+  /* Web processes that already mapped the previous snapshot keep it alive,
+   * the UI process only needs the latest one to hand it to new pages.
+   */
+  if (priv->overview_fd != -1)
+    close (priv->overview_fd);
+  priv->overview_fd = fd;
+  priv->overview_version++;
+
+  for (l = priv->web_extensions; l; l = g_list_next (l))
+    ephy_embed_shell_send_overview_snapshot (shell, (EphyWebExtensionProxy *)l->data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_embed_shell_schedule_overview_publish (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  /* Coalesce the history and thumbnail updates of a main loop iteration into
+   * a single snapshot.
+   */
+  if (priv->overview_publish_id)
+    return;
+
+  priv->overview_publish_id = g_idle_add ((GSourceFunc)publish_overview_snapshot_cb, shell);
+  g_source_set_name_by_id (priv->overview_publish_id, "[epiphany] publish_overview_snapshot_cb");
+}
+
 static void
 history_service_query_urls_cb (EphyHistoryService *service,
                                gboolean            success,
@@ -246,16 +335,31 @@ history_service_query_urls_cb (EphyHistoryService *service,
                                EphyEmbedShell     *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  g_autoptr(GHashTable) thumbnails = NULL;
   GList *l;
 
   if (!success)
     return;
 
-  for (l = priv->web_extensions; l; l = g_list_next (l)) {
-    EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
+  ephy_history_url_list_free (priv->overview_urls);
+  priv->overview_urls = NULL;
+
+  /* Only keep the thumbnails of the URLs still in the overview. */
+  thumbnails = g_steal_pointer (&priv->overview_thumbnails);
+  priv->overview_thumbnails = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  for (l = urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+    const char *thumbnail;
 
-    ephy_web_extension_proxy_history_set_urls (web_extension, urls);
+    priv->overview_urls = g_list_prepend (priv->overview_urls, ephy_history_url_copy (url));
+    thumbnail = g_hash_table_lookup (thumbnails, url->url);
+    if (thumbnail)
+      g_hash_table_insert (priv->overview_thumbnails, g_strdup (url->url), g_strdup (thumbnail));
   }
+  priv->overview_urls = g_list_reverse (priv->overview_urls);
+
+  ephy_embed_shell_schedule_overview_publish (shell);
 
   for (l = urls; l; l = g_list_next (l))
     ephy_embed_shell_schedule_thumbnail_update (shell, (EphyHistoryURL *)l->data);
@@ -286,9 +390,12 @@ history_set_url_hidden_cb (EphyHistoryService *service,
                            gpointer            result_data,
                            EphyEmbedShell     *shell)
 {
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
   if (!success)
     return;
 
+  ephy_about_handler_invalidate_overview (priv->about_handler);
   ephy_embed_shell_update_overview_urls (shell);
 }
 
@@ -428,7 +535,7 @@ web_extension_password_manager_query_received_cb (WebKitUserContentManager *mana
 
   ephy_password_manager_query (priv->password_manager,
                                NULL,
-                               origin,
+                               data->origin,
                                target_origin,
                                username,
                                username_field,
@@ -584,10 +691,15 @@ history_service_url_title_changed_cb (EphyHistoryService *service,
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   GList *l;
 
-  for (l = priv->web_extensions; l; l = g_list_next (l)) {
-    EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
+  for (l = priv->overview_urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
 
-    ephy_web_extension_proxy_history_set_url_title (web_extension, url, title);
+    if (g_strcmp0 (overview_url->url, url) != 0 || g_strcmp0 (overview_url->title, title) == 0)
+      continue;
+
+    g_free (overview_url->title);
+    overview_url->title = g_strdup (title);
+    ephy_embed_shell_schedule_overview_publish (shell);
   }
 }
 
@@ -597,12 +709,19 @@ history_service_url_deleted_cb (EphyHistoryService *service,
                                 EphyEmbedShell     *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
-  GList *l;
+  GList *l = priv->overview_urls;
 
-  for (l = priv->web_extensions; l; l = g_list_next (l)) {
-    EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
+  while (l) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+    GList *next = g_list_next (l);
 
-    ephy_web_extension_proxy_history_delete_url (web_extension, url->url);
+    if (g_strcmp0 (overview_url->url, url->url) == 0) {
+      g_hash_table_remove (priv->overview_thumbnails, overview_url->url);
+      ephy_history_url_free (overview_url);
+      priv->overview_urls = g_list_delete_link (priv->overview_urls, l);
+      ephy_embed_shell_schedule_overview_publish (shell);
+    }
+    l = next;
   }
 }
 
@@ -612,15 +731,27 @@ history_service_host_deleted_cb (EphyHistoryService *service,
                                  EphyEmbedShell     *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
-  GList *l;
   g_autoptr(SoupURI) deleted_uri = NULL;
+  GList *l;
 
   deleted_uri = soup_uri_new (deleted_url);
+  if (!deleted_uri)
+    return;
 
-  for (l = priv->web_extensions; l; l = g_list_next (l)) {
-    EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
-
-    ephy_web_extension_proxy_history_delete_host (web_extension, soup_uri_get_host (deleted_uri));
+  l = priv->overview_urls;
+  while (l) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+    GList *next = g_list_next (l);
+    g_autoptr(SoupURI) uri = NULL;
+
+    uri = soup_uri_new (overview_url->url);
+    if (uri && g_strcmp0 (soup_uri_get_host (uri), soup_uri_get_host (deleted_uri)) == 0) {
+      g_hash_table_remove (priv->overview_thumbnails, overview_url->url);
+      ephy_history_url_free (overview_url);
+      priv->overview_urls = g_list_delete_link (priv->overview_urls, l);
+      ephy_embed_shell_schedule_overview_publish (shell);
+    }
+    l = next;
   }
 }
 
@@ -629,60 +760,11 @@ history_service_cleared_cb (EphyHistoryService *service,
                             EphyEmbedShell     *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
-  GList *l;
-
-  for (l = priv->web_extensions; l; l = g_list_next (l)) {
-    EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
 
-    ephy_web_extension_proxy_history_clear (web_extension);
-  }
-}
-
-typedef struct {
-  EphyWebExtensionProxy *extension;
-  char *url;
-  char *path;
-} DelayedThumbnailUpdateData;
-
-static DelayedThumbnailUpdateData *
-delayed_thumbnail_update_data_new (EphyWebExtensionProxy *extension,
-                                   const char            *url,
-                                   const char            *path)
-{
-  DelayedThumbnailUpdateData *data = g_new (DelayedThumbnailUpdateData, 1);
-  data->extension = extension;
-  data->url = g_strdup (url);
-  data->path = g_strdup (path);
-  g_object_add_weak_pointer (G_OBJECT (extension), (gpointer *)&data->extension);
-  return data;
-}
-
-static void
-delayed_thumbnail_update_data_free (DelayedThumbnailUpdateData *data)
-{
-  if (data->extension)
-    g_object_remove_weak_pointer (G_OBJECT (data->extension), (gpointer *)&data->extension);
-  g_free (data->url);
-  g_free (data->path);
-  g_free (data);
-}
-
-static gboolean
-delayed_thumbnail_update_cb (DelayedThumbnailUpdateData *data)
-{
-  if (!data->extension) {
-    delayed_thumbnail_update_data_free (data);
-    return G_SOURCE_REMOVE;
-  }
-
-  if (GPOINTER_TO_INT (g_object_get_data (G_OBJECT (data->extension), "initialized"))) {
-    ephy_web_extension_proxy_history_set_url_thumbnail (data->extension, data->url, data->path);
-    delayed_thumbnail_update_data_free (data);
-    return G_SOURCE_REMOVE;
-  }
-
-  /* Web extension is not initialized yet, try again later.... */
-  return G_SOURCE_CONTINUE;
+  ephy_history_url_list_free (priv->overview_urls);
+  priv->overview_urls = NULL;
+  g_hash_table_remove_all (priv->overview_thumbnails);
+  ephy_embed_shell_schedule_overview_publish (shell);
 }
 
 void
@@ -693,13 +775,18 @@ ephy_embed_shell_set_thumbnail_path (EphyEmbedShell *shell,
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   GList *l;
 
-  for (l = priv->web_extensions; l; l = g_list_next (l)) {
-    EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
-    if (GPOINTER_TO_INT (g_object_get_data (G_OBJECT (web_extension), "initialized"))) {
-      ephy_web_extension_proxy_history_set_url_thumbnail (web_extension, url, path);
-    } else {
-      DelayedThumbnailUpdateData *data = delayed_thumbnail_update_data_new (web_extension, url, path);
-      g_timeout_add (50, (GSourceFunc)delayed_thumbnail_update_cb, data);
+  /* Thumbnails of pages that are not in the overview are not shared. */
+  for (l = priv->overview_urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+
+    if (g_strcmp0 (overview_url->url, url) == 0) {
+      if (g_strcmp0 (g_hash_table_lookup (priv->overview_thumbnails, url), path) != 0) {
+        g_hash_table_insert (priv->overview_thumbnails, g_strdup (url), g_strdup (path));
+        /* The cached about:overview page embeds thumbnail paths. */
+        ephy_about_handler_invalidate_overview (priv->about_handler);
+        ephy_embed_shell_schedule_overview_publish (shell);
+      }
+      return;
     }
   }
 }
@@ -956,7 +1043,10 @@ web_extension_page_created (EphyWebExtensionProxy *extension,
                             guint64                page_id,
                             EphyEmbedShell        *shell)
 {
-  g_object_set_data (G_OBJECT (extension), "initialized", GINT_TO_POINTER (TRUE));
+  /* The proxy is ready once pages are reported, so this is the first chance
+   * to share the overview with a new web process.
+   */
+  ephy_embed_shell_send_overview_snapshot (shell, extension);
   g_signal_emit (shell, signals[PAGE_CREATED], 0, page_id, extension);
 }
 
@@ -1345,9 +1435,14 @@ ephy_embed_shell_constructed (GObject *object)
 static void
 ephy_embed_shell_init (EphyEmbedShell *shell)
 {
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
   /* globally accessible singleton */
   g_assert (!embed_shell);
   embed_shell = shell;
+
+  priv->overview_thumbnails = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  priv->overview_fd = -1;
 }
 
 static void
@@ -1688,3 +1783,19 @@ ephy_embed_shell_get_password_manager (EphyEmbedShell *shell)
 
   return priv->password_manager;
 }
+
+/**
+ * ephy_embed_shell_get_web_extensions:
+ * @shell: the #EphyEmbedShell
+ *
+ * Returns the proxies of the web extensions of the connected web processes.
+ *
+ * Returns: (transfer none) (element-type EphyWebExtensionProxy): a #GList
+ **/
+GList *
+ephy_embed_shell_get_web_extensions (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  return priv->web_extensions;
+}
@@ -83,5 +83,6 @@ EphyDownloadsManager     *ephy_embed_shell_get_downloads_manager    (EphyEmbedSh
 EphyPermissionsManager   *ephy_embed_shell_get_permissions_manager  (EphyEmbedShell *shell);
 EphySearchEngineManager  *ephy_embed_shell_get_search_engine_manager (EphyEmbedShell *shell);
 EphyPasswordManager      *ephy_embed_shell_get_password_manager      (EphyEmbedShell *shell);
+GList                    *ephy_embed_shell_get_web_extensions        (EphyEmbedShell *shell);
 
 G_END_DECLS
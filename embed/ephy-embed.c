@@ -69,7 +69,9 @@ struct _EphyEmbed {
   char *title;
   WebKitURIRequest *delayed_request;
   WebKitWebViewSessionState *delayed_state;
+  GBytes *delayed_state_data;
   guint delayed_request_source_id;
+  gint64 last_visible_time;
 
   GSList *messages;
   GSList *keys;
@@ -389,6 +391,7 @@ ephy_embed_dispose (GObject *object)
 
   g_clear_object (&embed->delayed_request);
   g_clear_pointer (&embed->delayed_state, webkit_web_view_session_state_unref);
+  g_clear_pointer (&embed->delayed_state_data, g_bytes_unref);
 
   G_OBJECT_CLASS (ephy_embed_parent_class)->dispose (object);
 }
@@ -650,19 +653,15 @@ progress_update (EphyWebView *view, GParamSpec *pspec, EphyEmbed *embed)
                                  (loading || progress == 1.0) ? progress : 0.0);
 }
 
-static gboolean
-load_delayed_request_if_mapped (gpointer user_data)
+static void
+load_delayed_request (EphyEmbed *embed)
 {
-  EphyEmbed *embed = EPHY_EMBED (user_data);
   EphyWebView *web_view;
   WebKitBackForwardListItem *item;
 
-  embed->delayed_request_source_id = 0;
-
-  if (!gtk_widget_get_mapped (GTK_WIDGET (embed)))
-    return G_SOURCE_REMOVE;
-
   web_view = ephy_embed_get_web_view (embed);
+  if (!embed->delayed_state && embed->delayed_state_data)
+    embed->delayed_state = webkit_web_view_session_state_new (embed->delayed_state_data);
   if (embed->delayed_state)
     webkit_web_view_restore_session_state (WEBKIT_WEB_VIEW (web_view), embed->delayed_state);
 
@@ -674,11 +673,25 @@ load_delayed_request_if_mapped (gpointer user_data)
 
   g_clear_object (&embed->delayed_request);
   g_clear_pointer (&embed->delayed_state, webkit_web_view_session_state_unref);
+  g_clear_pointer (&embed->delayed_state_data, g_bytes_unref);
 
   /* This is to allow UI elements watching load status to show that the page is
    * loading as soon as possible.
    */
   g_signal_emit_by_name (web_view, "load-changed", WEBKIT_LOAD_STARTED);
+}
+
+static gboolean
+load_delayed_request_if_mapped (gpointer user_data)
+{
+  EphyEmbed *embed = EPHY_EMBED (user_data);
+
+  embed->delayed_request_source_id = 0;
+
+  if (!gtk_widget_get_mapped (GTK_WIDGET (embed)))
+    return G_SOURCE_REMOVE;
+
+  load_delayed_request (embed);
 
   return G_SOURCE_REMOVE;
 }
@@ -709,22 +722,70 @@ ephy_embed_restored_window_cb (EphyEmbedShell *shell, EphyEmbed *embed)
 static void
 ephy_embed_mapped_cb (GtkWidget *widget, gpointer data)
 {
+  ((EphyEmbed *)widget)->last_visible_time = g_get_monotonic_time ();
   ephy_embed_maybe_load_delayed_request ((EphyEmbed *)widget);
 }
 
+static void
+ephy_embed_unmapped_cb (GtkWidget *widget, gpointer data)
+{
+  ((EphyEmbed *)widget)->last_visible_time = g_get_monotonic_time ();
+}
+
+static void
+ephy_embed_connect_web_view (EphyEmbed *embed)
+{
+  WebKitWebInspector *inspector;
+
+  if (embed->progress_bar_enabled)
+    embed->progress_update_handler_id = g_signal_connect (embed->web_view, "notify::estimated-load-progress",
+                                                          G_CALLBACK (progress_update), embed);
+
+  g_object_connect (embed->web_view,
+                    "signal::notify::title", G_CALLBACK (web_view_title_changed_cb), embed,
+                    "signal::load-changed", G_CALLBACK (load_changed_cb), embed,
+                    "signal::enter-fullscreen", G_CALLBACK (entering_fullscreen_cb), embed,
+                    "signal::leave-fullscreen", G_CALLBACK (leaving_fullscreen_cb), embed,
+                    NULL);
+
+  embed->status_handler_id = g_signal_connect (embed->web_view, "notify::status-message",
+                                               G_CALLBACK (status_message_notify_cb),
+                                               embed);
+
+  /* The inspector */
+  inspector = webkit_web_view_get_inspector (embed->web_view);
+
+  g_signal_connect (inspector, "attach",
+                    G_CALLBACK (ephy_embed_attach_inspector_cb),
+                    embed);
+  g_signal_connect (inspector, "closed",
+                    G_CALLBACK (ephy_embed_close_inspector_cb),
+                    embed);
+}
+
+static void
+ephy_embed_disconnect_web_view (EphyEmbed *embed)
+{
+  g_signal_handlers_disconnect_by_data (webkit_web_view_get_inspector (embed->web_view), embed);
+  g_signal_handlers_disconnect_by_data (embed->web_view, embed);
+  embed->status_handler_id = 0;
+  embed->progress_update_handler_id = 0;
+}
+
 static void
 ephy_embed_constructed (GObject *object)
 {
   EphyEmbed *embed = (EphyEmbed *)object;
   EphyEmbedShell *shell = ephy_embed_shell_get_default ();
   GtkWidget *paned;
-  WebKitWebInspector *inspector;
 
   g_signal_connect (shell, "window-restored",
                     G_CALLBACK (ephy_embed_restored_window_cb), embed);
 
   g_signal_connect (embed, "map",
                     G_CALLBACK (ephy_embed_mapped_cb), NULL);
+  g_signal_connect (embed, "unmap",
+                    G_CALLBACK (ephy_embed_unmapped_cb), NULL);
 
   /* Skeleton */
   embed->overlay = gtk_overlay_new ();
@@ -772,10 +833,6 @@ ephy_embed_constructed (GObject *object)
 
   paned = GTK_WIDGET (embed->paned);
 
-  if (embed->progress_bar_enabled)
-    embed->progress_update_handler_id = g_signal_connect (embed->web_view, "notify::estimated-load-progress",
-                                                          G_CALLBACK (progress_update), object);
-
   gtk_paned_pack1 (GTK_PANED (paned), GTK_WIDGET (embed->overlay),
                    TRUE, FALSE);
 
@@ -788,26 +845,7 @@ ephy_embed_constructed (GObject *object)
   gtk_widget_show (GTK_WIDGET (embed->web_view));
   gtk_widget_show_all (paned);
 
-  g_object_connect (embed->web_view,
-                    "signal::notify::title", G_CALLBACK (web_view_title_changed_cb), embed,
-                    "signal::load-changed", G_CALLBACK (load_changed_cb), embed,
-                    "signal::enter-fullscreen", G_CALLBACK (entering_fullscreen_cb), embed,
-                    "signal::leave-fullscreen", G_CALLBACK (leaving_fullscreen_cb), embed,
-                    NULL);
-
-  embed->status_handler_id = g_signal_connect (embed->web_view, "notify::status-message",
-                                               G_CALLBACK (status_message_notify_cb),
-                                               embed);
-
-  /* The inspector */
-  inspector = webkit_web_view_get_inspector (embed->web_view);
-
-  g_signal_connect (inspector, "attach",
-                    G_CALLBACK (ephy_embed_attach_inspector_cb),
-                    embed);
-  g_signal_connect (inspector, "closed",
-                    G_CALLBACK (ephy_embed_close_inspector_cb),
-                    embed);
+  ephy_embed_connect_web_view (embed);
 
   if (webkit_web_view_is_controlled_by_automation (embed->web_view)) {
     GtkWidget *info_bar;
@@ -837,6 +875,7 @@ ephy_embed_init (EphyEmbed *embed)
   embed->seq_message_id = 1;
   embed->tab_message_id = ephy_embed_statusbar_get_context_id (embed, EPHY_EMBED_STATUSBAR_TAB_MESSAGE_CONTEXT_DESCRIPTION);
   embed->inspector_loaded = FALSE;
+  embed->last_visible_time = g_get_monotonic_time ();
 }
 
 /**
@@ -942,6 +981,7 @@ ephy_embed_set_delayed_load_request (EphyEmbed *embed, WebKitURIRequest *request
   g_assert (WEBKIT_IS_URI_REQUEST (request));
 
   g_clear_pointer (&embed->delayed_state, webkit_web_view_session_state_unref);
+  g_clear_pointer (&embed->delayed_state_data, g_bytes_unref);
   g_clear_object (&embed->delayed_request);
 
   embed->delayed_request = g_object_ref (request);
@@ -949,6 +989,50 @@ ephy_embed_set_delayed_load_request (EphyEmbed *embed, WebKitURIRequest *request
     embed->delayed_state = webkit_web_view_session_state_ref (state);
 }
 
+/**
+ * ephy_embed_set_delayed_load_request_with_serialized_state:
+ * @embed: a #EphyEmbed
+ * @request: a #WebKitNetworkRequest
+ * @state_data: (nullable): a serialized #WebKitWebViewSessionState
+ *
+ * Like ephy_embed_set_delayed_load_request(), but the session state is only
+ * deserialized when the tab is switched to, so restoring a large session does
+ * not pay for decoding the history of tabs that are never shown.
+ */
+void
+ephy_embed_set_delayed_load_request_with_serialized_state (EphyEmbed        *embed,
+                                                           WebKitURIRequest *request,
+                                                           GBytes           *state_data)
+{
+  ephy_embed_set_delayed_load_request (embed, request, NULL);
+
+  if (state_data)
+    embed->delayed_state_data = g_bytes_ref (state_data);
+}
+
+/**
+ * ephy_embed_load_delayed_request:
+ * @embed: a #EphyEmbed
+ *
+ * Starts loading the delayed request of @embed right away, whether or not the
+ * tab is currently shown. Does nothing if there is no load pending.
+ */
+void
+ephy_embed_load_delayed_request (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+
+  if (!embed->delayed_request)
+    return;
+
+  if (embed->delayed_request_source_id) {
+    g_source_remove (embed->delayed_request_source_id);
+    embed->delayed_request_source_id = 0;
+  }
+
+  load_delayed_request (embed);
+}
+
 /**
  * ephy_embed_has_load_pending:
  * @embed: a #EphyEmbed
@@ -965,6 +1049,108 @@ ephy_embed_has_load_pending (EphyEmbed *embed)
   return !!embed->delayed_request;
 }
 
+/**
+ * ephy_embed_get_session_state:
+ * @embed: a #EphyEmbed
+ *
+ * Returns the back/forward history of @embed. For a tab whose load is
+ * delayed, this is the history it will be restored with, rather than the
+ * placeholder shown in the meantime.
+ *
+ * Returns: (transfer full) (nullable): a #WebKitWebViewSessionState
+ */
+WebKitWebViewSessionState *
+ephy_embed_get_session_state (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+
+  if (embed->delayed_state)
+    return webkit_web_view_session_state_ref (embed->delayed_state);
+  if (embed->delayed_state_data)
+    return webkit_web_view_session_state_new (embed->delayed_state_data);
+
+  return webkit_web_view_get_session_state (embed->web_view);
+}
+
+/* Listeners of notify::web-view get the new web view while the previous one
+ * is still alive, so that they can disconnect from it.
+ */
+static void
+ephy_embed_replace_web_view (EphyEmbed     *embed,
+                             WebKitWebView *web_view)
+{
+  WebKitWebView *old_web_view = g_object_ref (embed->web_view);
+
+  ephy_embed_disconnect_web_view (embed);
+  gtk_container_remove (GTK_CONTAINER (embed->overlay), GTK_WIDGET (old_web_view));
+
+  embed->web_view = web_view;
+  gtk_container_add (GTK_CONTAINER (embed->overlay), GTK_WIDGET (web_view));
+  gtk_widget_show (GTK_WIDGET (web_view));
+  g_object_set (embed->find_toolbar, "web-view", web_view, NULL);
+  ephy_embed_connect_web_view (embed);
+
+  g_object_notify_by_pspec (G_OBJECT (embed), obj_properties[PROP_WEB_VIEW]);
+
+  gtk_widget_destroy (GTK_WIDGET (old_web_view));
+  g_object_unref (old_web_view);
+}
+
+/**
+ * ephy_embed_discard:
+ * @embed: a #EphyEmbed
+ *
+ * Frees the memory used by the page of a tab that is not shown, by replacing
+ * its web view with a new one showing a placeholder, which closes the page in
+ * the web process. The page and its history are restored in the new web view
+ * through the delayed load request when the tab is switched to again, like a
+ * tab restored from the session.
+ */
+void
+ephy_embed_discard (EphyEmbed *embed)
+{
+  g_autoptr(WebKitURIRequest) request = NULL;
+  g_autofree char *uri = NULL;
+  g_autofree char *title = NULL;
+  WebKitWebViewSessionState *state;
+
+  g_assert (EPHY_IS_EMBED (embed));
+
+  if (!webkit_web_view_get_uri (embed->web_view) ||
+      ephy_embed_has_load_pending (embed) ||
+      webkit_web_view_is_controlled_by_automation (embed->web_view))
+    return;
+
+  uri = g_strdup (webkit_web_view_get_uri (embed->web_view));
+  title = g_strdup (embed->title);
+
+  LOG ("Discarding tab %s", uri);
+
+  request = webkit_uri_request_new (uri);
+  state = webkit_web_view_get_session_state (embed->web_view);
+  ephy_embed_set_delayed_load_request (embed, request, state);
+  webkit_web_view_session_state_unref (state);
+
+  ephy_find_toolbar_close (embed->find_toolbar);
+  ephy_embed_replace_web_view (embed, WEBKIT_WEB_VIEW (ephy_web_view_new ()));
+  ephy_web_view_set_placeholder (EPHY_WEB_VIEW (embed->web_view), uri, title);
+}
+
+/**
+ * ephy_embed_get_last_visible_time:
+ * @embed: a #EphyEmbed
+ *
+ * Returns: the monotonic time at which @embed was last shown or hidden, or
+ * created if it was never shown
+ */
+gint64
+ephy_embed_get_last_visible_time (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+
+  return embed->last_visible_time;
+}
+
 const char *
 ephy_embed_get_title (EphyEmbed *embed)
 {
@@ -49,7 +49,15 @@ void             ephy_embed_leaving_fullscreen            (EphyEmbed *embed);
 void             ephy_embed_set_delayed_load_request      (EphyEmbed *embed,
                                                            WebKitURIRequest          *request,
                                                            WebKitWebViewSessionState *state);
+void             ephy_embed_set_delayed_load_request_with_serialized_state
+                                                          (EphyEmbed        *embed,
+                                                           WebKitURIRequest *request,
+                                                           GBytes           *state_data);
+void             ephy_embed_load_delayed_request          (EphyEmbed *embed);
 gboolean         ephy_embed_has_load_pending              (EphyEmbed *embed);
+WebKitWebViewSessionState *ephy_embed_get_session_state   (EphyEmbed *embed);
+void             ephy_embed_discard                       (EphyEmbed *embed);
+gint64           ephy_embed_get_last_visible_time         (EphyEmbed *embed);
 gboolean         ephy_embed_inspector_is_loaded           (EphyEmbed *embed);
 const char      *ephy_embed_get_title                     (EphyEmbed *embed);
 void             ephy_embed_attach_notification_container (EphyEmbed *embed);
@@ -495,7 +495,7 @@ ephy_find_toolbar_class_init (EphyFindToolbarClass *klass)
                          "WebView",
                          "Parent web view",
                          WEBKIT_TYPE_WEB_VIEW,
-                         G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+                         G_PARAM_WRITABLE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
 
   g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
 }
@@ -22,7 +22,8 @@
 #include "ephy-web-extension-proxy.h"
 
 #include "ephy-dbus-names.h"
-#include "ephy-history-service.h"
+
+#include <gio/gunixfdlist.h>
 
 struct _EphyWebExtensionProxy {
   GObject parent_instance;
@@ -30,6 +31,7 @@ struct _EphyWebExtensionProxy {
   GCancellable *cancellable;
   GDBusProxy *proxy;
   GDBusConnection *connection;
+  guint pid;
 
   guint page_created_signal_id;
 };
@@ -163,11 +165,19 @@ EphyWebExtensionProxy *
 ephy_web_extension_proxy_new (GDBusConnection *connection)
 {
   EphyWebExtensionProxy *web_extension;
+  GCredentials *credentials;
 
   g_assert (G_IS_DBUS_CONNECTION (connection));
 
   web_extension = g_object_new (EPHY_TYPE_WEB_EXTENSION_PROXY, NULL);
 
+  /* The web process authenticated with its credentials when it connected, so
+   * they tell which process this is.
+   */
+  credentials = g_dbus_connection_get_peer_credentials (connection);
+  if (credentials)
+    web_extension->pid = MAX (g_credentials_get_unix_pid (credentials, NULL), 0);
+
   g_signal_connect (connection, "closed",
                     G_CALLBACK (connection_closed_cb), web_extension);
 
@@ -187,111 +197,149 @@ ephy_web_extension_proxy_new (GDBusConnection *connection)
   return web_extension;
 }
 
-void
-ephy_web_extension_proxy_history_set_urls (EphyWebExtensionProxy *web_extension,
-                                           GList                 *urls)
+/**
+ * ephy_web_extension_proxy_get_pid:
+ * @web_extension: an #EphyWebExtensionProxy
+ *
+ * Returns the process identifier of the web process, as seen from the UI
+ * process.
+ *
+ * Return value: the pid, or 0 if it is not known
+ **/
+guint
+ephy_web_extension_proxy_get_pid (EphyWebExtensionProxy *web_extension)
 {
-  GList *l;
-  GVariantBuilder builder;
+  return web_extension->pid;
+}
 
-  if (!web_extension->proxy)
-    return;
+/**
+ * ephy_web_extension_proxy_history_set_snapshot:
+ * @web_extension: an #EphyWebExtensionProxy
+ * @fd: a sealed file descriptor holding an overview snapshot
+ * @version: the version of the snapshot
+ *
+ * Shares the overview snapshot in @fd with the web process. @fd is
+ * duplicated, the caller keeps ownership of it.
+ *
+ * Return value: %TRUE if the snapshot was sent, %FALSE if the web process
+ *               is not connected yet
+ **/
+gboolean
+ephy_web_extension_proxy_history_set_snapshot (EphyWebExtensionProxy *web_extension,
+                                               int                    fd,
+                                               guint64                version)
+{
+  g_autoptr(GUnixFDList) fd_list = NULL;
+  g_autoptr(GError) error = NULL;
+  int handle;
 
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
-  for (l = urls; l; l = g_list_next (l)) {
-    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+  if (!web_extension->proxy)
+    return FALSE;
 
-    g_variant_builder_add (&builder, "(ss)", url->url, url->title);
+  fd_list = g_unix_fd_list_new ();
+  handle = g_unix_fd_list_append (fd_list, fd, &error);
+  if (handle == -1) {
+    g_warning ("Failed to share overview snapshot: %s", error->message);
+    return FALSE;
   }
 
-  g_dbus_proxy_call (web_extension->proxy,
-                     "HistorySetURLs",
-                     g_variant_new ("(@a(ss))", g_variant_builder_end (&builder)),
-                     G_DBUS_CALL_FLAGS_NONE,
-                     -1,
-                     web_extension->cancellable,
-                     NULL, NULL);
+  g_dbus_proxy_call_with_unix_fd_list (web_extension->proxy,
+                                       "HistorySetSnapshot",
+                                       g_variant_new ("(ht)", handle, version),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1,
+                                       fd_list,
+                                       web_extension->cancellable,
+                                       NULL, NULL);
+  return TRUE;
 }
 
-void
-ephy_web_extension_proxy_history_set_url_thumbnail (EphyWebExtensionProxy *web_extension,
-                                                    const char            *url,
-                                                    const char            *path)
+static void
+get_performance_metrics_cb (GDBusProxy   *proxy,
+                            GAsyncResult *result,
+                            GTask        *task)
 {
-  if (!web_extension->proxy)
-    return;
-
-  g_dbus_proxy_call (web_extension->proxy,
-                     "HistorySetURLThumbnail",
-                     g_variant_new ("(ss)", url, path),
-                     G_DBUS_CALL_FLAGS_NONE,
-                     -1,
-                     web_extension->cancellable,
-                     NULL, NULL);
+  GVariant *value;
+  GError *error = NULL;
+
+  value = g_dbus_proxy_call_finish (proxy, result, &error);
+  if (value)
+    g_task_return_pointer (task, value, (GDestroyNotify)g_variant_unref);
+  else
+    g_task_return_error (task, error);
+  g_object_unref (task);
 }
 
+/**
+ * ephy_web_extension_proxy_get_performance_metrics:
+ * @web_extension: an #EphyWebExtensionProxy
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the request is satisfied
+ * @user_data: the data to pass to callback function
+ *
+ * Asynchronously gets the metrics recorded by the web process. When the
+ * operation is finished, @callback will be called. You can then call
+ * ephy_web_extension_proxy_get_performance_metrics_finish() to get the
+ * result of the operation.
+ **/
 void
-ephy_web_extension_proxy_history_set_url_title (EphyWebExtensionProxy *web_extension,
-                                                const char            *url,
-                                                const char            *title)
+ephy_web_extension_proxy_get_performance_metrics (EphyWebExtensionProxy *web_extension,
+                                                  GCancellable          *cancellable,
+                                                  GAsyncReadyCallback    callback,
+                                                  gpointer               user_data)
 {
-  if (!web_extension->proxy)
-    return;
+  GTask *task;
 
-  g_dbus_proxy_call (web_extension->proxy,
-                     "HistorySetURLTitle",
-                     g_variant_new ("(ss)", url, title),
-                     G_DBUS_CALL_FLAGS_NONE,
-                     -1,
-                     web_extension->cancellable,
-                     NULL, NULL);
-}
+  g_assert (EPHY_IS_WEB_EXTENSION_PROXY (web_extension));
 
-void
-ephy_web_extension_proxy_history_delete_url (EphyWebExtensionProxy *web_extension,
-                                             const char            *url)
-{
-  if (!web_extension->proxy)
+  task = g_task_new (web_extension, cancellable, callback, user_data);
+
+  if (!web_extension->proxy) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+                             "The web process is not connected yet");
+    g_object_unref (task);
     return;
+  }
 
+  /* A busy web process must not hold up about:performance for long. */
   g_dbus_proxy_call (web_extension->proxy,
-                     "HistoryDeleteURL",
-                     g_variant_new ("(s)", url),
+                     "GetPerformanceMetrics",
+                     NULL,
                      G_DBUS_CALL_FLAGS_NONE,
-                     -1,
-                     web_extension->cancellable,
-                     NULL, NULL);
+                     1000,
+                     cancellable,
+                     (GAsyncReadyCallback)get_performance_metrics_cb,
+                     task);
 }
 
-void
-ephy_web_extension_proxy_history_delete_host (EphyWebExtensionProxy *web_extension,
-                                              const char            *host)
+/**
+ * ephy_web_extension_proxy_get_performance_metrics_finish:
+ * @web_extension: an #EphyWebExtensionProxy
+ * @result: a #GAsyncResult
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an operation started with
+ * ephy_web_extension_proxy_get_performance_metrics().
+ *
+ * Returns: (transfer full): the metrics of the web process, in the format
+ *          described by %EPHY_METRICS_SNAPSHOT_TYPE, or %NULL on error
+ **/
+GVariant *
+ephy_web_extension_proxy_get_performance_metrics_finish (EphyWebExtensionProxy  *web_extension,
+                                                         GAsyncResult           *result,
+                                                         GError                **error)
 {
-  if (!web_extension->proxy)
-    return;
+  g_autoptr(GVariant) value = NULL;
+  GVariant *metrics;
 
-  g_dbus_proxy_call (web_extension->proxy,
-                     "HistoryDeleteHost",
-                     g_variant_new ("(s)", host),
-                     G_DBUS_CALL_FLAGS_NONE,
-                     -1,
-                     web_extension->cancellable,
-                     NULL, NULL);
-}
+  g_assert (g_task_is_valid (result, web_extension));
 
-void
-ephy_web_extension_proxy_history_clear (EphyWebExtensionProxy *web_extension)
-{
-  if (!web_extension->proxy)
-    return;
+  value = g_task_propagate_pointer (G_TASK (result), error);
+  if (!value)
+    return NULL;
 
-  g_dbus_proxy_call (web_extension->proxy,
-                     "HistoryClear",
-                     NULL,
-                     G_DBUS_CALL_FLAGS_NONE,
-                     -1,
-                     web_extension->cancellable,
-                     NULL, NULL);
+  g_variant_get (value, "(@a(ssutxxxxx))", &metrics);
+  return metrics;
 }
 
 void
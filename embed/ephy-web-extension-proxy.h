@@ -29,19 +29,17 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (EphyWebExtensionProxy, ephy_web_extension_proxy, EPHY, WEB_EXTENSION_PROXY, GObject)
 
 EphyWebExtensionProxy *ephy_web_extension_proxy_new                                       (GDBusConnection       *connection);
-void                   ephy_web_extension_proxy_history_set_urls                          (EphyWebExtensionProxy *web_extension,
-                                                                                           GList                 *urls);
-void                   ephy_web_extension_proxy_history_set_url_thumbnail                 (EphyWebExtensionProxy *web_extension,
-                                                                                           const char            *url,
-                                                                                           const char            *path);
-void                   ephy_web_extension_proxy_history_set_url_title                     (EphyWebExtensionProxy *web_extension,
-                                                                                           const char            *url,
-                                                                                           const char            *title);
-void                   ephy_web_extension_proxy_history_delete_url                        (EphyWebExtensionProxy *web_extension,
-                                                                                           const char            *url);
-void                   ephy_web_extension_proxy_history_delete_host                       (EphyWebExtensionProxy *web_extension,
-                                                                                           const char            *host);
-void                   ephy_web_extension_proxy_history_clear                             (EphyWebExtensionProxy *web_extension);
+guint                  ephy_web_extension_proxy_get_pid                                   (EphyWebExtensionProxy *web_extension);
+gboolean               ephy_web_extension_proxy_history_set_snapshot                      (EphyWebExtensionProxy *web_extension,
+                                                                                           int                    fd,
+                                                                                           guint64                version);
+void                   ephy_web_extension_proxy_get_performance_metrics                   (EphyWebExtensionProxy *web_extension,
+                                                                                           GCancellable          *cancellable,
+                                                                                           GAsyncReadyCallback    callback,
+                                                                                           gpointer               user_data);
+GVariant              *ephy_web_extension_proxy_get_performance_metrics_finish            (EphyWebExtensionProxy *web_extension,
+                                                                                           GAsyncResult          *result,
+                                                                                           GError               **error);
 void                   ephy_web_extension_proxy_password_query_usernames_response         (EphyWebExtensionProxy *web_extension,
                                                                                            GList                 *users,
                                                                                            gint32                 promise_id,
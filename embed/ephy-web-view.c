@@ -907,6 +907,10 @@ page_created_cb (EphyEmbedShell        *shell,
   if (webkit_web_view_get_page_id (WEBKIT_WEB_VIEW (view)) != page_id)
     return;
 
+  /* The page may have moved to a new web process. */
+  if (view->web_extension)
+    g_object_remove_weak_pointer (G_OBJECT (view->web_extension), (gpointer *)&view->web_extension);
+
   view->web_extension = web_extension;
   g_object_add_weak_pointer (G_OBJECT (view->web_extension), (gpointer *)&view->web_extension);
 
@@ -3850,3 +3854,19 @@ ephy_web_view_get_web_extension_proxy (EphyWebView *view)
 {
   return view->web_extension;
 }
+
+/**
+ * ephy_web_view_get_web_process_pid:
+ * @view: an #EphyWebView
+ *
+ * Returns the process identifier of the web process that hosts the page of
+ * @view. It changes when the page moves to another process, e.g. after the
+ * web process crashed.
+ *
+ * Return value: the pid, or 0 if the web process is not known yet
+ **/
+guint
+ephy_web_view_get_web_process_pid (EphyWebView *view)
+{
+  return view->web_extension ? ephy_web_extension_proxy_get_pid (view->web_extension) : 0;
+}
@@ -163,6 +163,7 @@ gboolean                   ephy_web_view_is_reader_mode_available (EphyWebView
 gboolean                   ephy_web_view_get_reader_mode_state    (EphyWebView               *view);
 
 EphyWebExtensionProxy     *ephy_web_view_get_web_extension_proxy  (EphyWebView               *view);
+guint                      ephy_web_view_get_web_process_pid      (EphyWebView               *view);
 
 void                       ephy_web_view_show_auth_form_save_request (EphyWebView                    *web_view,
                                                                       const char                     *origin,
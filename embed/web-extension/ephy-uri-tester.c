@@ -28,8 +28,10 @@
 #include "ephy-uri-tester.h"
 
 #include "ephy-debug.h"
+#include "ephy-metrics.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
+#include "ephy-trace.h"
 #include "ephy-uri-tester-shared.h"
 
 #include <gio/gio.h>
@@ -582,9 +584,17 @@ ephy_uri_tester_rewrite_uri (EphyUriTester    *tester,
                              const char       *request_uri,
                              const char       *page_uri)
 {
+  gint64 begin_time = g_get_monotonic_time ();
+  gboolean blocked;
+  EPHY_TRACE_SPAN ("adblock", "match");
+
   /* Should we block the URL outright? */
-  if (ephy_uri_tester_block_uri (tester, request_uri, page_uri)) {
+  blocked = ephy_uri_tester_block_uri (tester, request_uri, page_uri);
+  ephy_metrics_add_duration ("adblock", "match", g_get_monotonic_time () - begin_time);
+
+  if (blocked) {
     g_debug ("Request '%s' blocked (page: '%s')", request_uri, page_uri);
+    ephy_metrics_add_count ("adblock", "blocked", 1);
 
     return NULL;
   }
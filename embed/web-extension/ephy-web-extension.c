@@ -25,6 +25,8 @@
 #include "ephy-dbus-util.h"
 #include "ephy-debug.h"
 #include "ephy-file-helpers.h"
+#include "ephy-metrics.h"
+#include "ephy-overview-snapshot.h"
 #include "ephy-permissions-manager.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
@@ -33,11 +35,13 @@
 #include "ephy-web-overview-model.h"
 
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <jsc/jsc.h>
 #include <libsoup/soup.h>
 #include <string.h>
+#include <unistd.h>
 #include <webkit2/webkit-web-extension.h>
 #include <JavaScriptCore/JavaScript.h>
 
@@ -65,24 +69,13 @@ static const char introspection_xml[] =
   "  <signal name='PageCreated'>"
   "   <arg type='t' name='page_id' direction='out'/>"
   "  </signal>"
-  "  <method name='HistorySetURLs'>"
-  "   <arg type='a(ss)' name='urls' direction='in'/>"
+  "  <method name='HistorySetSnapshot'>"
+  "   <arg type='h' name='snapshot' direction='in'/>"
+  "   <arg type='t' name='version' direction='in'/>"
   "  </method>"
-  "  <method name='HistorySetURLThumbnail'>"
-  "   <arg type='s' name='url' direction='in'/>"
-  "   <arg type='s' name='path' direction='in'/>"
+  "  <method name='GetPerformanceMetrics'>"
+  "   <arg type='a(ssutxxxxx)' name='metrics' direction='out'/>"
   "  </method>"
-  "  <method name='HistorySetURLTitle'>"
-  "   <arg type='s' name='url' direction='in'/>"
-  "   <arg type='s' name='title' direction='in'/>"
-  "  </method>"
-  "  <method name='HistoryDeleteURL'>"
-  "   <arg type='s' name='url' direction='in'/>"
-  "  </method>"
-  "  <method name='HistoryDeleteHost'>"
-  "   <arg type='s' name='host' direction='in'/>"
-  "  </method>"
-  "  <method name='HistoryClear'/>"
   "  <method name='PasswordQueryResponse'>"
   "    <arg type='s' name='username' direction='in'/>"
   "    <arg type='s' name='password' direction='in'/>"
@@ -426,61 +419,46 @@ handle_method_call (GDBusConnection       *connection,
   if (g_strcmp0 (interface_name, EPHY_WEB_EXTENSION_INTERFACE) != 0)
     return;
 
-  if (g_strcmp0 (method_name, "HistorySetURLs") == 0) {
-    if (extension->overview_model) {
-      GVariantIter iter;
-      g_autoptr(GVariant) array = NULL;
-      const char *url;
-      const char *title;
-      GList *items = NULL;
-
-      g_variant_get (parameters, "(@a(ss))", &array);
-      g_variant_iter_init (&iter, array);
-
-      while (g_variant_iter_loop (&iter, "(&s&s)", &url, &title))
-        items = g_list_prepend (items, ephy_web_overview_model_item_new (url, title));
-
-      ephy_web_overview_model_set_urls (extension->overview_model, g_list_reverse (items));
+  if (g_strcmp0 (method_name, "HistorySetSnapshot") == 0) {
+    GUnixFDList *fd_list;
+    gint32 handle;
+    guint64 version;
+
+    g_variant_get (parameters, "(ht)", &handle, &version);
+    fd_list = g_dbus_message_get_unix_fd_list (g_dbus_method_invocation_get_message (invocation));
+    if (!fd_list || handle < 0 || handle >= g_unix_fd_list_get_length (fd_list)) {
+      g_dbus_method_invocation_return_error (invocation, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                             "Missing overview snapshot file descriptor");
+      return;
     }
-    g_dbus_method_invocation_return_value (invocation, NULL);
-  } else if (g_strcmp0 (method_name, "HistorySetURLThumbnail") == 0) {
-    if (extension->overview_model) {
-      const char *url;
-      const char *path;
 
-      g_variant_get (parameters, "(&s&s)", &url, &path);
-      ephy_web_overview_model_set_url_thumbnail (extension->overview_model, url, path, TRUE);
+    /* Snapshots are published in order, but one sent on page creation can
+     * race with a newer one. There is no need to map stale ones.
+     */
+    if (extension->overview_model &&
+        version > ephy_web_overview_model_get_version (extension->overview_model)) {
+      g_autoptr(GError) error = NULL;
+      g_autoptr(GVariant) snapshot = NULL;
+      int fd;
+
+      fd = g_unix_fd_list_get (fd_list, handle, &error);
+      if (fd != -1) {
+        snapshot = ephy_overview_snapshot_from_fd (fd, &error);
+        close (fd);
+      }
+
+      if (snapshot)
+        ephy_web_overview_model_set_snapshot (extension->overview_model, snapshot);
+      else
+        g_warning ("Failed to read overview snapshot: %s", error->message);
     }
     g_dbus_method_invocation_return_value (invocation, NULL);
-  } else if (g_strcmp0 (method_name, "HistorySetURLTitle") == 0) {
-    if (extension->overview_model) {
-      const char *url;
-      const char *title;
-
-      g_variant_get (parameters, "(&s&s)", &url, &title);
-      ephy_web_overview_model_set_url_title (extension->overview_model, url, title);
-    }
-    g_dbus_method_invocation_return_value (invocation, NULL);
-  } else if (g_strcmp0 (method_name, "HistoryDeleteURL") == 0) {
-    if (extension->overview_model) {
-      const char *url;
-
-      g_variant_get (parameters, "(&s)", &url);
-      ephy_web_overview_model_delete_url (extension->overview_model, url);
-    }
-    g_dbus_method_invocation_return_value (invocation, NULL);
-  } else if (g_strcmp0 (method_name, "HistoryDeleteHost") == 0) {
-    if (extension->overview_model) {
-      const char *host;
-
-      g_variant_get (parameters, "(&s)", &host);
-      ephy_web_overview_model_delete_host (extension->overview_model, host);
-    }
-    g_dbus_method_invocation_return_value (invocation, NULL);
-  } else if (g_strcmp0 (method_name, "HistoryClear") == 0) {
-    if (extension->overview_model)
-      ephy_web_overview_model_clear (extension->overview_model);
-    g_dbus_method_invocation_return_value (invocation, NULL);
+  } else if (g_strcmp0 (method_name, "GetPerformanceMetrics") == 0) {
+    /* The pid is not part of the reply, the one of the sandboxed process
+     * does not mean anything to the UI process.
+     */
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@a(ssutxxxxx))", ephy_metrics_get_snapshot ()));
   } else if (g_strcmp0 (method_name, "PasswordQueryUsernamesResponse") == 0) {
     g_autofree const char **users;
     g_autoptr(JSCValue) ret = NULL;
@@ -21,15 +21,27 @@
 #include "config.h"
 #include "ephy-web-overview-model.h"
 
-#include <libsoup/soup.h>
+#include "ephy-overview-snapshot.h"
+
+#include <string.h>
 
 struct _EphyWebOverviewModel {
   GObject parent_instance;
 
-  GList *items;
+  /* Shared with the UI process and the other web processes, read-only. */
+  GVariant *snapshot;
+  GVariant *items;
+  guint64 version;
+
+  /* Thumbnails found in the overview page for items the snapshot has
+   * none for yet.
+   */
   GHashTable *thumbnails;
 
   GHashTable *urls_listeners;
+  GHashTable *url_inserted_listeners;
+  GHashTable *url_removed_listeners;
+  GHashTable *url_moved_listeners;
   GHashTable *thumbnail_listeners;
   GHashTable *title_listeners;
 };
@@ -41,10 +53,8 @@ ephy_web_overview_model_dispose (GObject *object)
 {
   EphyWebOverviewModel *model = EPHY_WEB_OVERVIEW_MODEL (object);
 
-  if (model->items) {
-    g_list_free_full (model->items, (GDestroyNotify)ephy_web_overview_model_item_free);
-    model->items = NULL;
-  }
+  g_clear_pointer (&model->items, g_variant_unref);
+  g_clear_pointer (&model->snapshot, g_variant_unref);
 
   if (model->thumbnails) {
     g_hash_table_destroy (model->thumbnails);
@@ -52,6 +62,9 @@ ephy_web_overview_model_dispose (GObject *object)
   }
 
   g_clear_pointer (&model->urls_listeners, g_hash_table_destroy);
+  g_clear_pointer (&model->url_inserted_listeners, g_hash_table_destroy);
+  g_clear_pointer (&model->url_removed_listeners, g_hash_table_destroy);
+  g_clear_pointer (&model->url_moved_listeners, g_hash_table_destroy);
   g_clear_pointer (&model->thumbnail_listeners, g_hash_table_destroy);
   g_clear_pointer (&model->title_listeners, g_hash_table_destroy);
 
@@ -77,6 +90,18 @@ ephy_web_overview_model_init (EphyWebOverviewModel *model)
                                                  g_direct_equal,
                                                  g_object_unref,
                                                  NULL);
+  model->url_inserted_listeners = g_hash_table_new_full (g_direct_hash,
+                                                         g_direct_equal,
+                                                         g_object_unref,
+                                                         NULL);
+  model->url_removed_listeners = g_hash_table_new_full (g_direct_hash,
+                                                        g_direct_equal,
+                                                        g_object_unref,
+                                                        NULL);
+  model->url_moved_listeners = g_hash_table_new_full (g_direct_hash,
+                                                      g_direct_equal,
+                                                      g_object_unref,
+                                                      NULL);
   model->thumbnail_listeners = g_hash_table_new_full (g_direct_hash,
                                                       g_direct_equal,
                                                       g_object_unref,
@@ -87,25 +112,56 @@ ephy_web_overview_model_init (EphyWebOverviewModel *model)
                                                   NULL);
 }
 
+static gsize
+items_get_n_items (GVariant *items)
+{
+  return items ? g_variant_n_children (items) : 0;
+}
+
+static void
+items_get_item (GVariant    *items,
+                gsize        index,
+                const char **url,
+                const char **title,
+                const char **thumbnail)
+{
+  g_variant_get_child (items, index, "(&s&s&s)", url, title, thumbnail);
+}
+
+static const char *
+ephy_web_overview_model_lookup_thumbnail (EphyWebOverviewModel *model,
+                                          const char           *url,
+                                          const char           *thumbnail)
+{
+  if (thumbnail && *thumbnail)
+    return thumbnail;
+
+  return g_hash_table_lookup (model->thumbnails, url);
+}
+
 static GPtrArray *
 ephy_web_overview_model_urls_to_js_value (EphyWebOverviewModel *model,
                                           JSCContext           *js_context)
 {
   GPtrArray *urls;
-  GList *l;
+  gsize n_items = items_get_n_items (model->items);
 
   urls = g_ptr_array_new_with_free_func (g_object_unref);
-  for (l = model->items; l; l = g_list_next (l)) {
-    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
+  for (gsize i = 0; i < n_items; i++) {
     g_autoptr(JSCValue) js_item = NULL;
     g_autoptr(JSCValue) value = NULL;
+    const char *url;
+    const char *title;
+    const char *thumbnail;
+
+    items_get_item (model->items, i, &url, &title, &thumbnail);
 
     js_item = jsc_value_new_object (js_context, NULL, NULL);
-    value = jsc_value_new_string (js_context, item->url);
+    value = jsc_value_new_string (js_context, url);
     jsc_value_object_set_property (js_item, "url", value);
 
     g_clear_object (&value);
-    value = jsc_value_new_string (js_context, item->title);
+    value = jsc_value_new_string (js_context, title);
     jsc_value_object_set_property (js_item, "title", value);
 
     g_ptr_array_add (urls, g_steal_pointer (&js_item));
@@ -135,6 +191,75 @@ ephy_web_overview_model_notify_urls_changed (EphyWebOverviewModel *model)
   }
 }
 
+static void
+ephy_web_overview_model_notify_url_inserted (EphyWebOverviewModel *model,
+                                             guint                 index,
+                                             const char           *url,
+                                             const char           *title,
+                                             const char           *thumbnail)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, model->url_inserted_listeners);
+  while (g_hash_table_iter_next (&iter, &key, NULL)) {
+    g_autoptr(JSCValue) value = NULL;
+    g_autoptr(JSCValue) ret = NULL;
+
+    value = jsc_weak_value_get_value (JSC_WEAK_VALUE (key));
+    if (value) {
+      if (jsc_value_is_function (value))
+        ret = jsc_value_function_call (value,
+                                       G_TYPE_UINT, index,
+                                       G_TYPE_STRING, url,
+                                       G_TYPE_STRING, title,
+                                       G_TYPE_STRING, thumbnail,
+                                       G_TYPE_NONE);
+    }
+  }
+}
+
+static void
+ephy_web_overview_model_notify_url_removed (EphyWebOverviewModel *model,
+                                            const char           *url)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, model->url_removed_listeners);
+  while (g_hash_table_iter_next (&iter, &key, NULL)) {
+    g_autoptr(JSCValue) value = NULL;
+    g_autoptr(JSCValue) ret = NULL;
+
+    value = jsc_weak_value_get_value (JSC_WEAK_VALUE (key));
+    if (value) {
+      if (jsc_value_is_function (value))
+        ret = jsc_value_function_call (value, G_TYPE_STRING, url, G_TYPE_NONE);
+    }
+  }
+}
+
+static void
+ephy_web_overview_model_notify_url_moved (EphyWebOverviewModel *model,
+                                          const char           *url,
+                                          guint                 index)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, model->url_moved_listeners);
+  while (g_hash_table_iter_next (&iter, &key, NULL)) {
+    g_autoptr(JSCValue) value = NULL;
+    g_autoptr(JSCValue) ret = NULL;
+
+    value = jsc_weak_value_get_value (JSC_WEAK_VALUE (key));
+    if (value) {
+      if (jsc_value_is_function (value))
+        ret = jsc_value_function_call (value, G_TYPE_STRING, url, G_TYPE_UINT, index, G_TYPE_NONE);
+    }
+  }
+}
+
 static void
 ephy_web_overview_model_notify_thumbnail_changed (EphyWebOverviewModel *model,
                                                   const char           *url,
@@ -183,158 +308,142 @@ ephy_web_overview_model_new (void)
   return g_object_new (EPHY_TYPE_WEB_OVERVIEW_MODEL, NULL);
 }
 
-void
-ephy_web_overview_model_set_urls (EphyWebOverviewModel *model,
-                                  GList                *urls)
-{
-  g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
-
-  g_list_free_full (model->items, (GDestroyNotify)ephy_web_overview_model_item_free);
-  model->items = urls;
-  ephy_web_overview_model_notify_urls_changed (model);
-}
-
-void
-ephy_web_overview_model_set_url_thumbnail (EphyWebOverviewModel *model,
-                                           const char           *url,
-                                           const char           *path,
-                                           gboolean              notify)
+/**
+ * ephy_web_overview_model_get_version:
+ * @model: an #EphyWebOverviewModel
+ *
+ * Return value: the version of the current overview snapshot, 0 if there is
+ *               none yet
+ **/
+guint64
+ephy_web_overview_model_get_version (EphyWebOverviewModel *model)
 {
-  const char *thumbnail_path;
-
   g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
 
-  thumbnail_path = g_hash_table_lookup (model->thumbnails, url);
-  if (g_strcmp0 (thumbnail_path, path) == 0)
-    return;
-
-  g_hash_table_insert (model->thumbnails, g_strdup (url), g_strdup (path));
-  if (notify)
-    ephy_web_overview_model_notify_thumbnail_changed (model, url, path);
+  return model->version;
 }
 
-void
-ephy_web_overview_model_set_url_title (EphyWebOverviewModel *model,
-                                       const char           *url,
-                                       const char           *title)
+static void
+ephy_web_overview_model_notify_items_changed (EphyWebOverviewModel *model,
+                                              GVariant             *old_items)
 {
-  GList *l;
-  gboolean changed = FALSE;
-
-  g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
-
-  for (l = model->items; l; l = g_list_next (l)) {
-    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
-
-    if (g_strcmp0 (item->url, url) != 0)
-      continue;
+  g_autoptr(GHashTable) old_indices = NULL;
+  g_autoptr(GHashTable) new_urls = NULL;
+  g_autoptr(GPtrArray) urls = NULL;
+  gsize n_old_items = items_get_n_items (old_items);
+  gsize n_items = items_get_n_items (model->items);
 
-    if (g_strcmp0 (item->title, title) != 0) {
-      changed = TRUE;
+  old_indices = g_hash_table_new (g_str_hash, g_str_equal);
+  for (gsize i = 0; i < n_old_items; i++) {
+    const char *url;
+    const char *title;
+    const char *thumbnail;
 
-      g_free (item->title);
-      item->title = g_strdup (title);
-    }
+    items_get_item (old_items, i, &url, &title, &thumbnail);
+    g_hash_table_insert (old_indices, (gpointer)url, GSIZE_TO_POINTER (i));
   }
 
-  if (changed)
-    ephy_web_overview_model_notify_title_changed (model, url, title);
-}
-
-void
-ephy_web_overview_model_delete_url (EphyWebOverviewModel *model,
-                                    const char           *url)
-{
-  GList *l;
-  gboolean changed = FALSE;
-
-  g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
-
-  l = model->items;
-  while (l) {
-    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
-    GList *next = l->next;
-
-    if (g_strcmp0 (item->url, url) == 0) {
-      changed = TRUE;
+  new_urls = g_hash_table_new (g_str_hash, g_str_equal);
+  for (gsize i = 0; i < n_items; i++) {
+    const char *url;
+    const char *title;
+    const char *thumbnail;
 
-      ephy_web_overview_model_item_free (item);
-      model->items = g_list_delete_link (model->items, l);
-    }
+    items_get_item (model->items, i, &url, &title, &thumbnail);
+    g_hash_table_add (new_urls, (gpointer)url);
+  }
 
-    l = next;
+  /* Replay the changes on a copy of the old URL list, so that the indices
+   * of every event are those of the page once the previous events have been
+   * applied: removals first, then insertions and moves in order.
+   */
+  urls = g_ptr_array_sized_new (n_old_items);
+  for (gsize i = 0; i < n_old_items; i++) {
+    const char *url;
+    const char *title;
+    const char *thumbnail;
+
+    items_get_item (old_items, i, &url, &title, &thumbnail);
+    if (g_hash_table_contains (new_urls, url))
+      g_ptr_array_add (urls, (gpointer)url);
+    else
+      ephy_web_overview_model_notify_url_removed (model, url);
   }
 
-  if (changed)
-    ephy_web_overview_model_notify_urls_changed (model);
-}
+  for (guint i = 0; i < n_items; i++) {
+    const char *url;
+    const char *title;
+    const char *thumbnail;
+    gpointer old_index;
 
-void
-ephy_web_overview_model_delete_host (EphyWebOverviewModel *model,
-                                     const char           *host)
-{
-  GList *l;
-  gboolean changed = FALSE;
+    items_get_item (model->items, i, &url, &title, &thumbnail);
 
-  g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
+    if (!g_hash_table_lookup_extended (old_indices, url, NULL, &old_index)) {
+      g_ptr_array_insert (urls, i, (gpointer)url);
+      ephy_web_overview_model_notify_url_inserted (model, i, url, title,
+                                                   ephy_web_overview_model_lookup_thumbnail (model, url, thumbnail));
+      continue;
+    }
 
-  l = model->items;
-  while (l) {
-    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
-    SoupURI *uri = soup_uri_new (item->url);
-    GList *next = l->next;
+    if (i >= urls->len || strcmp (g_ptr_array_index (urls, i), url) != 0) {
+      for (guint j = i + 1; j < urls->len; j++) {
+        if (strcmp (g_ptr_array_index (urls, j), url) == 0) {
+          g_ptr_array_remove_index (urls, j);
+          break;
+        }
+      }
+      g_ptr_array_insert (urls, i, (gpointer)url);
+      ephy_web_overview_model_notify_url_moved (model, url, i);
+    }
 
-    if (g_strcmp0 (soup_uri_get_host (uri), host) == 0) {
-      changed = TRUE;
+    {
+      const char *old_url;
+      const char *old_title;
+      const char *old_thumbnail;
 
-      ephy_web_overview_model_item_free (item);
-      model->items = g_list_delete_link (model->items, l);
+      items_get_item (old_items, GPOINTER_TO_SIZE (old_index), &old_url, &old_title, &old_thumbnail);
+      if (strcmp (title, old_title) != 0)
+        ephy_web_overview_model_notify_title_changed (model, url, title);
+      if (*thumbnail && strcmp (thumbnail, old_thumbnail) != 0)
+        ephy_web_overview_model_notify_thumbnail_changed (model, url, thumbnail);
     }
-
-    soup_uri_free (uri);
-    l = next;
   }
-
-  if (changed)
-    ephy_web_overview_model_notify_urls_changed (model);
 }
 
+/**
+ * ephy_web_overview_model_set_snapshot:
+ * @model: an #EphyWebOverviewModel
+ * @snapshot: a #GVariant of type %EPHY_OVERVIEW_SNAPSHOT_TYPE
+ *
+ * Replaces the overview items with those of @snapshot. The first snapshot
+ * is announced to the listeners as a whole, later ones as the items that
+ * were inserted, removed, moved or updated. Older snapshots are ignored.
+ **/
 void
-ephy_web_overview_model_clear (EphyWebOverviewModel *model)
+ephy_web_overview_model_set_snapshot (EphyWebOverviewModel *model,
+                                      GVariant             *snapshot)
 {
+  g_autoptr(GVariant) old_items = NULL;
+  guint64 version;
+
   g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
+  g_assert (g_variant_is_of_type (snapshot, EPHY_OVERVIEW_SNAPSHOT_TYPE));
 
-  if (!model->items)
+  g_variant_get_child (snapshot, 0, "t", &version);
+  if (version <= model->version)
     return;
 
-  g_list_free_full (model->items, (GDestroyNotify)ephy_web_overview_model_item_free);
-  model->items = NULL;
-  ephy_web_overview_model_notify_urls_changed (model);
-}
+  old_items = g_steal_pointer (&model->items);
+  g_clear_pointer (&model->snapshot, g_variant_unref);
 
-EphyWebOverviewModelItem *
-ephy_web_overview_model_item_new (const char *url,
-                                  const char *title)
-{
-  EphyWebOverviewModelItem *item;
+  model->snapshot = g_variant_ref (snapshot);
+  model->items = g_variant_get_child_value (snapshot, 1);
+  model->version = version;
 
-  item = g_new0 (EphyWebOverviewModelItem, 1);
-  item->url = g_strdup (url);
-  item->title = g_strdup (title);
-
-  return item;
-}
-
-void
-ephy_web_overview_model_item_free (EphyWebOverviewModelItem *item)
-{
-  if (G_UNLIKELY (!item))
-    return;
-
-  g_free (item->url);
-  g_free (item->title);
-
-  g_free (item);
+  if (!old_items)
+    ephy_web_overview_model_notify_urls_changed (model);
+  else
+    ephy_web_overview_model_notify_items_changed (model, old_items);
 }
 
 static void
@@ -342,13 +451,25 @@ js_web_overview_model_set_thumbnail (EphyWebOverviewModel *model,
                                      const char           *url,
                                      const char           *path)
 {
-  ephy_web_overview_model_set_url_thumbnail (model, url, path, FALSE);
+  g_hash_table_insert (model->thumbnails, g_strdup (url), g_strdup (path));
 }
 
 static char *
 js_web_overview_model_get_thumbnail (EphyWebOverviewModel *model,
                                      const char           *url)
 {
+  gsize n_items = items_get_n_items (model->items);
+
+  for (gsize i = 0; i < n_items; i++) {
+    const char *item_url;
+    const char *title;
+    const char *thumbnail;
+
+    items_get_item (model->items, i, &item_url, &title, &thumbnail);
+    if (g_strcmp0 (item_url, url) == 0)
+      return g_strdup (ephy_web_overview_model_lookup_thumbnail (model, url, thumbnail));
+  }
+
   return g_strdup (g_hash_table_lookup (model->thumbnails, url));
 }
 
@@ -366,57 +487,66 @@ js_event_listener_destroyed (JSCWeakValue *weak_value,
 }
 
 static void
-js_web_overview_model_add_urls_changed_event_listener (EphyWebOverviewModel *model,
-                                                       JSCValue             *js_function)
+js_web_overview_model_add_event_listener (GHashTable *listeners,
+                                          JSCValue   *js_function,
+                                          const char *name)
 {
   JSCWeakValue *weak_value;
 
   if (!jsc_value_is_function (js_function)) {
-    jsc_context_throw (jsc_context_get_current (), "Invalid type passed to onurlschanged");
+    g_autofree char *message = g_strdup_printf ("Invalid type passed to %s", name);
+
+    jsc_context_throw (jsc_context_get_current (), message);
     return;
   }
 
   weak_value = jsc_weak_value_new (js_function);
   g_signal_connect (weak_value, "cleared",
                     G_CALLBACK (js_event_listener_destroyed),
-                    model->urls_listeners);
-  g_hash_table_add (model->urls_listeners, weak_value);
+                    listeners);
+  g_hash_table_add (listeners, weak_value);
 }
 
 static void
-js_web_overview_model_add_thumbnail_changed_event_listener (EphyWebOverviewModel *model,
-                                                            JSCValue             *js_function)
+js_web_overview_model_add_urls_changed_event_listener (EphyWebOverviewModel *model,
+                                                       JSCValue             *js_function)
 {
-  JSCWeakValue *weak_value;
+  js_web_overview_model_add_event_listener (model->urls_listeners, js_function, "onurlschanged");
+}
 
-  if (!jsc_value_is_function (js_function)) {
-    jsc_context_throw (jsc_context_get_current (), "Invalid type passed to onthumbnailchanged");
-    return;
-  }
+static void
+js_web_overview_model_add_url_inserted_event_listener (EphyWebOverviewModel *model,
+                                                       JSCValue             *js_function)
+{
+  js_web_overview_model_add_event_listener (model->url_inserted_listeners, js_function, "onurlinserted");
+}
 
-  weak_value = jsc_weak_value_new (js_function);
-  g_signal_connect (weak_value, "cleared",
-                    G_CALLBACK (js_event_listener_destroyed),
-                    model->thumbnail_listeners);
-  g_hash_table_add (model->thumbnail_listeners, weak_value);
+static void
+js_web_overview_model_add_url_removed_event_listener (EphyWebOverviewModel *model,
+                                                      JSCValue             *js_function)
+{
+  js_web_overview_model_add_event_listener (model->url_removed_listeners, js_function, "onurlremoved");
 }
 
 static void
-js_web_overview_model_add_title_changed_event_listener (EphyWebOverviewModel *model,
-                                                        JSCValue             *js_function)
+js_web_overview_model_add_url_moved_event_listener (EphyWebOverviewModel *model,
+                                                    JSCValue             *js_function)
 {
-  JSCWeakValue *weak_value;
+  js_web_overview_model_add_event_listener (model->url_moved_listeners, js_function, "onurlmoved");
+}
 
-  if (!jsc_value_is_function (js_function)) {
-    jsc_context_throw (jsc_context_get_current (), "Invalid type passed to ontitlechanged");
-    return;
-  }
+static void
+js_web_overview_model_add_thumbnail_changed_event_listener (EphyWebOverviewModel *model,
+                                                            JSCValue             *js_function)
+{
+  js_web_overview_model_add_event_listener (model->thumbnail_listeners, js_function, "onthumbnailchanged");
+}
 
-  weak_value = jsc_weak_value_new (js_function);
-  g_signal_connect (weak_value, "cleared",
-                    G_CALLBACK (js_event_listener_destroyed),
-                    model->title_listeners);
-  g_hash_table_add (model->title_listeners, weak_value);
+static void
+js_web_overview_model_add_title_changed_event_listener (EphyWebOverviewModel *model,
+                                                        JSCValue             *js_function)
+{
+  js_web_overview_model_add_event_listener (model->title_listeners, js_function, "ontitlechanged");
 }
 
 JSCValue *
@@ -448,6 +578,24 @@ ephy_web_overview_model_export_to_js_context (EphyWebOverviewModel *model,
                           NULL,
                           G_CALLBACK (js_web_overview_model_add_urls_changed_event_listener),
                           NULL, NULL);
+  jsc_class_add_property (js_class,
+                          "onurlinserted",
+                          JSC_TYPE_VALUE,
+                          NULL,
+                          G_CALLBACK (js_web_overview_model_add_url_inserted_event_listener),
+                          NULL, NULL);
+  jsc_class_add_property (js_class,
+                          "onurlremoved",
+                          JSC_TYPE_VALUE,
+                          NULL,
+                          G_CALLBACK (js_web_overview_model_add_url_removed_event_listener),
+                          NULL, NULL);
+  jsc_class_add_property (js_class,
+                          "onurlmoved",
+                          JSC_TYPE_VALUE,
+                          NULL,
+                          G_CALLBACK (js_web_overview_model_add_url_moved_event_listener),
+                          NULL, NULL);
   jsc_class_add_property (js_class,
                           "onthumbnailchanged",
                           JSC_TYPE_VALUE,
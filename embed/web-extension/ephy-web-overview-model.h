@@ -29,33 +29,10 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (EphyWebOverviewModel, ephy_web_overview_model, EPHY, WEB_OVERVIEW_MODEL, GObject)
 
-EphyWebOverviewModel *ephy_web_overview_model_new               (void);
-void                  ephy_web_overview_model_set_urls          (EphyWebOverviewModel *model,
-                                                                 GList                *urls);
-void                  ephy_web_overview_model_set_url_thumbnail (EphyWebOverviewModel *model,
-                                                                 const char           *url,
-                                                                 const char           *path,
-                                                                 gboolean              notify);
-void                  ephy_web_overview_model_set_url_title     (EphyWebOverviewModel *model,
-                                                                 const char           *url,
-                                                                 const char           *title);
-void                  ephy_web_overview_model_delete_url        (EphyWebOverviewModel *model,
-                                                                 const char           *url);
-void                  ephy_web_overview_model_delete_host       (EphyWebOverviewModel *model,
-                                                                 const char           *host);
-void                  ephy_web_overview_model_clear             (EphyWebOverviewModel *model);
-
-
-typedef struct _EphyWebOverviewModelItem EphyWebOverviewModelItem;
-struct _EphyWebOverviewModelItem
-{
-  char *url;
-  char *title;
-};
-
-EphyWebOverviewModelItem *ephy_web_overview_model_item_new  (const char               *url,
-                                                             const char               *title);
-void                      ephy_web_overview_model_item_free (EphyWebOverviewModelItem *item);
+EphyWebOverviewModel *ephy_web_overview_model_new          (void);
+guint64               ephy_web_overview_model_get_version  (EphyWebOverviewModel *model);
+void                  ephy_web_overview_model_set_snapshot (EphyWebOverviewModel *model,
+                                                            GVariant             *snapshot);
 
 JSCValue *ephy_web_overview_model_export_to_js_context  (EphyWebOverviewModel *model,
                                                          JSCContext           *js_context);
@@ -11,6 +11,12 @@ Ephy.Overview = class Overview
         // a strong reference to them while Ephy.Overview is alive.
         this._onURLsChangedFunction = this._onURLsChanged.bind(this);
         this._model.onurlschanged = this._onURLsChangedFunction;
+        this._onURLInsertedFunction = this._onURLInserted.bind(this);
+        this._model.onurlinserted = this._onURLInsertedFunction;
+        this._onURLRemovedFunction = this._onURLRemoved.bind(this);
+        this._model.onurlremoved = this._onURLRemovedFunction;
+        this._onURLMovedFunction = this._onURLMoved.bind(this);
+        this._model.onurlmoved = this._onURLMovedFunction;
         this._onThumbnailChangedFunction = this._onThumbnailChanged.bind(this);
         this._model.onthumbnailchanged = this._onThumbnailChangedFunction;
         this._onTitleChangedFunction = this._onTitleChanged.bind(this);
@@ -47,8 +53,10 @@ Ephy.Overview = class Overview
 
             this._items.push(item);
         }
+        // Once the model has been populated it is authoritative, and later
+        // changes are only sent as incremental updates relative to it.
         let items = this._model.urls;
-        if (items.length > this._items.length)
+        if (items.length > 0)
             this._onURLsChanged(items);
     }
 
@@ -69,7 +77,8 @@ Ephy.Overview = class Overview
         item.classList.add('overview-removed');
         // Animation takes 0.75s, remove the item after 1s to ensure the animation finished.
         setTimeout(() => {
-            item.parentNode.removeChild(item);
+            if (item.parentNode)
+                item.parentNode.removeChild(item);
             for (let i = 0; i < this._items.length; i++) {
                 if (this._items[i].url() == item.href) {
                     this._items.splice(i, 1);
@@ -80,7 +89,29 @@ Ephy.Overview = class Overview
         }, 1000);
     }
 
-    _onURLsChanged(urls)
+    _createItem()
+    {
+        let anchor = document.createElement('a');
+        anchor.classList.add('overview-item');
+        let closeButton = document.createElement('div');
+        closeButton.title = Ephy._("Remove from overview");
+        closeButton.onclick = (event) => {
+            this._removeItem(anchor);
+            event.preventDefault();
+        };
+        closeButton.innerHTML = '&#10006;';
+        closeButton.classList.add('overview-close-button');
+        anchor.appendChild(closeButton);
+        let thumbnailSpan = document.createElement('span');
+        thumbnailSpan.classList.add('overview-thumbnail');
+        anchor.appendChild(thumbnailSpan);
+        let titleSpan = document.createElement('span');
+        titleSpan.classList.add('overview-title');
+        anchor.appendChild(titleSpan);
+        return new Ephy.Overview.Item(anchor);
+    }
+
+    _clearEmpty()
     {
         let overview = document.getElementById('overview');
         if (overview.classList.contains('overview-empty')) {
@@ -88,6 +119,32 @@ Ephy.Overview = class Overview
                 overview.removeChild(overview.lastChild);
             overview.classList.remove('overview-empty');
         }
+        return overview;
+    }
+
+    _indexOfURL(url)
+    {
+        for (let i = 0; i < this._items.length; i++) {
+            if (this._items[i].url() == url)
+                return i;
+        }
+        return -1;
+    }
+
+    _insertItemAt(item, index)
+    {
+        // Items being removed by the user are already gone from the model, so
+        // indices can be off by those, never past the end.
+        index = Math.min(index, this._items.length);
+        let overview = this._clearEmpty();
+        let sibling = index < this._items.length ? this._items[index].element() : null;
+        overview.insertBefore(item.element(), sibling);
+        this._items.splice(index, 0, item);
+    }
+
+    _onURLsChanged(urls)
+    {
+        let overview = this._clearEmpty();
 
         for (let i = 0; i < urls.length; i++) {
             let url = urls[i];
@@ -97,25 +154,8 @@ Ephy.Overview = class Overview
                 item = this._items[i];
             } else {
                 Ephy.log('create an item for the url ' + url.url);
-                let anchor = document.createElement('a');
-                anchor.classList.add('overview-item');
-                let closeButton = document.createElement('div');
-                closeButton.title = Ephy._("Remove from overview");
-                closeButton.onclick = (event) => {
-                    this._removeItem(anchor);
-                    event.preventDefault();
-                };
-                closeButton.innerHTML = '&#10006;';
-                closeButton.classList.add('overview-close-button');
-                anchor.appendChild(closeButton);
-                let thumbnailSpan = document.createElement('span');
-                thumbnailSpan.classList.add('overview-thumbnail');
-                anchor.appendChild(thumbnailSpan);
-                let titleSpan = document.createElement('span');
-                titleSpan.classList.add('overview-title');
-                anchor.appendChild(titleSpan);
-                document.getElementById('overview').appendChild(anchor);
-                item = new Ephy.Overview.Item(anchor);
+                item = this._createItem();
+                overview.appendChild(item.element());
                 this._items.push(item);
             }
 
@@ -130,6 +170,37 @@ Ephy.Overview = class Overview
         }
     }
 
+    _onURLInserted(index, url, title, thumbnailPath)
+    {
+        let item = this._createItem();
+        item.setURL(url);
+        item.setTitle(title);
+        item.setThumbnailPath(thumbnailPath);
+        this._insertItemAt(item, index);
+    }
+
+    _onURLRemoved(url)
+    {
+        let index = this._indexOfURL(url);
+        if (index == -1)
+            return;
+
+        let item = this._items[index];
+        this._items.splice(index, 1);
+        item.detachFromParent();
+    }
+
+    _onURLMoved(url, index)
+    {
+        let oldIndex = this._indexOfURL(url);
+        if (oldIndex == -1 || oldIndex == index)
+            return;
+
+        let item = this._items[oldIndex];
+        this._items.splice(oldIndex, 1);
+        this._insertItemAt(item, index);
+    }
+
     _onThumbnailChanged(url, path)
     {
         for (let i = 0; i < this._items.length; i++) {
@@ -175,6 +246,11 @@ Ephy.Overview.Item = class OverviewItem
 
     // Public
 
+    element()
+    {
+        return this._item;
+    }
+
     url()
     {
         return this._item.href;
@@ -222,6 +298,7 @@ Ephy.Overview.Item = class OverviewItem
 
     detachFromParent()
     {
-        this._item.parentNode.removeChild(this._item);
+        if (this._item.parentNode)
+            this._item.parentNode.removeChild(this._item);
     }
 };
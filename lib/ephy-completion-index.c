@@ -0,0 +1,285 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-completion-index.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+/**
+ * SECTION:ephy-completion-index
+ * @short_description: A read-only index of bookmarks and history
+ *
+ * The browser writes the bookmarks and the most visited history URLs of its
+ * profile into a small file, and processes that only need to complete
+ * addresses, like the GNOME Shell search provider, map it instead of opening
+ * the history database. A query is a scan of the mapped file: no thread, no
+ * SQLite connection and no allocation per entry.
+ *
+ * The file is replaced atomically, so a mapped index never changes; use
+ * ephy_completion_index_is_current() to know when to map it again.
+ */
+
+/* Bumped whenever the format changes; older files are then ignored. */
+#define EPHY_COMPLETION_INDEX_VERSION 1
+
+/* (version, bookmarks, history). Each entry is (key, url, title), where the
+ * key is the casefolded URL and title that queries are matched against.
+ * History is sorted by visit count.
+ */
+#define EPHY_COMPLETION_INDEX_TYPE G_VARIANT_TYPE ("(ua(sss)a(sss))")
+
+struct _EphyCompletionIndex {
+  char *filename;
+  GMappedFile *mapped_file;
+  GVariant *variant;
+  GStatBuf stat_buf;
+};
+
+static void
+add_entries (GVariantBuilder *builder,
+             GList           *urls)
+{
+  g_variant_builder_open (builder, G_VARIANT_TYPE ("a(sss)"));
+
+  for (GList *l = urls; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+    const char *title = url->title ? url->title : "";
+    g_autofree char *folded_url = g_utf8_casefold (url->url, -1);
+    g_autofree char *folded_title = g_utf8_casefold (title, -1);
+    g_autofree char *key = g_strconcat (folded_url, "\n", folded_title, NULL);
+
+    g_variant_builder_add (builder, "(sss)", key, url->url, title);
+  }
+
+  g_variant_builder_close (builder);
+}
+
+/**
+ * ephy_completion_index_write:
+ * @filename: the file to write
+ * @bookmarks: (element-type EphyHistoryURL): the bookmarks
+ * @history: (element-type EphyHistoryURL): the history URLs, most visited
+ *   first
+ * @error: return location for a #GError
+ *
+ * Atomically replaces @filename with an index of @bookmarks and @history.
+ * This does blocking I/O.
+ *
+ * Return value: %TRUE on success
+ **/
+gboolean
+ephy_completion_index_write (const char  *filename,
+                             GList       *bookmarks,
+                             GList       *history,
+                             GError     **error)
+{
+  g_autoptr(GVariant) variant = NULL;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, EPHY_COMPLETION_INDEX_TYPE);
+  g_variant_builder_add (&builder, "u", EPHY_COMPLETION_INDEX_VERSION);
+  add_entries (&builder, bookmarks);
+  add_entries (&builder, history);
+  variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  return g_file_set_contents (filename,
+                              g_variant_get_data (variant),
+                              g_variant_get_size (variant),
+                              error);
+}
+
+/**
+ * ephy_completion_index_new_for_file:
+ * @filename: a file written by ephy_completion_index_write()
+ * @error: return location for a #GError
+ *
+ * Maps the index in @filename.
+ *
+ * Return value: (transfer full): the index, or %NULL on error
+ **/
+EphyCompletionIndex *
+ephy_completion_index_new_for_file (const char  *filename,
+                                    GError     **error)
+{
+  EphyCompletionIndex *index;
+  g_autoptr(GBytes) bytes = NULL;
+  guint32 version;
+
+  index = g_new0 (EphyCompletionIndex, 1);
+  index->filename = g_strdup (filename);
+
+  /* Stat before mapping, so that a file replaced in between is seen as not
+   * current rather than the other way around.
+   */
+  if (g_stat (filename, &index->stat_buf) == -1) {
+    int errsv = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                 "Failed to stat %s: %s", filename, g_strerror (errsv));
+    ephy_completion_index_free (index);
+    return NULL;
+  }
+
+  index->mapped_file = g_mapped_file_new (filename, FALSE, error);
+  if (!index->mapped_file) {
+    ephy_completion_index_free (index);
+    return NULL;
+  }
+
+  bytes = g_mapped_file_get_bytes (index->mapped_file);
+  index->variant = g_variant_ref_sink (g_variant_new_from_bytes (EPHY_COMPLETION_INDEX_TYPE, bytes, FALSE));
+
+  g_variant_get_child (index->variant, 0, "u", &version);
+  if (version != EPHY_COMPLETION_INDEX_VERSION) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "Unsupported completion index version %u in %s", version, filename);
+    ephy_completion_index_free (index);
+    return NULL;
+  }
+
+  return index;
+}
+
+void
+ephy_completion_index_free (EphyCompletionIndex *index)
+{
+  g_free (index->filename);
+  g_clear_pointer (&index->variant, g_variant_unref);
+  g_clear_pointer (&index->mapped_file, g_mapped_file_unref);
+  g_free (index);
+}
+
+/**
+ * ephy_completion_index_is_current:
+ * @index: an #EphyCompletionIndex
+ *
+ * Checks whether the file @index was mapped from has been replaced since.
+ * This costs a stat().
+ *
+ * Return value: %FALSE if the file was replaced or removed
+ **/
+gboolean
+ephy_completion_index_is_current (EphyCompletionIndex *index)
+{
+  GStatBuf stat_buf;
+
+  if (g_stat (index->filename, &stat_buf) == -1)
+    return FALSE;
+
+  return stat_buf.st_dev == index->stat_buf.st_dev &&
+         stat_buf.st_ino == index->stat_buf.st_ino &&
+         stat_buf.st_mtime == index->stat_buf.st_mtime &&
+         stat_buf.st_size == index->stat_buf.st_size;
+}
+
+static gboolean
+key_matches (const char  *key,
+             char       **terms)
+{
+  for (guint i = 0; terms[i]; i++) {
+    if (!strstr (key, terms[i]))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+add_matches (GPtrArray   *matches,
+             GHashTable  *seen_urls,
+             GVariant    *entries,
+             char       **terms,
+             guint        max_results)
+{
+  GVariantIter iter;
+  const char *key;
+  const char *url;
+  const char *title;
+  guint added = 0;
+
+  g_variant_iter_init (&iter, entries);
+  while (added < max_results &&
+         g_variant_iter_next (&iter, "(&s&s&s)", &key, &url, &title)) {
+    if (!key_matches (key, terms) || g_hash_table_contains (seen_urls, url))
+      continue;
+
+    /* The URL is owned by the mapped file, which outlives the table. */
+    g_hash_table_add (seen_urls, (gpointer)url);
+    g_ptr_array_add (matches, ephy_history_url_new (url, *title ? title : url, 0, 0, 0));
+    added++;
+  }
+}
+
+/**
+ * ephy_completion_index_query:
+ * @index: an #EphyCompletionIndex
+ * @query: the text typed by the user
+ * @max_history_results: the maximum number of history URLs to return
+ *
+ * Finds the bookmarks and history URLs whose address or title contains
+ * every word of @query, ignoring case. Bookmarks come first, then history
+ * by decreasing visit count. Each URL is returned once, and the title is
+ * the URL when there is none.
+ *
+ * Return value: (transfer full) (element-type EphyHistoryURL): the matches
+ **/
+GPtrArray *
+ephy_completion_index_query (EphyCompletionIndex *index,
+                             const char          *query,
+                             guint                max_history_results)
+{
+  g_autoptr(GVariant) bookmarks = NULL;
+  g_autoptr(GVariant) history = NULL;
+  g_autoptr(GHashTable) seen_urls = NULL;
+  g_autofree char *folded_query = NULL;
+  g_auto(GStrv) terms = NULL;
+  GPtrArray *matches;
+  guint i, j;
+
+  matches = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_url_free);
+
+  folded_query = g_utf8_casefold (query, -1);
+  terms = g_strsplit (folded_query, " ", -1);
+
+  /* Drop the empty words left by repeated spaces. */
+  for (i = 0, j = 0; terms[i]; i++) {
+    if (*terms[i])
+      terms[j++] = terms[i];
+    else
+      g_free (terms[i]);
+  }
+  terms[j] = NULL;
+
+  if (j == 0)
+    return matches;
+
+  seen_urls = g_hash_table_new (g_str_hash, g_str_equal);
+  bookmarks = g_variant_get_child_value (index->variant, 1);
+  history = g_variant_get_child_value (index->variant, 2);
+
+  add_matches (matches, seen_urls, bookmarks, terms, G_MAXUINT);
+  add_matches (matches, seen_urls, history, terms, max_history_results);
+
+  return matches;
+}
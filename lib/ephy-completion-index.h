@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-history-types.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EphyCompletionIndex EphyCompletionIndex;
+
+gboolean             ephy_completion_index_write         (const char           *filename,
+                                                          GList                *bookmarks,
+                                                          GList                *history,
+                                                          GError              **error);
+
+EphyCompletionIndex *ephy_completion_index_new_for_file  (const char           *filename,
+                                                          GError              **error);
+void                 ephy_completion_index_free          (EphyCompletionIndex  *index);
+gboolean             ephy_completion_index_is_current    (EphyCompletionIndex  *index);
+GPtrArray           *ephy_completion_index_query         (EphyCompletionIndex  *index,
+                                                          const char           *query,
+                                                          guint                 max_history_results);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EphyCompletionIndex, ephy_completion_index_free)
+
+G_END_DECLS
@@ -0,0 +1,111 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-memory-pressure.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Percentage of time in the last 10 seconds during which some task was
+ * stalled on memory, see Documentation/accounting/psi.txt.
+ */
+#define PSI_THRESHOLD                 10.0
+/* Without PSI, the share of memory that must still be available. */
+#define MIN_AVAILABLE_MEMORY_PERCENT  10
+
+static gboolean
+parse_psi_avg10 (const char *contents,
+                 double     *avg10)
+{
+  return contents && sscanf (contents, "some avg10=%lf", avg10) == 1;
+}
+
+static gboolean
+read_meminfo_field (const char *contents,
+                    const char *name,
+                    guint64    *kilobytes)
+{
+  const char *line;
+
+  for (line = contents; line; line = strchr (line, '\n')) {
+    if (*line == '\n')
+      line++;
+    if (g_str_has_prefix (line, name) && line[strlen (name)] == ':') {
+      *kilobytes = g_ascii_strtoull (line + strlen (name) + 1, NULL, 10);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ * ephy_memory_pressure_parse:
+ * @psi: (nullable): the contents of /proc/pressure/memory
+ * @meminfo: (nullable): the contents of /proc/meminfo
+ *
+ * Checks whether the system is short on memory from the memory pressure
+ * stall information of the kernel, or from the available memory if @psi is
+ * %NULL or cannot be parsed.
+ *
+ * Returns: %TRUE if memory is short
+ **/
+gboolean
+ephy_memory_pressure_parse (const char *psi,
+                            const char *meminfo)
+{
+  guint64 total, available;
+  double avg10;
+
+  if (parse_psi_avg10 (psi, &avg10))
+    return avg10 >= PSI_THRESHOLD;
+
+  if (!meminfo ||
+      !read_meminfo_field (meminfo, "MemTotal", &total) ||
+      !read_meminfo_field (meminfo, "MemAvailable", &available))
+    return FALSE;
+
+  return available * 100 < total * MIN_AVAILABLE_MEMORY_PERCENT;
+}
+
+/**
+ * ephy_is_under_memory_pressure:
+ *
+ * Checks whether the system is short on memory, see
+ * ephy_memory_pressure_parse(). This reads files in /proc, so call it at
+ * most every few seconds.
+ *
+ * Returns: %TRUE if memory is short
+ **/
+gboolean
+ephy_is_under_memory_pressure (void)
+{
+  g_autofree char *psi = NULL;
+  g_autofree char *meminfo = NULL;
+  double avg10;
+
+  /* Only available with CONFIG_PSI. */
+  g_file_get_contents ("/proc/pressure/memory", &psi, NULL, NULL);
+  if (!parse_psi_avg10 (psi, &avg10))
+    g_file_get_contents ("/proc/meminfo", &meminfo, NULL, NULL);
+
+  return ephy_memory_pressure_parse (psi, meminfo);
+}
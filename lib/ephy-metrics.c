@@ -0,0 +1,338 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-metrics.h"
+
+#include <string.h>
+
+/**
+ * SECTION:ephy-metrics
+ * @short_description: Always-on performance metrics
+ *
+ * Unlike ephy-trace, which records individual events when enabled, metrics
+ * are aggregated in memory all the time so that about:performance can show
+ * them on any machine. Recording one takes a mutex and a hash lookup, and
+ * allocates nothing once the metric exists.
+ */
+
+#define SUB_BUCKET_BITS EPHY_HISTOGRAM_SUB_BUCKET_BITS
+
+typedef struct {
+  const char *category;
+  const char *name;
+} MetricKey;
+
+typedef struct {
+  MetricKey key;
+  EphyMetricKind kind;
+  guint64 count;
+  gint64 value;
+  gint64 max;
+  EphyHistogram *histogram;
+} Metric;
+
+static GMutex metrics_mutex;
+static GHashTable *metrics;
+
+static guint
+metric_key_hash (gconstpointer key)
+{
+  const MetricKey *metric_key = key;
+
+  return g_str_hash (metric_key->category) * 31 + g_str_hash (metric_key->name);
+}
+
+static gboolean
+metric_key_equal (gconstpointer a,
+                  gconstpointer b)
+{
+  const MetricKey *key_a = a;
+  const MetricKey *key_b = b;
+
+  return strcmp (key_a->category, key_b->category) == 0 &&
+         strcmp (key_a->name, key_b->name) == 0;
+}
+
+static void
+metric_free (Metric *metric)
+{
+  g_free ((char *)metric->key.category);
+  g_free ((char *)metric->key.name);
+  g_clear_pointer (&metric->histogram, ephy_histogram_free);
+  g_free (metric);
+}
+
+/* Must be called with metrics_mutex held. */
+static Metric *
+lookup_metric (const char     *category,
+               const char     *name,
+               EphyMetricKind  kind)
+{
+  MetricKey key = { category, name };
+  Metric *metric;
+
+  if (G_UNLIKELY (!metrics))
+    metrics = g_hash_table_new_full (metric_key_hash, metric_key_equal, NULL, (GDestroyNotify)metric_free);
+
+  metric = g_hash_table_lookup (metrics, &key);
+  if (G_LIKELY (metric)) {
+    g_assert (metric->kind == kind);
+    return metric;
+  }
+
+  metric = g_new0 (Metric, 1);
+  metric->key.category = g_strdup (category);
+  metric->key.name = g_strdup (name);
+  metric->kind = kind;
+  if (kind == EPHY_METRIC_DURATION)
+    metric->histogram = ephy_histogram_new ();
+  g_hash_table_insert (metrics, &metric->key, metric);
+
+  return metric;
+}
+
+static guint
+bucket_for_value (gint64 value)
+{
+  guint bits;
+
+  if (value < (1 << (SUB_BUCKET_BITS + 1)))
+    return MAX (value, 0);
+
+  bits = g_bit_storage ((guint64)value);
+  return ((bits - SUB_BUCKET_BITS) << SUB_BUCKET_BITS) |
+         ((value >> (bits - 1 - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1));
+}
+
+static gint64
+bucket_upper_bound (guint bucket)
+{
+  guint bits;
+  guint64 lower;
+
+  if (bucket < (1 << (SUB_BUCKET_BITS + 1)))
+    return bucket;
+
+  bits = (bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS;
+  lower = (G_GUINT64_CONSTANT (1) << (bits - 1)) |
+          ((guint64)(bucket & ((1 << SUB_BUCKET_BITS) - 1)) << (bits - 1 - SUB_BUCKET_BITS));
+  return (gint64)(lower + (G_GUINT64_CONSTANT (1) << (bits - 1 - SUB_BUCKET_BITS)) - 1);
+}
+
+/**
+ * ephy_histogram_new:
+ *
+ * Creates an empty histogram. It is not thread-safe, callers must hold their
+ * own lock.
+ *
+ * Returns: (transfer full): a new #EphyHistogram
+ **/
+EphyHistogram *
+ephy_histogram_new (void)
+{
+  EphyHistogram *histogram = g_new0 (EphyHistogram, 1);
+
+  histogram->min = G_MAXINT64;
+  histogram->max = G_MININT64;
+
+  return histogram;
+}
+
+void
+ephy_histogram_free (EphyHistogram *histogram)
+{
+  g_free (histogram);
+}
+
+void
+ephy_histogram_add (EphyHistogram *histogram,
+                    gint64         value)
+{
+  histogram->buckets[bucket_for_value (value)]++;
+  histogram->count++;
+  histogram->sum += value;
+  histogram->min = MIN (histogram->min, value);
+  histogram->max = MAX (histogram->max, value);
+}
+
+/**
+ * ephy_histogram_get_percentile:
+ * @histogram: an #EphyHistogram
+ * @percentile: the percentile, between 0 and 100
+ *
+ * Returns the upper bound of the bucket holding the @percentile-th value,
+ * clamped to the extremes of @histogram, or 0 if it is empty.
+ *
+ * Returns: the approximate percentile
+ **/
+gint64
+ephy_histogram_get_percentile (EphyHistogram *histogram,
+                               guint          percentile)
+{
+  guint64 target;
+  guint64 seen = 0;
+  guint i;
+
+  if (histogram->count == 0)
+    return 0;
+
+  target = MAX ((histogram->count * percentile + 99) / 100, 1);
+  for (i = 0; i < EPHY_HISTOGRAM_N_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= target)
+      return CLAMP (bucket_upper_bound (i), histogram->min, histogram->max);
+  }
+
+  return histogram->max;
+}
+
+static gint64
+metric_get_percentile (Metric *metric,
+                       guint   percentile)
+{
+  return metric->histogram ? ephy_histogram_get_percentile (metric->histogram, percentile) : 0;
+}
+
+/**
+ * ephy_metrics_add_duration:
+ * @category: the subsystem, e.g. "history"
+ * @name: the name of the operation
+ * @usec: how long the operation took, in microseconds
+ *
+ * Adds a duration to the histogram of @category and @name.
+ **/
+void
+ephy_metrics_add_duration (const char *category,
+                           const char *name,
+                           gint64      usec)
+{
+  Metric *metric;
+
+  g_mutex_lock (&metrics_mutex);
+  metric = lookup_metric (category, name, EPHY_METRIC_DURATION);
+  ephy_histogram_add (metric->histogram, usec);
+  metric->count++;
+  metric->value += usec;
+  metric->max = metric->histogram->max;
+  g_mutex_unlock (&metrics_mutex);
+}
+
+/**
+ * ephy_metrics_add_count:
+ * @category: the subsystem, e.g. "safe-browsing"
+ * @name: the name of the counter
+ * @delta: the amount to add
+ *
+ * Adds @delta to a counter, e.g. of cache hits or bytes written.
+ **/
+void
+ephy_metrics_add_count (const char *category,
+                        const char *name,
+                        gint64      delta)
+{
+  Metric *metric;
+
+  g_mutex_lock (&metrics_mutex);
+  metric = lookup_metric (category, name, EPHY_METRIC_COUNTER);
+  metric->count++;
+  metric->value += delta;
+  g_mutex_unlock (&metrics_mutex);
+}
+
+/**
+ * ephy_metrics_set_gauge:
+ * @category: the subsystem, e.g. "history"
+ * @name: the name of the gauge
+ * @value: the current value
+ *
+ * Sets the current value of a gauge, e.g. the length of a queue. The
+ * maximum value is kept too.
+ **/
+void
+ephy_metrics_set_gauge (const char *category,
+                        const char *name,
+                        gint64      value)
+{
+  Metric *metric;
+
+  g_mutex_lock (&metrics_mutex);
+  metric = lookup_metric (category, name, EPHY_METRIC_GAUGE);
+  metric->count++;
+  metric->value = value;
+  metric->max = metric->count == 1 ? value : MAX (metric->max, value);
+  g_mutex_unlock (&metrics_mutex);
+}
+
+static int
+compare_metrics (Metric **a,
+                 Metric **b)
+{
+  int result = strcmp ((*a)->key.category, (*b)->key.category);
+
+  return result != 0 ? result : strcmp ((*a)->key.name, (*b)->key.name);
+}
+
+/**
+ * ephy_metrics_get_snapshot:
+ *
+ * Returns the current value of every metric of the process, in the format
+ * described by %EPHY_METRICS_SNAPSHOT_TYPE.
+ *
+ * Returns: (transfer floating): a #GVariant
+ **/
+GVariant *
+ephy_metrics_get_snapshot (void)
+{
+  g_autoptr(GPtrArray) sorted = g_ptr_array_new ();
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  Metric *metric;
+  guint i;
+
+  g_variant_builder_init (&builder, EPHY_METRICS_SNAPSHOT_TYPE);
+
+  g_mutex_lock (&metrics_mutex);
+
+  if (metrics) {
+    g_hash_table_iter_init (&iter, metrics);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&metric))
+      g_ptr_array_add (sorted, metric);
+  }
+  g_ptr_array_sort (sorted, (GCompareFunc)compare_metrics);
+
+  for (i = 0; i < sorted->len; i++) {
+    metric = g_ptr_array_index (sorted, i);
+    g_variant_builder_add (&builder, "(ssutxxxxx)",
+                           metric->key.category,
+                           metric->key.name,
+                           metric->kind,
+                           metric->count,
+                           metric->value,
+                           metric->max,
+                           metric_get_percentile (metric, 50),
+                           metric_get_percentile (metric, 90),
+                           metric_get_percentile (metric, 99));
+  }
+
+  g_mutex_unlock (&metrics_mutex);
+
+  return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  EPHY_METRIC_DURATION,
+  EPHY_METRIC_COUNTER,
+  EPHY_METRIC_GAUGE
+} EphyMetricKind;
+
+/* The metrics of a process, sorted by category and name. Each one is
+ * (category, name, kind, count, value, max, p50, p90, p99). The value is
+ * the sum of the durations, the total of a counter or the current value of
+ * a gauge. Durations are in microseconds, and percentiles are only set for
+ * them.
+ */
+#define EPHY_METRICS_SNAPSHOT_TYPE G_VARIANT_TYPE ("a(ssutxxxxx)")
+
+/* Values are counted in log-linear buckets: values below 8 have their own
+ * bucket, and each power of two above is split into 4, so percentiles are
+ * accurate within 25%. The fields are read-only.
+ */
+#define EPHY_HISTOGRAM_SUB_BUCKET_BITS 2
+#define EPHY_HISTOGRAM_N_BUCKETS (64 << EPHY_HISTOGRAM_SUB_BUCKET_BITS)
+
+typedef struct {
+  guint64 count;
+  gint64 sum;
+  gint64 min;
+  gint64 max;
+  guint64 buckets[EPHY_HISTOGRAM_N_BUCKETS];
+} EphyHistogram;
+
+EphyHistogram *ephy_histogram_new            (void);
+void           ephy_histogram_free           (EphyHistogram *histogram);
+void           ephy_histogram_add            (EphyHistogram *histogram,
+                                              gint64         value);
+gint64         ephy_histogram_get_percentile (EphyHistogram *histogram,
+                                              guint          percentile);
+
+void      ephy_metrics_add_duration (const char *category,
+                                     const char *name,
+                                     gint64      usec);
+void      ephy_metrics_add_count    (const char *category,
+                                     const char *name,
+                                     gint64      delta);
+void      ephy_metrics_set_gauge    (const char *category,
+                                     const char *name,
+                                     gint64      value);
+GVariant *ephy_metrics_get_snapshot (void);
+
+G_END_DECLS
@@ -0,0 +1,147 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* For memfd_create() */
+#define _GNU_SOURCE
+
+#include "config.h"
+#include "ephy-overview-snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static int
+create_anonymous_file (GError **error)
+{
+  int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create ("epiphany-overview", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1) {
+    int errsv = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                 "Failed to create memfd: %s", g_strerror (errsv));
+  }
+#else
+  char *path = NULL;
+
+  fd = g_file_open_tmp ("epiphany-overview-XXXXXX", &path, error);
+  if (fd != -1)
+    g_unlink (path);
+  g_free (path);
+#endif
+
+  return fd;
+}
+
+/**
+ * ephy_overview_snapshot_to_fd:
+ * @snapshot: a #GVariant of type %EPHY_OVERVIEW_SNAPSHOT_TYPE
+ * @error: return location for a #GError
+ *
+ * Writes @snapshot into an anonymous file that can be passed to web
+ * processes. Where supported, the file is sealed so that its contents can
+ * be mapped by the receivers without copying and never change under them.
+ *
+ * Return value: a file descriptor owned by the caller, or -1 on error
+ **/
+int
+ephy_overview_snapshot_to_fd (GVariant  *snapshot,
+                              GError   **error)
+{
+  const guint8 *data;
+  gsize size;
+  int fd;
+
+  g_assert (g_variant_is_of_type (snapshot, EPHY_OVERVIEW_SNAPSHOT_TYPE));
+
+  fd = create_anonymous_file (error);
+  if (fd == -1)
+    return -1;
+
+  data = g_variant_get_data (snapshot);
+  size = g_variant_get_size (snapshot);
+  while (size > 0) {
+    ssize_t written = write (fd, data, size);
+
+    if (written == -1) {
+      int errsv = errno;
+
+      if (errsv == EINTR)
+        continue;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to write overview snapshot: %s", g_strerror (errsv));
+      close (fd);
+      return -1;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+#ifdef HAVE_MEMFD_CREATE
+  if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+    int errsv = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                 "Failed to seal overview snapshot: %s", g_strerror (errsv));
+    close (fd);
+    return -1;
+  }
+#endif
+
+  return fd;
+}
+
+/**
+ * ephy_overview_snapshot_from_fd:
+ * @fd: a file descriptor returned by ephy_overview_snapshot_to_fd()
+ * @error: return location for a #GError
+ *
+ * Maps the snapshot written to @fd. @fd can be closed afterwards.
+ *
+ * Return value: (transfer full): the snapshot, or %NULL on error
+ **/
+GVariant *
+ephy_overview_snapshot_from_fd (int      fd,
+                                GError **error)
+{
+  GMappedFile *mapped_file;
+  GVariant *snapshot;
+  GBytes *bytes;
+
+  mapped_file = g_mapped_file_new_from_fd (fd, FALSE, error);
+  if (!mapped_file)
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (mapped_file);
+  snapshot = g_variant_ref_sink (g_variant_new_from_bytes (EPHY_OVERVIEW_SNAPSHOT_TYPE, bytes, FALSE));
+
+  g_bytes_unref (bytes);
+  g_mapped_file_unref (mapped_file);
+
+  return snapshot;
+}
@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The overview snapshot the UI process shares with web processes: a version
+ * number and the (url, title, thumbnail path) of each overview item, in
+ * order. The thumbnail path is empty when there is none yet.
+ */
+#define EPHY_OVERVIEW_SNAPSHOT_TYPE G_VARIANT_TYPE ("(ta(sss))")
+
+int       ephy_overview_snapshot_to_fd   (GVariant  *snapshot,
+                                          GError   **error);
+GVariant *ephy_overview_snapshot_from_fd (int        fd,
+                                          GError   **error);
+
+G_END_DECLS
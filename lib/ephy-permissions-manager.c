@@ -25,8 +25,7 @@
 #include "ephy-file-helpers.h"
 #include "ephy-string.h"
 
-#define G_SETTINGS_ENABLE_BACKEND 1
-#include <gio/gsettingsbackend.h>
+#include <gio/gio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <webkit2/webkit2.h>
@@ -35,8 +34,24 @@ struct _EphyPermissionsManager
 {
   GObject parent_instance;
 
-  GHashTable *origins_mapping;
-  GHashTable *settings_mapping;
+  /* permissions.ini, in the format of the GSettings keyfile backend it used
+   * to be written with. It is kept in memory so that it can be written back
+   * with only our own changes.
+   */
+  char *filename;
+  GKeyFile *key_file;
+  GFileMonitor *monitor;
+  guint save_source_id;
+  /* Entity tag of the file as we last wrote it, to tell our own writes from
+   * those of other processes when it changes.
+   */
+  char *saved_etag;
+
+  /* Keyfile group of an origin to the decisions made for it, PERMISSION_BITS
+   * bits per permission type. Origins without any decision are not stored.
+   */
+  GHashTable *permissions;
+  GHashTable *origin_groups;
 
   GHashTable *permission_type_permitted_origins;
   GHashTable *permission_type_denied_origins;
@@ -45,12 +60,28 @@ struct _EphyPermissionsManager
 G_DEFINE_TYPE (EphyPermissionsManager, ephy_permissions_manager, G_TYPE_OBJECT)
 
 #define PERMISSIONS_FILENAME "permissions.ini"
+#define PERMISSIONS_GROUP_PREFIX "org/gnome/epiphany/permissions/"
+#define PERMISSION_BITS 2
+#define PERMISSION_MASK ((1 << PERMISSION_BITS) - 1)
+/* Origins are looked up for every page load, so their groups are cached, but
+ * not for every origin ever visited.
+ */
+#define MAX_CACHED_ORIGIN_GROUPS 1024
+
+static const EphyPermissionType permission_types[] = {
+  EPHY_PERMISSION_TYPE_SHOW_NOTIFICATIONS,
+  EPHY_PERMISSION_TYPE_SAVE_PASSWORD,
+  EPHY_PERMISSION_TYPE_ACCESS_LOCATION,
+  EPHY_PERMISSION_TYPE_ACCESS_MICROPHONE,
+  EPHY_PERMISSION_TYPE_ACCESS_WEBCAM,
+  EPHY_PERMISSION_TYPE_SHOW_ADS
+};
 
 static void
 ephy_permissions_manager_init (EphyPermissionsManager *manager)
 {
-  manager->origins_mapping = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
-  manager->settings_mapping = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  manager->permissions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  manager->origin_groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
   /* We cannot use a key_destroy_func here because we need to be able to update
    * the GList keys without destroying the contents of the lists. */
@@ -66,13 +97,65 @@ free_cached_origin_list (gpointer key,
   g_list_free_full ((GList *)value, (GDestroyNotify)webkit_security_origin_unref);
 }
 
+static void
+ephy_permissions_manager_clear_origin_caches (EphyPermissionsManager *manager)
+{
+  g_hash_table_foreach (manager->permission_type_permitted_origins, free_cached_origin_list, NULL);
+  g_hash_table_remove_all (manager->permission_type_permitted_origins);
+  g_hash_table_foreach (manager->permission_type_denied_origins, free_cached_origin_list, NULL);
+  g_hash_table_remove_all (manager->permission_type_denied_origins);
+}
+
+static char *
+get_file_etag (GFile *file)
+{
+  g_autoptr(GFileInfo) info = NULL;
+
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_ETAG_VALUE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (!info)
+    return NULL;
+
+  return g_strdup (g_file_info_get_etag (info));
+}
+
+static void
+ephy_permissions_manager_save (EphyPermissionsManager *manager)
+{
+  g_autoptr(GFile) file = NULL;
+  GError *error = NULL;
+
+  g_clear_pointer (&manager->saved_etag, g_free);
+
+  if (!g_key_file_save_to_file (manager->key_file, manager->filename, &error)) {
+    g_warning ("Failed to save %s: %s", manager->filename, error->message);
+    g_error_free (error);
+    return;
+  }
+
+  file = g_file_new_for_path (manager->filename);
+  manager->saved_etag = get_file_etag (file);
+}
+
 static void
 ephy_permissions_manager_dispose (GObject *object)
 {
   EphyPermissionsManager *manager = EPHY_PERMISSIONS_MANAGER (object);
 
-  g_clear_pointer (&manager->origins_mapping, g_hash_table_destroy);
-  g_clear_pointer (&manager->settings_mapping, g_hash_table_destroy);
+  /* Don't lose decisions that were not written yet. */
+  if (manager->save_source_id) {
+    g_clear_handle_id (&manager->save_source_id, g_source_remove);
+    ephy_permissions_manager_save (manager);
+  }
+
+  if (manager->monitor) {
+    g_file_monitor_cancel (manager->monitor);
+    g_clear_object (&manager->monitor);
+  }
+  g_clear_pointer (&manager->key_file, g_key_file_unref);
+  g_clear_pointer (&manager->filename, g_free);
+  g_clear_pointer (&manager->saved_etag, g_free);
+  g_clear_pointer (&manager->permissions, g_hash_table_destroy);
+  g_clear_pointer (&manager->origin_groups, g_hash_table_destroy);
 
   if (manager->permission_type_permitted_origins != NULL) {
     g_hash_table_foreach (manager->permission_type_permitted_origins, free_cached_origin_list, NULL);
@@ -97,53 +180,6 @@ ephy_permissions_manager_class_init (EphyPermissionsManagerClass *klass)
   object_class->dispose = ephy_permissions_manager_dispose;
 }
 
-static GSettings *
-ephy_permissions_manager_get_settings_for_origin (EphyPermissionsManager *manager,
-                                                  const char             *origin)
-{
-  char *origin_path;
-  char *trimmed_protocol;
-  char *filename;
-  GSettingsBackend* backend;
-  GSettings *settings;
-  WebKitSecurityOrigin *security_origin;
-  char *pos;
-
-  g_assert (origin != NULL);
-
-  settings = g_hash_table_lookup (manager->origins_mapping, origin);
-  if (settings)
-    return settings;
-
-  filename = g_build_filename (ephy_profile_dir (), PERMISSIONS_FILENAME, NULL);
-  backend = g_keyfile_settings_backend_new (filename, "/", NULL);
-  g_free (filename);
-
-  /* Cannot contain consecutive slashes in GSettings path... */
-  security_origin = webkit_security_origin_new_for_uri (origin);
-  trimmed_protocol = g_strdup (webkit_security_origin_get_protocol (security_origin));
-  pos = strchr (trimmed_protocol, '/');
-  if (pos != NULL)
-    *pos = '\0';
-
-  origin_path = g_strdup_printf ("/org/gnome/epiphany/permissions/%s/%s/%u/",
-                                 trimmed_protocol,
-                                 webkit_security_origin_get_host (security_origin),
-                                 webkit_security_origin_get_port (security_origin));
-
-  settings = g_settings_new_with_backend_and_path ("org.gnome.Epiphany.permissions", backend, origin_path);
-  g_free (trimmed_protocol);
-  g_free (origin_path);
-  g_object_unref (backend);
-  webkit_security_origin_unref (security_origin);
-
-  /* Note that settings is owned only by the first hash table! */
-  g_hash_table_insert (manager->origins_mapping, g_strdup (origin), settings);
-  g_hash_table_insert (manager->settings_mapping, settings, g_strdup (origin));
-
-  return settings;
-}
-
 EphyPermissionsManager *
 ephy_permissions_manager_new (void)
 {
@@ -171,13 +207,203 @@ permission_type_to_string (EphyPermissionType type)
   }
 }
 
+static EphyPermission
+permission_from_keyfile_value (const char *value)
+{
+  /* Values are GVariant text, as written by the keyfile settings backend. */
+  if (g_strcmp0 (value, "'allow'") == 0)
+    return EPHY_PERMISSION_PERMIT;
+  if (g_strcmp0 (value, "'deny'") == 0)
+    return EPHY_PERMISSION_DENY;
+  return EPHY_PERMISSION_UNDECIDED;
+}
+
+static EphyPermission
+permission_from_bitmap (guint              bitmap,
+                        EphyPermissionType type)
+{
+  return (EphyPermission)((bitmap >> (type * PERMISSION_BITS)) & PERMISSION_MASK) - 1;
+}
+
+static void
+ephy_permissions_manager_index_group (EphyPermissionsManager *manager,
+                                      const char             *group)
+{
+  guint bitmap = 0;
+
+  for (guint i = 0; i < G_N_ELEMENTS (permission_types); i++) {
+    EphyPermissionType type = permission_types[i];
+    g_autofree char *value = NULL;
+    EphyPermission permission;
+
+    value = g_key_file_get_value (manager->key_file, group, permission_type_to_string (type), NULL);
+    permission = permission_from_keyfile_value (value);
+    bitmap |= (guint)(permission + 1) << (type * PERMISSION_BITS);
+  }
+
+  if (bitmap)
+    g_hash_table_replace (manager->permissions, g_strdup (group), GUINT_TO_POINTER (bitmap));
+  else
+    g_hash_table_remove (manager->permissions, group);
+}
+
+static void
+ephy_permissions_manager_load (EphyPermissionsManager *manager)
+{
+  g_autoptr(GKeyFile) key_file = NULL;
+  g_auto(GStrv) groups = NULL;
+  GError *error = NULL;
+
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file, manager->filename, G_KEY_FILE_KEEP_COMMENTS, &error)) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Error processing %s: %s", manager->filename, error->message);
+    g_error_free (error);
+  }
+
+  g_clear_pointer (&manager->key_file, g_key_file_unref);
+  manager->key_file = g_steal_pointer (&key_file);
+
+  g_hash_table_remove_all (manager->permissions);
+  ephy_permissions_manager_clear_origin_caches (manager);
+
+  groups = g_key_file_get_groups (manager->key_file, NULL);
+  for (guint i = 0; groups[i]; i++) {
+    if (g_str_has_prefix (groups[i], PERMISSIONS_GROUP_PREFIX))
+      ephy_permissions_manager_index_group (manager, groups[i]);
+  }
+}
+
+static void
+permissions_file_changed_cb (GFileMonitor           *monitor,
+                             GFile                  *file,
+                             GFile                  *other_file,
+                             GFileMonitorEvent       event_type,
+                             EphyPermissionsManager *manager)
+{
+  if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+      event_type != G_FILE_MONITOR_EVENT_CREATED &&
+      event_type != G_FILE_MONITOR_EVENT_DELETED)
+    return;
+
+  /* Decisions made here and not written yet take precedence. Only the UI
+   * process writes the file, web processes follow its changes.
+   */
+  if (manager->save_source_id)
+    return;
+
+  /* Our own writes are already in memory. */
+  if (event_type != G_FILE_MONITOR_EVENT_DELETED && manager->saved_etag) {
+    g_autofree char *etag = get_file_etag (file);
+
+    if (g_strcmp0 (etag, manager->saved_etag) == 0)
+      return;
+  }
+
+  ephy_permissions_manager_load (manager);
+}
+
+static void
+ephy_permissions_manager_ensure_loaded (EphyPermissionsManager *manager)
+{
+  g_autoptr(GFile) file = NULL;
+  GError *error = NULL;
+
+  if (manager->key_file)
+    return;
+
+  manager->filename = g_build_filename (ephy_profile_dir (), PERMISSIONS_FILENAME, NULL);
+  ephy_permissions_manager_load (manager);
+
+  file = g_file_new_for_path (manager->filename);
+  manager->monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error);
+  if (manager->monitor) {
+    g_signal_connect (manager->monitor, "changed",
+                      G_CALLBACK (permissions_file_changed_cb), manager);
+  } else {
+    g_warning ("Failed to monitor %s: %s", manager->filename, error->message);
+    g_error_free (error);
+  }
+}
+
+static gboolean
+ephy_permissions_manager_save_cb (EphyPermissionsManager *manager)
+{
+  manager->save_source_id = 0;
+  ephy_permissions_manager_save (manager);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_permissions_manager_schedule_save (EphyPermissionsManager *manager)
+{
+  if (manager->save_source_id)
+    return;
+
+  /* Write once for all the decisions made in this main loop iteration. */
+  manager->save_source_id = g_idle_add ((GSourceFunc)ephy_permissions_manager_save_cb, manager);
+  g_source_set_name_by_id (manager->save_source_id, "[epiphany] permissions_manager_save_cb");
+}
+
+static const char *
+ephy_permissions_manager_get_group_for_origin (EphyPermissionsManager *manager,
+                                               const char             *origin)
+{
+  WebKitSecurityOrigin *security_origin;
+  char *trimmed_protocol;
+  char *group;
+  char *pos;
+
+  g_assert (origin != NULL);
+
+  group = g_hash_table_lookup (manager->origin_groups, origin);
+  if (group)
+    return group;
+
+  security_origin = webkit_security_origin_new_for_uri (origin);
+  if (!security_origin)
+    return NULL;
+
+  /* Cannot contain consecutive slashes in GSettings path... */
+  trimmed_protocol = g_strdup (webkit_security_origin_get_protocol (security_origin));
+  pos = strchr (trimmed_protocol, '/');
+  if (pos != NULL)
+    *pos = '\0';
+
+  group = g_strdup_printf (PERMISSIONS_GROUP_PREFIX "%s/%s/%u",
+                           trimmed_protocol,
+                           webkit_security_origin_get_host (security_origin),
+                           webkit_security_origin_get_port (security_origin));
+  g_free (trimmed_protocol);
+  webkit_security_origin_unref (security_origin);
+
+  if (g_hash_table_size (manager->origin_groups) >= MAX_CACHED_ORIGIN_GROUPS)
+    g_hash_table_remove_all (manager->origin_groups);
+  g_hash_table_insert (manager->origin_groups, g_strdup (origin), group);
+
+  return group;
+}
+
 EphyPermission
 ephy_permissions_manager_get_permission (EphyPermissionsManager *manager,
                                          EphyPermissionType      type,
                                          const char             *origin)
 {
-  GSettings *settings = ephy_permissions_manager_get_settings_for_origin (manager, origin);
-  return g_settings_get_enum (settings, permission_type_to_string (type));
+  const char *group;
+  guint bitmap;
+
+  ephy_permissions_manager_ensure_loaded (manager);
+
+  group = ephy_permissions_manager_get_group_for_origin (manager, origin);
+  if (!group)
+    return EPHY_PERMISSION_UNDECIDED;
+
+  bitmap = GPOINTER_TO_UINT (g_hash_table_lookup (manager->permissions, group));
+  if (!bitmap)
+    return EPHY_PERMISSION_UNDECIDED;
+
+  return permission_from_bitmap (bitmap, type);
 }
 
 static gint
@@ -242,14 +468,33 @@ ephy_permissions_manager_set_permission (EphyPermissionsManager *manager,
                                          EphyPermission          permission)
 {
   WebKitSecurityOrigin *webkit_origin;
-  GSettings *settings;
+  const char *group;
+  const char *key;
 
   webkit_origin = webkit_security_origin_new_for_uri (origin);
   if (webkit_origin == NULL)
     return;
 
-  settings = ephy_permissions_manager_get_settings_for_origin (manager, origin);
-  g_settings_set_enum (settings, permission_type_to_string (type), permission);
+  ephy_permissions_manager_ensure_loaded (manager);
+
+  group = ephy_permissions_manager_get_group_for_origin (manager, origin);
+  key = permission_type_to_string (type);
+
+  /* Undecided is the default, it does not need to be stored. */
+  if (permission == EPHY_PERMISSION_UNDECIDED) {
+    g_auto(GStrv) keys = NULL;
+
+    g_key_file_remove_key (manager->key_file, group, key, NULL);
+    keys = g_key_file_get_keys (manager->key_file, group, NULL, NULL);
+    if (keys && !keys[0])
+      g_key_file_remove_group (manager->key_file, group, NULL);
+  } else {
+    g_key_file_set_value (manager->key_file, group, key,
+                          permission == EPHY_PERMISSION_PERMIT ? "'allow'" : "'deny'");
+  }
+
+  ephy_permissions_manager_index_group (manager, group);
+  ephy_permissions_manager_schedule_save (manager);
 
   switch (permission) {
     case EPHY_PERMISSION_UNDECIDED:
@@ -287,79 +532,16 @@ group_name_to_security_origin (const char *group)
   return origin;
 }
 
-static WebKitSecurityOrigin *
-origin_for_keyfile_key (GKeyFile           *file,
-                        const char         *filename,
-                        const char         *group,
-                        const char         *key,
-                        EphyPermissionType  type,
-                        gboolean            permit)
-{
-  WebKitSecurityOrigin *origin = NULL;
-  char *value;
-  GError *error = NULL;
-
-  if (strcmp (permission_type_to_string (type), key) == 0) {
-    value = g_key_file_get_string (file, group, key, &error);
-    if (error != NULL) {
-      g_warning ("Error processing %s group %s key %s: %s",
-                 filename, group, key, error->message);
-      g_error_free (error);
-      return NULL;
-    }
-
-    if ((permit && strcmp (value, "'allow'") == 0) ||
-        (!permit && strcmp (value, "'deny'") == 0))
-      origin = group_name_to_security_origin (group);
-
-    g_free (value);
-  }
-
-  return origin;
-}
-
-static GList *
-origins_for_keyfile_group (GKeyFile           *file,
-                           const char         *filename,
-                           const char         *group,
-                           EphyPermissionType  type,
-                           gboolean            permit)
-{
-  char **keys;
-  gsize keys_length;
-  GList *origins = NULL;
-  WebKitSecurityOrigin *origin;
-  GError *error = NULL;
-
-  keys = g_key_file_get_keys (file, group, &keys_length, &error);
-  if (error != NULL) {
-    g_warning ("Error processing %s group %s: %s", filename, group, error->message);
-    g_error_free (error);
-    return NULL;
-  }
-
-  for (guint i = 0; i < keys_length; i++) {
-    origin = origin_for_keyfile_key (file, filename, group, keys[i], type, permit);
-    if (origin)
-      origins = g_list_prepend (origins, origin);
-  }
-
-  g_strfreev (keys);
-
-  return origins;
-}
-
 static GList *
 ephy_permissions_manager_get_matching_origins (EphyPermissionsManager *manager,
                                                EphyPermissionType      type,
                                                gboolean                permit)
 {
-  GKeyFile *file;
-  char *filename;
-  char **groups = NULL;
-  gsize groups_length;
+  GHashTableIter iter;
+  gpointer key, value;
   GList *origins = NULL;
-  GError *error = NULL;
+
+  ephy_permissions_manager_ensure_loaded (manager);
 
   /* Return results from cache, if they exist. */
   if (permit) {
@@ -372,23 +554,18 @@ ephy_permissions_manager_get_matching_origins (EphyPermissionsManager *manager,
       return origins;
   }
 
-  /* Not cached. Load results from GSettings keyfile. Do it manually because the
-   * GSettings API is not designed to be used for enumerating settings. */
-  file = g_key_file_new ();
-  filename = g_build_filename (ephy_profile_dir (), PERMISSIONS_FILENAME, NULL);
+  g_hash_table_iter_init (&iter, manager->permissions);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    EphyPermission permission = permission_from_bitmap (GPOINTER_TO_UINT (value), type);
+    WebKitSecurityOrigin *origin;
 
-  g_key_file_load_from_file (file, filename, G_KEY_FILE_NONE, &error);
-  if (error != NULL) {
-    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
-      g_warning ("Error processing %s: %s", filename, error->message);
-    g_error_free (error);
-    goto out;
-  }
+    if (permission != (permit ? EPHY_PERMISSION_PERMIT : EPHY_PERMISSION_DENY))
+      continue;
 
-  groups = g_key_file_get_groups (file, &groups_length);
-  for (guint i = 0; i < groups_length; i++)
-    origins = g_list_concat (origins,
-                             origins_for_keyfile_group (file, filename, groups[i], type, permit));
+    origin = group_name_to_security_origin (key);
+    if (origin)
+      origins = g_list_prepend (origins, origin);
+  }
 
   /* Cache the results. */
   if (origins != NULL) {
@@ -398,11 +575,6 @@ ephy_permissions_manager_get_matching_origins (EphyPermissionsManager *manager,
                          origins);
   }
 
-out:
-  g_key_file_unref (file);
-  g_strfreev (groups);
-  g_free (filename);
-
   return origins;
 }
 
@@ -167,6 +167,9 @@ static const char * const ephy_prefs_web_schema[] = {
 #define EPHY_PREFS_INTERNAL_VIEW_SOURCE               "internal-view-source"
 #define EPHY_PREFS_RESTORE_SESSION_POLICY             "restore-session-policy"
 #define EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS     "restore-session-delaying-loads"
+#define EPHY_PREFS_RESTORE_SESSION_BINARY_FORMAT      "restore-session-binary-format"
+#define EPHY_PREFS_RESTORE_SESSION_MAX_CONCURRENT_LOADS "restore-session-max-concurrent-loads"
+#define EPHY_PREFS_DISCARD_TABS_UNDER_MEMORY_PRESSURE "discard-tabs-under-memory-pressure"
 #define EPHY_PREFS_ADBLOCK_FILTERS                    "adblock-filters"
 #define EPHY_PREFS_SEARCH_ENGINES                     "search-engines"
 #define EPHY_PREFS_DEFAULT_SEARCH_ENGINE              "default-search-engine"
@@ -33,8 +33,12 @@ G_BEGIN_DECLS
 
 #define EPHY_BOOKMARKS_FILE     "bookmarks.gvdb"
 #define EPHY_HISTORY_FILE       "ephy-history.db"
+/* Bookmarks and most visited history, for the search provider. */
+#define EPHY_COMPLETION_INDEX_FILE "completion-index"
 /* Threat list database for Google Safe Browsing. */
 #define EPHY_GSB_FILE           "gsb-threats.db"
+/* Local changes waiting to be uploaded to Firefox Sync. */
+#define EPHY_SYNC_DIRTY_SET_FILE "sync-dirty-set"
 
 int ephy_profile_utils_get_migration_version (void);
 int ephy_profile_utils_get_migration_version_for_profile_dir (const char *profile_directory);
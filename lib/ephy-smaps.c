@@ -21,44 +21,32 @@
 #include "config.h"
 #include "ephy-smaps.h"
 
+#include "ephy-debug.h"
+#include "ephy-trace.h"
+
 #include <errno.h>
-#include <gio/gio.h>
-#include <stdio.h>
+#include <fcntl.h>
+#include <json-glib/json-glib.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/**
+ * SECTION:ephy-smaps
+ * @short_description: Memory usage of the browser processes
+ *
+ * Reads /proc/<pid>/smaps_rollup of the UI process and of its web and plugin
+ * processes, in parallel. The kernel already sums every mapping in that file,
+ * so reading it is much cheaper than reading smaps; smaps is only read, and
+ * summed the same way, on kernels older than 4.14 that lack smaps_rollup.
+ */
 
 struct _EphySMaps {
   GObject parent_instance;
-  GRegex *header;
-  GRegex *detail;
 };
 
 G_DEFINE_TYPE (EphySMaps, ephy_smaps, G_TYPE_OBJECT)
 
-typedef struct {
-  char *start;
-  char *end;
-  char *perms;
-  char *offset;
-  char *major;
-  char *minor;
-  char *inode;
-  char *filename;
-  char *size;
-  char *rss;
-  char *pss;
-  char *shared_clean;
-  char *shared_dirty;
-  char *private_clean;
-  char *private_dirty;
-} VMA_t;
-
-typedef struct {
-  guint shared_clean;
-  guint shared_dirty;
-  guint private_clean;
-  guint private_dirty;
-} PermEntry;
-
 typedef enum {
   EPHY_PROCESS_EPIPHANY,
   EPHY_PROCESS_WEB,
@@ -67,6 +55,38 @@ typedef enum {
   EPHY_PROCESS_OTHER
 } EphyProcess;
 
+typedef enum {
+  FIELD_RSS,
+  FIELD_PSS,
+  FIELD_SHARED_CLEAN,
+  FIELD_SHARED_DIRTY,
+  FIELD_PRIVATE_CLEAN,
+  FIELD_PRIVATE_DIRTY,
+  FIELD_ANONYMOUS,
+  FIELD_SWAP,
+
+  N_FIELDS
+} Field;
+
+/* The names of the fields in smaps, and their keys in the JSON output. */
+static const char * const field_names[N_FIELDS] = {
+  "Rss", "Pss", "Shared_Clean", "Shared_Dirty", "Private_Clean", "Private_Dirty", "Anonymous", "Swap"
+};
+
+static const char * const field_keys[N_FIELDS] = {
+  "rss", "pss", "shared_clean", "shared_dirty", "private_clean", "private_dirty", "anonymous", "swap"
+};
+
+typedef struct {
+  pid_t pid;
+  EphyProcess process;
+  gboolean valid;
+  guint64 kilobytes[N_FIELDS];
+} ProcessMemory;
+
+/* Long enough for any line but the header of a mapping with a long path. */
+#define READ_BUFFER_SIZE 4096
+
 static const char *get_ephy_process_name (EphyProcess process)
 {
   switch (process) {
@@ -84,237 +104,115 @@ static const char *get_ephy_process_name (EphyProcess process)
   return NULL;
 }
 
-static void vma_free (VMA_t *vma)
-{
-  g_free (vma->start);
-  g_free (vma->end);
-  g_free (vma->perms);
-  g_free (vma->offset);
-  g_free (vma->major);
-  g_free (vma->minor);
-  g_free (vma->inode);
-  g_free (vma->filename);
-  g_free (vma->size);
-  g_free (vma->rss);
-  g_free (vma->pss);
-  g_free (vma->shared_clean);
-  g_free (vma->shared_dirty);
-  g_free (vma->private_clean);
-  g_free (vma->private_dirty);
-
-  g_free (vma);
-}
-
-static void perm_entry_free (PermEntry *entry)
-{
-  g_free (entry);
-}
-
-static void add_to_perm_entry (GHashTable *hash, VMA_t *entry)
+static const char *
+get_ephy_process_key (EphyProcess process)
 {
-  const char *perms = entry->perms;
-  PermEntry *value;
-  guint number;
-  gboolean insert = FALSE;
-
-  value = g_hash_table_lookup (hash, perms);
-
-  if (!value) {
-    value = g_new0 (PermEntry, 1);
-    insert = TRUE;
+  switch (process) {
+    case EPHY_PROCESS_EPIPHANY:
+      return "browser";
+    case EPHY_PROCESS_WEB:
+      return "web";
+    case EPHY_PROCESS_PLUGIN:
+      return "plugin";
+    case EPHY_PROCESS_OTHER:
+    default:
+      g_assert_not_reached ();
   }
 
-  sscanf (entry->shared_clean, "%u", &number);
-  value->shared_clean += number;
-  sscanf (entry->shared_dirty, "%u", &number);
-  value->shared_dirty += number;
-  sscanf (entry->private_clean, "%u", &number);
-  value->private_clean += number;
-  sscanf (entry->private_dirty, "%u", &number);
-  value->private_dirty += number;
-
-  if (insert)
-    g_hash_table_insert (hash, g_strdup (perms), value);
+  return NULL;
 }
 
-static void add_to_totals (PermEntry *entry, PermEntry *totals)
+static void
+parse_line (char          *line,
+            ProcessMemory *memory)
 {
-  totals->shared_clean += entry->shared_clean;
-  totals->shared_dirty += entry->shared_dirty;
-  totals->private_dirty += entry->private_dirty;
-  totals->private_dirty += entry->private_dirty;
-}
+  char *colon;
+  guint i;
 
-static void print_vma_table (GString *str, GHashTable *hash, const char *caption)
-{
-  PermEntry *pentry, totals;
+  colon = strchr (line, ':');
+  if (!colon)
+    return;
 
-  memset (&totals, 0, sizeof (PermEntry));
+  /* Mapping headers have a colon in the device number, but field names never
+   * contain spaces.
+   */
+  *colon = '\0';
+  if (strchr (line, ' '))
+    return;
 
-  g_string_append_printf (str, "<table class=\"memory-table\"><caption>%s</caption><colgroup><colgroup span=\"2\" align=\"center\"><colgroup span=\"2\" align=\"center\"><colgroup><thead><tr><th><th colspan=\"2\">Shared</th><th colspan=\"2\">Private</th><th></tr></thead>", caption);
-  g_string_append (str, "<tbody><tr><td></td><td>Clean</td><td>Dirty</td><td>Clean</td><td>Dirty</td><td></td></tr>");
-  pentry = g_hash_table_lookup (hash, "r-xp");
-  if (pentry) {
-    g_string_append_printf (str, "<tbody><tr><td>r-xp</td><td>%d</td><td>%d</td><td>%d</td><td>%d</td><td>Code</td></tr>",
-                            pentry->shared_clean, pentry->shared_dirty, pentry->private_clean, pentry->private_dirty);
-    add_to_totals (pentry, &totals);
-  }
-  pentry = g_hash_table_lookup (hash, "rw-p");
-  if (pentry) {
-    g_string_append_printf (str, "<tbody><tr><td>rw-p</td><td>%d</td><td>%d</td><td>%d</td><td>%d</td><td>Data</td></tr>",
-                            pentry->shared_clean, pentry->shared_dirty, pentry->private_clean, pentry->private_dirty);
-    add_to_totals (pentry, &totals);
-  }
-  pentry = g_hash_table_lookup (hash, "r--p");
-  if (pentry) {
-    g_string_append_printf (str, "<tbody><tr><td>r--p</td><td>%d</td><td>%d</td><td>%d</td><td>%d</td><td>Read-only Data</td></tr>",
-                            pentry->shared_clean, pentry->shared_dirty, pentry->private_clean, pentry->private_dirty);
-    add_to_totals (pentry, &totals);
-  }
-  pentry = g_hash_table_lookup (hash, "---p");
-  if (pentry) {
-    g_string_append_printf (str, "<tbody><tr><td>---p</td><td>%d</td><td>%d</td><td>%d</td><td>%d</td><td></td></tr>",
-                            pentry->shared_clean, pentry->shared_dirty, pentry->private_clean, pentry->private_dirty);
-    add_to_totals (pentry, &totals);
-  }
-  pentry = g_hash_table_lookup (hash, "r--s");
-  if (pentry) {
-    g_string_append_printf (str, "<tbody><tr><td>r--s</td><td>%d</td><td>%d</td><td>%d</td><td>%d</td><td></td></tr>",
-                            pentry->shared_clean, pentry->shared_dirty, pentry->private_clean, pentry->private_dirty);
-    add_to_totals (pentry, &totals);
+  for (i = 0; i < N_FIELDS; i++) {
+    if (strcmp (line, field_names[i]) == 0) {
+      memory->kilobytes[i] += g_ascii_strtoull (colon + 1, NULL, 10);
+      return;
+    }
   }
-  g_string_append_printf (str, "<tbody><tr><td>Total:</td><td>%d kB</td><td>%d kB</td><td>%d kB</td><td>%d kB</td><td></td></tr>",
-                          totals.shared_clean, totals.shared_dirty, totals.private_clean, totals.private_dirty);
-  g_string_append (str, "</table>");
 }
 
-static void ephy_smaps_pid_to_html (EphySMaps *smaps, GString *str, pid_t pid, EphyProcess process)
+/* Adds up the fields of every line of @path in a single pass, without
+ * allocating. Returns %FALSE if @path cannot be opened.
+ */
+static gboolean
+read_smaps_file (const char    *path,
+                 ProcessMemory *memory)
 {
-  GFileInputStream *stream;
-  GDataInputStream *data_stream;
-  char *path;
-  GFile *file;
-  char *line;
-  GError *error = NULL;
-  VMA_t *vma = NULL;
-  GHashTable *anon_hash, *mapped_hash;
-  GSList *vma_entries = NULL, *p;
-
-  path = g_strdup_printf ("/proc/%u/smaps", pid);
-  file = g_file_new_for_path (path);
-  g_free (path);
-
-  stream = g_file_read (file, NULL, &error);
-  g_object_unref (file);
-
-  if (error && error->code == G_IO_ERROR_NOT_FOUND) {
-    /* This is not GNU/Linux, do nothing. */
-    g_error_free (error);
-    return;
-  }
-
-  data_stream = g_data_input_stream_new (G_INPUT_STREAM (stream));
-  g_object_unref (stream);
-
-  while ((line = g_data_input_stream_read_line (data_stream, NULL, NULL, NULL))) {
-    GMatchInfo *match_info = NULL;
-    gboolean matched = FALSE;
-
-    g_regex_match (smaps->header, line, 0, &match_info);
-    if (g_match_info_matches (match_info)) {
-      matched = TRUE;
-
-      if (vma)
-        vma_entries = g_slist_append (vma_entries, vma);
-
-      vma = g_new0 (VMA_t, 1);
-
-      vma->start = g_match_info_fetch (match_info, 1);
-      vma->end = g_match_info_fetch (match_info, 2);
-      vma->perms = g_match_info_fetch (match_info, 3);
-      vma->offset = g_match_info_fetch (match_info, 4);
-      vma->major = g_match_info_fetch (match_info, 5);
-      vma->minor = g_match_info_fetch (match_info, 6);
-      vma->inode = g_match_info_fetch (match_info, 7);
-      vma->filename = g_match_info_fetch (match_info, 8);
+  char buffer[READ_BUFFER_SIZE];
+  gsize length = 0;
+  gboolean truncated = FALSE;
+  int fd;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return FALSE;
+
+  for (;;) {
+    gssize bytes_read;
+    char *line;
+    char *newline;
+
+    bytes_read = read (fd, buffer + length, sizeof (buffer) - length);
+    if (bytes_read < 0 && errno == EINTR)
+      continue;
+    if (bytes_read <= 0)
+      break;
+    length += bytes_read;
+
+    line = buffer;
+    while ((newline = memchr (line, '\n', buffer + length - line))) {
+      *newline = '\0';
+      if (!truncated)
+        parse_line (line, memory);
+      truncated = FALSE;
+      line = newline + 1;
     }
 
-    g_match_info_free (match_info);
-
-    if (matched)
-      goto out;
-
-    g_regex_match (smaps->detail, line, 0, &match_info);
-    if (g_match_info_matches (match_info)) {
-      char *name = g_match_info_fetch (match_info, 1);
-      char **size = NULL;
-
-      if (!strcmp (name, "Size"))
-        size = &vma->size;
-      else if (!strcmp (name, "Rss"))
-        size = &vma->rss;
-      else if (!strcmp (name, "Pss"))
-        size = &vma->pss;
-      else if (!strcmp (name, "Shared_Clean"))
-        size = &vma->shared_clean;
-      else if (!strcmp (name, "Shared_Dirty"))
-        size = &vma->shared_dirty;
-      else if (!strcmp (name, "Private_Clean"))
-        size = &vma->private_clean;
-      else if (!strcmp (name, "Private_Dirty"))
-        size = &vma->private_dirty;
-
-      if (size)
-        *size = g_match_info_fetch (match_info, 2);
-
-      g_free (name);
+    length -= line - buffer;
+    if (length == sizeof (buffer)) {
+      /* Only mapping headers can be this long, and they are skipped anyway. */
+      truncated = TRUE;
+      length = 0;
+    } else {
+      memmove (buffer, line, length);
     }
-
-    g_match_info_free (match_info);
- out:
-    g_free (line);
-  }
-
-  if (vma)
-    vma_entries = g_slist_append (vma_entries, vma);
-
-  g_object_unref (data_stream);
-
-  /* All the file is parsed now. We have parsed more stuff than what
-   * we are going to use, but it might be useful in the future. */
-  anon_hash = g_hash_table_new_full (g_str_hash,
-                                     g_str_equal,
-                                     (GDestroyNotify)g_free,
-                                     (GDestroyNotify)perm_entry_free);
-  mapped_hash = g_hash_table_new_full (g_str_hash,
-                                       g_str_equal,
-                                       (GDestroyNotify)g_free,
-                                       (GDestroyNotify)perm_entry_free);
-
-  for (p = vma_entries; p; p = p->next) {
-    VMA_t *entry = (VMA_t *)p->data;
-
-    if (g_strcmp0 (entry->major, "00") && g_strcmp0 (entry->minor, "00"))
-      add_to_perm_entry (anon_hash, entry);
-    else
-      add_to_perm_entry (mapped_hash, entry);
-
-    vma_free (entry);
   }
 
-  g_slist_free (vma_entries);
+  close (fd);
 
-  g_string_append_printf (str, "<h2>%s</h2>", get_ephy_process_name (process));
+  return TRUE;
+}
 
-  /* Anon table. */
-  print_vma_table (str, anon_hash, "Anonymous memory");
+static void
+collect_process_memory (ProcessMemory *memory,
+                        gpointer       user_data)
+{
+  char path[64];
 
-  /* Mapped table. */
-  print_vma_table (str, mapped_hash, "Mapped memory");
+  g_snprintf (path, sizeof (path), "/proc/%d/smaps_rollup", memory->pid);
+  memory->valid = read_smaps_file (path, memory);
+  if (memory->valid)
+    return;
 
-  /* Done. */
-  g_hash_table_unref (anon_hash);
-  g_hash_table_unref (mapped_hash);
+  g_snprintf (path, sizeof (path), "/proc/%d/smaps", memory->pid);
+  memory->valid = read_smaps_file (path, memory);
 }
 
 static pid_t get_pid_from_proc_name (const char *name)
@@ -335,7 +233,6 @@ static pid_t get_pid_from_proc_name (const char *name)
 
   return pid;
 }
-
 static pid_t get_parent_pid (pid_t pid)
 {
   char *path;
@@ -407,7 +304,53 @@ static EphyProcess get_ephy_process (pid_t pid)
   return process;
 }
 
-static void ephy_smaps_pid_children_to_html (EphySMaps *smaps, GString *str, pid_t parent_pid)
+/* Reads the children of every thread of @parent_pid from
+ * /proc/<pid>/task/<tid>/children. Returns %FALSE if the kernel does not
+ * provide those files.
+ */
+static gboolean
+get_children_from_tasks (pid_t   parent_pid,
+                         GArray *children)
+{
+  g_autofree char *task_path = NULL;
+  GDir *tasks;
+  const char *name;
+  gboolean found = FALSE;
+
+  task_path = g_strdup_printf ("/proc/%u/task", parent_pid);
+  tasks = g_dir_open (task_path, 0, NULL);
+  if (!tasks)
+    return FALSE;
+
+  while ((name = g_dir_read_name (tasks))) {
+    g_autofree char *path = NULL;
+    g_autofree char *data = NULL;
+    char *p;
+    char *end_ptr;
+
+    path = g_build_filename (task_path, name, "children", NULL);
+    if (!g_file_get_contents (path, &data, NULL, NULL))
+      continue;
+    found = TRUE;
+
+    for (p = data; *p; p = end_ptr) {
+      pid_t pid = g_ascii_strtoll (p, &end_ptr, 10);
+
+      if (end_ptr == p)
+        break;
+      if (pid > 0)
+        g_array_append_val (children, pid);
+    }
+  }
+  g_dir_close (tasks);
+
+  return found;
+}
+
+/* Scans every process for the ones whose parent is @parent_pid. */
+static void
+get_children_from_proc (pid_t   parent_pid,
+                        GArray *children)
 {
   GDir *proc;
   const char *name;
@@ -417,70 +360,382 @@ static void ephy_smaps_pid_children_to_html (EphySMaps *smaps, GString *str, pid
     return;
 
   while ((name = g_dir_read_name (proc))) {
-    pid_t pid, ppid;
-    EphyProcess process;
-
-    if (!strcmp (name, "self"))
-      continue;
+    pid_t pid;
 
     pid = get_pid_from_proc_name (name);
     if (pid == 0 || pid == parent_pid)
       continue;
 
-    ppid = get_parent_pid (pid);
-    if (ppid != parent_pid)
-      continue;
-
-    process = get_ephy_process (pid);
-    if (process != EPHY_PROCESS_OTHER)
-      ephy_smaps_pid_to_html (smaps, str, pid, process);
+    if (get_parent_pid (pid) == parent_pid)
+      g_array_append_val (children, pid);
   }
   g_dir_close (proc);
 }
 
-char *ephy_smaps_to_html (EphySMaps *smaps)
+static int
+compare_pids (const pid_t *a,
+              const pid_t *b)
 {
-  GString *str = g_string_new ("");
+  return *a - *b;
+}
+
+/* Returns the memory usage of the UI process followed by that of its web and
+ * plugin processes, sorted by pid. Each process is read by a different thread
+ * of a pool, into its own element of the array.
+ */
+static GArray *
+collect_memory (void)
+{
+  EPHY_TRACE_SPAN ("memory", "collect");
+  g_autoptr(GArray) children = g_array_new (FALSE, FALSE, sizeof (pid_t));
+  GArray *processes = g_array_new (FALSE, TRUE, sizeof (ProcessMemory));
+  ProcessMemory memory = { 0, };
+  GThreadPool *pool;
   pid_t pid = getpid ();
+  gint64 start_time = g_get_monotonic_time ();
+  guint i;
 
-  g_string_append (str, "<body>");
+  memory.pid = pid;
+  memory.process = EPHY_PROCESS_EPIPHANY;
+  g_array_append_val (processes, memory);
 
-  ephy_smaps_pid_to_html (smaps, str, pid, EPHY_PROCESS_EPIPHANY);
-  ephy_smaps_pid_children_to_html (smaps, str, pid);
+  if (!get_children_from_tasks (pid, children))
+    get_children_from_proc (pid, children);
+  g_array_sort (children, (GCompareFunc)compare_pids);
 
-  g_string_append (str, "</body>");
+  for (i = 0; i < children->len; i++) {
+    memory.pid = g_array_index (children, pid_t, i);
+    memory.process = get_ephy_process (memory.pid);
+    if (memory.process != EPHY_PROCESS_OTHER)
+      g_array_append_val (processes, memory);
+  }
 
-  return g_string_free (str, FALSE);
+  /* The array must not grow anymore, the workers write into it. */
+  pool = g_thread_pool_new ((GFunc)collect_process_memory, NULL,
+                            MIN (processes->len, g_get_num_processors ()),
+                            FALSE, NULL);
+  for (i = 0; i < processes->len; i++)
+    g_thread_pool_push (pool, &g_array_index (processes, ProcessMemory, i), NULL);
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  LOG ("Collected memory usage of %u processes in %" G_GINT64_FORMAT " µs",
+       processes->len, g_get_monotonic_time () - start_time);
+
+  return processes;
+}
+
+typedef struct {
+  EphySMapsTab *tab;
+  gboolean known;
+  guint64 pss;
+  guint64 uss;
+  guint n_sharing;
+} TabMemory;
+
+static ProcessMemory *
+find_process (GArray *processes,
+              guint   pid)
+{
+  guint i;
+
+  for (i = 0; i < processes->len; i++) {
+    ProcessMemory *memory = &g_array_index (processes, ProcessMemory, i);
+
+    if (memory->valid && memory->pid == (pid_t)pid)
+      return memory;
+  }
+
+  return NULL;
+}
+
+static int
+compare_tabs_by_title (const TabMemory *a,
+                       const TabMemory *b)
+{
+  return g_utf8_collate (a->tab->title ? a->tab->title : "", b->tab->title ? b->tab->title : "");
+}
+
+static int
+compare_tabs (const TabMemory    *a,
+              const TabMemory    *b,
+              EphySMapsSortOrder *sort_order)
+{
+  guint64 value_a, value_b;
+
+  if (*sort_order == EPHY_SMAPS_SORT_TITLE)
+    return compare_tabs_by_title (a, b);
+
+  /* Tabs whose web process is not known yet go last. */
+  if (a->known != b->known)
+    return a->known ? -1 : 1;
+
+  value_a = *sort_order == EPHY_SMAPS_SORT_USS ? a->uss : a->pss;
+  value_b = *sort_order == EPHY_SMAPS_SORT_USS ? b->uss : b->pss;
+  if (value_a != value_b)
+    return value_a > value_b ? -1 : 1;
+
+  return compare_tabs_by_title (a, b);
+}
+
+/* Splits the memory of each web process evenly between the tabs it hosts,
+ * since there is no way to tell which page uses which memory.
+ */
+static GArray *
+attribute_memory_to_tabs (GArray             *processes,
+                          GPtrArray          *tabs,
+                          EphySMapsSortOrder  sort_order)
+{
+  GArray *tab_memory = g_array_sized_new (FALSE, TRUE, sizeof (TabMemory), tabs->len);
+  guint i, j;
+
+  for (i = 0; i < tabs->len; i++) {
+    EphySMapsTab *tab = g_ptr_array_index (tabs, i);
+    ProcessMemory *memory = tab->pid ? find_process (processes, tab->pid) : NULL;
+    TabMemory entry = { tab, FALSE, 0, 0, 0 };
+
+    if (memory) {
+      for (j = 0; j < tabs->len; j++) {
+        if (((EphySMapsTab *)g_ptr_array_index (tabs, j))->pid == tab->pid)
+          entry.n_sharing++;
+      }
+
+      entry.known = TRUE;
+      entry.pss = memory->kilobytes[FIELD_PSS] / entry.n_sharing;
+      entry.uss = (memory->kilobytes[FIELD_PRIVATE_CLEAN] + memory->kilobytes[FIELD_PRIVATE_DIRTY]) / entry.n_sharing;
+    }
+
+    g_array_append_val (tab_memory, entry);
+  }
+
+  g_array_sort_with_data (tab_memory, (GCompareDataFunc)compare_tabs, &sort_order);
+
+  return tab_memory;
 }
 
 static void
-ephy_smaps_init (EphySMaps *smaps)
+append_sort_header (GString            *str,
+                    const char         *label,
+                    EphySMapsSortOrder  column,
+                    EphySMapsSortOrder  sort_order)
 {
-  /* Prepare the regexps for the smaps file. */
-  smaps->header = g_regex_new ("^([0-9a-f]+)-([0-9a-f]+) (....) ([0-9a-f]+) (..):(..) (\\d+) *(.*)$",
-                               G_REGEX_OPTIMIZE,
-                               0,
-                               NULL);
-  smaps->detail = g_regex_new ("^(.*): +(\\d+) kB", G_REGEX_OPTIMIZE, 0, NULL);
+  static const char * const sort_keys[] = { "pss", "uss", "title" };
+
+  if (column == sort_order)
+    g_string_append_printf (str, "<th>%s ▾</th>", label);
+  else
+    g_string_append_printf (str, "<th><a href=\"ephy-about:memory?sort=%s\">%s</a></th>", sort_keys[column], label);
 }
 
 static void
-ephy_smaps_finalize (GObject *obj)
+append_tabs_html (GString            *str,
+                  GArray             *processes,
+                  GPtrArray          *tabs,
+                  EphySMapsSortOrder  sort_order)
 {
-  EphySMaps *smaps = EPHY_SMAPS (obj);
+  g_autoptr(GArray) tab_memory = NULL;
+  guint i;
+
+  if (!tabs || tabs->len == 0)
+    return;
 
-  g_regex_unref (smaps->header);
-  g_regex_unref (smaps->detail);
+  tab_memory = attribute_memory_to_tabs (processes, tabs, sort_order);
 
-  G_OBJECT_CLASS (ephy_smaps_parent_class)->finalize (obj);
+  g_string_append (str, "<table class=\"memory-table\"><caption>Tabs</caption><thead><tr>");
+  append_sort_header (str, "Title", EPHY_SMAPS_SORT_TITLE, sort_order);
+  g_string_append (str, "<th>PID</th>");
+  append_sort_header (str, "PSS", EPHY_SMAPS_SORT_PSS, sort_order);
+  append_sort_header (str, "USS", EPHY_SMAPS_SORT_USS, sort_order);
+  g_string_append (str, "<th>Tabs in process</th></tr></thead><tbody>");
+
+  for (i = 0; i < tab_memory->len; i++) {
+    TabMemory *entry = &g_array_index (tab_memory, TabMemory, i);
+    g_autofree char *title = g_markup_escape_text (entry->tab->title ? entry->tab->title : "", -1);
+    g_autofree char *address = g_markup_escape_text (entry->tab->address ? entry->tab->address : "", -1);
+
+    g_string_append_printf (str, "<tr><td title=\"%s\">%s</td>", address, title);
+    if (entry->known)
+      g_string_append_printf (str, "<td>%u</td><td>%" G_GUINT64_FORMAT " kB</td><td>%" G_GUINT64_FORMAT " kB</td><td>%u</td></tr>",
+                              entry->tab->pid, entry->pss, entry->uss, entry->n_sharing);
+    else
+      g_string_append (str, "<td></td><td></td><td></td><td></td></tr>");
+  }
+
+  g_string_append (str, "</tbody></table>");
 }
 
 static void
-ephy_smaps_class_init (EphySMapsClass *smaps_class)
+append_processes_html (GString *str,
+                       GArray  *processes)
+{
+  guint64 totals[N_FIELDS] = { 0, };
+  guint i, j;
+
+  g_string_append (str, "<table class=\"memory-table\"><caption>Processes</caption><colgroup><colgroup span=\"4\" align=\"center\"><colgroup span=\"2\" align=\"center\"><colgroup span=\"2\" align=\"center\"><colgroup span=\"2\" align=\"center\">"
+                   "<thead><tr><th></th><th></th><th>RSS</th><th>PSS</th><th colspan=\"2\">Shared</th><th colspan=\"2\">Private</th><th>Anonymous</th><th>Swap</th></tr></thead>");
+  g_string_append (str, "<tbody><tr><td>Process</td><td>PID</td><td></td><td></td><td>Clean</td><td>Dirty</td><td>Clean</td><td>Dirty</td><td></td><td></td></tr>");
+
+  for (i = 0; i < processes->len; i++) {
+    ProcessMemory *memory = &g_array_index (processes, ProcessMemory, i);
+
+    if (!memory->valid)
+      continue;
+
+    g_string_append_printf (str, "<tr><td>%s</td><td>%d</td>",
+                            get_ephy_process_name (memory->process), memory->pid);
+    for (j = 0; j < N_FIELDS; j++) {
+      g_string_append_printf (str, "<td>%" G_GUINT64_FORMAT "</td>", memory->kilobytes[j]);
+      totals[j] += memory->kilobytes[j];
+    }
+    g_string_append (str, "</tr>");
+  }
+
+  /* RSS and shared memory would be counted once per process sharing it, so
+   * only proportional and private memory add up.
+   */
+  g_string_append_printf (str, "<tr><td>Total:</td><td></td><td></td><td>%" G_GUINT64_FORMAT " kB</td><td></td><td></td>"
+                          "<td>%" G_GUINT64_FORMAT " kB</td><td>%" G_GUINT64_FORMAT " kB</td><td></td><td>%" G_GUINT64_FORMAT " kB</td></tr>",
+                          totals[FIELD_PSS], totals[FIELD_PRIVATE_CLEAN], totals[FIELD_PRIVATE_DIRTY], totals[FIELD_SWAP]);
+  g_string_append (str, "</tbody></table>");
+}
+
+/**
+ * ephy_smaps_to_html:
+ * @smaps: an #EphySMaps
+ * @tabs: (element-type EphySMapsTab) (nullable): the open tabs
+ * @sort_order: how to sort @tabs
+ *
+ * Returns tables with the memory usage of @tabs and of the browser
+ * processes, in kB.
+ *
+ * Returns: (transfer full): an HTML fragment
+ **/
+char *
+ephy_smaps_to_html (EphySMaps          *smaps,
+                    GPtrArray          *tabs,
+                    EphySMapsSortOrder  sort_order)
+{
+  g_autoptr(GArray) processes = collect_memory ();
+  GString *str = g_string_new ("");
+
+  append_tabs_html (str, processes, tabs, sort_order);
+  append_processes_html (str, processes);
+
+  return g_string_free (str, FALSE);
+}
+
+/**
+ * ephy_smaps_to_json:
+ * @smaps: an #EphySMaps
+ * @tabs: (element-type EphySMapsTab) (nullable): the open tabs
+ * @sort_order: how to sort @tabs
+ *
+ * Returns the memory usage of @tabs and of the browser processes for
+ * monitoring scripts, as
+ * {"tabs": [{"title": "…", "address": "…", "pid": 1234, "pss": 100,
+ * "uss": 80, "tabs_in_process": 1}, ...],
+ * "processes": [{"pid": 1234, "type": "web", "rss": 100, ...}, ...]}.
+ * The type is "browser", "web" or "plugin", and sizes are in kB. The pid and
+ * sizes of a tab are missing if its web process is not known yet.
+ *
+ * Returns: (transfer full): a JSON document
+ **/
+char *
+ephy_smaps_to_json (EphySMaps          *smaps,
+                    GPtrArray          *tabs,
+                    EphySMapsSortOrder  sort_order)
 {
-  GObjectClass *gobject_class = G_OBJECT_CLASS (smaps_class);
+  g_autoptr(GArray) processes = collect_memory ();
+  g_autoptr(JsonNode) node = NULL;
+  JsonObject *object;
+  JsonArray *array;
+  char *retval;
+  guint i, j;
+
+  object = json_object_new ();
+
+  array = json_array_new ();
+  if (tabs) {
+    g_autoptr(GArray) tab_memory = attribute_memory_to_tabs (processes, tabs, sort_order);
+
+    for (i = 0; i < tab_memory->len; i++) {
+      TabMemory *entry = &g_array_index (tab_memory, TabMemory, i);
+      JsonObject *tab_object = json_object_new ();
+
+      json_object_set_string_member (tab_object, "title", entry->tab->title);
+      json_object_set_string_member (tab_object, "address", entry->tab->address);
+      if (entry->known) {
+        json_object_set_int_member (tab_object, "pid", entry->tab->pid);
+        json_object_set_int_member (tab_object, "pss", entry->pss);
+        json_object_set_int_member (tab_object, "uss", entry->uss);
+        json_object_set_int_member (tab_object, "tabs_in_process", entry->n_sharing);
+      }
+      json_array_add_object_element (array, tab_object);
+    }
+  }
+  json_object_set_array_member (object, "tabs", array);
+
+  array = json_array_new ();
+  for (i = 0; i < processes->len; i++) {
+    ProcessMemory *memory = &g_array_index (processes, ProcessMemory, i);
+    JsonObject *process_object;
 
-  gobject_class->finalize = ephy_smaps_finalize;
+    if (!memory->valid)
+      continue;
+
+    process_object = json_object_new ();
+    json_object_set_int_member (process_object, "pid", memory->pid);
+    json_object_set_string_member (process_object, "type", get_ephy_process_key (memory->process));
+    for (j = 0; j < N_FIELDS; j++)
+      json_object_set_int_member (process_object, field_keys[j], memory->kilobytes[j]);
+    json_array_add_object_element (array, process_object);
+  }
+  json_object_set_array_member (object, "processes", array);
+
+  node = json_node_new (JSON_NODE_OBJECT);
+  json_node_take_object (node, object);
+  retval = json_to_string (node, FALSE);
+
+  return retval;
+}
+
+/**
+ * ephy_smaps_tab_new:
+ * @title: (nullable): the title of the tab
+ * @address: (nullable): the address loaded in the tab
+ * @pid: the pid of the web process of the tab, or 0 if unknown
+ *
+ * Returns: (transfer full): a new #EphySMapsTab
+ **/
+EphySMapsTab *
+ephy_smaps_tab_new (const char *title,
+                    const char *address,
+                    guint       pid)
+{
+  EphySMapsTab *tab = g_new (EphySMapsTab, 1);
+
+  tab->title = g_strdup (title);
+  tab->address = g_strdup (address);
+  tab->pid = pid;
+
+  return tab;
+}
+
+void
+ephy_smaps_tab_free (EphySMapsTab *tab)
+{
+  g_free (tab->title);
+  g_free (tab->address);
+  g_free (tab);
+}
+
+static void
+ephy_smaps_init (EphySMaps *smaps)
+{
+}
+
+static void
+ephy_smaps_class_init (EphySMapsClass *smaps_class)
+{
 }
 
 EphySMaps *ephy_smaps_new (void)
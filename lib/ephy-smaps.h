@@ -28,7 +28,30 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (EphySMaps, ephy_smaps, EPHY, SMAPS, GObject)
 
-EphySMaps * ephy_smaps_new      (void);
-char      * ephy_smaps_to_html  (EphySMaps *smaps);
+/* An open tab, to attribute the memory of its web process to it. */
+typedef struct {
+  char *title;
+  char *address;
+  guint pid;
+} EphySMapsTab;
+
+typedef enum {
+  EPHY_SMAPS_SORT_PSS,
+  EPHY_SMAPS_SORT_USS,
+  EPHY_SMAPS_SORT_TITLE
+} EphySMapsSortOrder;
+
+EphySMaps    *ephy_smaps_new      (void);
+char         *ephy_smaps_to_html  (EphySMaps          *smaps,
+                                   GPtrArray          *tabs,
+                                   EphySMapsSortOrder  sort_order);
+char         *ephy_smaps_to_json  (EphySMaps          *smaps,
+                                   GPtrArray          *tabs,
+                                   EphySMapsSortOrder  sort_order);
+
+EphySMapsTab *ephy_smaps_tab_new  (const char         *title,
+                                   const char         *address,
+                                   guint               pid);
+void          ephy_smaps_tab_free (EphySMapsTab       *tab);
 
 G_END_DECLS
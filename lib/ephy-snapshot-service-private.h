@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-snapshot-service.h"
+
+G_BEGIN_DECLS
+
+/* These give tests access to the thumbnail index without taking snapshots
+ * of web views. Only meant for tests.
+ */
+char     *ephy_snapshot_service_get_thumbnail_path_for_testing   (const char          *url);
+void      ephy_snapshot_service_index_thumbnail_for_testing      (EphySnapshotService *service,
+                                                                  const char          *url,
+                                                                  guint                width,
+                                                                  guint                height);
+gboolean  ephy_snapshot_service_thumbnail_is_indexed_for_testing (EphySnapshotService *service,
+                                                                  const char          *url);
+void      ephy_snapshot_service_set_max_size_for_testing         (EphySnapshotService *service,
+                                                                  guint64              max_size);
+
+G_END_DECLS
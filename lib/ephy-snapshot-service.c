@@ -19,12 +19,16 @@
  */
 
 #include "config.h"
-#include "ephy-snapshot-service.h"
+#include "ephy-snapshot-service-private.h"
 
 #include "ephy-favicon-helpers.h"
 #include "ephy-file-helpers.h"
+#include "ephy-metrics.h"
+#include "ephy-trace.h"
 
+#include <errno.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,10 +40,54 @@ struct _EphySnapshotService {
   GObject parent_instance;
 
   GHashTable *cache;
+
+  /* Metadata of the thumbnails on disk, keyed by file name, and persisted
+   * in the thumbnails directory so that thumbnails do not need to be decoded
+   * to be validated. It is used from the worker threads, so all accesses
+   * must hold index_mutex.
+   */
+  GMutex index_mutex;
+  GHashTable *index;
+  gboolean index_loaded;
+  guint index_save_source_id;
+  guint64 max_size;
 };
 
 G_DEFINE_TYPE (EphySnapshotService, ephy_snapshot_service, G_TYPE_OBJECT)
 
+#define THUMBNAIL_INDEX_FILENAME "index"
+#define THUMBNAIL_INDEX_VERSION 1
+/* Version, then file name -> (url, mtime, size, width, height, last used). */
+#define THUMBNAIL_INDEX_FORMAT "(ua{s(sxtuux)})"
+#define THUMBNAIL_INDEX_SAVE_DELAY_SECONDS 5
+
+/* Least recently used thumbnails are deleted when the thumbnails take more
+ * than this on disk, until they are back under the low watermark.
+ */
+#define THUMBNAIL_CACHE_MAX_SIZE (32 * 1024 * 1024)
+#define THUMBNAIL_CACHE_LOW_WATERMARK(max_size) ((max_size) / 10 * 9)
+
+/* Thumbnails are small and rewritten often, so favor encoding speed over
+ * size. Run the thumbnail encode benchmark to compare levels.
+ */
+#define THUMBNAIL_PNG_COMPRESSION_LEVEL "1"
+
+typedef struct {
+  char *url;
+  gint64 mtime;
+  guint64 size;
+  guint width;
+  guint height;
+  gint64 last_used;
+} ThumbnailIndexEntry;
+
+static void
+thumbnail_index_entry_free (ThumbnailIndexEntry *entry)
+{
+  g_free (entry->url);
+  g_free (entry);
+}
+
 typedef enum {
   SNAPSHOT_STALE,
   SNAPSHOT_FRESH
@@ -57,17 +105,18 @@ snapshot_path_cached_data_free (SnapshotPathCachedData *data)
   g_free (data);
 }
 
-static void
-ephy_snapshot_service_class_init (EphySnapshotServiceClass *klass)
-{
-}
-
 static void
 ephy_snapshot_service_init (EphySnapshotService *self)
 {
   self->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
                                        (GDestroyNotify)g_free,
                                        (GDestroyNotify)snapshot_path_cached_data_free);
+
+  g_mutex_init (&self->index_mutex);
+  self->index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                       (GDestroyNotify)g_free,
+                                       (GDestroyNotify)thumbnail_index_entry_free);
+  self->max_size = THUMBNAIL_CACHE_MAX_SIZE;
 }
 
 static char *
@@ -106,14 +155,23 @@ thumbnail_is_valid (GdkPixbuf  *pixbuf,
 
 static gboolean
 validate_thumbnail_path (const char *path,
-                         const char *uri)
+                         const char *uri,
+                         guint      *width,
+                         guint      *height)
 {
   GdkPixbuf *pixbuf;
 
   pixbuf = gdk_pixbuf_new_from_file (path, NULL);
-  if (pixbuf == NULL || !thumbnail_is_valid (pixbuf, uri))
+  if (pixbuf == NULL)
     return FALSE;
 
+  if (!thumbnail_is_valid (pixbuf, uri)) {
+    g_object_unref (pixbuf);
+    return FALSE;
+  }
+
+  *width = gdk_pixbuf_get_width (pixbuf);
+  *height = gdk_pixbuf_get_height (pixbuf);
   g_object_unref (pixbuf);
 
   return TRUE;
@@ -142,6 +200,421 @@ thumbnail_path (const char *uri)
   return path;
 }
 
+static char *
+thumbnail_index_path (void)
+{
+  return g_build_filename (ephy_cache_dir (),
+                           "thumbnails",
+                           THUMBNAIL_INDEX_FILENAME,
+                           NULL);
+}
+
+/* Must be called with index_mutex held. Adds the thumbnails that are on
+ * disk but not in the index, e.g. written by older versions, so that they
+ * count towards the cache size. Their URL is unknown until they are looked
+ * up again, so they are first in line for eviction.
+ */
+static void
+thumbnail_index_add_unknown_files (EphySnapshotService *service)
+{
+  g_autofree char *dirname = NULL;
+  GDir *dir;
+  const char *name;
+
+  dirname = thumbnail_directory ();
+  dir = g_dir_open (dirname, 0, NULL);
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name (dir))) {
+    g_autofree char *path = NULL;
+    ThumbnailIndexEntry *entry;
+    GStatBuf st;
+
+    if (!g_str_has_suffix (name, ".png") || g_hash_table_contains (service->index, name))
+      continue;
+
+    path = g_build_filename (dirname, name, NULL);
+    if (g_stat (path, &st) != 0)
+      continue;
+
+    entry = g_new0 (ThumbnailIndexEntry, 1);
+    entry->url = g_strdup ("");
+    entry->mtime = st.st_mtime;
+    entry->size = st.st_size;
+    entry->last_used = (gint64)st.st_mtime * G_USEC_PER_SEC;
+    g_hash_table_insert (service->index, g_strdup (name), entry);
+  }
+
+  g_dir_close (dir);
+}
+
+/* Must be called with index_mutex held. */
+static void
+thumbnail_index_ensure_loaded (EphySnapshotService *service)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariantIter) iter = NULL;
+  char *contents;
+  gsize length;
+  guint32 version;
+  const char *file;
+  ThumbnailIndexEntry entry;
+
+  if (service->index_loaded)
+    return;
+
+  service->index_loaded = TRUE;
+
+  path = thumbnail_index_path ();
+  if (!g_file_get_contents (path, &contents, &length, NULL)) {
+    thumbnail_index_add_unknown_files (service);
+    return;
+  }
+
+  variant = g_variant_new_from_data (G_VARIANT_TYPE (THUMBNAIL_INDEX_FORMAT),
+                                     contents, length, FALSE,
+                                     g_free, contents);
+  g_variant_get (variant, "(ua{s(sxtuux)})", &version, &iter);
+  if (version != THUMBNAIL_INDEX_VERSION) {
+    thumbnail_index_add_unknown_files (service);
+    return;
+  }
+
+  while (g_variant_iter_next (iter, "{&s(sxtuux)}", &file,
+                              &entry.url, &entry.mtime, &entry.size,
+                              &entry.width, &entry.height, &entry.last_used)) {
+    ThumbnailIndexEntry *copy = g_new (ThumbnailIndexEntry, 1);
+
+    *copy = entry;
+    g_hash_table_insert (service->index, g_strdup (file), copy);
+  }
+
+  thumbnail_index_add_unknown_files (service);
+}
+
+static void
+thumbnail_index_saved_cb (GFile        *file,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (file, result, NULL, &error)) {
+    /* The thumbnails directory might have been deleted meanwhile. */
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+      g_warning ("Failed to save thumbnail index: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+static GBytes *
+thumbnail_index_serialize (EphySnapshotService *service)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  GVariant *variant;
+  GBytes *bytes;
+  const char *key;
+  ThumbnailIndexEntry *entry;
+
+  g_mutex_lock (&service->index_mutex);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(sxtuux)}"));
+  g_hash_table_iter_init (&iter, service->index);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&entry)) {
+    g_variant_builder_add (&builder, "{s(sxtuux)}", key,
+                           entry->url, entry->mtime, entry->size,
+                           entry->width, entry->height, entry->last_used);
+  }
+
+  g_mutex_unlock (&service->index_mutex);
+
+  variant = g_variant_ref_sink (g_variant_new ("(u@a{s(sxtuux)})",
+                                               THUMBNAIL_INDEX_VERSION,
+                                               g_variant_builder_end (&builder)));
+  bytes = g_variant_get_data_as_bytes (variant);
+  g_variant_unref (variant);
+
+  return bytes;
+}
+
+static gboolean
+thumbnail_index_save_cb (EphySnapshotService *service)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GFile) file = NULL;
+  GBytes *bytes;
+
+  g_mutex_lock (&service->index_mutex);
+  service->index_save_source_id = 0;
+  g_mutex_unlock (&service->index_mutex);
+
+  bytes = thumbnail_index_serialize (service);
+
+  path = thumbnail_index_path ();
+  file = g_file_new_for_path (path);
+  g_file_replace_contents_bytes_async (file, bytes, NULL, FALSE,
+                                       G_FILE_CREATE_PRIVATE, NULL,
+                                       (GAsyncReadyCallback)thumbnail_index_saved_cb,
+                                       NULL);
+
+  g_bytes_unref (bytes);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Writes a pending save synchronously, for when the service goes away. */
+static void
+thumbnail_index_flush (EphySnapshotService *service)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GFile) file = NULL;
+  GBytes *bytes;
+  GError *error = NULL;
+
+  if (!service->index_save_source_id)
+    return;
+
+  g_clear_handle_id (&service->index_save_source_id, g_source_remove);
+
+  bytes = thumbnail_index_serialize (service);
+
+  path = thumbnail_index_path ();
+  file = g_file_new_for_path (path);
+  if (!g_file_replace_contents (file,
+                                g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                                NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, NULL, &error)) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+      g_warning ("Failed to save thumbnail index: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_bytes_unref (bytes);
+}
+
+static void
+ephy_snapshot_service_dispose (GObject *object)
+{
+  EphySnapshotService *self = EPHY_SNAPSHOT_SERVICE (object);
+
+  /* Don't lose index changes that were not written yet. */
+  if (self->index)
+    thumbnail_index_flush (self);
+
+  g_clear_pointer (&self->index, g_hash_table_unref);
+  g_clear_pointer (&self->cache, g_hash_table_unref);
+
+  G_OBJECT_CLASS (ephy_snapshot_service_parent_class)->dispose (object);
+}
+
+static void
+ephy_snapshot_service_finalize (GObject *object)
+{
+  EphySnapshotService *self = EPHY_SNAPSHOT_SERVICE (object);
+
+  g_mutex_clear (&self->index_mutex);
+
+  G_OBJECT_CLASS (ephy_snapshot_service_parent_class)->finalize (object);
+}
+
+static void
+ephy_snapshot_service_class_init (EphySnapshotServiceClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_snapshot_service_dispose;
+  object_class->finalize = ephy_snapshot_service_finalize;
+}
+
+/* Must be called with index_mutex held. The index is written back lazily on
+ * the main thread, so that bursts of changes result in a single write.
+ */
+static void
+thumbnail_index_schedule_save (EphySnapshotService *service)
+{
+  if (service->index_save_source_id)
+    return;
+
+  service->index_save_source_id = g_timeout_add_seconds (THUMBNAIL_INDEX_SAVE_DELAY_SECONDS,
+                                                         (GSourceFunc)thumbnail_index_save_cb,
+                                                         service);
+  g_source_set_name_by_id (service->index_save_source_id, "[epiphany] thumbnail_index_save_cb");
+}
+
+static int
+compare_last_used (const char         **a,
+                   const char         **b,
+                   GHashTable          *index)
+{
+  ThumbnailIndexEntry *entry_a = g_hash_table_lookup (index, *a);
+  ThumbnailIndexEntry *entry_b = g_hash_table_lookup (index, *b);
+
+  if (entry_a->last_used < entry_b->last_used)
+    return -1;
+  if (entry_a->last_used > entry_b->last_used)
+    return 1;
+  return 0;
+}
+
+/* Must be called with index_mutex held. Returns the URLs of the evicted
+ * thumbnails, or %NULL if the cache is within budget.
+ */
+static GPtrArray *
+thumbnail_index_evict (EphySnapshotService *service)
+{
+  g_autofree char *dirname = NULL;
+  g_autoptr(GPtrArray) files = NULL;
+  GPtrArray *evicted;
+  GHashTableIter iter;
+  const char *file;
+  ThumbnailIndexEntry *entry;
+  guint64 total_size = 0;
+
+  g_hash_table_iter_init (&iter, service->index);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    total_size += entry->size;
+
+  if (total_size <= service->max_size)
+    return NULL;
+
+  files = g_ptr_array_sized_new (g_hash_table_size (service->index));
+  g_hash_table_iter_init (&iter, service->index);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&file, NULL))
+    g_ptr_array_add (files, (gpointer)file);
+  g_ptr_array_sort_with_data (files, (GCompareDataFunc)compare_last_used, service->index);
+
+  dirname = thumbnail_directory ();
+  evicted = g_ptr_array_new_with_free_func (g_free);
+
+  for (guint i = 0; i < files->len && total_size > THUMBNAIL_CACHE_LOW_WATERMARK (service->max_size); i++) {
+    g_autofree char *path = NULL;
+
+    file = g_ptr_array_index (files, i);
+    entry = g_hash_table_lookup (service->index, file);
+    path = g_build_filename (dirname, file, NULL);
+
+    if (g_unlink (path) != 0 && errno != ENOENT)
+      continue;
+
+    total_size -= entry->size;
+    if (*entry->url)
+      g_ptr_array_add (evicted, g_strdup (entry->url));
+    g_hash_table_remove (service->index, file);
+  }
+
+  thumbnail_index_schedule_save (service);
+
+  return evicted;
+}
+
+typedef struct {
+  EphySnapshotService *service;
+  GPtrArray *urls;
+} UncacheData;
+
+static gboolean
+idle_uncache_snapshot_paths (UncacheData *data)
+{
+  for (guint i = 0; i < data->urls->len; i++)
+    g_hash_table_remove (data->service->cache, g_ptr_array_index (data->urls, i));
+
+  g_object_unref (data->service);
+  g_ptr_array_unref (data->urls);
+  g_free (data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+thumbnail_index_update (EphySnapshotService *service,
+                        const char          *url,
+                        const char          *path,
+                        guint                width,
+                        guint                height)
+{
+  ThumbnailIndexEntry *entry;
+  GPtrArray *evicted;
+  GStatBuf st;
+
+  if (g_stat (path, &st) != 0)
+    return;
+
+  entry = g_new (ThumbnailIndexEntry, 1);
+  entry->url = g_strdup (url);
+  entry->mtime = st.st_mtime;
+  entry->size = st.st_size;
+  entry->width = width;
+  entry->height = height;
+  entry->last_used = g_get_real_time ();
+
+  g_mutex_lock (&service->index_mutex);
+  thumbnail_index_ensure_loaded (service);
+  g_hash_table_replace (service->index, g_path_get_basename (path), entry);
+  thumbnail_index_schedule_save (service);
+  evicted = thumbnail_index_evict (service);
+  g_mutex_unlock (&service->index_mutex);
+
+  /* The paths of the evicted thumbnails must not be served anymore. */
+  if (evicted && evicted->len > 0) {
+    UncacheData *data = g_new (UncacheData, 1);
+
+    data->service = g_object_ref (service);
+    data->urls = evicted;
+    g_idle_add ((GSourceFunc)idle_uncache_snapshot_paths, data);
+  } else if (evicted) {
+    g_ptr_array_unref (evicted);
+  }
+}
+
+static void
+thumbnail_index_remove (EphySnapshotService *service,
+                        const char          *path)
+{
+  g_autofree char *file = g_path_get_basename (path);
+
+  g_mutex_lock (&service->index_mutex);
+  thumbnail_index_ensure_loaded (service);
+  if (g_hash_table_remove (service->index, file))
+    thumbnail_index_schedule_save (service);
+  g_mutex_unlock (&service->index_mutex);
+}
+
+/* Checks whether the thumbnail at @path is the one of @url without decoding
+ * it, using the index. The thumbnail must not have been modified since it
+ * was indexed.
+ */
+static gboolean
+thumbnail_index_validate (EphySnapshotService *service,
+                          const char          *url,
+                          const char          *path)
+{
+  g_autofree char *file = g_path_get_basename (path);
+  ThumbnailIndexEntry *entry;
+  gboolean valid = FALSE;
+  GStatBuf st;
+
+  if (g_stat (path, &st) != 0)
+    return FALSE;
+
+  g_mutex_lock (&service->index_mutex);
+  thumbnail_index_ensure_loaded (service);
+  entry = g_hash_table_lookup (service->index, file);
+  if (entry &&
+      strcmp (entry->url, url) == 0 &&
+      entry->mtime == st.st_mtime &&
+      entry->size == (guint64)st.st_size) {
+    /* Saved so that eviction still knows about this use after a restart. */
+    entry->last_used = g_get_real_time ();
+    thumbnail_index_schedule_save (service);
+    valid = TRUE;
+  }
+  g_mutex_unlock (&service->index_mutex);
+
+  return valid;
+}
+
 static gboolean
 save_thumbnail (GdkPixbuf  *pixbuf,
                 const char *uri)
@@ -182,6 +655,7 @@ save_thumbnail (GdkPixbuf  *pixbuf,
                            "tEXt::Thumb::Image::Height", height,
                            "tEXt::Thumb::URI", uri,
                            "tEXt::Software", "GNOME::Epiphany::ThumbnailFactory",
+                           "compression", THUMBNAIL_PNG_COMPRESSION_LEVEL,
                            NULL);
   else
     ret = gdk_pixbuf_save (pixbuf,
@@ -189,6 +663,7 @@ save_thumbnail (GdkPixbuf  *pixbuf,
                            "png", &error,
                            "tEXt::Thumb::URI", uri,
                            "tEXt::Software", "GNOME::Epiphany::ThumbnailFactory",
+                           "compression", THUMBNAIL_PNG_COMPRESSION_LEVEL,
                            NULL);
 
   if (!ret)
@@ -212,27 +687,149 @@ save_thumbnail (GdkPixbuf  *pixbuf,
   return ret;
 }
 
+/* Halves a premultiplied ARGB32 image by averaging 2x2 blocks. Each 32-bit
+ * pixel is split into two words holding two channels each in 16-bit lanes,
+ * so both channels are summed with a single addition, and the simple loop is
+ * left for the compiler to vectorize further.
+ */
+static void
+downscale_half (const guint8 *src,
+                int           src_stride,
+                int           src_width,
+                int           src_height,
+                guint32      *dest)
+{
+  int dest_width = src_width / 2;
+  int dest_height = src_height / 2;
+
+  for (int y = 0; y < dest_height; y++) {
+    const guint32 *row0 = (const guint32 *)(src + 2 * y * src_stride);
+    const guint32 *row1 = (const guint32 *)(src + (2 * y + 1) * src_stride);
+    guint32 *out = dest + y * dest_width;
+
+    for (int x = 0; x < dest_width; x++) {
+      guint32 a = row0[2 * x];
+      guint32 b = row0[2 * x + 1];
+      guint32 c = row1[2 * x];
+      guint32 d = row1[2 * x + 1];
+      guint32 rb, ag;
+
+      rb = (a & 0x00ff00ff) + (b & 0x00ff00ff) + (c & 0x00ff00ff) + (d & 0x00ff00ff);
+      ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) +
+           ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff);
+
+      rb = ((rb + 0x00020002) >> 2) & 0x00ff00ff;
+      ag = ((ag + 0x00020002) >> 2) & 0x00ff00ff;
+
+      out[x] = rb | (ag << 8);
+    }
+  }
+}
+
+/* Resamples a premultiplied ARGB32 image into @dest with an area filter:
+ * every destination pixel is the average of the source area it covers.
+ */
+static void
+area_scale_to_pixbuf (const guint8 *src,
+                      int           src_stride,
+                      int           src_width,
+                      int           src_height,
+                      GdkPixbuf    *dest)
+{
+  int dest_width = gdk_pixbuf_get_width (dest);
+  int dest_height = gdk_pixbuf_get_height (dest);
+  int dest_stride = gdk_pixbuf_get_rowstride (dest);
+  guint8 *dest_pixels = gdk_pixbuf_get_pixels (dest);
+  double x_scale = src_width / (double)dest_width;
+  double y_scale = src_height / (double)dest_height;
+  float *tmp;
+
+  /* Horizontal pass, into unpacked float channels: A, R, G, B. */
+  tmp = g_new (float, (gsize)dest_width * src_height * 4);
+  for (int y = 0; y < src_height; y++) {
+    const guint32 *row = (const guint32 *)(src + y * src_stride);
+
+    for (int x = 0; x < dest_width; x++) {
+      double start = x * x_scale;
+      double end = start + x_scale;
+      float *out = tmp + ((gsize)y * dest_width + x) * 4;
+      float acc[4] = { 0, 0, 0, 0 };
+
+      for (int sx = (int)start; sx < end && sx < src_width; sx++) {
+        float weight = MIN (end, sx + 1) - MAX (start, sx);
+        guint32 pixel = row[sx];
+
+        acc[0] += weight * (pixel >> 24);
+        acc[1] += weight * ((pixel >> 16) & 0xff);
+        acc[2] += weight * ((pixel >> 8) & 0xff);
+        acc[3] += weight * (pixel & 0xff);
+      }
+
+      for (int c = 0; c < 4; c++)
+        out[c] = acc[c] / x_scale;
+    }
+  }
+
+  /* Vertical pass, unpremultiplying into the RGBA pixbuf. */
+  for (int y = 0; y < dest_height; y++) {
+    double start = y * y_scale;
+    double end = start + y_scale;
+    guint8 *out = dest_pixels + y * dest_stride;
+
+    for (int x = 0; x < dest_width; x++) {
+      float acc[4] = { 0, 0, 0, 0 };
+      float alpha;
+
+      for (int sy = (int)start; sy < end && sy < src_height; sy++) {
+        float weight = MIN (end, sy + 1) - MAX (start, sy);
+        const float *in = tmp + ((gsize)sy * dest_width + x) * 4;
+
+        for (int c = 0; c < 4; c++)
+          acc[c] += weight * in[c];
+      }
+
+      alpha = acc[0] / y_scale;
+      if (alpha < 0.5) {
+        memset (out + x * 4, 0, 4);
+        continue;
+      }
+
+      out[x * 4] = CLAMP (acc[1] / y_scale * 255 / alpha + 0.5, 0, 255);
+      out[x * 4 + 1] = CLAMP (acc[2] / y_scale * 255 / alpha + 0.5, 0, 255);
+      out[x * 4 + 2] = CLAMP (acc[3] / y_scale * 255 / alpha + 0.5, 0, 255);
+      out[x * 4 + 3] = CLAMP (alpha + 0.5, 0, 255);
+    }
+  }
+
+  g_free (tmp);
+}
+
+/* Crops @surface to the thumbnail aspect ratio, and scales it down working
+ * directly on the pixels of the surface: it is first halved as many times as
+ * possible, which is cheap, and then resampled to the exact thumbnail size.
+ * Safe to call from a worker thread, as long as nothing else uses @surface.
+ */
 static GdkPixbuf *
 ephy_snapshot_service_prepare_snapshot (cairo_surface_t *surface,
-                                        cairo_surface_t *favicon)
+                                        GdkPixbuf       *favicon)
 {
-  GdkPixbuf *snapshot, *scaled;
+  GdkPixbuf *scaled;
+  const guint8 *src;
+  guint32 *buffer = NULL;
   int orig_width, orig_height;
   float orig_aspect_ratio, dest_aspect_ratio;
-  int x_offset, new_width = 0, new_height;
+  int x_offset, new_width, new_height;
+  int stride;
 
   orig_width = cairo_image_surface_get_width (surface);
   orig_height = cairo_image_surface_get_height (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  src = cairo_image_surface_get_data (surface);
 
   if (orig_width < EPHY_THUMBNAIL_WIDTH ||
       orig_height < EPHY_THUMBNAIL_HEIGHT) {
-    snapshot = gdk_pixbuf_get_from_surface (surface,
-                                            0, 0,
-                                            orig_width, orig_height);
-    scaled = gdk_pixbuf_scale_simple (snapshot,
-                                      EPHY_THUMBNAIL_WIDTH,
-                                      EPHY_THUMBNAIL_HEIGHT,
-                                      GDK_INTERP_TILES);
+    new_width = orig_width;
+    new_height = orig_height;
   } else {
     orig_aspect_ratio = orig_width / (float)orig_height;
     dest_aspect_ratio = EPHY_THUMBNAIL_WIDTH / (float)EPHY_THUMBNAIL_HEIGHT;
@@ -249,27 +846,38 @@ ephy_snapshot_service_prepare_snapshot (cairo_surface_t *surface,
       x_offset = 0;
     }
 
-    snapshot = gdk_pixbuf_get_from_surface (surface, x_offset, 0, new_width, new_height);
-    scaled = gdk_pixbuf_scale_simple (snapshot,
-                                      EPHY_THUMBNAIL_WIDTH,
-                                      EPHY_THUMBNAIL_HEIGHT,
-                                      GDK_INTERP_BILINEAR);
+    /* Cropping is only a matter of where to start reading. */
+    src += x_offset * 4;
+
+    while (new_width >= 2 * EPHY_THUMBNAIL_WIDTH &&
+           new_height >= 2 * EPHY_THUMBNAIL_HEIGHT) {
+      guint32 *half = g_new (guint32, (gsize)(new_width / 2) * (new_height / 2));
+
+      downscale_half (src, stride, new_width, new_height, half);
+      g_free (buffer);
+      buffer = half;
+
+      src = (const guint8 *)buffer;
+      new_width /= 2;
+      new_height /= 2;
+      stride = new_width * 4;
+    }
   }
 
-  g_object_unref (snapshot);
+  scaled = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                           EPHY_THUMBNAIL_WIDTH, EPHY_THUMBNAIL_HEIGHT);
+  area_scale_to_pixbuf (src, stride, new_width, new_height, scaled);
+  g_free (buffer);
 
   x_offset = 6;
   if (favicon) {
-    GdkPixbuf *fav_pixbuf;
-    int favicon_size = 16;
+    int favicon_size = gdk_pixbuf_get_width (favicon);
     int y_offset = gdk_pixbuf_get_height (scaled) - favicon_size - x_offset;
 
-    fav_pixbuf = ephy_pixbuf_get_from_surface_scaled (favicon, favicon_size, favicon_size);
-    gdk_pixbuf_composite (fav_pixbuf, scaled,
+    gdk_pixbuf_composite (favicon, scaled,
                           x_offset, y_offset, favicon_size, favicon_size,
                           x_offset, y_offset, 1, 1,
                           GDK_INTERP_NEAREST, 255);
-    g_object_unref (fav_pixbuf);
   }
 
   return scaled;
@@ -280,6 +888,13 @@ typedef struct {
   GdkPixbuf *snapshot;
   WebKitWebView *web_view;
   char *url;
+
+  /* Input of ephy_snapshot_service_prepare_snapshot(). */
+  cairo_surface_t *surface;
+  GdkPixbuf *favicon;
+
+  /* When the web view was asked for the snapshot. */
+  gint64 capture_time;
 } SnapshotAsyncData;
 
 static SnapshotAsyncData *
@@ -317,6 +932,8 @@ snapshot_async_data_free (SnapshotAsyncData *data)
 {
   g_clear_object (&data->service);
   g_clear_object (&data->snapshot);
+  g_clear_pointer (&data->surface, cairo_surface_destroy);
+  g_clear_object (&data->favicon);
 
   if (data->web_view)
     g_object_remove_weak_pointer (G_OBJECT (data->web_view), (gpointer *)&data->web_view);
@@ -365,33 +982,49 @@ save_snapshot_thread (GTask               *task,
                       GCancellable        *cancellable)
 {
   char *path;
+  gint64 begin_time = g_get_monotonic_time ();
+  EPHY_TRACE_SPAN ("snapshot", "save");
+
+  data->snapshot = ephy_snapshot_service_prepare_snapshot (data->surface, data->favicon);
 
-  save_thumbnail (data->snapshot, data->url);
   path = thumbnail_path (data->url);
+  if (save_thumbnail (data->snapshot, data->url))
+    thumbnail_index_update (service, data->url, path,
+                            gdk_pixbuf_get_width (data->snapshot),
+                            gdk_pixbuf_get_height (data->snapshot));
   cache_snapshot_data_in_idle (service, data->url, path, SNAPSHOT_FRESH);
 
+  ephy_metrics_add_duration ("snapshot", "save", g_get_monotonic_time () - begin_time);
+
   g_task_return_pointer (task, path, g_free);
 }
 
+/* Scales @surface down to a thumbnail, composites @favicon on it and saves
+ * it, all in a worker thread. @surface must be an image surface that is not
+ * used anymore by the caller.
+ */
 static void
 ephy_snapshot_service_save_snapshot_async (EphySnapshotService *service,
-                                           GdkPixbuf           *snapshot,
+                                           cairo_surface_t     *surface,
+                                           GdkPixbuf           *favicon,
                                            const char          *url,
                                            GCancellable        *cancellable,
                                            GAsyncReadyCallback  callback,
                                            gpointer             user_data)
 {
   GTask *task;
+  SnapshotAsyncData *data;
 
   g_assert (EPHY_IS_SNAPSHOT_SERVICE (service));
-  g_assert (GDK_IS_PIXBUF (snapshot));
+  g_assert (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE);
   g_assert (url != NULL);
 
   task = g_task_new (service, cancellable, callback, user_data);
   g_task_set_priority (task, G_PRIORITY_LOW);
-  g_task_set_task_data (task,
-                        snapshot_async_data_new (service, snapshot, NULL, url),
-                        (GDestroyNotify)snapshot_async_data_free);
+  data = snapshot_async_data_new (service, NULL, NULL, url);
+  data->surface = cairo_surface_reference (surface);
+  data->favicon = favicon ? g_object_ref (favicon) : NULL;
+  g_task_set_task_data (task, data, (GDestroyNotify)snapshot_async_data_free);
   g_task_run_in_thread (task, (GTaskThreadFunc)save_snapshot_thread);
   g_object_unref (task);
 }
@@ -424,16 +1057,33 @@ save_snapshot (cairo_surface_t *surface,
                GTask           *task)
 {
   SnapshotAsyncData *data = g_task_get_task_data (task);
+  cairo_surface_t *favicon;
+  GdkPixbuf *favicon_pixbuf = NULL;
+
+  if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+    g_task_return_new_error (task,
+                             EPHY_SNAPSHOT_SERVICE_ERROR,
+                             EPHY_SNAPSHOT_SERVICE_ERROR_WEB_VIEW,
+                             "%s", "Error getting snapshot, unexpected surface type");
+    g_object_unref (task);
+    return;
+  }
 
-  data->snapshot = ephy_snapshot_service_prepare_snapshot (surface,
-                                                           webkit_web_view_get_favicon (data->web_view));
+  /* The favicon is tiny and owned by the web view, so scale it here. */
+  favicon = webkit_web_view_get_favicon (data->web_view);
+  if (favicon)
+    favicon_pixbuf = ephy_pixbuf_get_from_surface_scaled (favicon, 16, 16);
 
+  cairo_surface_flush (surface);
   ephy_snapshot_service_save_snapshot_async (g_task_get_source_object (task),
-                                             data->snapshot,
+                                             surface,
+                                             favicon_pixbuf,
                                              webkit_web_view_get_uri (data->web_view),
                                              g_task_get_cancellable (task),
                                              (GAsyncReadyCallback)snapshot_saved,
                                              task);
+
+  g_clear_object (&favicon_pixbuf);
 }
 
 static void
@@ -441,10 +1091,13 @@ on_snapshot_ready (WebKitWebView *web_view,
                    GAsyncResult  *result,
                    GTask         *task)
 {
+  SnapshotAsyncData *data = g_task_get_task_data (task);
   cairo_surface_t *surface;
   GError *error = NULL;
 
   surface = webkit_web_view_get_snapshot_finish (web_view, result, &error);
+  ephy_trace_mark ("snapshot", "capture", data->capture_time);
+  ephy_metrics_add_duration ("snapshot", "capture", g_get_monotonic_time () - data->capture_time);
   if (error) {
     g_task_return_error (task, error);
     g_object_unref (task);
@@ -470,6 +1123,7 @@ retrieve_snapshot_from_web_view (GTask *task)
     return FALSE;
   }
 
+  data->capture_time = g_get_monotonic_time ();
   webkit_web_view_get_snapshot (data->web_view,
                                 WEBKIT_SNAPSHOT_REGION_VISIBLE,
                                 WEBKIT_SNAPSHOT_OPTIONS_NONE,
@@ -614,19 +1268,34 @@ get_snapshot_path_for_url_thread (GTask               *task,
                                   GCancellable        *cancellable)
 {
   char *path;
+  guint width, height;
+  gint64 begin_time = g_get_monotonic_time ();
+  EPHY_TRACE_SPAN ("snapshot", "lookup");
 
   path = thumbnail_path (data->url);
-  if (!validate_thumbnail_path (path, data->url)) {
-    g_task_return_new_error (task,
-                             EPHY_SNAPSHOT_SERVICE_ERROR,
-                             EPHY_SNAPSHOT_SERVICE_ERROR_NOT_FOUND,
-                             "Snapshot for url \"%s\" not found in disk cache", data->url);
-    g_free (path);
-    return;
+  if (!thumbnail_index_validate (service, data->url, path)) {
+    ephy_metrics_add_count ("snapshot", "lookup-index-misses", 1);
+
+    /* Not indexed yet, or modified behind our back. Fall back to checking
+     * the URL stored in the thumbnail itself, and index it for next time.
+     */
+    if (!validate_thumbnail_path (path, data->url, &width, &height)) {
+      ephy_metrics_add_duration ("snapshot", "lookup", g_get_monotonic_time () - begin_time);
+      g_task_return_new_error (task,
+                               EPHY_SNAPSHOT_SERVICE_ERROR,
+                               EPHY_SNAPSHOT_SERVICE_ERROR_NOT_FOUND,
+                               "Snapshot for url \"%s\" not found in disk cache", data->url);
+      g_free (path);
+      return;
+    }
+
+    thumbnail_index_update (service, data->url, path, width, height);
   }
 
   cache_snapshot_data_in_idle (service, data->url, path, SNAPSHOT_STALE);
 
+  ephy_metrics_add_duration ("snapshot", "lookup", g_get_monotonic_time () - begin_time);
+
   g_task_return_pointer (task, path, g_free);
 }
 
@@ -760,8 +1429,10 @@ got_snapshot_path_to_delete_cb (EphySnapshotService *service,
   char *path;
 
   path = ephy_snapshot_service_get_snapshot_path_for_url_finish (service, result, NULL);
-  if (path)
+  if (path) {
     unlink (path);
+    thumbnail_index_remove (service, path);
+  }
   g_free (path);
 }
 
@@ -784,6 +1455,10 @@ ephy_snapshot_service_delete_all_snapshots (EphySnapshotService *service)
 
   dir = thumbnail_directory ();
 
+  g_mutex_lock (&service->index_mutex);
+  g_hash_table_remove_all (service->index);
+  g_mutex_unlock (&service->index_mutex);
+
   ephy_file_delete_dir_recursively (dir, &error);
   if (error) {
     g_warning ("Failed to delete thumbnail directory: %s", error->message);
@@ -792,3 +1467,38 @@ ephy_snapshot_service_delete_all_snapshots (EphySnapshotService *service)
 
   g_free (dir);
 }
+
+char *
+ephy_snapshot_service_get_thumbnail_path_for_testing (const char *url)
+{
+  return thumbnail_path (url);
+}
+
+void
+ephy_snapshot_service_index_thumbnail_for_testing (EphySnapshotService *service,
+                                                   const char          *url,
+                                                   guint                width,
+                                                   guint                height)
+{
+  g_autofree char *path = thumbnail_path (url);
+
+  thumbnail_index_update (service, url, path, width, height);
+}
+
+gboolean
+ephy_snapshot_service_thumbnail_is_indexed_for_testing (EphySnapshotService *service,
+                                                        const char          *url)
+{
+  g_autofree char *path = thumbnail_path (url);
+
+  return thumbnail_index_validate (service, url, path);
+}
+
+void
+ephy_snapshot_service_set_max_size_for_testing (EphySnapshotService *service,
+                                                guint64              max_size)
+{
+  g_mutex_lock (&service->index_mutex);
+  service->max_size = max_size;
+  g_mutex_unlock (&service->index_mutex);
+}
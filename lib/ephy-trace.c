@@ -0,0 +1,384 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-trace.h"
+
+#include "ephy-metrics.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * SECTION:ephy-trace
+ * @short_description: Epiphany tracing facilities
+ *
+ * When the EPHY_TRACE_DIR environment variable is set, every process that
+ * calls ephy_debug_init() writes its spans, counters and histograms to
+ * `<prgname>-<pid>.json` in that directory, in the Chrome trace event format.
+ * The files can be loaded in chrome://tracing or Perfetto; spans are nested
+ * by time within each thread. When the variable is not set, every entry point
+ * returns after testing a single global flag.
+ */
+
+gboolean ephy_trace_enabled = FALSE;
+
+static GMutex trace_mutex;
+static FILE *trace_file;
+static gboolean trace_has_events;
+static GHashTable *trace_histograms;
+static int trace_pid;
+static GPrivate trace_thread_id;
+#ifndef __linux__
+static int trace_next_thread_id = 1;
+#endif
+
+/* The following helpers must be called with trace_mutex held. */
+
+static void
+begin_event (void)
+{
+  if (trace_has_events)
+    fputs (",\n", trace_file);
+  trace_has_events = TRUE;
+}
+
+static void
+write_string (const char *str)
+{
+  const char *p;
+
+  fputc ('"', trace_file);
+  for (p = str; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\')
+      fprintf (trace_file, "\\%c", *p);
+    else if ((guchar)*p < 0x20)
+      fprintf (trace_file, "\\u%04x", (guint)(guchar)*p);
+    else
+      fputc (*p, trace_file);
+  }
+  fputc ('"', trace_file);
+}
+
+static void
+write_metadata (const char *name,
+                int         tid,
+                const char *value)
+{
+  begin_event ();
+  fprintf (trace_file, "{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+           name, trace_pid, tid);
+  write_string (value);
+  fputs ("}}", trace_file);
+}
+
+static void
+histogram_add (const char *category,
+               const char *name,
+               gint64      value)
+{
+  EphyHistogram *histogram;
+  g_autofree char *key = g_strdup_printf ("%s/%s", category, name);
+
+  histogram = g_hash_table_lookup (trace_histograms, key);
+  if (!histogram) {
+    histogram = ephy_histogram_new ();
+    g_hash_table_insert (trace_histograms, g_steal_pointer (&key), histogram);
+  }
+
+  ephy_histogram_add (histogram, value);
+}
+
+static void
+write_histograms (void)
+{
+  GHashTableIter iter;
+  const char *key;
+  EphyHistogram *histogram;
+  gint64 now = g_get_monotonic_time ();
+
+  g_hash_table_iter_init (&iter, trace_histograms);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&histogram)) {
+    begin_event ();
+    fputs ("{\"cat\":\"histogram\",\"name\":", trace_file);
+    write_string (key);
+    fprintf (trace_file,
+             ",\"ph\":\"i\",\"s\":\"p\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":0,"
+             "\"args\":{\"count\":%" G_GUINT64_FORMAT ",\"sum\":%" G_GINT64_FORMAT
+             ",\"min\":%" G_GINT64_FORMAT ",\"max\":%" G_GINT64_FORMAT
+             ",\"p50\":%" G_GINT64_FORMAT ",\"p90\":%" G_GINT64_FORMAT
+             ",\"p99\":%" G_GINT64_FORMAT "}}",
+             now, trace_pid,
+             histogram->count, histogram->sum, histogram->min, histogram->max,
+             ephy_histogram_get_percentile (histogram, 50),
+             ephy_histogram_get_percentile (histogram, 90),
+             ephy_histogram_get_percentile (histogram, 99));
+  }
+}
+
+static int
+register_current_thread (void)
+{
+  g_autofree char *name = NULL;
+  int tid;
+
+#ifdef __linux__
+  char thread_name[17] = { 0 };
+
+  tid = (int)syscall (SYS_gettid);
+  if (prctl (PR_GET_NAME, thread_name, 0, 0, 0) == 0 && thread_name[0] != '\0')
+    name = g_strdup (thread_name);
+#else
+  tid = g_atomic_int_add (&trace_next_thread_id, 1);
+#endif
+
+  if (!name)
+    name = g_strdup_printf ("thread-%d", tid);
+
+  g_mutex_lock (&trace_mutex);
+  if (trace_file)
+    write_metadata ("thread_name", tid, name);
+  g_mutex_unlock (&trace_mutex);
+
+  return tid;
+}
+
+static int
+get_current_thread_id (void)
+{
+  gpointer tid = g_private_get (&trace_thread_id);
+
+  if (G_UNLIKELY (tid == NULL)) {
+    tid = GINT_TO_POINTER (register_current_thread ());
+    g_private_set (&trace_thread_id, tid);
+  }
+
+  return GPOINTER_TO_INT (tid);
+}
+
+static void
+record_span (const char *category,
+             const char *name,
+             gint64      begin_time,
+             gint64      end_time)
+{
+  int tid = get_current_thread_id ();
+
+  g_mutex_lock (&trace_mutex);
+  if (trace_file) {
+    begin_event ();
+    fputs ("{\"cat\":", trace_file);
+    write_string (category);
+    fputs (",\"name\":", trace_file);
+    write_string (name);
+    fprintf (trace_file,
+             ",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d}",
+             begin_time, end_time - begin_time, trace_pid, tid);
+    histogram_add (category, name, end_time - begin_time);
+  }
+  g_mutex_unlock (&trace_mutex);
+}
+
+static void
+trace_finish (void)
+{
+  g_mutex_lock (&trace_mutex);
+  if (trace_file) {
+    write_histograms ();
+    /* A file without the closing bracket, e.g. when the process is killed,
+     * is still accepted by trace viewers.
+     */
+    fputs ("\n]\n", trace_file);
+    fclose (trace_file);
+    trace_file = NULL;
+  }
+  g_clear_pointer (&trace_histograms, g_hash_table_destroy);
+  g_mutex_unlock (&trace_mutex);
+}
+
+/**
+ * ephy_trace_init:
+ *
+ * Starts tracing to the directory named by the EPHY_TRACE_DIR environment
+ * variable, if it is set. This is called by ephy_debug_init() and must run
+ * before any thread is started.
+ **/
+void
+ephy_trace_init (void)
+{
+  const char *dir;
+  g_autofree char *filename = NULL;
+  g_autofree char *path = NULL;
+
+  if (ephy_trace_enabled)
+    return;
+
+  dir = g_getenv ("EPHY_TRACE_DIR");
+  if (!dir || dir[0] == '\0')
+    return;
+
+  if (g_mkdir_with_parents (dir, 0700) == -1) {
+    g_warning ("Failed to create trace directory %s: %s", dir, g_strerror (errno));
+    return;
+  }
+
+  trace_pid = getpid ();
+  filename = g_strdup_printf ("%s-%d.json", g_get_prgname () ? g_get_prgname () : "epiphany", trace_pid);
+  path = g_build_filename (dir, filename, NULL);
+
+  trace_file = g_fopen (path, "w");
+  if (!trace_file) {
+    g_warning ("Failed to open trace file %s: %s", path, g_strerror (errno));
+    return;
+  }
+
+  trace_histograms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify)ephy_histogram_free);
+
+  fputs ("[\n", trace_file);
+  write_metadata ("process_name", 0, g_get_prgname () ? g_get_prgname () : "epiphany");
+
+  atexit (trace_finish);
+  ephy_trace_enabled = TRUE;
+}
+
+/**
+ * ephy_trace_flush:
+ *
+ * Writes the buffered trace events to disk. Events are otherwise written as
+ * the buffer fills up and when the process exits.
+ **/
+void
+ephy_trace_flush (void)
+{
+  if (!EPHY_TRACE_IS_ENABLED ())
+    return;
+
+  g_mutex_lock (&trace_mutex);
+  if (trace_file)
+    fflush (trace_file);
+  g_mutex_unlock (&trace_mutex);
+}
+
+/**
+ * ephy_trace_span_end:
+ * @span: a span started with EPHY_TRACE_SPAN_INIT()
+ *
+ * Ends @span and records it. Spans declared with EPHY_TRACE_SPAN() end
+ * automatically when they go out of scope.
+ **/
+void
+ephy_trace_span_end (EphyTraceSpan *span)
+{
+  if (span->begin_time == 0)
+    return;
+
+  record_span (span->category, span->name, span->begin_time, g_get_monotonic_time ());
+  span->begin_time = 0;
+}
+
+/**
+ * ephy_trace_mark:
+ * @category: the category of the span
+ * @name: the name of the span
+ * @begin_time: the monotonic time when the span began, e.g. from
+ *   EPHY_TRACE_NOW()
+ *
+ * Records a span ending now that does not follow the scope of a function, e.g. a job
+ * queued in one thread and completed in another. The span is attributed to
+ * the calling thread. Nothing is recorded if @begin_time is 0, i.e. if
+ * tracing was disabled when the span began.
+ **/
+void
+ephy_trace_mark (const char *category,
+                 const char *name,
+                 gint64      begin_time)
+{
+  if (!EPHY_TRACE_IS_ENABLED () || begin_time == 0)
+    return;
+
+  record_span (category, name, begin_time, g_get_monotonic_time ());
+}
+
+/**
+ * ephy_trace_counter:
+ * @category: the category of the counter
+ * @name: the name of the counter
+ * @value: the current value
+ *
+ * Records the current value of a counter, e.g. the length of a queue.
+ **/
+void
+ephy_trace_counter (const char *category,
+                    const char *name,
+                    gint64      value)
+{
+  int tid;
+
+  if (!EPHY_TRACE_IS_ENABLED ())
+    return;
+
+  tid = get_current_thread_id ();
+
+  g_mutex_lock (&trace_mutex);
+  if (trace_file) {
+    begin_event ();
+    fputs ("{\"cat\":", trace_file);
+    write_string (category);
+    fputs (",\"name\":", trace_file);
+    write_string (name);
+    fprintf (trace_file,
+             ",\"ph\":\"C\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%" G_GINT64_FORMAT "}}",
+             g_get_monotonic_time (), trace_pid, tid, value);
+  }
+  g_mutex_unlock (&trace_mutex);
+}
+
+/**
+ * ephy_trace_histogram_add:
+ * @category: the category of the histogram
+ * @name: the name of the histogram
+ * @value: the value to add
+ *
+ * Adds @value to a histogram. Histograms are summarized in the trace when the
+ * process exits, with their count, sum, extremes and approximate percentiles.
+ * The duration of every span is also added to the histogram of its name.
+ **/
+void
+ephy_trace_histogram_add (const char *category,
+                          const char *name,
+                          gint64      value)
+{
+  if (!EPHY_TRACE_IS_ENABLED ())
+    return;
+
+  g_mutex_lock (&trace_mutex);
+  if (trace_histograms)
+    histogram_add (category, name, value);
+  g_mutex_unlock (&trace_mutex);
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Set once by ephy_trace_init(), before any other thread is started. Use
+ * EPHY_TRACE_IS_ENABLED() rather than reading it directly.
+ */
+extern gboolean ephy_trace_enabled;
+
+#define EPHY_TRACE_IS_ENABLED() G_UNLIKELY (ephy_trace_enabled)
+
+/* The current monotonic time in microseconds when tracing is enabled, or 0.
+ * Use it to timestamp the beginning of an operation that ends in another
+ * function or thread, and pass it to ephy_trace_mark() once it ends.
+ */
+#define EPHY_TRACE_NOW() (EPHY_TRACE_IS_ENABLED () ? g_get_monotonic_time () : 0)
+
+typedef struct {
+  const char *category;
+  const char *name;
+  gint64      begin_time;
+} EphyTraceSpan;
+
+#define EPHY_TRACE_SPAN_INIT(category, name) { (category), (name), EPHY_TRACE_NOW () }
+
+/* Declares a span that ends when the enclosing scope is left. @category and
+ * @name must outlive the scope; string literals are expected.
+ */
+#define EPHY_TRACE_SPAN(category, name) \
+  g_auto (EphyTraceSpan) G_PASTE (ephy_trace_span_, __LINE__) = EPHY_TRACE_SPAN_INIT (category, name)
+
+void ephy_trace_init          (void);
+void ephy_trace_flush         (void);
+
+void ephy_trace_span_end      (EphyTraceSpan *span);
+void ephy_trace_mark          (const char    *category,
+                               const char    *name,
+                               gint64         begin_time);
+void ephy_trace_counter       (const char    *category,
+                               const char    *name,
+                               gint64         value);
+void ephy_trace_histogram_add (const char    *category,
+                               const char    *name,
+                               gint64         value);
+
+static inline void
+ephy_trace_span_clear (EphyTraceSpan *span)
+{
+  if (span->begin_time != 0)
+    ephy_trace_span_end (span);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (EphyTraceSpan, ephy_trace_span_clear)
+
+G_END_DECLS
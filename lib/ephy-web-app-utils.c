@@ -49,6 +49,28 @@
 
 #define EPHY_WEB_APP_PROGRAM_NAME_PREFIX "epiphany-"
 
+/* The list of installed applications is only read from disk the first time
+ * it is needed, and again after it changed. Changes are noticed through a
+ * monitor on the data directory, where profile directories are created and
+ * deleted, and one on each profile directory, where the desktop file and the
+ * .app marker are. Changes made by this process are applied right away.
+ * All of this is protected by application_list_mutex, since the list is also
+ * requested from worker threads.
+ */
+static GMutex application_list_mutex;
+static GList *application_list;
+static gboolean application_list_valid;
+static GFileMonitor *data_directory_monitor;
+static GPtrArray *profile_directory_monitors;
+
+static void
+invalidate_application_list (void)
+{
+  g_mutex_lock (&application_list_mutex);
+  application_list_valid = FALSE;
+  g_mutex_unlock (&application_list_mutex);
+}
+
 char *
 ephy_web_application_get_app_id_from_name (const char *name)
 {
@@ -269,6 +291,8 @@ ephy_web_application_delete (const char *id)
     LOG ("Deleted application launcher.\n");
   }
 
+  invalidate_application_list ();
+
   return TRUE;
 }
 
@@ -409,6 +433,8 @@ ephy_web_application_create (const char *id,
   if (desktop_file_path)
     ephy_web_application_initialize_settings (profile_dir);
 
+  invalidate_application_list ();
+
  out:
   if (profile_dir)
     g_free (profile_dir);
@@ -592,20 +618,83 @@ ephy_web_application_for_profile_directory (const char *profile_dir)
   return app;
 }
 
+static void
+data_directory_changed_cb (GFileMonitor      *monitor,
+                           GFile             *file,
+                           GFile             *other_file,
+                           GFileMonitorEvent  event_type,
+                           gpointer           user_data)
+{
+  g_autofree char *name = g_file_get_basename (file);
+  g_autofree char *other_name = other_file ? g_file_get_basename (other_file) : NULL;
+
+  if (g_str_has_prefix (name, EPHY_WEB_APP_PROGRAM_NAME_PREFIX) ||
+      (other_name && g_str_has_prefix (other_name, EPHY_WEB_APP_PROGRAM_NAME_PREFIX)))
+    invalidate_application_list ();
+}
+
+/* Web applications write their own data to their profile directory all the
+ * time, only the files that make up the application matter.
+ */
+static gboolean
+is_application_file (GFile *file)
+{
+  g_autofree char *name = NULL;
+
+  if (!file)
+    return FALSE;
+
+  name = g_file_get_basename (file);
+  return g_strcmp0 (name, ".app") == 0 || g_str_has_suffix (name, ".desktop");
+}
+
+static void
+profile_directory_changed_cb (GFileMonitor      *monitor,
+                              GFile             *file,
+                              GFile             *other_file,
+                              GFileMonitorEvent  event_type,
+                              gpointer           user_data)
+{
+  /* Desktop files are saved by renaming a temporary file over them. */
+  if (is_application_file (file) || is_application_file (other_file))
+    invalidate_application_list ();
+}
+
+/* The monitor delivers its events in the main context of the calling thread,
+ * which is the global one for the worker threads of GTask.
+ */
+static GFileMonitor *
+monitor_directory (const char *path,
+                   GCallback   callback)
+{
+  g_autoptr(GFile) directory = g_file_new_for_path (path);
+  g_autoptr(GError) error = NULL;
+  GFileMonitor *monitor;
+
+  monitor = g_file_monitor_directory (directory, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+  if (!monitor) {
+    g_warning ("Failed to monitor %s for web application changes: %s", path, error->message);
+    return NULL;
+  }
+
+  g_signal_connect (monitor, "changed", callback, NULL);
+
+  return monitor;
+}
+
+/* When @monitors is not %NULL, a monitor is added to it for the profile
+ * directory of each application, including the ones still being created.
+ */
 static GList *
-ephy_web_application_get_application_list_internal (gboolean only_legacy)
+build_application_list (const char *parent_directory_path,
+                        gboolean    only_legacy,
+                        GPtrArray  *monitors)
 {
   GFileEnumerator *children = NULL;
   GFileInfo *info;
   GList *applications = NULL;
-  g_autofree char *parent_directory_path = NULL;
   g_autoptr(GFile) parent_directory = NULL;
 
-  if (only_legacy)
-    parent_directory_path = g_build_filename (g_get_user_config_dir (), "epiphany", NULL);
-  else
-    parent_directory_path = g_strdup (g_get_user_data_dir ());
-
   parent_directory = g_file_new_for_path (parent_directory_path);
   children = g_file_enumerate_children (parent_directory,
                                         "standard::name",
@@ -624,6 +713,13 @@ ephy_web_application_get_application_list_internal (gboolean only_legacy)
       char *profile_dir;
 
       profile_dir = g_build_filename (parent_directory_path, name, NULL);
+
+      if (monitors) {
+        GFileMonitor *monitor = monitor_directory (profile_dir, G_CALLBACK (profile_directory_changed_cb));
+        if (monitor)
+          g_ptr_array_add (monitors, monitor);
+      }
+
       app = ephy_web_application_for_profile_directory (profile_dir);
       if (app) {
         if (!only_legacy) {
@@ -631,7 +727,7 @@ ephy_web_application_get_application_list_internal (gboolean only_legacy)
           if (g_file_test (app_file, G_FILE_TEST_EXISTS))
             applications = g_list_prepend (applications, app);
           else
-            g_object_unref (app);
+            ephy_web_application_free (app);
         } else
           applications = g_list_prepend (applications, app);
       }
@@ -649,6 +745,48 @@ ephy_web_application_get_application_list_internal (gboolean only_legacy)
   return g_list_reverse (applications);
 }
 
+/* Must be called with application_list_mutex held. A change reported while
+ * the list is being read invalidates it once the mutex is released, so it is
+ * read again the next time.
+ */
+static void
+update_application_list (void)
+{
+  const char *data_dir = g_get_user_data_dir ();
+
+  if (application_list_valid)
+    return;
+
+  if (!data_directory_monitor)
+    data_directory_monitor = monitor_directory (data_dir, G_CALLBACK (data_directory_changed_cb));
+
+  if (profile_directory_monitors)
+    g_ptr_array_set_size (profile_directory_monitors, 0);
+  else
+    profile_directory_monitors = g_ptr_array_new_with_free_func (g_object_unref);
+
+  ephy_web_application_free_application_list (application_list);
+  application_list = build_application_list (data_dir, FALSE, profile_directory_monitors);
+  application_list_valid = TRUE;
+
+  LOG ("Read the list of %u installed web applications", g_list_length (application_list));
+}
+
+static EphyWebApplication *
+ephy_web_application_copy (EphyWebApplication *app)
+{
+  EphyWebApplication *copy = g_new0 (EphyWebApplication, 1);
+
+  copy->id = g_strdup (app->id);
+  copy->name = g_strdup (app->name);
+  copy->icon_url = g_strdup (app->icon_url);
+  copy->url = g_strdup (app->url);
+  copy->desktop_file = g_strdup (app->desktop_file);
+  memcpy (copy->install_date, app->install_date, sizeof (copy->install_date));
+
+  return copy;
+}
+
 /**
  * ephy_web_application_get_application_list:
  *
@@ -656,12 +794,22 @@ ephy_web_application_get_application_list_internal (gboolean only_legacy)
  * Free the returned GList with
  * ephy_web_application_free_application_list.
  *
+ * The list is cached, so this only reads the disk after applications were
+ * installed, changed or deleted. It can be called from any thread.
+ *
  * Returns: (transfer-full): a #GList of #EphyWebApplication objects
  **/
 GList *
 ephy_web_application_get_application_list (void)
 {
-  return ephy_web_application_get_application_list_internal (FALSE);
+  GList *applications;
+
+  g_mutex_lock (&application_list_mutex);
+  update_application_list ();
+  applications = g_list_copy_deep (application_list, (GCopyFunc)ephy_web_application_copy, NULL);
+  g_mutex_unlock (&application_list_mutex);
+
+  return applications;
 }
 
 /**
@@ -679,7 +827,9 @@ ephy_web_application_get_application_list (void)
 GList *
 ephy_web_application_get_legacy_application_list (void)
 {
-  return ephy_web_application_get_application_list_internal (TRUE);
+  g_autofree char *legacy_directory = g_build_filename (g_get_user_config_dir (), "epiphany", NULL);
+
+  return build_application_list (legacy_directory, TRUE, NULL);
 }
 
 
@@ -851,6 +1001,9 @@ ephy_web_application_save (EphyWebApplication *app)
         g_error_free (error);
       }
     }
+
+    if (saved)
+      invalidate_application_list ();
     g_free (contents);
     g_key_file_free (key);
   } else {
@@ -29,9 +29,11 @@ struct _EphyHistoryService {
   char *history_filename;
   EphySQLiteConnection *history_database;
   GMutex history_thread_mutex;
-  gboolean history_thread_initialized;
-  GCond history_thread_initialized_condition;
   GThread *history_thread;
+  gboolean ready;
+  guint ready_id;
+  gint64 construct_time;
+  gint64 open_time;
   GAsyncQueue *queue;
   gboolean scheduled_to_quit;
   gboolean read_only;
@@ -21,13 +21,16 @@
 #include "config.h"
 #include "ephy-history-service.h"
 
+#include "ephy-debug.h"
 #include "ephy-history-service-private.h"
 #include "ephy-history-types.h"
 #include "ephy-lib-type-builtins.h"
+#include "ephy-metrics.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-sqlite-connection.h"
 #include "ephy-sync-utils.h"
+#include "ephy-trace.h"
 
 #include <errno.h>
 #include <glib.h>
@@ -56,6 +59,26 @@ typedef enum {
   QUERY_HOSTS
 } EphyHistoryServiceMessageType;
 
+/* The trace span and metric names of the message types. */
+static const char * const message_names[] = {
+  "set-url-title",
+  "set-url-zoom-level",
+  "set-url-hidden",
+  "add-visit",
+  "add-visits",
+  "delete-urls",
+  "delete-host",
+  "clear",
+  "quit",
+  "get-url",
+  "get-host-for-url",
+  "query-urls",
+  "query-visits",
+  "get-hosts",
+  "query-hosts"
+};
+G_STATIC_ASSERT (G_N_ELEMENTS (message_names) == QUERY_HOSTS + 1);
+
 enum {
   VISIT_URL,
   URLS_VISITED,
@@ -63,6 +86,7 @@ enum {
   URL_TITLE_CHANGED,
   URL_DELETED,
   HOST_DELETED,
+  READY,
   LAST_SIGNAL
 };
 
@@ -78,6 +102,7 @@ typedef struct _EphyHistoryServiceMessage {
   GCancellable *cancellable;
   GDestroyNotify method_argument_cleanup;
   EphyHistoryJobCallback callback;
+  gint64 queued_time;
 } EphyHistoryServiceMessage;
 
 static gpointer run_history_service_thread (EphyHistoryService *self);
@@ -139,6 +164,8 @@ ephy_history_service_finalize (GObject *object)
   if (self->history_thread)
     g_thread_join (self->history_thread);
 
+  g_clear_handle_id (&self->ready_id, g_source_remove);
+
   g_free (self->history_filename);
 
   G_OBJECT_CLASS (ephy_history_service_parent_class)->finalize (object);
@@ -165,25 +192,17 @@ ephy_history_service_constructed (GObject *object)
   G_OBJECT_CLASS (ephy_history_service_parent_class)->constructed (object);
 
   self->queue = g_async_queue_new ();
+  self->construct_time = g_get_monotonic_time ();
 
   /* This value is checked in several functions to verify that they are only
    * ever run on the history thread. Accordingly, we'd better be sure it's set
-   * before it is checked for the first time. That requires a lock here. */
+   * before it is checked for the first time. That requires a lock here.
+   *
+   * Opening the database is left to the thread: messages sent until then
+   * wait in the queue, and ::ready is emitted once it is done.
+   */
   g_mutex_lock (&self->history_thread_mutex);
   self->history_thread = g_thread_new ("EphyHistoryService", (GThreadFunc)run_history_service_thread, self);
-
-  /* Additionally, make sure the SQLite connection has really been opened before
-   * returning. We need this so that we can test that using a read-only service
-   * at the same time as a read/write service does not cause the read/write
-   * service to break. This delay is required because we need to be sure the
-   * read/write service has completed initialization before attempting to open
-   * the read-only service, or initializing the read-only service will fail.
-   * This isn't needed except in test mode, because only tests might run
-   * multiple history services, but it's harmless and cleaner to do always.
-   */
-  while (!self->history_thread_initialized)
-    g_cond_wait (&self->history_thread_initialized_condition, &self->history_thread_mutex);
-
   g_mutex_unlock (&self->history_thread_mutex);
 }
 
@@ -280,6 +299,22 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
                   1,
                   G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE);
 
+/**
+ * EphyHistoryService::ready:
+ * @service: the #EphyHistoryService that received the signal
+ *
+ * The ::ready signal is emitted once the history database has been opened
+ * and is ready to process messages. Messages can be sent before, they are
+ * queued until then. It is not emitted if the database could not be opened.
+ **/
+  signals[READY] =
+    g_signal_new ("ready",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  0);
+
   obj_properties[PROP_HISTORY_FILENAME] =
     g_param_spec_string ("history-filename",
                          "History filename",
@@ -302,6 +337,21 @@ ephy_history_service_init (EphyHistoryService *self)
 {
 }
 
+/**
+ * ephy_history_service_is_ready:
+ * @self: an #EphyHistoryService
+ *
+ * Return value: %TRUE if the history database has been opened and
+ *               #EphyHistoryService::ready was emitted
+ **/
+gboolean
+ephy_history_service_is_ready (EphyHistoryService *self)
+{
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  return self->ready;
+}
+
 EphyHistoryService *
 ephy_history_service_new (const char               *history_filename,
                           EphySQLiteConnectionMode  mode)
@@ -355,7 +405,14 @@ ephy_history_service_message_free (EphyHistoryServiceMessage *message)
 static void
 ephy_history_service_send_message (EphyHistoryService *self, EphyHistoryServiceMessage *message)
 {
+  gint length;
+
+  message->queued_time = g_get_monotonic_time ();
   g_async_queue_push_sorted (self->queue, message, (GCompareDataFunc)sort_messages, NULL);
+
+  length = g_async_queue_length (self->queue);
+  ephy_metrics_set_gauge ("history", "queue-length", length);
+  ephy_trace_counter ("history", "queue-length", length);
 }
 
 static void
@@ -451,6 +508,23 @@ ephy_history_service_execute_quit (EphyHistoryService *self, gpointer data, gpoi
   return FALSE;
 }
 
+static gboolean
+emit_ready (EphyHistoryService *self)
+{
+  LOG ("History database opened in %.3f ms, ready %.3f ms after construction",
+       (self->open_time - self->construct_time) / 1000.0,
+       (g_get_monotonic_time () - self->construct_time) / 1000.0);
+
+  g_mutex_lock (&self->history_thread_mutex);
+  self->ready_id = 0;
+  g_mutex_unlock (&self->history_thread_mutex);
+
+  self->ready = TRUE;
+  g_signal_emit (self, signals[READY], 0);
+
+  return G_SOURCE_REMOVE;
+}
+
 static gpointer
 run_history_service_thread (EphyHistoryService *self)
 {
@@ -464,16 +538,21 @@ run_history_service_thread (EphyHistoryService *self)
    */
   g_mutex_lock (&self->history_thread_mutex);
   g_assert (self->history_thread == g_thread_self ());
+  g_mutex_unlock (&self->history_thread_mutex);
 
   success = ephy_history_service_open_database_connections (self);
-
-  self->history_thread_initialized = TRUE;
-  g_cond_signal (&self->history_thread_initialized_condition);
-  g_mutex_unlock (&self->history_thread_mutex);
+  self->open_time = g_get_monotonic_time ();
 
   if (!success)
     return NULL;
 
+  /* The mutex makes sure the source ID is stored before emit_ready() clears
+   * it, finalize removes the source if it did not run yet.
+   */
+  g_mutex_lock (&self->history_thread_mutex);
+  self->ready_id = g_idle_add ((GSourceFunc)emit_ready, self);
+  g_mutex_unlock (&self->history_thread_mutex);
+
   do {
     message = g_async_queue_try_pop (self->queue);
     if (!message) {
@@ -495,8 +574,12 @@ ephy_history_service_execute_job_callback (gpointer data)
 {
   EphyHistoryServiceMessage *message = (EphyHistoryServiceMessage *)data;
 
+  EPHY_TRACE_SPAN ("history", "job-callback");
+
   g_assert (message->callback || message->type == CLEAR);
 
+  ephy_metrics_add_duration ("history", "job-latency", g_get_monotonic_time () - message->queued_time);
+
   if (g_cancellable_is_cancelled (message->cancellable)) {
     ephy_history_service_message_free (message);
     return FALSE;
@@ -1194,9 +1277,14 @@ ephy_history_service_process_message (EphyHistoryService        *self,
                                       EphyHistoryServiceMessage *message)
 {
   EphyHistoryServiceMethod method;
+  gint64 begin_time;
 
   g_assert (self->history_thread == g_thread_self ());
 
+  begin_time = g_get_monotonic_time ();
+  ephy_metrics_add_duration ("history", "queue-wait", begin_time - message->queued_time);
+  ephy_metrics_set_gauge ("history", "queue-length", g_async_queue_length (self->queue));
+
   if (g_cancellable_is_cancelled (message->cancellable) &&
       !ephy_history_service_message_is_write (message)) {
     ephy_history_service_message_free (message);
@@ -1213,6 +1301,9 @@ ephy_history_service_process_message (EphyHistoryService        *self,
     message->success = FALSE;
   }
 
+  ephy_metrics_add_duration ("history", message_names[message->type], g_get_monotonic_time () - begin_time);
+  ephy_trace_mark ("history", message_names[message->type], begin_time);
+
   if (message->callback || message->type == CLEAR)
     g_idle_add ((GSourceFunc)ephy_history_service_execute_job_callback, message);
   else
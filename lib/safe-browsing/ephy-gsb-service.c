@@ -23,6 +23,8 @@
 
 #include "ephy-debug.h"
 #include "ephy-gsb-storage.h"
+#include "ephy-metrics.h"
+#include "ephy-trace.h"
 #include "ephy-user-agent.h"
 
 #include <libsoup/soup.h>
@@ -42,7 +44,9 @@ struct _EphyGSBService {
 
   char           *api_key;
   EphyGSBStorage *storage;
+  GCancellable   *cancellable;
 
+  gboolean        is_opened;
   gboolean        is_updating;
   guint           source_id;
 
@@ -176,6 +180,7 @@ ephy_gsb_service_update_thread (GTask          *task,
   GList *threat_lists = NULL;
   char *url = NULL;
   char *body;
+  EPHY_TRACE_SPAN ("safe-browsing", "update");
 
   g_assert (EPHY_IS_GSB_SERVICE (self));
   g_assert (ephy_gsb_storage_is_operable (self->storage));
@@ -380,6 +385,11 @@ ephy_gsb_service_dispose (GObject *object)
 {
   EphyGSBService *self = EPHY_GSB_SERVICE (object);
 
+  if (self->cancellable) {
+    g_cancellable_cancel (self->cancellable);
+    g_clear_object (&self->cancellable);
+  }
+
   g_clear_object (&self->storage);
   g_clear_object (&self->session);
 
@@ -392,13 +402,19 @@ ephy_gsb_service_dispose (GObject *object)
 }
 
 static void
-ephy_gsb_service_constructed (GObject *object)
+ephy_gsb_service_storage_opened_cb (EphyGSBStorage *storage,
+                                    GAsyncResult   *result,
+                                    EphyGSBService *self)
 {
-  EphyGSBService *self = EPHY_GSB_SERVICE (object);
+  g_autoptr(GError) error = NULL;
+  gboolean success;
 
-  G_OBJECT_CLASS (ephy_gsb_service_parent_class)->constructed (object);
+  success = ephy_gsb_storage_open_finish (storage, result, &error);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
 
-  if (!ephy_gsb_storage_is_operable (self->storage))
+  g_atomic_int_set (&self->is_opened, TRUE);
+  if (!success)
     return;
 
   /* Restore back-off parameters. */
@@ -430,6 +446,22 @@ ephy_gsb_service_constructed (GObject *object)
     ephy_gsb_service_update (self);
 }
 
+static void
+ephy_gsb_service_constructed (GObject *object)
+{
+  EphyGSBService *self = EPHY_GSB_SERVICE (object);
+
+  G_OBJECT_CLASS (ephy_gsb_service_parent_class)->constructed (object);
+
+  /* The database is large, and may have to be recreated. Don't make the
+   * caller wait for it, URLs are considered safe until it is available.
+   */
+  self->cancellable = g_cancellable_new ();
+  ephy_gsb_storage_open_async (self->storage, self->cancellable,
+                               (GAsyncReadyCallback)ephy_gsb_service_storage_opened_cb,
+                               self);
+}
+
 static void
 ephy_gsb_service_init (EphyGSBService *self)
 {
@@ -502,6 +534,7 @@ ephy_gsb_service_update_full_hashes_sync (EphyGSBService *self,
   char *url;
   char *body;
   double duration;
+  EPHY_TRACE_SPAN ("safe-browsing", "update-full-hashes");
 
   g_assert (EPHY_IS_GSB_SERVICE (self));
   g_assert (ephy_gsb_storage_is_operable (self->storage));
@@ -618,14 +651,23 @@ ephy_gsb_service_verify_url_thread (GTask          *task,
   gboolean has_matching_expired_hashes = FALSE;
   gboolean has_matching_expired_prefixes = FALSE;
   GList *threats = NULL;
+  gint64 begin_time = g_get_monotonic_time ();
+  const char *outcome = "unavailable";
+  EPHY_TRACE_SPAN ("safe-browsing", "verify-url");
 
   g_assert (EPHY_IS_GSB_SERVICE (self));
   g_assert (G_IS_TASK (task));
   g_assert (url);
 
-  /* If the local database is broken or an update is in course, we cannot
-   * really verify the URL, so we have no choice other than to consider it safe.
+  /* If the local database is not open yet, is broken or an update is in
+   * course, we cannot really verify the URL, so we have no choice other than
+   * to consider it safe.
    */
+  if (!g_atomic_int_get (&self->is_opened)) {
+    LOG ("Local GSB database is not available yet, cannot verify URL");
+    goto out;
+  }
+
   if (g_atomic_int_get (&self->is_updating)) {
     LOG ("Local GSB database is being updated, cannot verify URL");
     goto out;
@@ -636,6 +678,7 @@ ephy_gsb_service_verify_url_thread (GTask          *task,
     goto out;
   }
 
+  outcome = "no-match";
   hashes = ephy_gsb_utils_compute_hashes (url);
   if (!hashes)
     goto out;
@@ -687,6 +730,7 @@ ephy_gsb_service_verify_url_thread (GTask          *task,
    */
   if (threats) {
     LOG ("Positive cache hit, URL is not safe");
+    outcome = "positive-cache-hit";
     goto out;
   }
 
@@ -702,6 +746,7 @@ ephy_gsb_service_verify_url_thread (GTask          *task,
   }
   if (!has_matching_expired_hashes && !has_matching_expired_prefixes) {
     LOG ("Negative cache hit, URL is safe");
+    outcome = "negative-cache-hit";
     goto out;
   }
 
@@ -711,6 +756,7 @@ ephy_gsb_service_verify_url_thread (GTask          *task,
    * the full hashes of the matching prefixes with fresh values from
    * server and re-checking for positive cache hits.
    */
+  outcome = "server-lookup";
   matching_prefixes = g_hash_table_get_keys (matching_prefixes_set);
   ephy_gsb_service_update_full_hashes_sync (self, matching_prefixes);
 
@@ -726,6 +772,9 @@ ephy_gsb_service_verify_url_thread (GTask          *task,
   }
 
 out:
+  ephy_metrics_add_count ("safe-browsing", outcome, 1);
+  ephy_metrics_add_duration ("safe-browsing", "verify-url", g_get_monotonic_time () - begin_time);
+
   g_task_return_pointer (task, threats, NULL);
 
   g_list_free (matching_prefixes);
@@ -23,6 +23,7 @@
 
 #include "ephy-debug.h"
 #include "ephy-sqlite-connection.h"
+#include "ephy-trace.h"
 
 #include <string.h>
 
@@ -482,29 +483,6 @@ ephy_gsb_storage_finalize (GObject *object)
   G_OBJECT_CLASS (ephy_gsb_storage_parent_class)->finalize (object);
 }
 
-static void
-ephy_gsb_storage_constructed (GObject *object)
-{
-  EphyGSBStorage *self = EPHY_GSB_STORAGE (object);
-  gboolean success;
-
-  G_OBJECT_CLASS (ephy_gsb_storage_parent_class)->constructed (object);
-
-  if (!g_file_test (self->db_path, G_FILE_TEST_EXISTS)) {
-    LOG ("GSB database does not exist, initializing...");
-    success = ephy_gsb_storage_init_db (self);
-  } else {
-    LOG ("GSB database exists, opening...");
-    success = ephy_gsb_storage_open_db (self);
-    if (success && !ephy_gsb_storage_check_schema_version (self)) {
-      LOG ("GSB database schema incompatibility, recreating database...");
-      success = ephy_gsb_storage_recreate_db (self);
-    }
-  }
-
-  self->is_operable = success;
-}
-
 static void
 ephy_gsb_storage_init (EphyGSBStorage *self)
 {
@@ -517,7 +495,6 @@ ephy_gsb_storage_class_init (EphyGSBStorageClass *klass)
 
   object_class->set_property = ephy_gsb_storage_set_property;
   object_class->get_property = ephy_gsb_storage_get_property;
-  object_class->constructed = ephy_gsb_storage_constructed;
   object_class->finalize = ephy_gsb_storage_finalize;
 
   obj_properties[PROP_DB_PATH] =
@@ -536,13 +513,88 @@ ephy_gsb_storage_new (const char *db_path)
   return g_object_new (EPHY_TYPE_GSB_STORAGE, "db-path", db_path, NULL);
 }
 
+static void
+ephy_gsb_storage_open_thread (GTask          *task,
+                              EphyGSBStorage *self,
+                              gpointer        task_data,
+                              GCancellable   *cancellable)
+{
+  gint64 start_time = g_get_monotonic_time ();
+  gboolean success;
+  EPHY_TRACE_SPAN ("safe-browsing", "open-database");
+
+  if (!g_file_test (self->db_path, G_FILE_TEST_EXISTS)) {
+    LOG ("GSB database does not exist, initializing...");
+    success = ephy_gsb_storage_init_db (self);
+  } else {
+    LOG ("GSB database exists, opening...");
+    success = ephy_gsb_storage_open_db (self);
+    if (success && !ephy_gsb_storage_check_schema_version (self)) {
+      LOG ("GSB database schema incompatibility, recreating database...");
+      success = ephy_gsb_storage_recreate_db (self);
+    }
+  }
+
+  LOG ("GSB database %s in %.3f ms", success ? "ready" : "failed",
+       (g_get_monotonic_time () - start_time) / 1000.0);
+
+  g_atomic_int_set (&self->is_operable, success);
+  g_task_return_boolean (task, success);
+}
+
+/**
+ * ephy_gsb_storage_open_async:
+ * @self: an #EphyGSBStorage
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the database is open
+ * @user_data: the data to pass to @callback
+ *
+ * Opens the local database on a worker thread, creating it if it does not
+ * exist yet or if its schema is outdated. @self is not operable until then.
+ **/
+void
+ephy_gsb_storage_open_async (EphyGSBStorage      *self,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+  GTask *task;
+
+  g_assert (EPHY_IS_GSB_STORAGE (self));
+  g_assert (!self->db);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_run_in_thread (task, (GTaskThreadFunc)ephy_gsb_storage_open_thread);
+  g_object_unref (task);
+}
+
+/**
+ * ephy_gsb_storage_open_finish:
+ * @self: an #EphyGSBStorage
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError
+ *
+ * Return value: %TRUE if the local database is operable, %FALSE if it could
+ *               not be opened or the operation was cancelled
+ **/
+gboolean
+ephy_gsb_storage_open_finish (EphyGSBStorage  *self,
+                              GAsyncResult    *result,
+                              GError         **error)
+{
+  g_assert (g_task_is_valid (result, self));
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 /**
  * ephy_gsb_storage_is_operable:
  * @self: an #EphyGSBStorage
  *
- * Verify whether the local database is operable, i.e. no error occurred during
- * the opening and/or initialization of the database. No operations on @self are
- * allowed if the local database is inoperable.
+ * Verify whether the local database is operable, i.e. it has been opened with
+ * ephy_gsb_storage_open_async() and no error occurred during the opening and/or
+ * initialization of the database. No operations on @self are allowed if the
+ * local database is inoperable.
  *
  * Return value: %TRUE if the local database is operable
  **/
@@ -551,7 +603,7 @@ ephy_gsb_storage_is_operable (EphyGSBStorage *self)
 {
   g_assert (EPHY_IS_GSB_STORAGE (self));
 
-  return self->is_operable;
+  return g_atomic_int_get (&self->is_operable);
 }
 
 /**
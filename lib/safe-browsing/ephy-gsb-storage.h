@@ -22,7 +22,7 @@
 
 #include "ephy-gsb-utils.h"
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -31,6 +31,13 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (EphyGSBStorage, ephy_gsb_storage, EPHY, GSB_STORAGE, GObject)
 
 EphyGSBStorage *ephy_gsb_storage_new                            (const char *db_path);
+void            ephy_gsb_storage_open_async                     (EphyGSBStorage      *self,
+                                                                 GCancellable        *cancellable,
+                                                                 GAsyncReadyCallback  callback,
+                                                                 gpointer             user_data);
+gboolean        ephy_gsb_storage_open_finish                    (EphyGSBStorage  *self,
+                                                                 GAsyncResult    *result,
+                                                                 GError         **error);
 gboolean        ephy_gsb_storage_is_operable                    (EphyGSBStorage *self);
 gint64          ephy_gsb_storage_get_metadata                   (EphyGSBStorage *self,
                                                                  const char     *key,
@@ -30,6 +30,9 @@
 #include <inttypes.h>
 #include <stdio.h>
 
+/* Maximum number of keyring writes in flight at once. */
+#define MAX_PENDING_WRITES 4
+
 const SecretSchema *
 ephy_password_manager_get_password_schema (void)
 {
@@ -53,6 +56,18 @@ struct _EphyPasswordManager {
   GObject parent_instance;
 
   GHashTable *cache;
+
+  GHashTable *index;
+  gboolean    index_loaded;
+  gboolean    index_changed;
+  gint64      index_start_time;
+
+  GQueue     *write_queue;
+  guint       n_pending_writes;
+
+  gint64      merge_start_time;
+  guint       merge_n_writes;
+  guint       merge_n_unchanged;
 };
 
 static void ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *iface);
@@ -287,21 +302,394 @@ ephy_password_manager_cache_add (EphyPasswordManager *self,
   g_hash_table_replace (self->cache, g_strdup (origin), usernames);
 }
 
+/* Autofill queries are answered from an in-process index of the password
+ * records, so that only the secrets of the matching items have to be read
+ * from the keyring. The index is keyed by origin; entries keep the attributes
+ * of the record and the SecretItem holding its password. That item never
+ * loads the password itself, so that no plaintext is kept in memory.
+ */
+typedef struct {
+  char       *id;
+  char       *origin;
+  char       *target_origin;
+  char       *username;
+  char       *username_field;
+  char       *password_field;
+  gint64      server_time_modified;
+  SecretItem *item;
+} PasswordIndexEntry;
+
 static void
-populate_cache_cb (GList    *records,
-                   gpointer  user_data)
+password_index_entry_free (PasswordIndexEntry *entry)
 {
-  EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (user_data);
+  g_free (entry->id);
+  g_free (entry->origin);
+  g_free (entry->target_origin);
+  g_free (entry->username);
+  g_free (entry->username_field);
+  g_free (entry->password_field);
+  g_clear_object (&entry->item);
+  g_free (entry);
+}
 
-  for (GList *l = records; l && l->data; l = l->next) {
-    EphyPasswordRecord *record = EPHY_PASSWORD_RECORD (l->data);
-    const char *origin = ephy_password_record_get_origin (record);
-    const char *username = ephy_password_record_get_username (record);
+static void
+ephy_password_manager_index_remove (EphyPasswordManager *self,
+                                    const char          *origin,
+                                    const char          *id)
+{
+  GPtrArray *entries;
+
+  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
+
+  if (!self->index_loaded)
+    self->index_changed = TRUE;
+
+  if (!origin || !id)
+    return;
 
-    ephy_password_manager_cache_add (self, origin, username);
+  entries = g_hash_table_lookup (self->index, origin);
+  if (!entries)
+    return;
+
+  for (guint i = 0; i < entries->len; i++) {
+    PasswordIndexEntry *entry = g_ptr_array_index (entries, i);
+
+    if (!g_strcmp0 (entry->id, id)) {
+      g_ptr_array_remove_index_fast (entries, i);
+      break;
+    }
   }
 
-  g_list_free_full (records, g_object_unref);
+  if (entries->len == 0)
+    g_hash_table_remove (self->index, origin);
+}
+
+static void
+ephy_password_manager_index_add (EphyPasswordManager *self,
+                                 const char          *id,
+                                 const char          *origin,
+                                 const char          *target_origin,
+                                 const char          *username,
+                                 const char          *username_field,
+                                 const char          *password_field,
+                                 gint64               server_time_modified,
+                                 SecretItem          *item)
+{
+  PasswordIndexEntry *entry;
+  GPtrArray *entries;
+
+  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
+
+  ephy_password_manager_index_remove (self, origin, id);
+  if (!id || !origin)
+    return;
+
+  entries = g_hash_table_lookup (self->index, origin);
+  if (!entries) {
+    entries = g_ptr_array_new_with_free_func ((GDestroyNotify)password_index_entry_free);
+    g_hash_table_insert (self->index, g_strdup (origin), entries);
+  }
+
+  entry = g_new (PasswordIndexEntry, 1);
+  entry->id = g_strdup (id);
+  entry->origin = g_strdup (origin);
+  entry->target_origin = g_strdup (target_origin);
+  entry->username = g_strdup (username);
+  entry->username_field = g_strdup (username_field);
+  entry->password_field = g_strdup (password_field);
+  entry->server_time_modified = server_time_modified;
+  entry->item = item ? g_object_ref (item) : NULL;
+  g_ptr_array_add (entries, entry);
+}
+
+static void
+ephy_password_manager_index_add_item (EphyPasswordManager *self,
+                                      SecretItem          *item)
+{
+  GHashTable *attributes = secret_item_get_attributes (item);
+  const char *timestamp = g_hash_table_lookup (attributes, SERVER_TIME_MODIFIED_KEY);
+
+  ephy_password_manager_index_add (self,
+                                   g_hash_table_lookup (attributes, ID_KEY),
+                                   g_hash_table_lookup (attributes, ORIGIN_KEY),
+                                   g_hash_table_lookup (attributes, TARGET_ORIGIN_KEY),
+                                   g_hash_table_lookup (attributes, USERNAME_KEY),
+                                   g_hash_table_lookup (attributes, USERNAME_FIELD_KEY),
+                                   g_hash_table_lookup (attributes, PASSWORD_FIELD_KEY),
+                                   timestamp ? g_ascii_strtod (timestamp, NULL) : -1,
+                                   item);
+  g_hash_table_unref (attributes);
+}
+
+static void ephy_password_manager_populate_index (EphyPasswordManager *self);
+
+static void
+populate_index_cb (SecretService       *service,
+                   GAsyncResult        *result,
+                   EphyPasswordManager *self)
+{
+  GList *items;
+  GError *error = NULL;
+  gint64 start_time = self->index_start_time;
+
+  items = secret_service_search_finish (service, result, &error);
+  if (error) {
+    g_warning ("Failed to load password records: %s", error->message);
+    g_error_free (error);
+    g_object_unref (self);
+    return;
+  }
+
+  /* Records stored or forgotten while the keyring was being searched might
+   * be missing from the results. Search again.
+   */
+  if (self->index_changed) {
+    g_list_free_full (items, g_object_unref);
+    ephy_password_manager_populate_index (self);
+    g_object_unref (self);
+    return;
+  }
+
+  g_hash_table_remove_all (self->index);
+  ephy_password_manager_cache_clear (self);
+  self->index_loaded = TRUE;
+
+  for (GList *l = items; l && l->data; l = l->next) {
+    GHashTable *attributes = secret_item_get_attributes (l->data);
+
+    ephy_password_manager_cache_add (self,
+                                     g_hash_table_lookup (attributes, ORIGIN_KEY),
+                                     g_hash_table_lookup (attributes, USERNAME_KEY));
+    ephy_password_manager_index_add_item (self, l->data);
+    g_hash_table_unref (attributes);
+  }
+
+  LOG ("Indexed %u password records in %.3f ms", g_list_length (items),
+       (g_get_monotonic_time () - start_time) / 1000.0);
+
+  g_list_free_full (items, g_object_unref);
+  g_object_unref (self);
+}
+
+/* Loads the attributes of all the password records, but not the passwords. */
+static void
+ephy_password_manager_populate_index (EphyPasswordManager *self)
+{
+  GHashTable *attributes;
+
+  self->index_loaded = FALSE;
+  self->index_changed = FALSE;
+  self->index_start_time = g_get_monotonic_time ();
+
+  attributes = secret_attributes_build (EPHY_FORM_PASSWORD_SCHEMA, NULL);
+  secret_service_search (NULL, EPHY_FORM_PASSWORD_SCHEMA, attributes,
+                         SECRET_SEARCH_ALL | SECRET_SEARCH_UNLOCK,
+                         NULL,
+                         (GAsyncReadyCallback)populate_index_cb,
+                         g_object_ref (self));
+  g_hash_table_unref (attributes);
+}
+
+static void
+index_stored_item_cb (SecretService         *service,
+                      GAsyncResult          *result,
+                      ManageRecordAsyncData *data)
+{
+  GList *items;
+  GError *error = NULL;
+  EphyPasswordRecord *record = data->record;
+
+  items = secret_service_search_finish (service, result, &error);
+  if (error) {
+    g_warning ("Failed to look up stored password record: %s", error->message);
+    g_error_free (error);
+  } else if (items && !items->next) {
+    ephy_password_manager_index_add_item (data->manager, items->data);
+  } else {
+    /* Keep the entry without its item, queries will search the keyring. */
+    ephy_password_manager_index_add (data->manager,
+                                     ephy_password_record_get_id (record),
+                                     ephy_password_record_get_origin (record),
+                                     ephy_password_record_get_target_origin (record),
+                                     ephy_password_record_get_username (record),
+                                     ephy_password_record_get_username_field (record),
+                                     ephy_password_record_get_password_field (record),
+                                     ephy_synchronizable_get_server_time_modified (EPHY_SYNCHRONIZABLE (record)),
+                                     NULL);
+  }
+
+  g_list_free_full (items, g_object_unref);
+  manage_record_async_data_free (data);
+}
+
+/* secret_service_store() does not return the item it creates. */
+static void
+ephy_password_manager_index_stored_record (EphyPasswordManager *self,
+                                           EphyPasswordRecord  *record)
+{
+  GHashTable *attributes;
+
+  attributes = get_attributes_table (ephy_password_record_get_id (record),
+                                     NULL, NULL, NULL, NULL, NULL, -1);
+  secret_service_search (NULL, EPHY_FORM_PASSWORD_SCHEMA, attributes,
+                         SECRET_SEARCH_ALL,
+                         NULL,
+                         (GAsyncReadyCallback)index_stored_item_cb,
+                         manage_record_async_data_new (self, record));
+  g_hash_table_unref (attributes);
+}
+
+typedef struct {
+  GList          *records;
+  guint           n_pending;
+  QueryAsyncData *query;
+} IndexQueryAsyncData;
+
+static void
+index_query_async_data_free (IndexQueryAsyncData *data)
+{
+  g_list_free_full (data->records, g_object_unref);
+  query_async_data_free (data->query);
+  g_free (data);
+}
+
+static EphyPasswordRecord *
+password_record_new_from_item (SecretItem *item)
+{
+  EphyPasswordRecord *record;
+  GHashTable *attributes;
+  SecretValue *value;
+  const char *timestamp;
+
+  value = secret_item_get_secret (item);
+  if (!value)
+    return NULL;
+
+  attributes = secret_item_get_attributes (item);
+  timestamp = g_hash_table_lookup (attributes, SERVER_TIME_MODIFIED_KEY);
+  record = ephy_password_record_new (g_hash_table_lookup (attributes, ID_KEY),
+                                     g_hash_table_lookup (attributes, ORIGIN_KEY),
+                                     g_hash_table_lookup (attributes, TARGET_ORIGIN_KEY),
+                                     g_hash_table_lookup (attributes, USERNAME_KEY),
+                                     secret_value_get (value, NULL),
+                                     g_hash_table_lookup (attributes, USERNAME_FIELD_KEY),
+                                     g_hash_table_lookup (attributes, PASSWORD_FIELD_KEY),
+                                     secret_item_get_created (item) * 1000,
+                                     secret_item_get_modified (item) * 1000);
+  if (timestamp)
+    ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (record),
+                                                  g_ascii_strtod (timestamp, NULL));
+
+  secret_value_unref (value);
+  g_hash_table_unref (attributes);
+
+  return record;
+}
+
+/* The secret is loaded by a copy of the indexed item, dropped along with the
+ * password once the record is built.
+ */
+static void
+index_query_load_item_cb (GObject             *source_object,
+                          GAsyncResult        *result,
+                          IndexQueryAsyncData *data)
+{
+  SecretItem *item;
+  GError *error = NULL;
+
+  item = secret_item_new_for_dbus_path_finish (result, &error);
+  if (!item) {
+    g_warning ("Failed to load password: %s", error->message);
+    g_error_free (error);
+  } else {
+    EphyPasswordRecord *record = password_record_new_from_item (item);
+
+    if (record)
+      data->records = g_list_prepend (data->records, record);
+    g_object_unref (item);
+  }
+
+  if (--data->n_pending > 0)
+    return;
+
+  if (data->query->callback)
+    data->query->callback (g_steal_pointer (&data->records), data->query->user_data);
+  index_query_async_data_free (data);
+}
+
+static gboolean
+index_query_no_match_cb (QueryAsyncData *data)
+{
+  if (data->callback)
+    data->callback (NULL, data->user_data);
+  query_async_data_free (data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Returns %FALSE if the index cannot answer the query, in which case the
+ * keyring has to be searched.
+ */
+static gboolean
+ephy_password_manager_query_index (EphyPasswordManager              *self,
+                                   const char                       *origin,
+                                   const char                       *target_origin,
+                                   const char                       *username,
+                                   const char                       *username_field,
+                                   const char                       *password_field,
+                                   EphyPasswordManagerQueryCallback  callback,
+                                   gpointer                          user_data)
+{
+  IndexQueryAsyncData *data;
+  GPtrArray *entries;
+  GList *items = NULL;
+
+  if (!self->index_loaded)
+    return FALSE;
+
+  entries = g_hash_table_lookup (self->index, origin);
+  for (guint i = 0; entries && i < entries->len; i++) {
+    PasswordIndexEntry *entry = g_ptr_array_index (entries, i);
+
+    /* Same semantics as a search by attributes: unset parameters match
+     * anything.
+     */
+    if ((target_origin && g_strcmp0 (entry->target_origin, target_origin)) ||
+        (username && g_strcmp0 (entry->username, username)) ||
+        (username_field && g_strcmp0 (entry->username_field, username_field)) ||
+        (password_field && g_strcmp0 (entry->password_field, password_field)))
+      continue;
+
+    /* Locked items need the search to prompt for unlocking the keyring. */
+    if (!entry->item || secret_item_get_locked (entry->item)) {
+      g_list_free_full (items, g_object_unref);
+      return FALSE;
+    }
+
+    items = g_list_prepend (items, g_object_ref (entry->item));
+  }
+
+  if (!items) {
+    g_idle_add ((GSourceFunc)index_query_no_match_cb,
+                query_async_data_new (callback, user_data));
+    return TRUE;
+  }
+
+  data = g_new (IndexQueryAsyncData, 1);
+  data->records = NULL;
+  data->n_pending = g_list_length (items);
+  data->query = query_async_data_new (callback, user_data);
+  for (GList *l = items; l && l->data; l = l->next) {
+    secret_item_new_for_dbus_path (secret_item_get_service (l->data),
+                                   g_dbus_proxy_get_object_path (G_DBUS_PROXY (l->data)),
+                                   SECRET_ITEM_LOAD_SECRET,
+                                   NULL,
+                                   (GAsyncReadyCallback)index_query_load_item_cb,
+                                   data);
+  }
+  g_list_free_full (items, g_object_unref);
+
+  return TRUE;
 }
 
 static void
@@ -314,6 +702,10 @@ ephy_password_manager_dispose (GObject *object)
     g_clear_pointer (&self->cache, g_hash_table_unref);
   }
 
+  g_clear_pointer (&self->index, g_hash_table_unref);
+  /* Queued writes hold a reference on the manager, the queue is empty here. */
+  g_clear_pointer (&self->write_queue, g_queue_free);
+
   G_OBJECT_CLASS (ephy_password_manager_parent_class)->dispose (object);
 }
 
@@ -328,10 +720,12 @@ ephy_password_manager_class_init (EphyPasswordManagerClass *klass)
 static void
 ephy_password_manager_init (EphyPasswordManager *self)
 {
-  LOG ("Loading usernames into internal cache...");
+  LOG ("Loading password records into internal cache...");
   self->cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  ephy_password_manager_query (self, NULL, NULL, NULL, NULL, NULL, NULL,
-                               populate_cache_cb, self);
+  self->index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                       g_free, (GDestroyNotify)g_ptr_array_unref);
+  self->write_queue = g_queue_new ();
+  ephy_password_manager_populate_index (self);
 }
 
 EphyPasswordManager *
@@ -350,39 +744,88 @@ ephy_password_manager_get_usernames_for_origin (EphyPasswordManager *self,
   return g_hash_table_lookup (self->cache, origin);
 }
 
+/* Keyring writes go through a queue that keeps a bounded number of them in
+ * flight, so that merging a large collection does not flood the keyring
+ * daemon. A write forgets a record, stores one, or both in sequence.
+ */
+typedef struct {
+  EphyPasswordManager *manager;
+  EphyPasswordRecord  *record;
+  EphyPasswordRecord  *replacement;
+} PasswordWrite;
+
+static void
+password_write_free (PasswordWrite *write)
+{
+  g_object_unref (write->manager);
+  g_clear_object (&write->record);
+  g_clear_object (&write->replacement);
+  g_free (write);
+}
+
+static void ephy_password_manager_run_writes (EphyPasswordManager *self);
+
+static void
+ephy_password_manager_check_merge_done (EphyPasswordManager *self)
+{
+  if (!self->merge_start_time || self->n_pending_writes > 0 || !g_queue_is_empty (self->write_queue))
+    return;
+
+  LOG ("Merged passwords with %u keyring writes, %u records unchanged, in %.3f ms",
+       self->merge_n_writes, self->merge_n_unchanged,
+       (g_get_monotonic_time () - self->merge_start_time) / 1000.0);
+
+  self->merge_start_time = 0;
+}
+
 static void
-secret_service_store_cb (SecretService         *service,
-                         GAsyncResult          *result,
-                         ManageRecordAsyncData *data)
+password_write_finish (PasswordWrite *write)
 {
+  EphyPasswordManager *self = g_object_ref (write->manager);
+
+  password_write_free (write);
+
+  self->n_pending_writes--;
+  ephy_password_manager_run_writes (self);
+  ephy_password_manager_check_merge_done (self);
+  g_object_unref (self);
+}
+
+static void
+secret_service_store_cb (SecretService *service,
+                         GAsyncResult  *result,
+                         PasswordWrite *write)
+{
+  EphyPasswordRecord *record = write->replacement;
   GError *error = NULL;
   const char *origin;
   const char *username;
 
-  origin = ephy_password_record_get_origin (data->record);
-  username = ephy_password_record_get_username (data->record);
+  origin = ephy_password_record_get_origin (record);
+  username = ephy_password_record_get_username (record);
 
   secret_service_store_finish (service, result, &error);
   if (error) {
     g_warning ("Failed to store password record for (%s, %s, %s, %s, %s): %s",
                origin,
-               ephy_password_record_get_target_origin (data->record),
+               ephy_password_record_get_target_origin (record),
                username,
-               ephy_password_record_get_username_field (data->record),
-               ephy_password_record_get_password_field (data->record),
+               ephy_password_record_get_username_field (record),
+               ephy_password_record_get_password_field (record),
                error->message);
     g_error_free (error);
   } else {
-    ephy_password_manager_cache_add (data->manager, origin, username);
+    ephy_password_manager_cache_add (write->manager, origin, username);
+    ephy_password_manager_index_stored_record (write->manager, record);
   }
 
-  manage_record_async_data_free (data);
+  password_write_finish (write);
 }
 
 static void
-ephy_password_manager_store_record (EphyPasswordManager *self,
-                                    EphyPasswordRecord  *record)
+password_write_store (PasswordWrite *write)
 {
+  EphyPasswordRecord *record = write->replacement;
   GHashTable *attributes;
   SecretValue *value;
   const char *origin;
@@ -394,9 +837,6 @@ ephy_password_manager_store_record (EphyPasswordManager *self,
   char *label;
   gint64 modified;
 
-  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
-  g_assert (EPHY_IS_PASSWORD_RECORD (record));
-
   origin = ephy_password_record_get_origin (record);
   target_origin = ephy_password_record_get_target_origin (record);
   username = ephy_password_record_get_username (record);
@@ -428,13 +868,110 @@ ephy_password_manager_store_record (EphyPasswordManager *self,
   secret_service_store (NULL, EPHY_FORM_PASSWORD_SCHEMA,
                         attributes, NULL, label, value, NULL,
                         (GAsyncReadyCallback)secret_service_store_cb,
-                        manage_record_async_data_new (self, record));
+                        write);
 
   g_free (label);
   secret_value_unref (value);
   g_hash_table_unref (attributes);
 }
 
+static void
+password_write_clear_cb (SecretService *service,
+                         GAsyncResult  *result,
+                         PasswordWrite *write)
+{
+  GError *error = NULL;
+
+  secret_service_clear_finish (service, result, &error);
+  if (error) {
+    g_warning ("Failed to clear secrets from password schema: %s", error->message);
+    g_error_free (error);
+    password_write_finish (write);
+    return;
+  }
+
+  /* The replacement must not be stored before the old record is gone, the
+   * clear would match it too.
+   */
+  if (write->replacement)
+    password_write_store (write);
+  else
+    password_write_finish (write);
+}
+
+static void
+password_write_clear (PasswordWrite *write)
+{
+  EphyPasswordRecord *record = write->record;
+  GHashTable *attributes;
+
+  attributes = get_attributes_table (ephy_password_record_get_id (record),
+                                     ephy_password_record_get_origin (record),
+                                     ephy_password_record_get_target_origin (record),
+                                     ephy_password_record_get_username (record),
+                                     ephy_password_record_get_username_field (record),
+                                     ephy_password_record_get_password_field (record),
+                                     -1);
+
+  LOG ("Forgetting password record for (%s, %s, %s, %s, %s)",
+       ephy_password_record_get_origin (record),
+       ephy_password_record_get_target_origin (record),
+       ephy_password_record_get_username (record),
+       ephy_password_record_get_username_field (record),
+       ephy_password_record_get_password_field (record));
+
+  secret_service_clear (NULL, EPHY_FORM_PASSWORD_SCHEMA, attributes, NULL,
+                        (GAsyncReadyCallback)password_write_clear_cb,
+                        write);
+
+  g_hash_table_unref (attributes);
+}
+
+static void
+ephy_password_manager_run_writes (EphyPasswordManager *self)
+{
+  while (self->n_pending_writes < MAX_PENDING_WRITES && !g_queue_is_empty (self->write_queue)) {
+    PasswordWrite *write = g_queue_pop_head (self->write_queue);
+
+    self->n_pending_writes++;
+    if (write->record)
+      password_write_clear (write);
+    else
+      password_write_store (write);
+  }
+}
+
+static void
+ephy_password_manager_queue_write (EphyPasswordManager *self,
+                                   EphyPasswordRecord  *record,
+                                   EphyPasswordRecord  *replacement)
+{
+  PasswordWrite *write;
+
+  g_assert (record || replacement);
+
+  write = g_new (PasswordWrite, 1);
+  write->manager = g_object_ref (self);
+  write->record = record ? g_object_ref (record) : NULL;
+  write->replacement = replacement ? g_object_ref (replacement) : NULL;
+
+  if (self->merge_start_time)
+    self->merge_n_writes++;
+
+  g_queue_push_tail (self->write_queue, write);
+  ephy_password_manager_run_writes (self);
+}
+
+static void
+ephy_password_manager_store_record (EphyPasswordManager *self,
+                                    EphyPasswordRecord  *record)
+{
+  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
+  g_assert (EPHY_IS_PASSWORD_RECORD (record));
+
+  ephy_password_manager_queue_write (self, NULL, record);
+}
+
 static void
 update_password_cb (GList    *records,
                     gpointer  user_data)
@@ -590,6 +1127,12 @@ ephy_password_manager_query (EphyPasswordManager              *self,
   LOG ("Querying password records for (%s, %s, %s, %s)",
        origin, username, username_field, password_field);
 
+  if (!id && origin &&
+      ephy_password_manager_query_index (self, origin, target_origin, username,
+                                         username_field, password_field,
+                                         callback, user_data))
+    return;
+
   attributes = get_attributes_table (id, origin, target_origin, username,
                                      username_field, password_field, -1);
   data = query_async_data_new (callback, user_data);
@@ -616,13 +1159,6 @@ secret_service_clear_cb (SecretService *service,
   if (error) {
     g_warning ("Failed to clear secrets from password schema: %s", error->message);
     g_error_free (error);
-    return;
-  }
-
-  if (user_data) {
-    ManageRecordAsyncData *data = (ManageRecordAsyncData *)user_data;
-    ephy_password_manager_store_record (data->manager, data->record);
-    manage_record_async_data_free (data);
   }
 }
 
@@ -631,34 +1167,50 @@ ephy_password_manager_forget_record (EphyPasswordManager *self,
                                      EphyPasswordRecord  *record,
                                      EphyPasswordRecord  *replacement)
 {
-  GHashTable *attributes;
-
   g_assert (EPHY_IS_PASSWORD_MANAGER (self));
   g_assert (EPHY_IS_PASSWORD_RECORD (record));
 
-  attributes = get_attributes_table (ephy_password_record_get_id (record),
-                                     ephy_password_record_get_origin (record),
-                                     ephy_password_record_get_target_origin (record),
-                                     ephy_password_record_get_username (record),
-                                     ephy_password_record_get_username_field (record),
-                                     ephy_password_record_get_password_field (record),
-                                     -1);
-
-  LOG ("Forgetting password record for (%s, %s, %s, %s, %s)",
-       ephy_password_record_get_origin (record),
-       ephy_password_record_get_target_origin (record),
-       ephy_password_record_get_username (record),
-       ephy_password_record_get_username_field (record),
-       ephy_password_record_get_password_field (record));
-
-  secret_service_clear (NULL, EPHY_FORM_PASSWORD_SCHEMA, attributes, NULL,
-                        (GAsyncReadyCallback)secret_service_clear_cb,
-                        replacement ? manage_record_async_data_new (self, replacement) : NULL);
+  ephy_password_manager_queue_write (self, record, replacement);
 
   ephy_password_manager_cache_remove (self,
                                       ephy_password_record_get_origin (record),
                                       ephy_password_record_get_username (record));
-  g_hash_table_unref (attributes);
+  ephy_password_manager_index_remove (self,
+                                      ephy_password_record_get_origin (record),
+                                      ephy_password_record_get_id (record));
+}
+
+static gboolean
+password_records_have_same_attributes (EphyPasswordRecord *a,
+                                       EphyPasswordRecord *b)
+{
+  return !g_strcmp0 (ephy_password_record_get_id (a), ephy_password_record_get_id (b)) &&
+         !g_strcmp0 (ephy_password_record_get_origin (a), ephy_password_record_get_origin (b)) &&
+         !g_strcmp0 (ephy_password_record_get_target_origin (a), ephy_password_record_get_target_origin (b)) &&
+         !g_strcmp0 (ephy_password_record_get_username (a), ephy_password_record_get_username (b)) &&
+         !g_strcmp0 (ephy_password_record_get_username_field (a), ephy_password_record_get_username_field (b)) &&
+         !g_strcmp0 (ephy_password_record_get_password_field (a), ephy_password_record_get_password_field (b)) &&
+         ephy_synchronizable_get_server_time_modified (EPHY_SYNCHRONIZABLE (a)) ==
+         ephy_synchronizable_get_server_time_modified (EPHY_SYNCHRONIZABLE (b));
+}
+
+/* Replaces @record by @replacement in the keyring, doing only the writes
+ * needed: nothing if they are identical, and a single store, which updates
+ * the existing item, if only the password differs.
+ */
+static void
+ephy_password_manager_replace_record (EphyPasswordManager *self,
+                                      EphyPasswordRecord  *record,
+                                      EphyPasswordRecord  *replacement)
+{
+  if (!password_records_have_same_attributes (record, replacement)) {
+    ephy_password_manager_forget_record (self, record, replacement);
+  } else if (g_strcmp0 (ephy_password_record_get_password (record),
+                        ephy_password_record_get_password (replacement))) {
+    ephy_password_manager_store_record (self, replacement);
+  } else if (self->merge_start_time) {
+    self->merge_n_unchanged++;
+  }
 }
 
 static void
@@ -710,6 +1262,9 @@ forget_all_cb (GList    *records,
     g_signal_emit_by_name (self, "synchronizable-deleted", l->data);
 
   ephy_password_manager_cache_clear (self);
+  g_hash_table_remove_all (self->index);
+  if (!self->index_loaded)
+    self->index_changed = TRUE;
 
   g_hash_table_unref (attributes);
   g_list_free_full (records, g_object_unref);
@@ -931,11 +1486,11 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
           if (local_server_time_modified < remote_server_time_modified) {
             ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (record),
                                                           remote_server_time_modified);
-            ephy_password_manager_replace_existing (self, record);
+            ephy_password_manager_forget_record (self, record, record);
           }
         } else {
           /* Remote record is newer. Forget local record and store remote record. */
-          ephy_password_manager_forget_record (self, record, l->data);
+          ephy_password_manager_replace_record (self, record, l->data);
           g_hash_table_add (dont_upload, g_strdup (remote_id));
         }
       }
@@ -1033,7 +1588,7 @@ ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
     record = get_record_by_id (*local_records, remote_id);
     if (record) {
       /* Same id. Overwrite local record. */
-      ephy_password_manager_forget_record (self, record, l->data);
+      ephy_password_manager_replace_record (self, record, l->data);
     } else {
       record = get_record_by_parameters (*local_records,
                                          remote_origin,
@@ -1067,8 +1622,12 @@ merge_cb (GList    *records,
           gpointer  user_data)
 {
   MergePasswordsAsyncData *data = (MergePasswordsAsyncData *)user_data;
+  EphyPasswordManager *self = data->manager;
   GPtrArray *to_upload;
 
+  LOG ("Loaded %u local password records in %.3f ms", g_list_length (records),
+       (g_get_monotonic_time () - self->merge_start_time) / 1000.0);
+
   if (data->is_initial)
     to_upload = ephy_password_manager_handle_initial_merge (data->manager, records,
                                                             data->remotes_updated);
@@ -1077,6 +1636,11 @@ merge_cb (GList    *records,
                                                             data->remotes_deleted,
                                                             data->remotes_updated);
 
+  LOG ("Queued %u keyring writes for %u deleted and %u updated remote password records",
+       self->merge_n_writes, g_list_length (data->remotes_deleted),
+       g_list_length (data->remotes_updated));
+  ephy_password_manager_check_merge_done (self);
+
   data->callback (to_upload, data->user_data);
 
   g_list_free_full (records, g_object_unref);
@@ -1093,6 +1657,10 @@ synchronizable_manager_merge (EphySynchronizableManager              *manager,
 {
   EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (manager);
 
+  self->merge_start_time = g_get_monotonic_time ();
+  self->merge_n_writes = 0;
+  self->merge_n_unchanged = 0;
+
   ephy_password_manager_query (self, NULL, NULL, NULL, NULL, NULL, NULL,
                                merge_cb,
                                merge_passwords_async_data_new (self,
@@ -466,9 +466,8 @@ ephy_sync_crypto_key_bundle_new (const char *aes_key_b64,
   bundle = g_new (SyncCryptoKeyBundle, 1);
   bundle->aes_key_hex = ephy_sync_utils_encode_hex (aes_key, aes_key_len);
   bundle->hmac_key_hex = ephy_sync_utils_encode_hex (hmac_key, hmac_key_len);
-
-  g_free (aes_key);
-  g_free (hmac_key);
+  bundle->aes_key = aes_key;
+  bundle->hmac_key = hmac_key;
 
   return bundle;
 }
@@ -480,6 +479,8 @@ ephy_sync_crypto_key_bundle_free (SyncCryptoKeyBundle *bundle)
 
   g_free (bundle->aes_key_hex);
   g_free (bundle->hmac_key_hex);
+  g_free (bundle->aes_key);
+  g_free (bundle->hmac_key);
 
   g_free (bundle);
 }
@@ -793,6 +794,8 @@ ephy_sync_crypto_derive_master_bundle (const guint8 *key)
   bundle = g_new (SyncCryptoKeyBundle, 1);
   bundle->aes_key_hex = g_strdup (aes_key_hex);
   bundle->hmac_key_hex = g_strdup (hmac_key_hex);
+  bundle->aes_key = ephy_sync_utils_decode_hex (aes_key_hex);
+  bundle->hmac_key = ephy_sync_utils_decode_hex (hmac_key_hex);
 
   g_free (hmac_key_hex);
   g_free (tmp);
@@ -972,8 +975,6 @@ ephy_sync_crypto_encrypt_record (const char          *cleartext,
   char *iv_b64;
   char *ciphertext_b64;
   char *hmac;
-  guint8 *aes_key;
-  guint8 *hmac_key;
   guint8 *ciphertext;
   guint8 *iv;
   gsize ciphertext_len;
@@ -981,22 +982,18 @@ ephy_sync_crypto_encrypt_record (const char          *cleartext,
   g_assert (cleartext);
   g_assert (bundle);
 
-  /* Get the encryption key and the HMAC key. */
-  aes_key = ephy_sync_utils_decode_hex (bundle->aes_key_hex);
-  hmac_key = ephy_sync_utils_decode_hex (bundle->hmac_key_hex);
-
   /* Generate a random 16 bytes initialization vector. */
   iv = g_malloc (IV_LEN);
   ephy_sync_utils_generate_random_bytes (NULL, IV_LEN, iv);
 
   /* Encrypt the record using the AES key. */
-  ciphertext = ephy_sync_crypto_aes_256_encrypt (cleartext, aes_key,
+  ciphertext = ephy_sync_crypto_aes_256_encrypt (cleartext, bundle->aes_key,
                                                  iv, &ciphertext_len);
   ciphertext_b64 = g_base64_encode (ciphertext, ciphertext_len);
   iv_b64 = g_base64_encode (iv, IV_LEN);
   /* SHA256 expects a 32 bytes key. */
   hmac = g_compute_hmac_for_string (G_CHECKSUM_SHA256,
-                                    hmac_key, 32,
+                                    bundle->hmac_key, 32,
                                     ciphertext_b64, -1);
 
   node = json_node_new (JSON_NODE_OBJECT);
@@ -1014,8 +1011,6 @@ ephy_sync_crypto_encrypt_record (const char          *cleartext,
   g_free (ciphertext_b64);
   g_free (ciphertext);
   g_free (iv);
-  g_free (aes_key);
-  g_free (hmac_key);
 
   return payload;
 }
@@ -1095,8 +1090,6 @@ ephy_sync_crypto_decrypt_record (const char          *payload,
   JsonNode *node = NULL;
   JsonObject *json = NULL;
   GError *error = NULL;
-  guint8 *aes_key = NULL;
-  guint8 *hmac_key = NULL;
   guint8 *ciphertext = NULL;
   guint8 *iv = NULL;
   char *cleartext = NULL;
@@ -1128,14 +1121,10 @@ ephy_sync_crypto_decrypt_record (const char          *payload,
     goto out;
   }
 
-  /* Get the encryption key and the HMAC key. */
-  aes_key = ephy_sync_utils_decode_hex (bundle->aes_key_hex);
-  hmac_key = ephy_sync_utils_decode_hex (bundle->hmac_key_hex);
-
   /* Under no circumstances should a client try to decrypt a record
    * if the HMAC verification fails.
    */
-  if (!ephy_sync_crypto_hmac_is_valid (ciphertext_b64, hmac_key, hmac)) {
+  if (!ephy_sync_crypto_hmac_is_valid (ciphertext_b64, bundle->hmac_key, hmac)) {
     g_warning ("Incorrect HMAC value");
     goto out;
   }
@@ -1144,13 +1133,11 @@ ephy_sync_crypto_decrypt_record (const char          *payload,
   ciphertext = g_base64_decode (ciphertext_b64, &ciphertext_len);
   iv = g_base64_decode (iv_b64, &iv_len);
   cleartext = ephy_sync_crypto_aes_256_decrypt (ciphertext, ciphertext_len,
-                                                aes_key, iv);
+                                                bundle->aes_key, iv);
 
 out:
   g_free (ciphertext);
   g_free (iv);
-  g_free (aes_key);
-  g_free (hmac_key);
   if (node)
     json_node_unref (node);
   if (error)
@@ -61,8 +61,12 @@ typedef struct {
 } SyncCryptoRSAKeyPair;
 
 typedef struct {
-  char *aes_key_hex;
-  char *hmac_key_hex;
+  char   *aes_key_hex;
+  char   *hmac_key_hex;
+
+  /* The same keys, decoded once for all the records they are used on. */
+  guint8 *aes_key;
+  guint8 *hmac_key;
 } SyncCryptoKeyBundle;
 
 SyncCryptoHawkOptions *ephy_sync_crypto_hawk_options_new        (const char *app,
@@ -0,0 +1,461 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-sync-dirty-set.h"
+
+#include "ephy-debug.h"
+
+#include <gio/gio.h>
+
+/* Version, then collection -> id -> (payload, server time modified, force). */
+#define DIRTY_SET_FORMAT "(ua{sa{s(sxb)}})"
+#define DIRTY_SET_VERSION 1
+#define DIRTY_SET_SAVE_DELAY_SECONDS 2
+
+struct _EphySyncDirtySet {
+  GObject     parent_instance;
+
+  char       *path;
+  GHashTable *collections;
+  guint       save_source_id;
+};
+
+G_DEFINE_TYPE (EphySyncDirtySet, ephy_sync_dirty_set, G_TYPE_OBJECT)
+
+static EphySyncDirtyEntry *
+ephy_sync_dirty_entry_new (const char *id,
+                           const char *payload,
+                           gint64      server_time_modified,
+                           gboolean    should_force)
+{
+  EphySyncDirtyEntry *entry;
+
+  entry = g_new (EphySyncDirtyEntry, 1);
+  entry->id = g_strdup (id);
+  entry->payload = g_strdup (payload);
+  entry->server_time_modified = server_time_modified;
+  entry->should_force = should_force;
+
+  return entry;
+}
+
+void
+ephy_sync_dirty_entry_free (EphySyncDirtyEntry *entry)
+{
+  g_assert (entry);
+
+  g_free (entry->id);
+  g_free (entry->payload);
+  g_free (entry);
+}
+
+static GHashTable *
+get_collection (EphySyncDirtySet *self,
+                const char       *collection,
+                gboolean          create)
+{
+  GHashTable *entries = g_hash_table_lookup (self->collections, collection);
+
+  if (!entries && create) {
+    entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                     NULL, (GDestroyNotify)ephy_sync_dirty_entry_free);
+    g_hash_table_insert (self->collections, g_strdup (collection), entries);
+  }
+
+  return entries;
+}
+
+static GBytes *
+ephy_sync_dirty_set_serialize (EphySyncDirtySet *self)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  GVariant *variant;
+  GBytes *bytes;
+  const char *collection;
+  GHashTable *entries;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{s(sxb)}}"));
+  g_hash_table_iter_init (&iter, self->collections);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&collection, (gpointer *)&entries)) {
+    GHashTableIter entries_iter;
+    EphySyncDirtyEntry *entry;
+
+    g_variant_builder_open (&builder, G_VARIANT_TYPE ("{sa{s(sxb)}}"));
+    g_variant_builder_add (&builder, "s", collection);
+    g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{s(sxb)}"));
+
+    g_hash_table_iter_init (&entries_iter, entries);
+    while (g_hash_table_iter_next (&entries_iter, NULL, (gpointer *)&entry)) {
+      g_variant_builder_add (&builder, "{s(sxb)}", entry->id,
+                             entry->payload, entry->server_time_modified,
+                             entry->should_force);
+    }
+
+    g_variant_builder_close (&builder);
+    g_variant_builder_close (&builder);
+  }
+
+  variant = g_variant_ref_sink (g_variant_new ("(u@a{sa{s(sxb)}})",
+                                               DIRTY_SET_VERSION,
+                                               g_variant_builder_end (&builder)));
+  bytes = g_variant_get_data_as_bytes (variant);
+  g_variant_unref (variant);
+
+  return bytes;
+}
+
+static void
+ephy_sync_dirty_set_load (EphySyncDirtySet *self)
+{
+  GVariant *variant;
+  GVariantIter *collections_iter;
+  GVariantIter *entries_iter;
+  char *contents;
+  gsize length;
+  guint32 version;
+  const char *collection;
+  const char *id;
+  const char *payload;
+  gint64 server_time_modified;
+  gboolean should_force;
+
+  if (!g_file_get_contents (self->path, &contents, &length, NULL))
+    return;
+
+  variant = g_variant_new_from_data (G_VARIANT_TYPE (DIRTY_SET_FORMAT),
+                                     contents, length, FALSE,
+                                     g_free, contents);
+  g_variant_get (variant, "(ua{sa{s(sxb)}})", &version, &collections_iter);
+
+  if (version == DIRTY_SET_VERSION) {
+    while (g_variant_iter_next (collections_iter, "{&sa{s(sxb)}}", &collection, &entries_iter)) {
+      GHashTable *entries = get_collection (self, collection, TRUE);
+
+      while (g_variant_iter_next (entries_iter, "{&s(&sxb)}", &id,
+                                  &payload, &server_time_modified, &should_force)) {
+        EphySyncDirtyEntry *entry = ephy_sync_dirty_entry_new (id, payload,
+                                                               server_time_modified,
+                                                               should_force);
+        g_hash_table_replace (entries, entry->id, entry);
+      }
+
+      g_variant_iter_free (entries_iter);
+    }
+  }
+
+  g_variant_iter_free (collections_iter);
+  g_variant_unref (variant);
+}
+
+static void
+dirty_set_saved_cb (GFile        *file,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (file, result, NULL, &error)) {
+    g_warning ("Failed to save the sync dirty set: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+static gboolean
+dirty_set_save_cb (EphySyncDirtySet *self)
+{
+  GFile *file;
+  GBytes *bytes;
+
+  self->save_source_id = 0;
+
+  bytes = ephy_sync_dirty_set_serialize (self);
+  file = g_file_new_for_path (self->path);
+  g_file_replace_contents_bytes_async (file, bytes, NULL, FALSE,
+                                       G_FILE_CREATE_PRIVATE, NULL,
+                                       (GAsyncReadyCallback)dirty_set_saved_cb,
+                                       NULL);
+
+  g_object_unref (file);
+  g_bytes_unref (bytes);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Changes are written back lazily, so that a burst of edits results in a
+ * single write.
+ */
+static void
+ephy_sync_dirty_set_schedule_save (EphySyncDirtySet *self)
+{
+  if (!self->path || self->save_source_id)
+    return;
+
+  self->save_source_id = g_timeout_add_seconds (DIRTY_SET_SAVE_DELAY_SECONDS,
+                                                (GSourceFunc)dirty_set_save_cb,
+                                                self);
+  g_source_set_name_by_id (self->save_source_id, "[epiphany] dirty_set_save_cb");
+}
+
+static void
+ephy_sync_dirty_set_dispose (GObject *object)
+{
+  EphySyncDirtySet *self = EPHY_SYNC_DIRTY_SET (object);
+
+  /* Pending changes must survive the browser being closed. */
+  if (self->save_source_id) {
+    GBytes *bytes = ephy_sync_dirty_set_serialize (self);
+    GError *error = NULL;
+
+    g_source_remove (self->save_source_id);
+    self->save_source_id = 0;
+
+    if (!g_file_set_contents (self->path, g_bytes_get_data (bytes, NULL),
+                              g_bytes_get_size (bytes), &error)) {
+      g_warning ("Failed to save the sync dirty set: %s", error->message);
+      g_error_free (error);
+    }
+
+    g_bytes_unref (bytes);
+  }
+
+  G_OBJECT_CLASS (ephy_sync_dirty_set_parent_class)->dispose (object);
+}
+
+static void
+ephy_sync_dirty_set_finalize (GObject *object)
+{
+  EphySyncDirtySet *self = EPHY_SYNC_DIRTY_SET (object);
+
+  g_free (self->path);
+  g_hash_table_unref (self->collections);
+
+  G_OBJECT_CLASS (ephy_sync_dirty_set_parent_class)->finalize (object);
+}
+
+static void
+ephy_sync_dirty_set_class_init (EphySyncDirtySetClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_sync_dirty_set_dispose;
+  object_class->finalize = ephy_sync_dirty_set_finalize;
+}
+
+static void
+ephy_sync_dirty_set_init (EphySyncDirtySet *self)
+{
+  self->collections = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, (GDestroyNotify)g_hash_table_unref);
+}
+
+/**
+ * ephy_sync_dirty_set_new:
+ * @path: (nullable): the file the set is persisted to, or %NULL to keep it
+ *        in memory only
+ *
+ * Creates a set of local changes waiting to be uploaded, loading the
+ * changes left over from a previous session from @path.
+ *
+ * Return value: (transfer full): a new #EphySyncDirtySet
+ **/
+EphySyncDirtySet *
+ephy_sync_dirty_set_new (const char *path)
+{
+  EphySyncDirtySet *self = g_object_new (EPHY_TYPE_SYNC_DIRTY_SET, NULL);
+
+  self->path = g_strdup (path);
+  if (self->path)
+    ephy_sync_dirty_set_load (self);
+
+  return self;
+}
+
+/**
+ * ephy_sync_dirty_set_add:
+ * @self: an #EphySyncDirtySet
+ * @collection: the collection the record belongs to
+ * @id: the id of the record
+ * @payload: the encrypted payload of the record
+ * @server_time_modified: the server modified time of the version of the
+ *                        record that was changed
+ * @should_force: whether the change should overwrite newer server versions
+ *
+ * Records a change to be uploaded on the next sync, replacing any previous
+ * change to the same record. A forced change stays forced until uploaded.
+ **/
+void
+ephy_sync_dirty_set_add (EphySyncDirtySet *self,
+                         const char       *collection,
+                         const char       *id,
+                         const char       *payload,
+                         gint64            server_time_modified,
+                         gboolean          should_force)
+{
+  GHashTable *entries;
+  EphySyncDirtyEntry *previous;
+  EphySyncDirtyEntry *entry;
+
+  g_assert (EPHY_IS_SYNC_DIRTY_SET (self));
+  g_assert (collection);
+  g_assert (id);
+  g_assert (payload);
+
+  entries = get_collection (self, collection, TRUE);
+  previous = g_hash_table_lookup (entries, id);
+  if (previous) {
+    /* The record is still based on the version of the first change. */
+    server_time_modified = previous->server_time_modified;
+    should_force = should_force || previous->should_force;
+  }
+
+  entry = ephy_sync_dirty_entry_new (id, payload, server_time_modified, should_force);
+  g_hash_table_replace (entries, entry->id, entry);
+
+  LOG ("Marked %s record %s as dirty%s", collection, id, previous ? " again" : "");
+  ephy_sync_dirty_set_schedule_save (self);
+}
+
+/**
+ * ephy_sync_dirty_set_get_entries:
+ * @self: an #EphySyncDirtySet
+ * @collection: a collection name
+ *
+ * Return value: (transfer full): a copy of the pending changes of
+ *               @collection, as #EphySyncDirtyEntry
+ **/
+GPtrArray *
+ephy_sync_dirty_set_get_entries (EphySyncDirtySet *self,
+                                 const char       *collection)
+{
+  GHashTable *entries;
+  GHashTableIter iter;
+  EphySyncDirtyEntry *entry;
+  GPtrArray *copy;
+
+  g_assert (EPHY_IS_SYNC_DIRTY_SET (self));
+  g_assert (collection);
+
+  copy = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_sync_dirty_entry_free);
+  entries = get_collection (self, collection, FALSE);
+  if (!entries)
+    return copy;
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry)) {
+    g_ptr_array_add (copy, ephy_sync_dirty_entry_new (entry->id, entry->payload,
+                                                      entry->server_time_modified,
+                                                      entry->should_force));
+  }
+
+  return copy;
+}
+
+/**
+ * ephy_sync_dirty_set_remove:
+ * @self: an #EphySyncDirtySet
+ * @collection: a collection name
+ * @entry: an uploaded change, as returned by ephy_sync_dirty_set_get_entries()
+ * @server_time_modified: the server modified time of the uploaded version
+ *
+ * Forgets about @entry once its upload has been committed. If the record was
+ * changed again in the meantime, the newer change is kept, now based on the
+ * uploaded version.
+ *
+ * Return value: %TRUE if no change of the record is pending anymore
+ **/
+gboolean
+ephy_sync_dirty_set_remove (EphySyncDirtySet   *self,
+                            const char         *collection,
+                            EphySyncDirtyEntry *entry,
+                            gint64              server_time_modified)
+{
+  GHashTable *entries;
+  EphySyncDirtyEntry *current;
+
+  g_assert (EPHY_IS_SYNC_DIRTY_SET (self));
+  g_assert (collection);
+  g_assert (entry);
+
+  entries = get_collection (self, collection, FALSE);
+  if (!entries)
+    return TRUE;
+
+  current = g_hash_table_lookup (entries, entry->id);
+  if (!current)
+    return TRUE;
+
+  ephy_sync_dirty_set_schedule_save (self);
+
+  if (!g_strcmp0 (current->payload, entry->payload)) {
+    g_hash_table_remove (entries, entry->id);
+    return TRUE;
+  }
+
+  current->server_time_modified = server_time_modified;
+  return FALSE;
+}
+
+/**
+ * ephy_sync_dirty_set_discard:
+ * @self: an #EphySyncDirtySet
+ * @collection: a collection name
+ * @id: a record id
+ *
+ * Forgets about the pending change of record @id, if any, e.g. because a
+ * newer version of it is uploaded by other means or won a conflict.
+ **/
+void
+ephy_sync_dirty_set_discard (EphySyncDirtySet *self,
+                             const char       *collection,
+                             const char       *id)
+{
+  GHashTable *entries;
+
+  g_assert (EPHY_IS_SYNC_DIRTY_SET (self));
+  g_assert (collection);
+  g_assert (id);
+
+  entries = get_collection (self, collection, FALSE);
+  if (entries && g_hash_table_remove (entries, id))
+    ephy_sync_dirty_set_schedule_save (self);
+}
+
+/**
+ * ephy_sync_dirty_set_clear:
+ * @self: an #EphySyncDirtySet
+ * @collection: (nullable): a collection name, or %NULL for all collections
+ *
+ * Drops the pending changes of @collection.
+ **/
+void
+ephy_sync_dirty_set_clear (EphySyncDirtySet *self,
+                           const char       *collection)
+{
+  g_assert (EPHY_IS_SYNC_DIRTY_SET (self));
+
+  if (collection)
+    g_hash_table_remove (self->collections, collection);
+  else
+    g_hash_table_remove_all (self->collections);
+
+  ephy_sync_dirty_set_schedule_save (self);
+}
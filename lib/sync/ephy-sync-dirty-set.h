@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_SYNC_DIRTY_SET (ephy_sync_dirty_set_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphySyncDirtySet, ephy_sync_dirty_set, EPHY, SYNC_DIRTY_SET, GObject)
+
+/* A local change waiting to be uploaded: the encrypted BSO payload of the
+ * record, and the server modified time of the version it was made on.
+ */
+typedef struct {
+  char     *id;
+  char     *payload;
+  gint64    server_time_modified;
+  gboolean  should_force;
+} EphySyncDirtyEntry;
+
+void              ephy_sync_dirty_entry_free       (EphySyncDirtyEntry *entry);
+
+EphySyncDirtySet *ephy_sync_dirty_set_new          (const char       *path);
+void              ephy_sync_dirty_set_add          (EphySyncDirtySet *self,
+                                                    const char       *collection,
+                                                    const char       *id,
+                                                    const char       *payload,
+                                                    gint64            server_time_modified,
+                                                    gboolean          should_force);
+GPtrArray        *ephy_sync_dirty_set_get_entries  (EphySyncDirtySet *self,
+                                                    const char       *collection);
+gboolean          ephy_sync_dirty_set_remove       (EphySyncDirtySet   *self,
+                                                    const char         *collection,
+                                                    EphySyncDirtyEntry *entry,
+                                                    gint64              server_time_modified);
+void              ephy_sync_dirty_set_discard      (EphySyncDirtySet *self,
+                                                    const char       *collection,
+                                                    const char       *id);
+void              ephy_sync_dirty_set_clear        (EphySyncDirtySet *self,
+                                                    const char       *collection);
+
+G_END_DECLS
@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-sync-dirty-set.h"
+#include "ephy-sync-service.h"
+
+G_BEGIN_DECLS
+
+/* Points the service to a local storage server, skipping the Firefox
+ * Accounts sign in and the network connectivity check. Only meant for tests
+ * and benchmarks.
+ */
+void ephy_sync_service_set_storage_for_testing (EphySyncService *self,
+                                                const char      *storage_endpoint,
+                                                const char      *crypto_keys);
+
+EphySyncDirtySet *ephy_sync_service_get_dirty_set_for_testing (EphySyncService *self);
+
+G_END_DECLS
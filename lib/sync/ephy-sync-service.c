@@ -22,10 +22,17 @@
 #include "ephy-sync-service.h"
 
 #include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-metrics.h"
 #include "ephy-notification.h"
+#include "ephy-open-tabs-manager.h"
+#include "ephy-profile-utils.h"
 #include "ephy-settings.h"
 #include "ephy-sync-crypto.h"
+#include "ephy-sync-dirty-set.h"
+#include "ephy-sync-service-private.h"
 #include "ephy-sync-utils.h"
+#include "ephy-trace.h"
 #include "ephy-user-agent.h"
 
 #include <glib/gi18n.h>
@@ -46,6 +53,9 @@ struct _EphySyncService {
   GHashTable  *secrets;
   GSList      *managers;
 
+  EphySyncDirtySet *dirty_set;
+  GHashTable       *dirty_synchronizables;
+
   gboolean     locked;
   char        *storage_endpoint;
   char        *storage_credentials_id;
@@ -58,6 +68,7 @@ struct _EphySyncService {
 
   gboolean sync_periodically;
   gboolean is_signing_in;
+  gboolean is_testing;
 };
 
 G_DEFINE_TYPE (EphySyncService, ephy_sync_service, G_TYPE_OBJECT);
@@ -124,24 +135,35 @@ typedef struct {
   gboolean                   is_last;
   GList                     *remotes_deleted;
   GList                     *remotes_updated;
+  GPtrArray                 *to_upload;
+  gint64                     newer;
+  char                      *offset;
+  gint64                     last_modified;
+  guint                      n_pages;
+  gint64                     begin_time;
 } SyncCollectionAsyncData;
 
-typedef struct {
-  EphySyncService           *service;
-  EphySynchronizableManager *manager;
-  EphySynchronizable        *synchronizable;
-} SyncAsyncData;
+/* Uploads either the synchronizables to upload after a merge or the entries
+ * of the dirty set in the range [start, end). The covered entries are the
+ * changes of the dirty set that the synchronizables upload too, by id.
+ * Batches of a collection are uploaded one after the other, each one only
+ * if the collection is unmodified since the previous commit.
+ */
+typedef struct _BatchUploadAsyncData BatchUploadAsyncData;
 
-typedef struct {
+struct _BatchUploadAsyncData {
   EphySyncService           *service;
   EphySynchronizableManager *manager;
   GPtrArray                 *synchronizables;
+  GPtrArray                 *entries;
+  GHashTable                *covered_entries;
   guint                      start;
   guint                      end;
   char                      *batch_id;
-  gboolean                   batch_is_last;
   gboolean                   sync_done;
-} BatchUploadAsyncData;
+  gint64                     unmodified_since;
+  BatchUploadAsyncData      *next;
+};
 
 static StorageRequestAsyncData *
 storage_request_async_data_new (const char          *endpoint,
@@ -239,6 +261,12 @@ sync_collection_async_data_new (EphySyncService           *service,
   data->is_last = is_last;
   data->remotes_deleted = NULL;
   data->remotes_updated = NULL;
+  data->to_upload = NULL;
+  data->newer = is_initial ? -1 : ephy_synchronizable_manager_get_sync_time (manager);
+  data->offset = NULL;
+  data->last_modified = -1;
+  data->n_pages = 0;
+  data->begin_time = g_get_monotonic_time ();
 
   return data;
 }
@@ -248,36 +276,16 @@ sync_collection_async_data_free (SyncCollectionAsyncData *data)
 {
   g_assert (data);
 
+  ephy_trace_mark ("sync", "sync-collection", data->begin_time);
+  ephy_metrics_add_duration ("sync", "sync-collection", g_get_monotonic_time () - data->begin_time);
+
   g_object_unref (data->service);
   g_object_unref (data->manager);
   g_list_free_full (data->remotes_deleted, g_object_unref);
   g_list_free_full (data->remotes_updated, g_object_unref);
-  g_free (data);
-}
-
-static SyncAsyncData *
-sync_async_data_new (EphySyncService           *service,
-                     EphySynchronizableManager *manager,
-                     EphySynchronizable        *synchronizable)
-{
-  SyncAsyncData *data;
-
-  data = g_new (SyncAsyncData, 1);
-  data->service = g_object_ref (service);
-  data->manager = g_object_ref (manager);
-  data->synchronizable = g_object_ref (synchronizable);
-
-  return data;
-}
-
-static void
-sync_async_data_free (SyncAsyncData *data)
-{
-  g_assert (data);
-
-  g_object_unref (data->service);
-  g_object_unref (data->manager);
-  g_object_unref (data->synchronizable);
+  if (data->to_upload)
+    g_ptr_array_unref (data->to_upload);
+  g_free (data->offset);
   g_free (data);
 }
 
@@ -285,10 +293,11 @@ static inline BatchUploadAsyncData *
 batch_upload_async_data_new (EphySyncService           *service,
                              EphySynchronizableManager *manager,
                              GPtrArray                 *synchronizables,
+                             GPtrArray                 *entries,
+                             GHashTable                *covered_entries,
                              guint                      start,
                              guint                      end,
                              const char                *batch_id,
-                             gboolean                   batch_is_last,
                              gboolean                   sync_done)
 {
   BatchUploadAsyncData *data;
@@ -296,27 +305,19 @@ batch_upload_async_data_new (EphySyncService           *service,
   data = g_new (BatchUploadAsyncData, 1);
   data->service = g_object_ref (service);
   data->manager = g_object_ref (manager);
-  data->synchronizables = g_ptr_array_ref (synchronizables);
+  data->synchronizables = synchronizables ? g_ptr_array_ref (synchronizables) : NULL;
+  data->entries = entries ? g_ptr_array_ref (entries) : NULL;
+  data->covered_entries = covered_entries ? g_hash_table_ref (covered_entries) : NULL;
   data->start = start;
   data->end = end;
   data->batch_id = g_strdup (batch_id);
-  data->batch_is_last = batch_is_last;
   data->sync_done = sync_done;
+  data->unmodified_since = -1;
+  data->next = NULL;
 
   return data;
 }
 
-static inline BatchUploadAsyncData *
-batch_upload_async_data_dup (BatchUploadAsyncData *data)
-{
-  g_assert (data);
-
-  return batch_upload_async_data_new (data->service, data->manager,
-                                      data->synchronizables, data->start,
-                                      data->end, data->batch_id,
-                                      data->batch_is_last, data->sync_done);
-}
-
 static inline void
 batch_upload_async_data_free (BatchUploadAsyncData *data)
 {
@@ -324,8 +325,15 @@ batch_upload_async_data_free (BatchUploadAsyncData *data)
 
   g_object_unref (data->service);
   g_object_unref (data->manager);
-  g_ptr_array_unref (data->synchronizables);
+  if (data->synchronizables)
+    g_ptr_array_unref (data->synchronizables);
+  if (data->entries)
+    g_ptr_array_unref (data->entries);
+  if (data->covered_entries)
+    g_hash_table_unref (data->covered_entries);
   g_free (data->batch_id);
+  if (data->next)
+    batch_upload_async_data_free (data->next);
   g_free (data);
 }
 
@@ -1081,34 +1089,51 @@ ephy_sync_service_queue_storage_request (EphySyncService     *self,
   }
 }
 
-static void
-delete_synchronizable_cb (SoupSession *session,
-                          SoupMessage *msg,
-                          gpointer     user_data)
+/* The records of the changes marked dirty during this session, by
+ * collection and id, so that their server modified time can be updated once
+ * uploaded. Changes left over from a previous session have none.
+ */
+static GHashTable *
+ephy_sync_service_get_dirty_synchronizables (EphySyncService *self,
+                                             const char      *collection,
+                                             gboolean         create)
 {
-  if (msg->status_code == 200) {
-    LOG ("Successfully deleted from server");
-  } else {
-    g_warning ("Failed to delete object. Status code: %u, response: %s",
-               msg->status_code, msg->response_body->data);
+  GHashTable *synchronizables = g_hash_table_lookup (self->dirty_synchronizables, collection);
+
+  if (!synchronizables && create) {
+    synchronizables = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+    g_hash_table_insert (self->dirty_synchronizables, g_strdup (collection), synchronizables);
   }
+
+  return synchronizables;
 }
 
 static void
-ephy_sync_service_delete_synchronizable (EphySyncService           *self,
-                                         EphySynchronizableManager *manager,
-                                         EphySynchronizable        *synchronizable)
+ephy_sync_service_forget_dirty_synchronizable (EphySyncService *self,
+                                               const char      *collection,
+                                               const char      *id)
+{
+  GHashTable *synchronizables = ephy_sync_service_get_dirty_synchronizables (self, collection, FALSE);
+
+  if (synchronizables)
+    g_hash_table_remove (synchronizables, id);
+}
+
+/* Local changes are not uploaded right away: they are encrypted and kept in
+ * the dirty set until the next sync, which uploads them in batches. Editing
+ * a record several times in between results in a single upload.
+ */
+static void
+ephy_sync_service_mark_dirty (EphySyncService           *self,
+                              EphySynchronizableManager *manager,
+                              EphySynchronizable        *synchronizable,
+                              gboolean                   is_deleted,
+                              gboolean                   should_force)
 {
-  JsonNode *node;
-  JsonObject *object;
   SyncCryptoKeyBundle *bundle;
-  char *endpoint;
-  char *record;
-  char *payload;
-  char *body;
-  char *id_safe;
   const char *collection;
   const char *id;
+  char *payload;
 
   g_assert (EPHY_IS_SYNC_SERVICE (self));
   g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
@@ -1121,305 +1146,400 @@ ephy_sync_service_delete_synchronizable (EphySyncService           *self,
     return;
 
   id = ephy_synchronizable_get_id (synchronizable);
-  /* Firefox uses UUIDs with curly braces as IDs for saved passwords records.
-   * Curly braces are unsafe characters in URLs so they must be encoded.
-   */
-  id_safe = soup_uri_encode (id, NULL);
-  endpoint = g_strdup_printf ("storage/%s/%s", collection, id_safe);
 
-  node = json_node_new (JSON_NODE_OBJECT);
-  object = json_object_new ();
-  json_node_set_object (node, object);
-  json_object_set_string_member (object, "id", id);
-  json_object_set_boolean_member (object, "deleted", TRUE);
-  record = json_to_string (node, FALSE);
-  payload = ephy_sync_crypto_encrypt_record (record, bundle);
-  json_object_remove_member (object, "deleted");
-  json_object_set_string_member (object, "payload", payload);
-  body = json_to_string (node, FALSE);
+  if (is_deleted) {
+    JsonNode *node = json_node_new (JSON_NODE_OBJECT);
+    JsonObject *object = json_object_new ();
+    char *record;
 
-  LOG ("Deleting object with id %s from collection %s...", id, collection);
-  ephy_sync_service_queue_storage_request (self, endpoint,
-                                           SOUP_METHOD_PUT, body, -1, -1,
-                                           delete_synchronizable_cb, NULL);
+    json_node_set_object (node, object);
+    json_object_set_string_member (object, "id", id);
+    json_object_set_boolean_member (object, "deleted", TRUE);
+    record = json_to_string (node, FALSE);
+    payload = ephy_sync_crypto_encrypt_record (record, bundle);
+
+    g_free (record);
+    json_object_unref (object);
+    json_node_unref (node);
+  } else {
+    JsonNode *bso = ephy_synchronizable_to_bso (synchronizable, bundle);
+
+    payload = g_strdup (json_object_get_string_member (json_node_get_object (bso), "payload"));
+    json_node_unref (bso);
+  }
+
+  ephy_sync_dirty_set_add (self->dirty_set, collection, id, payload,
+                           ephy_synchronizable_get_server_time_modified (synchronizable),
+                           should_force);
+
+  if (is_deleted)
+    ephy_sync_service_forget_dirty_synchronizable (self, collection, id);
+  else
+    g_hash_table_replace (ephy_sync_service_get_dirty_synchronizables (self, collection, TRUE),
+                          g_strdup (id), g_object_ref (synchronizable));
 
-  g_free (id_safe);
-  g_free (endpoint);
-  g_free (record);
   g_free (payload);
-  g_free (body);
-  json_object_unref (object);
-  json_node_unref (node);
   ephy_sync_crypto_key_bundle_free (bundle);
 }
 
+/* Called once the upload of the change @entry has been committed at
+ * @server_time_modified. @synchronizable is the uploaded record, if known.
+ */
 static void
-download_synchronizable_cb (SoupSession *session,
-                            SoupMessage *msg,
-                            gpointer     user_data)
+ephy_sync_service_dirty_entry_committed (EphySyncService           *self,
+                                         EphySynchronizableManager *manager,
+                                         EphySyncDirtyEntry        *entry,
+                                         EphySynchronizable        *synchronizable,
+                                         gint64                     server_time_modified)
 {
-  SyncAsyncData *data = (SyncAsyncData *)user_data;
-  EphySynchronizable *synchronizable;
-  SyncCryptoKeyBundle *bundle = NULL;
-  JsonNode *node = NULL;
-  GError *error = NULL;
-  GType type;
+  GHashTable *synchronizables;
   const char *collection;
-  gboolean is_deleted;
-
-  if (msg->status_code != 200) {
-    g_warning ("Failed to download object. Status code: %u, response: %s",
-               msg->status_code, msg->response_body->data);
-    goto out;
-  }
-  node = json_from_string (msg->response_body->data, &error);
-  if (error) {
-    g_warning ("Response is not a valid JSON");
-    goto out;
-  }
-  type = ephy_synchronizable_manager_get_synchronizable_type (data->manager);
-  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
-  bundle = ephy_sync_service_get_key_bundle (data->service, collection);
-  if (!bundle)
-    goto out;
 
-  synchronizable = EPHY_SYNCHRONIZABLE (ephy_synchronizable_from_bso (node, type, bundle, &is_deleted));
-  if (!synchronizable) {
-    g_warning ("Failed to create synchronizable object from BSO");
-    goto out;
-  }
+  collection = ephy_synchronizable_manager_get_collection_name (manager);
+  synchronizables = ephy_sync_service_get_dirty_synchronizables (self, collection, FALSE);
+  if (!synchronizable && synchronizables)
+    synchronizable = g_hash_table_lookup (synchronizables, entry->id);
 
-  /* Delete the local object and add the remote one if it is not marked as deleted. */
-  ephy_synchronizable_manager_remove (data->manager, data->synchronizable);
-  if (!is_deleted) {
-    ephy_synchronizable_manager_add (data->manager, synchronizable);
-    LOG ("Successfully downloaded from server");
-  } else {
-    LOG ("The newer version was a deleted object");
+  /* Otherwise the next merge would take the record for an older version
+   * than the one on the server.
+   */
+  if (synchronizable) {
+    ephy_synchronizable_set_server_time_modified (synchronizable, server_time_modified);
+    ephy_synchronizable_manager_save (manager, synchronizable);
   }
 
-  g_object_unref (synchronizable);
-out:
-  if (node)
-    json_node_unref (node);
-  if (error)
-    g_error_free (error);
-  if (bundle)
-    ephy_sync_crypto_key_bundle_free (bundle);
-  sync_async_data_free (data);
+  if (ephy_sync_dirty_set_remove (self->dirty_set, collection, entry, server_time_modified))
+    ephy_sync_service_forget_dirty_synchronizable (self, collection, entry->id);
 }
 
+static void ephy_sync_service_sync_collection (EphySyncService           *self,
+                                               EphySynchronizableManager *manager,
+                                               gboolean                   is_last);
+static void ephy_sync_service_start_batch_upload (BatchUploadAsyncData *data);
+
+/* Gives up on the upload of @data and of the batches queued after it.
+ * Changes of the dirty set stay there until committed, so they are
+ * retried on the next sync. If @conflict, the collection changed on the
+ * server since it was downloaded, and it is synced again right away.
+ */
 static void
-ephy_sync_service_download_synchronizable (EphySyncService           *self,
-                                           EphySynchronizableManager *manager,
-                                           EphySynchronizable        *synchronizable)
+ephy_sync_service_abort_batch_upload (BatchUploadAsyncData *data,
+                                      gboolean              conflict)
 {
-  SyncAsyncData *data;
-  char *endpoint;
-  char *id_safe;
-  const char *collection;
-  const char *id;
+  gboolean sync_done = FALSE;
 
-  g_assert (EPHY_IS_SYNC_SERVICE (self));
-  g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
-  g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
-  g_assert (ephy_sync_utils_user_is_signed_in ());
+  for (BatchUploadAsyncData *d = data; d; d = d->next)
+    sync_done |= d->sync_done;
 
-  id = ephy_synchronizable_get_id (synchronizable);
-  collection = ephy_synchronizable_manager_get_collection_name (manager);
-  /* Firefox uses UUIDs with curly braces as IDs for saved passwords records.
-   * Curly braces are unsafe characters in URLs so they must be encoded.
-   */
-  id_safe = soup_uri_encode (id, NULL);
-  endpoint = g_strdup_printf ("storage/%s/%s", collection, id_safe);
-  data = sync_async_data_new (self, manager, synchronizable);
-
-  LOG ("Downloading object with id %s...", id);
-  ephy_sync_service_queue_storage_request (self, endpoint,
-                                           SOUP_METHOD_GET, NULL, -1, -1,
-                                           download_synchronizable_cb, data);
+  if (conflict) {
+    LOG ("The %s collection was modified on the server, syncing it again...",
+         ephy_synchronizable_manager_get_collection_name (data->manager));
+    ephy_sync_service_sync_collection (data->service, data->manager, sync_done);
+  } else if (sync_done) {
+    g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+  }
 
-  g_free (endpoint);
-  g_free (id_safe);
+  batch_upload_async_data_free (data);
 }
 
 static void
-upload_synchronizable_cb (SoupSession *session,
-                          SoupMessage *msg,
-                          gpointer     user_data)
+commit_batch_cb (SoupSession *session,
+                 SoupMessage *msg,
+                 gpointer     user_data)
 {
-  SyncAsyncData *data = (SyncAsyncData *)user_data;
+  BatchUploadAsyncData *data = user_data;
+  BatchUploadAsyncData *next;
+  const char *last_modified;
   gint64 time_modified;
 
-  /* Code 412 means that there is a more recent version on the server.
-   * Download it.
+  /* Code 412 means that the collection was modified since it was
+   * downloaded, committing would overwrite the newer records.
    */
   if (msg->status_code == 412) {
-    LOG ("Found a newer version of the object on the server, downloading it...");
-    ephy_sync_service_download_synchronizable (data->service, data->manager, data->synchronizable);
-  } else if (msg->status_code == 200) {
-    LOG ("Successfully uploaded to server");
-    time_modified = ceil (g_ascii_strtod (msg->response_body->data, NULL));
-    ephy_synchronizable_set_server_time_modified (data->synchronizable, time_modified);
-    ephy_synchronizable_manager_save (data->manager, data->synchronizable);
-  } else {
-    g_warning ("Failed to upload object. Status code: %u, response: %s",
+    ephy_sync_service_abort_batch_upload (data, TRUE);
+    return;
+  }
+
+  if (msg->status_code != 200) {
+    g_warning ("Failed to commit batch. Status code: %u, response: %s",
                msg->status_code, msg->response_body->data);
+    ephy_sync_service_abort_batch_upload (data, FALSE);
+    return;
+  }
+
+  LOG ("Successfully committed batches");
+  /* Update sync time. */
+  last_modified = soup_message_headers_get_one (msg->response_headers, "X-Last-Modified");
+  ephy_synchronizable_manager_set_sync_time (data->manager, g_ascii_strtod (last_modified, NULL));
+  time_modified = ceil (g_ascii_strtod (last_modified, NULL));
+
+  for (guint i = data->start; i < data->end; i++) {
+    if (data->entries) {
+      ephy_sync_service_dirty_entry_committed (data->service, data->manager,
+                                               g_ptr_array_index (data->entries, i),
+                                               NULL, time_modified);
+    } else if (data->covered_entries) {
+      EphySynchronizable *synchronizable = g_ptr_array_index (data->synchronizables, i);
+      EphySyncDirtyEntry *entry;
+
+      entry = g_hash_table_lookup (data->covered_entries, ephy_synchronizable_get_id (synchronizable));
+      if (entry)
+        ephy_sync_service_dirty_entry_committed (data->service, data->manager,
+                                                 entry, synchronizable, time_modified);
+    }
+  }
+
+  /* This commit is the only change to the collection the next batch may
+   * build upon.
+   */
+  next = g_steal_pointer (&data->next);
+  if (next) {
+    next->unmodified_since = time_modified;
+    ephy_sync_service_start_batch_upload (next);
   }
 
-  sync_async_data_free (data);
+  if (data->sync_done)
+    g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+  batch_upload_async_data_free (data);
 }
 
-static void
-ephy_sync_service_upload_synchronizable (EphySyncService           *self,
-                                         EphySynchronizableManager *manager,
-                                         EphySynchronizable        *synchronizable,
-                                         gboolean                   should_force)
-{
+/* State of the upload of one sync batch, split in several POSTs. */
+typedef struct {
+  BatchUploadAsyncData *data;
+  SyncCryptoKeyBundle  *bundle;
+  char                 *endpoint;
+  guint                 n_batches;
+  guint                 n_pending;
+  gboolean              failed;
+  gboolean              conflict;
+  gint64                start_time;
+} BatchUploadState;
+
+/* Records of one POST. Records of types using the default to_bso() are
+ * serialized but not yet encrypted, the others hold their finished BSO.
+ */
+typedef struct {
+  GPtrArray           *ids;
+  GPtrArray           *cleartexts;
+  GPtrArray           *bsos;
   SyncCryptoKeyBundle *bundle;
-  SyncAsyncData *data;
-  JsonNode *bso;
-  char *endpoint;
-  char *body;
-  char *id_safe;
-  const char *collection;
-  const char *id;
-  gint64 time_modified;
+} EncryptBatch;
 
-  g_assert (EPHY_IS_SYNC_SERVICE (self));
-  g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
-  g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
-  g_assert (ephy_sync_utils_user_is_signed_in ());
+static void
+batch_upload_state_free (BatchUploadState *state)
+{
+  if (state->data)
+    batch_upload_async_data_free (state->data);
+  ephy_sync_crypto_key_bundle_free (state->bundle);
+  g_free (state->endpoint);
+  g_free (state);
+}
 
-  collection = ephy_synchronizable_manager_get_collection_name (manager);
-  bundle = ephy_sync_service_get_key_bundle (self, collection);
-  if (!bundle)
-    return;
+static void
+encrypt_batch_free (EncryptBatch *batch)
+{
+  g_ptr_array_unref (batch->ids);
+  g_ptr_array_unref (batch->cleartexts);
+  for (guint i = 0; i < batch->bsos->len; i++) {
+    JsonNode *bso = g_ptr_array_index (batch->bsos, i);
 
-  bso = ephy_synchronizable_to_bso (synchronizable, bundle);
-  id = ephy_synchronizable_get_id (synchronizable);
-  /* Firefox uses UUIDs with curly braces as IDs for saved passwords records.
-   * Curly braces are unsafe characters in URLs so they must be encoded.
-   */
-  id_safe = soup_uri_encode (id, NULL);
-  endpoint = g_strdup_printf ("storage/%s/%s", collection, id_safe);
-  data = sync_async_data_new (self, manager, synchronizable);
-  body = json_to_string (bso, FALSE);
-
-  LOG ("Uploading object with id %s...", id);
-  time_modified = ephy_synchronizable_get_server_time_modified (synchronizable);
-  ephy_sync_service_queue_storage_request (self, endpoint, SOUP_METHOD_PUT, body,
-                                           -1, should_force ? -1 : time_modified,
-                                           upload_synchronizable_cb, data);
-
-  g_free (id_safe);
-  g_free (body);
-  g_free (endpoint);
-  json_node_unref (bso);
-  ephy_sync_crypto_key_bundle_free (bundle);
+    if (bso)
+      json_node_unref (bso);
+  }
+  g_ptr_array_unref (batch->bsos);
+  g_free (batch);
 }
 
-static GPtrArray *
-ephy_sync_service_split_into_batches (EphySyncService           *self,
-                                      EphySynchronizableManager *manager,
-                                      GPtrArray                 *synchronizables,
-                                      guint                      start,
-                                      guint                      end)
+static void
+upload_batch_cb (SoupSession *session,
+                 SoupMessage *msg,
+                 gpointer     user_data)
 {
-  SyncCryptoKeyBundle *bundle;
-  GPtrArray *batches;
+  BatchUploadState *state = user_data;
+  BatchUploadAsyncData *data;
   const char *collection;
+  char *endpoint;
 
-  g_assert (EPHY_IS_SYNC_SERVICE (self));
-  g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
-  g_assert (synchronizables);
+  /* Note: "202 Accepted" status code. */
+  if (msg->status_code == 412) {
+    state->failed = TRUE;
+    state->conflict = TRUE;
+  } else if (msg->status_code != 202) {
+    g_warning ("Failed to upload batch. Status code: %u, response: %s",
+               msg->status_code, msg->response_body->data);
+    state->failed = TRUE;
+  } else {
+    LOG ("Successfully uploaded batch");
+  }
 
-  collection = ephy_synchronizable_manager_get_collection_name (manager);
-  bundle = ephy_sync_service_get_key_bundle (self, collection);
-  if (!bundle)
-    return NULL;
+  if (--state->n_pending > 0)
+    return;
 
-  batches = g_ptr_array_new_with_free_func (g_free);
+  ephy_metrics_add_duration ("sync", "upload", g_get_monotonic_time () - state->start_time);
+  if (!state->failed)
+    ephy_metrics_add_count ("sync", "records-uploaded", state->data->end - state->data->start);
 
-  for (guint i = start; i < end; i += EPHY_SYNC_BATCH_SIZE) {
-    JsonNode *node = json_node_new (JSON_NODE_ARRAY);
-    JsonArray *array = json_array_new ();
+  collection = ephy_synchronizable_manager_get_collection_name (state->data->manager);
+  LOG ("Uploaded %u batches to %s collection in %.3f ms",
+       state->n_batches, collection,
+       (g_get_monotonic_time () - state->start_time) / 1000.0);
 
-    for (guint k = i; k < MIN (i + EPHY_SYNC_BATCH_SIZE, end); k++) {
-      EphySynchronizable *synchronizable = g_ptr_array_index (synchronizables, k);
-      JsonNode *bso = ephy_synchronizable_to_bso (synchronizable, bundle);
-      JsonObject *object = json_object_ref (json_node_get_object (bso));
+  /* Committing is only safe once the server has accepted every batch. */
+  if (state->failed) {
+    if (!state->conflict)
+      g_warning ("Not committing batch %s, some records failed to upload", state->data->batch_id);
+    ephy_sync_service_abort_batch_upload (g_steal_pointer (&state->data), state->conflict);
+  } else {
+    /* The commit takes over the data. */
+    data = g_steal_pointer (&state->data);
+    endpoint = g_strdup_printf ("storage/%s?commit=true&batch=%s", collection, data->batch_id);
+    ephy_sync_service_queue_storage_request (data->service, endpoint,
+                                             SOUP_METHOD_POST, "[]",
+                                             -1, data->unmodified_since,
+                                             commit_batch_cb, data);
+    g_free (endpoint);
+  }
 
-      json_array_add_object_element (array, object);
-      json_node_unref (bso);
-    }
+  batch_upload_state_free (state);
+}
 
-    json_node_take_array (node, array);
-    g_ptr_array_add (batches, json_to_string (node, FALSE));
-    json_node_unref (node);
+static void
+encrypt_batch_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+  EncryptBatch *batch = task_data;
+  JsonNode *node;
+  JsonArray *array;
+  char *body;
+
+  node = json_node_new (JSON_NODE_ARRAY);
+  array = json_array_new ();
+
+  for (guint i = 0; i < batch->ids->len; i++) {
+    JsonNode *bso = g_ptr_array_index (batch->bsos, i);
+
+    /* The array takes over the reference of a finished BSO. */
+    if (bso)
+      g_ptr_array_index (batch->bsos, i) = NULL;
+    else
+      bso = ephy_synchronizable_bso_new (g_ptr_array_index (batch->ids, i),
+                                         g_ptr_array_index (batch->cleartexts, i),
+                                         batch->bundle);
+    json_array_add_element (array, bso);
   }
 
-  ephy_sync_crypto_key_bundle_free (bundle);
+  json_node_take_array (node, array);
+  body = json_to_string (node, FALSE);
+  json_node_unref (node);
 
-  return batches;
+  g_task_return_pointer (task, body, g_free);
 }
 
 static void
-commit_batch_cb (SoupSession *session,
-                 SoupMessage *msg,
-                 gpointer     user_data)
+encrypt_batch_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
 {
-  BatchUploadAsyncData *data = user_data;
-  const char *last_modified;
-
-  if (msg->status_code != 200) {
-    g_warning ("Failed to commit batch. Status code: %u, response: %s",
-               msg->status_code, msg->response_body->data);
-  } else {
-    LOG ("Successfully committed batches");
-    /* Update sync time. */
-    last_modified = soup_message_headers_get_one (msg->response_headers, "X-Last-Modified");
-    ephy_synchronizable_manager_set_sync_time (data->manager, g_ascii_strtod (last_modified, NULL));
-  }
+  BatchUploadState *state = user_data;
+  char *body;
 
-  if (data->sync_done)
-    g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
-  batch_upload_async_data_free (data);
+  /* Each batch is posted as soon as it is encrypted, the session keeps
+   * several of them in flight.
+   */
+  body = g_task_propagate_pointer (G_TASK (result), NULL);
+  ephy_sync_service_queue_storage_request (state->data->service, state->endpoint,
+                                           SOUP_METHOD_POST, body,
+                                           -1, state->data->unmodified_since,
+                                           upload_batch_cb, state);
+  g_free (body);
 }
 
+/* Serializes the records of each POST on the main thread, where the
+ * synchronizables live, and encrypts them on worker threads with the thread
+ * safe half of ephy_synchronizable_default_to_bso(). Types that override
+ * to_bso() are converted through it on the main thread instead.
+ */
 static void
-upload_batch_cb (SoupSession *session,
-                 SoupMessage *msg,
-                 gpointer     user_data)
+ephy_sync_service_upload_batches (BatchUploadAsyncData *data,
+                                  SyncCryptoKeyBundle  *bundle)
 {
-  BatchUploadAsyncData *data = user_data;
+  BatchUploadState *state;
   const char *collection;
-  char *endpoint = NULL;
 
-  /* Note: "202 Accepted" status code. */
-  if (msg->status_code != 202) {
-    g_warning ("Failed to upload batch. Status code: %u, response: %s",
-               msg->status_code, msg->response_body->data);
-  } else {
-    LOG ("Successfully uploaded batch");
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+
+  state = g_new0 (BatchUploadState, 1);
+  state->data = data;
+  state->bundle = bundle;
+  state->endpoint = g_strdup_printf ("storage/%s?batch=%s", collection, data->batch_id);
+  state->start_time = g_get_monotonic_time ();
+
+  /* Entries of the dirty set are already encrypted. */
+  if (data->entries) {
+    for (guint i = data->start; i < data->end; i += EPHY_SYNC_BATCH_SIZE) {
+      JsonNode *node = json_node_new (JSON_NODE_ARRAY);
+      JsonArray *array = json_array_new ();
+      char *body;
+
+      for (guint k = i; k < MIN (i + EPHY_SYNC_BATCH_SIZE, data->end); k++) {
+        EphySyncDirtyEntry *entry = g_ptr_array_index (data->entries, k);
+        JsonObject *object = json_object_new ();
+
+        json_object_set_string_member (object, "id", entry->id);
+        json_object_set_string_member (object, "payload", entry->payload);
+        json_array_add_object_element (array, object);
+      }
+
+      json_node_take_array (node, array);
+      body = json_to_string (node, FALSE);
+
+      state->n_batches++;
+      state->n_pending++;
+      ephy_sync_service_queue_storage_request (data->service, state->endpoint,
+                                               SOUP_METHOD_POST, body,
+                                               -1, data->unmodified_since,
+                                               upload_batch_cb, state);
+
+      g_free (body);
+      json_node_unref (node);
+    }
+
+    return;
   }
 
-  if (!data->batch_is_last)
-    goto out;
+  for (guint i = data->start; i < data->end; i += EPHY_SYNC_BATCH_SIZE) {
+    EncryptBatch *batch;
+    GTask *task;
 
-  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
-  endpoint = g_strdup_printf ("storage/%s?commit=true&batch=%s", collection, data->batch_id);
-  ephy_sync_service_queue_storage_request (data->service, endpoint,
-                                           SOUP_METHOD_POST, "[]", -1, -1,
-                                           commit_batch_cb,
-                                           batch_upload_async_data_dup (data));
+    batch = g_new (EncryptBatch, 1);
+    batch->ids = g_ptr_array_new_with_free_func (g_free);
+    batch->cleartexts = g_ptr_array_new_with_free_func (g_free);
+    batch->bsos = g_ptr_array_new ();
+    batch->bundle = bundle;
 
-out:
-  g_free (endpoint);
-  /* Remove last reference to the array with the items to upload. */
-  if (data->batch_is_last)
-    g_ptr_array_unref (data->synchronizables);
-  batch_upload_async_data_free (data);
+    for (guint k = i; k < MIN (i + EPHY_SYNC_BATCH_SIZE, data->end); k++) {
+      EphySynchronizable *synchronizable = g_ptr_array_index (data->synchronizables, k);
+
+      g_ptr_array_add (batch->ids, g_strdup (ephy_synchronizable_get_id (synchronizable)));
+      if (EPHY_SYNCHRONIZABLE_GET_IFACE (synchronizable)->to_bso == ephy_synchronizable_default_to_bso) {
+        g_ptr_array_add (batch->cleartexts, json_gobject_to_data (G_OBJECT (synchronizable), NULL));
+        g_ptr_array_add (batch->bsos, NULL);
+      } else {
+        g_ptr_array_add (batch->cleartexts, NULL);
+        g_ptr_array_add (batch->bsos, ephy_synchronizable_to_bso (synchronizable, bundle));
+      }
+    }
+
+    state->n_batches++;
+    state->n_pending++;
+
+    task = g_task_new (NULL, NULL, encrypt_batch_cb, state);
+    g_task_set_task_data (task, batch, (GDestroyNotify)encrypt_batch_free);
+    g_task_run_in_thread (task, encrypt_batch_thread);
+    g_object_unref (task);
+  }
 }
 
 static void
@@ -1428,53 +1548,165 @@ start_batch_upload_cb (SoupSession *session,
                        gpointer     user_data)
 {
   BatchUploadAsyncData *data = user_data;
-  GPtrArray *batches = NULL;
+  SyncCryptoKeyBundle *bundle;
   JsonNode *node = NULL;
   JsonObject *object;
   GError *error = NULL;
   const char *collection;
-  char *endpoint = NULL;
+
+  if (msg->status_code == 412) {
+    ephy_sync_service_abort_batch_upload (data, TRUE);
+    return;
+  }
 
   /* Note: "202 Accepted" status code. */
   if (msg->status_code != 202) {
     g_warning ("Failed to start batch upload. Status code: %u, response: %s",
                msg->status_code, msg->response_body->data);
-    goto out;
+    goto out_error;
   }
 
   node = json_from_string (msg->response_body->data, &error);
   if (error) {
     g_warning ("Response is not a valid JSON: %s", error->message);
     g_error_free (error);
-    goto out;
+    goto out_error;
   }
 
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+  bundle = ephy_sync_service_get_key_bundle (data->service, collection);
+  if (!bundle)
+    goto out_error;
+
   object = json_node_get_object (node);
   data->batch_id = soup_uri_encode (json_object_get_string_member (object, "batch"), NULL);
+
+  /* The upload state takes ownership of the data and of the bundle. */
+  ephy_sync_service_upload_batches (data, bundle);
+  json_node_unref (node);
+  return;
+
+out_error:
+  if (node)
+    json_node_unref (node);
+  ephy_sync_service_abort_batch_upload (data, FALSE);
+}
+
+static void
+ephy_sync_service_start_batch_upload (BatchUploadAsyncData *data)
+{
+  char *endpoint;
+
+  endpoint = g_strdup_printf ("storage/%s?batch=true",
+                              ephy_synchronizable_manager_get_collection_name (data->manager));
+  ephy_sync_service_queue_storage_request (data->service, endpoint,
+                                           SOUP_METHOD_POST, "[]",
+                                           -1, data->unmodified_since,
+                                           start_batch_upload_cb, data);
+  g_free (endpoint);
+}
+
+static GHashTable *
+ephy_sync_service_get_uploaded_ids (GPtrArray *to_upload)
+{
+  GHashTable *uploaded = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (guint i = 0; to_upload && i < to_upload->len; i++)
+    g_hash_table_add (uploaded, (gpointer)ephy_synchronizable_get_id (g_ptr_array_index (to_upload, i)));
+
+  return uploaded;
+}
+
+/* Drops the pending local changes of the collection that lost against a
+ * newer version of the record in @data's downloaded records, unless the
+ * merge in @to_upload uploads that record anyway.
+ */
+static void
+ephy_sync_service_discard_lost_dirty_entries (SyncCollectionAsyncData *data,
+                                              GPtrArray               *to_upload)
+{
+  GHashTable *uploaded;
+  GHashTable *remotes;
+  GPtrArray *entries;
+  const char *collection;
+
+  if (!data->remotes_updated && !data->remotes_deleted)
+    return;
+
   collection = ephy_synchronizable_manager_get_collection_name (data->manager);
-  endpoint = g_strdup_printf ("storage/%s?batch=%s", collection, data->batch_id);
+  entries = ephy_sync_dirty_set_get_entries (data->service->dirty_set, collection);
+  if (entries->len == 0) {
+    g_ptr_array_unref (entries);
+    return;
+  }
 
-  batches = ephy_sync_service_split_into_batches (data->service, data->manager,
-                                                  data->synchronizables,
-                                                  data->start, data->end);
-  for (guint i = 0; i < batches->len; i++) {
-    BatchUploadAsyncData *data_dup = batch_upload_async_data_dup (data);
+  remotes = g_hash_table_new (g_str_hash, g_str_equal);
+  for (GList *l = data->remotes_updated; l && l->data; l = l->next)
+    g_hash_table_insert (remotes, (gpointer)ephy_synchronizable_get_id (l->data), l->data);
+  for (GList *l = data->remotes_deleted; l && l->data; l = l->next)
+    g_hash_table_insert (remotes, (gpointer)ephy_synchronizable_get_id (l->data), l->data);
 
-    if (i == batches->len - 1)
-      data_dup->batch_is_last = TRUE;
+  uploaded = ephy_sync_service_get_uploaded_ids (to_upload);
 
-    ephy_sync_service_queue_storage_request (data->service, endpoint, SOUP_METHOD_POST,
-                                             g_ptr_array_index (batches, i), -1, -1,
-                                             upload_batch_cb, data_dup);
+  for (guint i = 0; i < entries->len; i++) {
+    EphySyncDirtyEntry *entry = g_ptr_array_index (entries, i);
+    EphySynchronizable *remote = g_hash_table_lookup (remotes, entry->id);
+
+    if (remote && !entry->should_force && !g_hash_table_contains (uploaded, entry->id) &&
+        ephy_synchronizable_get_server_time_modified (remote) > entry->server_time_modified) {
+      LOG ("Dropping local change to %s, the server has a newer version", entry->id);
+      ephy_sync_dirty_set_discard (data->service->dirty_set, collection, entry->id);
+      ephy_sync_service_forget_dirty_synchronizable (data->service, collection, entry->id);
+    }
   }
 
-out:
-  g_free (endpoint);
-  if (node)
-    json_node_unref (node);
-  if (batches)
-    g_ptr_array_unref (batches);
-  batch_upload_async_data_free (data);
+  g_hash_table_unref (uploaded);
+  g_hash_table_unref (remotes);
+  g_ptr_array_unref (entries);
+}
+
+/* Returns the pending local changes of the collection that still have to be
+ * uploaded once the downloaded records have been merged. Changes to records
+ * that the merge uploads anyway are returned in @covered, by id: they stay
+ * in the dirty set until that upload is committed.
+ */
+static GPtrArray *
+ephy_sync_service_take_dirty_entries (SyncCollectionAsyncData  *data,
+                                      GPtrArray                *to_upload,
+                                      GHashTable              **covered)
+{
+  GHashTable *uploaded;
+  GPtrArray *entries;
+  const char *collection;
+
+  *covered = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                    NULL, (GDestroyNotify)ephy_sync_dirty_entry_free);
+
+  ephy_sync_service_discard_lost_dirty_entries (data, to_upload);
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+  entries = ephy_sync_dirty_set_get_entries (data->service->dirty_set, collection);
+  if (entries->len == 0)
+    return entries;
+
+  /* The entries are moved to @covered, which frees them. */
+  g_ptr_array_set_free_func (entries, NULL);
+
+  uploaded = ephy_sync_service_get_uploaded_ids (to_upload);
+
+  for (guint i = 0; i < entries->len; i++) {
+    EphySyncDirtyEntry *entry = g_ptr_array_index (entries, i);
+
+    if (g_hash_table_contains (uploaded, entry->id)) {
+      g_hash_table_insert (*covered, entry->id, entry);
+      g_ptr_array_remove_index_fast (entries, i--);
+    }
+  }
+
+  g_ptr_array_set_free_func (entries, (GDestroyNotify)ephy_sync_dirty_entry_free);
+  g_hash_table_unref (uploaded);
+
+  return entries;
 }
 
 static void
@@ -1482,53 +1714,280 @@ merge_collection_finished_cb (GPtrArray *to_upload,
                               gpointer   user_data)
 {
   SyncCollectionAsyncData *data = user_data;
-  BatchUploadAsyncData *bdata;
+  BatchUploadAsyncData *first = NULL;
+  BatchUploadAsyncData **link = &first;
+  GPtrArray *entries;
+  GHashTable *covered;
   guint step = EPHY_SYNC_MAX_BATCHES * EPHY_SYNC_BATCH_SIZE;
-  const char *collection;
-  char *endpoint = NULL;
+  guint n_to_upload;
 
-  if (!to_upload || to_upload->len == 0) {
+  n_to_upload = to_upload ? to_upload->len : 0;
+  entries = ephy_sync_service_take_dirty_entries (data, to_upload, &covered);
+
+  if (n_to_upload == 0 && entries->len == 0) {
     if (data->is_last)
       g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
     goto out;
   }
 
-  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
-  endpoint = g_strdup_printf ("storage/%s?batch=true", collection);
-
-  for (guint i = 0; i < to_upload->len; i += step) {
-    bdata = batch_upload_async_data_new (data->service, data->manager,
-                                         to_upload, i,
-                                         MIN (i + step, to_upload->len),
-                                         NULL, FALSE,
-                                         data->is_last && i + step >= to_upload->len);
-    ephy_sync_service_queue_storage_request (data->service, endpoint,
-                                             SOUP_METHOD_POST, "[]", -1, -1,
-                                             start_batch_upload_cb, bdata);
+  LOG ("Uploading %u merged and %u locally changed %s records",
+       n_to_upload, entries->len,
+       ephy_synchronizable_manager_get_collection_name (data->manager));
+
+  for (guint i = 0; i < n_to_upload; i += step) {
+    *link = batch_upload_async_data_new (data->service, data->manager,
+                                         to_upload, NULL, covered, i,
+                                         MIN (i + step, n_to_upload),
+                                         NULL,
+                                         data->is_last && entries->len == 0 &&
+                                         i + step >= n_to_upload);
+    link = &(*link)->next;
+  }
+
+  for (guint i = 0; i < entries->len; i += step) {
+    *link = batch_upload_async_data_new (data->service, data->manager,
+                                         NULL, entries, NULL, i,
+                                         MIN (i + step, entries->len),
+                                         NULL,
+                                         data->is_last && i + step >= entries->len);
+    link = &(*link)->next;
   }
 
+  /* The records were merged with the collection as it was downloaded, the
+   * server refuses the upload if it changed since.
+   */
+  first->unmodified_since = data->last_modified;
+  ephy_sync_service_start_batch_upload (first);
+
 out:
-  g_free (endpoint);
+  g_ptr_array_unref (entries);
+  g_hash_table_unref (covered);
+  if (to_upload)
+    g_ptr_array_unref (to_upload);
   sync_collection_async_data_free (data);
 }
 
+static void sync_collection_fetch_page (SyncCollectionAsyncData *data);
+
+static void
+merge_page_finished_cb (GPtrArray *to_upload,
+                        gpointer   user_data)
+{
+  SyncCollectionAsyncData *data = user_data;
+
+  ephy_sync_service_discard_lost_dirty_entries (data, to_upload);
+
+  /* The records of this page are in the local store now. */
+  g_list_free_full (data->remotes_deleted, g_object_unref);
+  g_list_free_full (data->remotes_updated, g_object_unref);
+  data->remotes_deleted = NULL;
+  data->remotes_updated = NULL;
+
+  if (to_upload) {
+    if (!data->to_upload)
+      data->to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+    for (guint i = 0; i < to_upload->len; i++)
+      g_ptr_array_add (data->to_upload, g_object_ref (g_ptr_array_index (to_upload, i)));
+    g_ptr_array_unref (to_upload);
+  }
+
+  if (data->offset)
+    sync_collection_fetch_page (data);
+  else
+    merge_collection_finished_cb (g_steal_pointer (&data->to_upload), data);
+}
+
+/* Smallest number of records worth handing to a decryption worker. */
+#define SYNC_DECRYPT_MIN_CHUNK_SIZE 64
+
+typedef struct {
+  JsonArray           *array;
+  guint                start;
+  guint                end;
+  GType                type;
+  SyncCryptoKeyBundle *bundle;
+  GList               *remotes_deleted;
+  GList               *remotes_updated;
+} DecryptChunk;
+
+typedef struct {
+  SyncCollectionAsyncData *data;
+  JsonNode                *node;
+  SyncCryptoKeyBundle     *bundle;
+  DecryptChunk            *chunks;
+  guint                    n_chunks;
+  guint                    n_pending;
+  gint64                   start_time;
+} DecryptCollectionAsyncData;
+
+static void
+decrypt_chunk_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+  DecryptChunk *chunk = task_data;
+  EphySynchronizable *remote;
+  gboolean is_deleted;
+  EPHY_TRACE_SPAN ("sync", "decrypt-chunk");
+
+  for (guint i = chunk->start; i < chunk->end; i++) {
+    remote = EPHY_SYNCHRONIZABLE (ephy_synchronizable_from_bso (json_array_get_element (chunk->array, i),
+                                                                chunk->type, chunk->bundle, &is_deleted));
+    if (!remote) {
+      g_warning ("Failed to create synchronizable object from BSO, skipping...");
+      continue;
+    }
+    if (is_deleted)
+      chunk->remotes_deleted = g_list_prepend (chunk->remotes_deleted, remote);
+    else
+      chunk->remotes_updated = g_list_prepend (chunk->remotes_updated, remote);
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+decrypt_collection_finished (DecryptCollectionAsyncData *decrypt_data)
+{
+  SyncCollectionAsyncData *data = decrypt_data->data;
+  const char *collection;
+
+  /* Chunks are collected in order, each one prepended like the records
+   * within it, so the lists end up exactly as a sequential pass builds them.
+   */
+  for (guint i = 0; i < decrypt_data->n_chunks; i++) {
+    DecryptChunk *chunk = &decrypt_data->chunks[i];
+
+    data->remotes_deleted = g_list_concat (chunk->remotes_deleted, data->remotes_deleted);
+    data->remotes_updated = g_list_concat (chunk->remotes_updated, data->remotes_updated);
+    chunk->remotes_deleted = NULL;
+    chunk->remotes_updated = NULL;
+  }
+
+  ephy_trace_mark ("sync", "decrypt-page", decrypt_data->start_time);
+  ephy_metrics_add_duration ("sync", "decrypt-page", g_get_monotonic_time () - decrypt_data->start_time);
+  ephy_metrics_add_count ("sync", "records-downloaded",
+                          json_array_get_length (json_node_get_array (decrypt_data->node)));
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+  LOG ("Decrypted page %u of %s collection in %u chunks in %.3f ms",
+       data->n_pages, collection, decrypt_data->n_chunks,
+       (g_get_monotonic_time () - decrypt_data->start_time) / 1000.0);
+
+  /* Regular merges handle each record on its own, so every page is merged
+   * as soon as it is decrypted and then freed. Initial merges and the open
+   * tabs manager need the complete set of remote records, so these only
+   * merge once the last page is in.
+   */
+  if (!data->is_initial && !EPHY_IS_OPEN_TABS_MANAGER (data->manager)) {
+    LOG ("Found %u deleted objects and %u new/updated objects in page %u of %s collection",
+         g_list_length (data->remotes_deleted),
+         g_list_length (data->remotes_updated),
+         data->n_pages, collection);
+
+    ephy_synchronizable_manager_merge (data->manager, FALSE,
+                                       data->remotes_deleted, data->remotes_updated,
+                                       merge_page_finished_cb, data);
+  } else if (data->offset) {
+    /* Only the records are kept, the next page replaces this one. */
+    sync_collection_fetch_page (data);
+  } else {
+    LOG ("Found %u deleted objects and %u new/updated objects in %s collection",
+         g_list_length (data->remotes_deleted),
+         g_list_length (data->remotes_updated),
+         collection);
+
+    ephy_synchronizable_manager_set_is_initial_sync (data->manager, FALSE);
+    ephy_synchronizable_manager_merge (data->manager, data->is_initial,
+                                       data->remotes_deleted, data->remotes_updated,
+                                       merge_collection_finished_cb, data);
+  }
+
+  ephy_sync_crypto_key_bundle_free (decrypt_data->bundle);
+  json_node_unref (decrypt_data->node);
+  g_free (decrypt_data->chunks);
+  g_free (decrypt_data);
+}
+
+static void
+decrypt_chunk_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  DecryptCollectionAsyncData *decrypt_data = user_data;
+
+  g_task_propagate_boolean (G_TASK (result), NULL);
+
+  if (--decrypt_data->n_pending == 0)
+    decrypt_collection_finished (decrypt_data);
+}
+
+/* Turns the BSOs of @array into synchronizable objects, which means an HMAC
+ * check, an AES decryption and two JSON parses per record. This is split
+ * into chunks run on worker threads, one per processor at most, and the
+ * results are merged in order on the main thread once all are done.
+ */
+static void
+decrypt_collection (SyncCollectionAsyncData *data,
+                    JsonNode                *node,
+                    SyncCryptoKeyBundle     *bundle)
+{
+  DecryptCollectionAsyncData *decrypt_data;
+  JsonArray *array = json_node_get_array (node);
+  guint length = json_array_get_length (array);
+  guint chunk_size;
+  guint n_chunks;
+
+  n_chunks = MIN (g_get_num_processors (),
+                  (length + SYNC_DECRYPT_MIN_CHUNK_SIZE - 1) / SYNC_DECRYPT_MIN_CHUNK_SIZE);
+  n_chunks = MAX (n_chunks, 1);
+  chunk_size = (length + n_chunks - 1) / n_chunks;
+
+  decrypt_data = g_new0 (DecryptCollectionAsyncData, 1);
+  decrypt_data->data = data;
+  decrypt_data->node = json_node_ref (node);
+  decrypt_data->bundle = bundle;
+  decrypt_data->chunks = g_new0 (DecryptChunk, n_chunks);
+  decrypt_data->n_chunks = n_chunks;
+  decrypt_data->n_pending = n_chunks;
+  decrypt_data->start_time = g_get_monotonic_time ();
+
+  for (guint i = 0; i < n_chunks; i++) {
+    DecryptChunk *chunk = &decrypt_data->chunks[i];
+    GTask *task;
+
+    chunk->array = array;
+    chunk->start = MIN (i * chunk_size, length);
+    chunk->end = MIN (chunk->start + chunk_size, length);
+    chunk->type = ephy_synchronizable_manager_get_synchronizable_type (data->manager);
+    chunk->bundle = bundle;
+
+    task = g_task_new (NULL, NULL, decrypt_chunk_cb, decrypt_data);
+    g_task_set_task_data (task, chunk, NULL);
+    g_task_run_in_thread (task, decrypt_chunk_thread);
+    g_object_unref (task);
+  }
+}
+
 static void
 sync_collection_cb (SoupSession *session,
                     SoupMessage *msg,
                     gpointer     user_data)
 {
   SyncCollectionAsyncData *data = (SyncCollectionAsyncData *)user_data;
-  EphySynchronizable *remote;
   SyncCryptoKeyBundle *bundle = NULL;
   JsonNode *node = NULL;
   JsonArray *array = NULL;
   GError *error = NULL;
-  GType type;
   const char *collection;
-  gboolean is_deleted;
+  const char *header;
 
   collection = ephy_synchronizable_manager_get_collection_name (data->manager);
 
+  /* 412 Precondition Failed means the collection changed while paging. The
+   * next sync will start over.
+   */
   if (msg->status_code != 200) {
     g_warning ("Failed to get records in collection %s. Status code: %u, response: %s",
                collection, msg->status_code, msg->response_body->data);
@@ -1545,33 +2004,23 @@ sync_collection_cb (SoupSession *session,
     goto out_error;
   }
 
-  type = ephy_synchronizable_manager_get_synchronizable_type (data->manager);
   bundle = ephy_sync_service_get_key_bundle (data->service, collection);
   if (!bundle)
     goto out_error;
 
-  for (guint i = 0; i < json_array_get_length (array); i++) {
-    remote = EPHY_SYNCHRONIZABLE (ephy_synchronizable_from_bso (json_array_get_element (array, i),
-                                                                type, bundle, &is_deleted));
-    if (!remote) {
-      g_warning ("Failed to create synchronizable object from BSO, skipping...");
-      continue;
-    }
-    if (is_deleted)
-      data->remotes_deleted = g_list_prepend (data->remotes_deleted, remote);
-    else
-      data->remotes_updated = g_list_prepend (data->remotes_updated, remote);
+  /* Later pages must come from the same version of the collection. */
+  if (data->last_modified < 0) {
+    header = soup_message_headers_get_one (msg->response_headers, "X-Last-Modified");
+    if (header)
+      data->last_modified = ceil (g_ascii_strtod (header, NULL));
   }
 
-  LOG ("Found %u deleted objects and %u new/updated objects in %s collection",
-       g_list_length (data->remotes_deleted),
-       g_list_length (data->remotes_updated),
-       collection);
+  g_free (data->offset);
+  data->offset = g_strdup (soup_message_headers_get_one (msg->response_headers, "X-Weave-Next-Offset"));
+  data->n_pages++;
 
-  ephy_synchronizable_manager_set_is_initial_sync (data->manager, FALSE);
-  ephy_synchronizable_manager_merge (data->manager, data->is_initial,
-                                     data->remotes_deleted, data->remotes_updated,
-                                     merge_collection_finished_cb, data);
+  /* The bundle is freed once all records are decrypted. */
+  decrypt_collection (data, node, bundle);
   goto out_no_error;
 
 out_error:
@@ -1579,14 +2028,44 @@ out_error:
     g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
   sync_collection_async_data_free (data);
 out_no_error:
-  if (bundle)
-    ephy_sync_crypto_key_bundle_free (bundle);
   if (node)
     json_node_unref (node);
   if (error)
     g_error_free (error);
 }
 
+/* Collections are downloaded EPHY_SYNC_DOWNLOAD_PAGE_SIZE records at a
+ * time, following the offset tokens given by the server, so that only one
+ * page of the response is held in memory.
+ */
+static void
+sync_collection_fetch_page (SyncCollectionAsyncData *data)
+{
+  GString *endpoint;
+  const char *collection;
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+  endpoint = g_string_new (NULL);
+  g_string_printf (endpoint, "storage/%s?full=true&limit=%d",
+                   collection, EPHY_SYNC_DOWNLOAD_PAGE_SIZE);
+
+  if (data->newer >= 0)
+    g_string_append_printf (endpoint, "&newer=%"PRId64, data->newer);
+
+  if (data->offset) {
+    char *offset = g_uri_escape_string (data->offset, NULL, TRUE);
+
+    g_string_append_printf (endpoint, "&offset=%s", offset);
+    g_free (offset);
+  }
+
+  ephy_sync_service_queue_storage_request (data->service, endpoint->str, SOUP_METHOD_GET,
+                                           NULL, -1, data->offset ? data->last_modified : -1,
+                                           sync_collection_cb, data);
+
+  g_string_free (endpoint, TRUE);
+}
+
 static void
 ephy_sync_service_sync_collection (EphySyncService           *self,
                                    EphySynchronizableManager *manager,
@@ -1594,7 +2073,6 @@ ephy_sync_service_sync_collection (EphySyncService           *self,
 {
   SyncCollectionAsyncData *data;
   const char *collection;
-  char *endpoint;
   gboolean is_initial;
 
   g_assert (EPHY_IS_SYNC_SERVICE (self));
@@ -1604,20 +2082,9 @@ ephy_sync_service_sync_collection (EphySyncService           *self,
   collection = ephy_synchronizable_manager_get_collection_name (manager);
   is_initial = ephy_synchronizable_manager_is_initial_sync (manager);
 
-  if (is_initial) {
-    endpoint = g_strdup_printf ("storage/%s?full=true", collection);
-  } else {
-    endpoint = g_strdup_printf ("storage/%s?newer=%"PRId64"&full=true", collection,
-                                ephy_synchronizable_manager_get_sync_time (manager));
-  }
-
   LOG ("Syncing %s collection %s...", collection, is_initial ? "initial" : "regular");
   data = sync_collection_async_data_new (self, manager, is_initial, is_last);
-  ephy_sync_service_queue_storage_request (self, endpoint, SOUP_METHOD_GET,
-                                           NULL, -1, -1,
-                                           sync_collection_cb, data);
-
-  g_free (endpoint);
+  sync_collection_fetch_page (data);
 }
 
 static gboolean
@@ -1629,8 +2096,10 @@ ephy_sync_service_sync_internal (EphySyncService *self)
 
   g_assert (ephy_sync_utils_user_is_signed_in ());
 
+  /* The local storage server of tests is reachable without a network. */
   monitor = g_network_monitor_get_default ();
-  if (g_network_monitor_get_connectivity (monitor) != G_NETWORK_CONNECTIVITY_FULL) {
+  if (!self->is_testing &&
+      g_network_monitor_get_connectivity (monitor) != G_NETWORK_CONNECTIVITY_FULL) {
     g_signal_emit (self, signals[SYNC_FINISHED], 0);
     return G_SOURCE_CONTINUE;
   }
@@ -1948,6 +2417,8 @@ ephy_sync_service_dispose (GObject *object)
   EphySyncService *self = EPHY_SYNC_SERVICE (object);
 
   g_clear_object (&self->session);
+  g_clear_object (&self->dirty_set);
+  g_clear_pointer (&self->dirty_synchronizables, g_hash_table_unref);
   g_clear_pointer (&self->secrets, g_hash_table_unref);
 
   G_OBJECT_CLASS (ephy_sync_service_parent_class)->dispose (object);
@@ -1973,9 +2444,20 @@ ephy_sync_service_constructed (GObject *object)
 static void
 ephy_sync_service_init (EphySyncService *self)
 {
-  self->session = soup_session_new ();
+  self->session = soup_session_new_with_options ("max-conns-per-host", EPHY_SYNC_MAX_CONNECTIONS,
+                                                 NULL);
   self->storage_queue = g_queue_new ();
   self->secrets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->dirty_synchronizables = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                       g_free, (GDestroyNotify)g_hash_table_unref);
+
+  if (ephy_profile_dir ()) {
+    char *path = g_build_filename (ephy_profile_dir (), EPHY_SYNC_DIRTY_SET_FILE, NULL);
+    self->dirty_set = ephy_sync_dirty_set_new (path);
+    g_free (path);
+  } else {
+    self->dirty_set = ephy_sync_dirty_set_new (NULL);
+  }
 
   if (ephy_sync_utils_user_is_signed_in ())
     ephy_sync_service_load_secrets (self);
@@ -2611,20 +3093,15 @@ synchronizable_deleted_cb (EphySynchronizableManager *manager,
                            EphySynchronizable        *synchronizable,
                            EphySyncService           *self)
 {
-  GNetworkMonitor *monitor;
-
   g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
   g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
   g_assert (EPHY_IS_SYNC_SERVICE (self));
 
-  monitor = g_network_monitor_get_default ();
-  if (g_network_monitor_get_connectivity (monitor) != G_NETWORK_CONNECTIVITY_FULL)
-    return;
-
   if (!ephy_sync_utils_user_is_signed_in ())
     return;
 
-  ephy_sync_service_delete_synchronizable (self, manager, synchronizable);
+  /* Deletions always win over remote changes. */
+  ephy_sync_service_mark_dirty (self, manager, synchronizable, TRUE, TRUE);
 }
 
 static void
@@ -2633,20 +3110,14 @@ synchronizable_modified_cb (EphySynchronizableManager *manager,
                             gboolean                   should_force,
                             EphySyncService           *self)
 {
-  GNetworkMonitor *monitor;
-
   g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
   g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
   g_assert (EPHY_IS_SYNC_SERVICE (self));
 
-  monitor = g_network_monitor_get_default ();
-  if (g_network_monitor_get_connectivity (monitor) != G_NETWORK_CONNECTIVITY_FULL)
-    return;
-
   if (!ephy_sync_utils_user_is_signed_in ())
     return;
 
-  ephy_sync_service_upload_synchronizable (self, manager, synchronizable, should_force);
+  ephy_sync_service_mark_dirty (self, manager, synchronizable, FALSE, should_force);
 }
 
 void
@@ -2677,6 +3148,42 @@ ephy_sync_service_unregister_manager (EphySyncService           *self,
 
   g_signal_handlers_disconnect_by_func (manager, synchronizable_deleted_cb, self);
   g_signal_handlers_disconnect_by_func (manager, synchronizable_modified_cb, self);
+
+  ephy_sync_dirty_set_clear (self->dirty_set,
+                             ephy_synchronizable_manager_get_collection_name (manager));
+  g_hash_table_remove (self->dirty_synchronizables,
+                       ephy_synchronizable_manager_get_collection_name (manager));
+}
+
+void
+ephy_sync_service_set_storage_for_testing (EphySyncService *self,
+                                           const char      *storage_endpoint,
+                                           const char      *crypto_keys)
+{
+  g_assert (EPHY_IS_SYNC_SERVICE (self));
+  g_assert (storage_endpoint);
+  g_assert (crypto_keys);
+
+  g_free (self->storage_endpoint);
+  g_free (self->storage_credentials_id);
+  g_free (self->storage_credentials_key);
+
+  /* The local server does not check Hawk signatures. */
+  self->storage_endpoint = g_strdup (storage_endpoint);
+  self->storage_credentials_id = g_strdup ("testing");
+  self->storage_credentials_key = g_strdup ("testing");
+  self->storage_credentials_expiry_time = g_get_real_time () / 1000000 + 24 * 60 * 60;
+  self->is_testing = TRUE;
+
+  ephy_sync_service_set_secret (self, secrets[CRYPTO_KEYS], crypto_keys);
+}
+
+EphySyncDirtySet *
+ephy_sync_service_get_dirty_set_for_testing (EphySyncService *self)
+{
+  g_assert (EPHY_IS_SYNC_SERVICE (self));
+
+  return self->dirty_set;
 }
 
 void
@@ -2777,6 +3284,8 @@ ephy_sync_service_sign_out (EphySyncService *self)
     g_signal_handlers_disconnect_by_func (l->data, synchronizable_modified_cb, self);
   }
   g_clear_pointer (&self->managers, g_slist_free);
+  ephy_sync_dirty_set_clear (self->dirty_set, NULL);
+  g_hash_table_remove_all (self->dirty_synchronizables);
 
   ephy_sync_utils_set_bookmarks_sync_is_initial (TRUE);
   ephy_sync_utils_set_passwords_sync_is_initial (TRUE);
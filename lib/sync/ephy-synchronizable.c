@@ -225,24 +225,54 @@ ephy_synchronizable_default_to_bso (EphySynchronizable  *synchronizable,
                                     SyncCryptoKeyBundle *bundle)
 {
   JsonNode *bso;
-  JsonObject *object;
   char *serialized;
-  char *payload;
 
   g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
   g_assert (bundle);
 
   serialized = json_gobject_to_data (G_OBJECT (synchronizable), NULL);
+  bso = ephy_synchronizable_bso_new (ephy_synchronizable_get_id (synchronizable),
+                                     serialized, bundle);
+  g_free (serialized);
+
+  return bso;
+}
+
+/**
+ * ephy_synchronizable_bso_new:
+ * @id: the id of the synchronizable
+ * @serialized: the synchronizable serialized as JSON data
+ * @bundle: a %SyncCryptoKeyBundle holding the encryption key and the HMAC key
+ *          used to validate and encrypt the Basic Storage Object
+ *
+ * Encrypts @serialized and wraps it in a Basic Storage Object, like
+ * ephy_synchronizable_default_to_bso() does. Unlike the latter, this does not
+ * touch the synchronizable, so it can be called from a worker thread.
+ *
+ * Return value: (transfer full): the BSO representation as a #JsonNode
+ **/
+JsonNode *
+ephy_synchronizable_bso_new (const char          *id,
+                             const char          *serialized,
+                             SyncCryptoKeyBundle *bundle)
+{
+  JsonNode *bso;
+  JsonObject *object;
+  char *payload;
+
+  g_assert (id);
+  g_assert (serialized);
+  g_assert (bundle);
+
   payload = ephy_sync_crypto_encrypt_record (serialized, bundle);
   bso = json_node_new (JSON_NODE_OBJECT);
   object = json_object_new ();
-  json_object_set_string_member (object, "id", ephy_synchronizable_get_id (synchronizable));
+  json_object_set_string_member (object, "id", id);
   json_object_set_string_member (object, "payload", payload);
   json_node_set_object (bso, object);
 
   json_object_unref (object);
   g_free (payload);
-  g_free (serialized);
 
   return bso;
 }
@@ -56,5 +56,8 @@ GObject    *ephy_synchronizable_from_bso                  (JsonNode            *
 /* Default implementations. */
 JsonNode   *ephy_synchronizable_default_to_bso            (EphySynchronizable  *synchronizable,
                                                            SyncCryptoKeyBundle *bundle);
+JsonNode   *ephy_synchronizable_bso_new                   (const char          *id,
+                                                           const char          *serialized,
+                                                           SyncCryptoKeyBundle *bundle);
 
 G_END_DECLS
@@ -0,0 +1,370 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-completion-index-writer-private.h"
+
+#include "ephy-completion-index.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-profile-utils.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+/* Keeps the completion index of the profile up to date with its bookmarks
+ * and history, so that the search provider never has to open the history
+ * database, see ephy-completion-index.c. Changes are batched; deletions are
+ * written sooner so that deleted history does not linger in the index, and
+ * discard the update in progress, which may predate them.
+ */
+
+#define STARTUP_DELAY_SECONDS     10
+#define UPDATE_DELAY_SECONDS      30
+#define DELETION_DELAY_SECONDS    1
+#define MAX_INDEXED_HISTORY_URLS  2000
+
+struct _EphyCompletionIndexWriter {
+  GObject parent_instance;
+
+  EphyHistoryService *history_service;
+  EphyBookmarksManager *bookmarks_manager;
+  char *filename;
+
+  guint update_source_id;
+  guint update_delay;
+
+  /* Set while an update runs. */
+  GCancellable *cancellable;
+  gboolean writing;
+  gboolean discard_write;
+
+  /* Delay of the update requested while another one runs, 0 if none. */
+  guint pending_delay;
+};
+
+G_DEFINE_TYPE (EphyCompletionIndexWriter, ephy_completion_index_writer, G_TYPE_OBJECT)
+
+typedef struct {
+  char *filename;
+  GList *bookmarks;
+  GList *history;
+} WriteData;
+
+static void
+write_data_free (WriteData *data)
+{
+  g_free (data->filename);
+  ephy_history_url_list_free (data->bookmarks);
+  ephy_history_url_list_free (data->history);
+  g_free (data);
+}
+
+static void schedule_update (EphyCompletionIndexWriter *writer,
+                             guint                      delay_seconds);
+
+static void
+write_thread (GTask        *task,
+              gpointer      source_object,
+              WriteData    *data,
+              GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  if (ephy_completion_index_write (data->filename, data->bookmarks, data->history, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+remove_index (EphyCompletionIndexWriter *writer)
+{
+  if (g_unlink (writer->filename) == -1) {
+    int errsv = errno;
+
+    if (errsv != ENOENT)
+      g_warning ("Failed to remove %s: %s", writer->filename, g_strerror (errsv));
+  }
+}
+
+static void
+update_finished (EphyCompletionIndexWriter *writer)
+{
+  g_clear_object (&writer->cancellable);
+
+  if (writer->pending_delay != 0) {
+    schedule_update (writer, writer->pending_delay);
+    writer->pending_delay = 0;
+  }
+}
+
+static void
+write_cb (EphyCompletionIndexWriter *writer,
+          GAsyncResult              *result,
+          gpointer                   user_data)
+{
+  g_autoptr(GError) error = NULL;
+
+  writer->writing = FALSE;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error) &&
+      !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_warning ("Failed to write completion index: %s", error->message);
+
+  /* The thread may have written the index anyway, with deleted history. */
+  if (writer->discard_write) {
+    writer->discard_write = FALSE;
+    remove_index (writer);
+  }
+
+  update_finished (writer);
+}
+
+static GList *
+get_bookmark_urls (EphyCompletionIndexWriter *writer)
+{
+  GSequence *bookmarks;
+  GList *urls = NULL;
+
+  bookmarks = ephy_bookmarks_manager_get_bookmarks (writer->bookmarks_manager);
+  for (GSequenceIter *iter = g_sequence_get_begin_iter (bookmarks);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    EphyBookmark *bookmark = g_sequence_get (iter);
+
+    urls = g_list_prepend (urls, ephy_history_url_new (ephy_bookmark_get_url (bookmark),
+                                                       ephy_bookmark_get_title (bookmark),
+                                                       0, 0, 0));
+  }
+
+  return g_list_reverse (urls);
+}
+
+static void
+query_urls_cb (EphyHistoryService        *service,
+               gboolean                   success,
+               GList                     *urls,
+               EphyCompletionIndexWriter *writer)
+{
+  WriteData *data;
+  GTask *task;
+
+  if (!success) {
+    update_finished (writer);
+    return;
+  }
+
+  data = g_new0 (WriteData, 1);
+  data->filename = g_strdup (writer->filename);
+  data->bookmarks = get_bookmark_urls (writer);
+  data->history = ephy_history_url_list_copy (urls);
+
+  LOG ("Writing completion index of %u bookmarks and %u history URLs",
+       g_list_length (data->bookmarks), g_list_length (data->history));
+
+  writer->writing = TRUE;
+  task = g_task_new (writer, writer->cancellable, (GAsyncReadyCallback)write_cb, NULL);
+  g_task_set_task_data (task, data, (GDestroyNotify)write_data_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc)write_thread);
+  g_object_unref (task);
+}
+
+static gboolean
+update_cb (EphyCompletionIndexWriter *writer)
+{
+  g_autoptr(EphyHistoryQuery) query = NULL;
+
+  writer->update_source_id = 0;
+
+  if (writer->cancellable) {
+    if (writer->pending_delay == 0 || writer->update_delay < writer->pending_delay)
+      writer->pending_delay = writer->update_delay;
+    return G_SOURCE_REMOVE;
+  }
+
+  writer->cancellable = g_cancellable_new ();
+
+  query = ephy_history_query_new ();
+  query->limit = MAX_INDEXED_HISTORY_URLS;
+  query->ignore_hidden = TRUE;
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+
+  ephy_history_service_query_urls (writer->history_service, query, writer->cancellable,
+                                   (EphyHistoryJobCallback)query_urls_cb, writer);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_update (EphyCompletionIndexWriter *writer,
+                 guint                      delay_seconds)
+{
+  if (writer->update_source_id != 0) {
+    if (delay_seconds >= writer->update_delay)
+      return;
+
+    g_source_remove (writer->update_source_id);
+  }
+
+  writer->update_delay = delay_seconds;
+  writer->update_source_id = g_timeout_add_seconds (delay_seconds, (GSourceFunc)update_cb, writer);
+  g_source_set_name_by_id (writer->update_source_id, "[epiphany] completion_index_update_cb");
+}
+
+static void
+contents_changed_cb (EphyCompletionIndexWriter *writer)
+{
+  schedule_update (writer, UPDATE_DELAY_SECONDS);
+}
+
+static void
+discard_update (EphyCompletionIndexWriter *writer)
+{
+  if (!writer->cancellable)
+    return;
+
+  g_cancellable_cancel (writer->cancellable);
+
+  /* A cancelled history query never calls back, while a cancelled write
+   * does once its thread is done, and no other write may start before.
+   */
+  if (writer->writing)
+    writer->discard_write = TRUE;
+  else
+    update_finished (writer);
+}
+
+static void
+contents_deleted_cb (EphyCompletionIndexWriter *writer)
+{
+  discard_update (writer);
+  schedule_update (writer, DELETION_DELAY_SECONDS);
+}
+
+static void
+history_cleared_cb (EphyCompletionIndexWriter *writer)
+{
+  discard_update (writer);
+
+  /* Do not wait for the new index to drop the old one. */
+  remove_index (writer);
+
+  schedule_update (writer, DELETION_DELAY_SECONDS);
+}
+
+static void
+ephy_completion_index_writer_dispose (GObject *object)
+{
+  EphyCompletionIndexWriter *writer = EPHY_COMPLETION_INDEX_WRITER (object);
+
+  if (writer->update_source_id != 0) {
+    g_source_remove (writer->update_source_id);
+    writer->update_source_id = 0;
+  }
+
+  if (writer->cancellable) {
+    g_cancellable_cancel (writer->cancellable);
+    g_clear_object (&writer->cancellable);
+  }
+  writer->pending_delay = 0;
+
+  g_clear_object (&writer->history_service);
+  g_clear_object (&writer->bookmarks_manager);
+
+  G_OBJECT_CLASS (ephy_completion_index_writer_parent_class)->dispose (object);
+}
+
+static void
+ephy_completion_index_writer_finalize (GObject *object)
+{
+  EphyCompletionIndexWriter *writer = EPHY_COMPLETION_INDEX_WRITER (object);
+
+  g_free (writer->filename);
+
+  G_OBJECT_CLASS (ephy_completion_index_writer_parent_class)->finalize (object);
+}
+
+static void
+ephy_completion_index_writer_init (EphyCompletionIndexWriter *writer)
+{
+  writer->filename = g_build_filename (ephy_profile_dir (), EPHY_COMPLETION_INDEX_FILE, NULL);
+}
+
+static void
+ephy_completion_index_writer_class_init (EphyCompletionIndexWriterClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_completion_index_writer_dispose;
+  object_class->finalize = ephy_completion_index_writer_finalize;
+}
+
+EphyCompletionIndexWriter *
+ephy_completion_index_writer_new (EphyHistoryService   *history_service,
+                                  EphyBookmarksManager *bookmarks_manager)
+{
+  EphyCompletionIndexWriter *writer;
+
+  writer = g_object_new (EPHY_TYPE_COMPLETION_INDEX_WRITER, NULL);
+  writer->history_service = g_object_ref (history_service);
+  writer->bookmarks_manager = g_object_ref (bookmarks_manager);
+
+  g_signal_connect_object (history_service, "urls-visited",
+                           G_CALLBACK (contents_changed_cb), writer, G_CONNECT_SWAPPED);
+  g_signal_connect_object (history_service, "url-title-changed",
+                           G_CALLBACK (contents_changed_cb), writer, G_CONNECT_SWAPPED);
+  g_signal_connect_object (history_service, "url-deleted",
+                           G_CALLBACK (contents_deleted_cb), writer, G_CONNECT_SWAPPED);
+  g_signal_connect_object (history_service, "host-deleted",
+                           G_CALLBACK (contents_deleted_cb), writer, G_CONNECT_SWAPPED);
+  g_signal_connect_object (history_service, "cleared",
+                           G_CALLBACK (history_cleared_cb), writer, G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (bookmarks_manager, "bookmark-added",
+                           G_CALLBACK (contents_changed_cb), writer, G_CONNECT_SWAPPED);
+  g_signal_connect_object (bookmarks_manager, "bookmark-title-changed",
+                           G_CALLBACK (contents_changed_cb), writer, G_CONNECT_SWAPPED);
+  g_signal_connect_object (bookmarks_manager, "bookmark-url-changed",
+                           G_CALLBACK (contents_deleted_cb), writer, G_CONNECT_SWAPPED);
+  g_signal_connect_object (bookmarks_manager, "bookmark-removed",
+                           G_CALLBACK (contents_deleted_cb), writer, G_CONNECT_SWAPPED);
+
+  schedule_update (writer, STARTUP_DELAY_SECONDS);
+
+  return writer;
+}
+
+void
+ephy_completion_index_writer_update_for_testing (EphyCompletionIndexWriter *writer)
+{
+  g_assert (EPHY_IS_COMPLETION_INDEX_WRITER (writer));
+
+  if (writer->update_source_id != 0) {
+    g_source_remove (writer->update_source_id);
+    writer->update_source_id = 0;
+  }
+
+  update_cb (writer);
+}
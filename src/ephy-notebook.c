@@ -683,6 +683,40 @@ close_button_clicked_cb (GtkWidget *widget, GtkWidget *tab)
   g_signal_emit (notebook, signals[TAB_CLOSE_REQUEST], 0, tab);
 }
 
+/* The bindings are dropped when the web view of the tab is replaced, while
+ * the previous web view is still alive.
+ */
+static void
+bind_tab_label (GtkWidget     *tab_label,
+                EphyWebView   *view,
+                GBindingFlags  flags)
+{
+  GPtrArray *bindings = g_object_get_data (G_OBJECT (tab_label), "ephy-web-view-bindings");
+
+  if (!bindings) {
+    bindings = g_ptr_array_new ();
+    g_object_set_data_full (G_OBJECT (tab_label), "ephy-web-view-bindings",
+                            bindings, (GDestroyNotify)g_ptr_array_unref);
+  }
+
+  for (guint i = 0; i < bindings->len; i++)
+    g_binding_unbind (g_ptr_array_index (bindings, i));
+  g_ptr_array_set_size (bindings, 0);
+
+  g_ptr_array_add (bindings, g_object_bind_property (view, "title", tab_label, "label-text", flags));
+  g_ptr_array_add (bindings, g_object_bind_property (view, "icon", tab_label, "icon-buf", flags));
+  g_ptr_array_add (bindings, g_object_bind_property (view, "is-loading", tab_label, "spinning", flags));
+  g_ptr_array_add (bindings, g_object_bind_property (view, "is-playing-audio", tab_label, "audio", flags));
+}
+
+static void
+web_view_replaced_cb (EphyEmbed  *embed,
+                      GParamSpec *pspec,
+                      GtkWidget  *tab_label)
+{
+  bind_tab_label (tab_label, ephy_embed_get_web_view (embed), G_BINDING_SYNC_CREATE);
+}
+
 static GtkWidget *
 build_tab_label (EphyNotebook *nb, EphyEmbed *embed)
 {
@@ -706,10 +740,9 @@ build_tab_label (EphyNotebook *nb, EphyEmbed *embed)
   g_signal_connect_object (embed, "notify::title",
                            G_CALLBACK (rebuild_tab_menu_cb), nb, 0);
 
-  g_object_bind_property (view, "title", tab_label, "label-text", G_BINDING_DEFAULT);
-  g_object_bind_property (view, "icon", tab_label, "icon-buf", G_BINDING_DEFAULT);
-  g_object_bind_property (view, "is-loading", tab_label, "spinning", G_BINDING_DEFAULT);
-  g_object_bind_property (view, "is-playing-audio", tab_label, "audio", G_BINDING_DEFAULT);
+  bind_tab_label (tab_label, view, G_BINDING_DEFAULT);
+  g_signal_connect_object (embed, "notify::web-view",
+                           G_CALLBACK (web_view_replaced_cb), tab_label, 0);
 
   return tab_label;
 }
@@ -39,6 +39,10 @@ struct _EphyPageRow {
   GtkImage *speaker_icon;
   GtkSpinner *spinner;
   GtkLabel *title;
+
+  EphyWebView *view;
+  GBinding *icon_binding;
+  GBinding *audio_binding;
 };
 
 static guint signals[LAST_SIGNAL];
@@ -76,6 +80,35 @@ load_changed_cb (EphyWebView     *view,
   sync_load_status (view, NULL, self);
 }
 
+/* Also called when the web view of the tab is replaced, while the previous
+ * one is still alive.
+ */
+static void
+bind_web_view (EphyPageRow *self,
+               EphyWebView *view)
+{
+  if (self->view) {
+    g_binding_unbind (self->icon_binding);
+    g_binding_unbind (self->audio_binding);
+    g_signal_handlers_disconnect_by_func (self->view, load_changed_cb, self);
+  }
+
+  self->view = view;
+  self->icon_binding = g_object_bind_property (view, "icon", self->icon, "pixbuf", G_BINDING_SYNC_CREATE);
+  self->audio_binding = g_object_bind_property (view, "is-playing-audio", self->speaker_icon, "visible", G_BINDING_SYNC_CREATE);
+  sync_load_status (view, NULL, self);
+  g_signal_connect_object (view, "load-changed",
+                           G_CALLBACK (load_changed_cb), self, 0);
+}
+
+static void
+web_view_replaced_cb (EphyEmbed   *embed,
+                      GParamSpec  *pspec,
+                      EphyPageRow *self)
+{
+  bind_web_view (self, ephy_embed_get_web_view (embed));
+}
+
 static void
 close_clicked_cb (EphyPageRow *self)
 {
@@ -133,7 +166,6 @@ ephy_page_row_new (EphyNotebook *notebook,
 {
   EphyPageRow *self;
   GtkWidget *embed;
-  EphyWebView *view;
 
   g_assert (notebook != NULL);
   g_assert (position >= 0);
@@ -144,15 +176,11 @@ ephy_page_row_new (EphyNotebook *notebook,
 
   g_assert (EPHY_IS_EMBED (embed));
 
-  view = ephy_embed_get_web_view (EPHY_EMBED (embed));
-
-  g_object_bind_property (view, "icon", self->icon, "pixbuf", G_BINDING_SYNC_CREATE);
   g_object_bind_property (embed, "title", self->title, "label", G_BINDING_SYNC_CREATE);
   g_object_bind_property (embed, "title", self->title, "tooltip-text", G_BINDING_SYNC_CREATE);
-  g_object_bind_property (view, "is-playing-audio", self->speaker_icon, "visible", G_BINDING_SYNC_CREATE);
-  sync_load_status (view, NULL, self);
-  g_signal_connect_object (view, "load-changed",
-                           G_CALLBACK (load_changed_cb), self, 0);
+  bind_web_view (self, ephy_embed_get_web_view (EPHY_EMBED (embed)));
+  g_signal_connect_object (embed, "notify::web-view",
+                           G_CALLBACK (web_view_replaced_cb), self, 0);
 
   return self;
 }
@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-session.h"
+
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+G_BEGIN_DECLS
+
+/* The state of a tab and of a window, as they are saved. */
+typedef struct {
+  char *url;
+  char *title;
+  gboolean loading;
+  gboolean crashed;
+  gboolean pinned;
+  WebKitWebViewSessionState *state;
+} SessionTab;
+
+typedef struct {
+  GdkRectangle geometry;
+  char *role;
+
+  GList *tabs;
+  gint active_tab;
+} SessionWindow;
+
+/* These convert lists of #SessionWindow to and from the binary session
+ * format without going through real windows. Only meant for tests.
+ */
+GBytes *ephy_session_write_binary_for_testing (GList   *windows,
+                                               GError **error);
+GList  *ephy_session_read_binary_for_testing  (GBytes  *bytes,
+                                               GError **error);
+void    ephy_session_free_windows_for_testing (GList   *windows);
+
+G_END_DECLS
@@ -22,7 +22,7 @@
  */
 
 #include "config.h"
-#include "ephy-session.h"
+#include "ephy-session-private.h"
 
 #include "ephy-about-handler.h"
 #include "ephy-debug.h"
@@ -32,17 +32,21 @@
 #include "ephy-file-helpers.h"
 #include "ephy-gui.h"
 #include "ephy-link.h"
+#include "ephy-metrics.h"
 #include "ephy-notebook.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-shell.h"
 #include "ephy-string.h"
+#include "ephy-tab-restore-scheduler.h"
+#include "ephy-trace.h"
 #include "ephy-window.h"
 
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <libxml/tree.h>
 #include <libxml/xmlwriter.h>
+#include <string.h>
 
 typedef struct {
   EphyNotebook *notebook;
@@ -60,6 +64,7 @@ struct _EphySession {
   GObject parent_instance;
 
   GQueue *closed_tabs;
+  EphyTabRestoreScheduler *restore_scheduler;
   guint save_source_id;
   GCancellable *save_cancellable;
   guint closing : 1;
@@ -322,6 +327,16 @@ ephy_session_get_can_undo_tab_closed (EphySession *session)
   return g_queue_is_empty (session->closed_tabs) == FALSE;
 }
 
+/* A discarded tab gets a new web view, see ephy_embed_discard(). */
+static void
+web_view_replaced_cb (EphyEmbed   *embed,
+                      GParamSpec  *pspec,
+                      EphySession *session)
+{
+  g_signal_connect (ephy_embed_get_web_view (embed), "load-changed",
+                    G_CALLBACK (load_changed_cb), session);
+}
+
 static void
 notebook_page_added_cb (GtkWidget   *notebook,
                         EphyEmbed   *embed,
@@ -330,6 +345,8 @@ notebook_page_added_cb (GtkWidget   *notebook,
 {
   g_signal_connect (ephy_embed_get_web_view (embed), "load-changed",
                     G_CALLBACK (load_changed_cb), session);
+  g_signal_connect (embed, "notify::web-view",
+                    G_CALLBACK (web_view_replaced_cb), session);
 }
 
 static void
@@ -343,6 +360,7 @@ notebook_page_removed_cb (GtkWidget   *notebook,
   g_signal_handlers_disconnect_by_func
     (ephy_embed_get_web_view (embed), G_CALLBACK (load_changed_cb),
     session);
+  g_signal_handlers_disconnect_by_func (embed, G_CALLBACK (web_view_replaced_cb), session);
 
   ephy_session_tab_closed (session, EPHY_NOTEBOOK (notebook), embed, position);
 }
@@ -458,6 +476,7 @@ ephy_session_dispose (GObject *object)
 
   g_queue_free_full (session->closed_tabs,
                      (GDestroyNotify)closed_tab_free);
+  g_clear_object (&session->restore_scheduler);
 
   G_OBJECT_CLASS (ephy_session_parent_class)->dispose (object);
 }
@@ -540,15 +559,6 @@ get_window_geometry (GtkWindow    *window,
   gtk_window_get_position (window, &rectangle->x, &rectangle->y);
 }
 
-typedef struct {
-  char *url;
-  char *title;
-  gboolean loading;
-  gboolean crashed;
-  gboolean pinned;
-  WebKitWebViewSessionState *state;
-} SessionTab;
-
 static SessionTab *
 session_tab_new (EphyEmbed   *embed,
                  EphySession *session,
@@ -580,7 +590,7 @@ session_tab_new (EphyEmbed   *embed,
                           !session->closing);
   session_tab->crashed = (error_page == EPHY_WEB_VIEW_ERROR_PAGE_CRASH ||
                           error_page == EPHY_WEB_VIEW_ERROR_PROCESS_CRASH);
-  session_tab->state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (web_view));
+  session_tab->state = ephy_embed_get_session_state (embed);
   session_tab->pinned = ephy_notebook_tab_is_pinned (EPHY_NOTEBOOK (notebook), embed);
 
   return session_tab;
@@ -596,14 +606,6 @@ session_tab_free (SessionTab *tab)
   g_free (tab);
 }
 
-typedef struct {
-  GdkRectangle geometry;
-  char *role;
-
-  GList *tabs;
-  gint active_tab;
-} SessionWindow;
-
 static SessionWindow *
 session_window_new (EphyWindow  *window,
                     EphySession *session)
@@ -652,6 +654,7 @@ typedef struct {
   EphySession *session;
 
   GList *windows;
+  gboolean binary;
 } SaveData;
 
 static SaveData *
@@ -663,6 +666,8 @@ save_data_new (EphySession *session)
 
   data = g_new0 (SaveData, 1);
   data->session = g_object_ref (session);
+  data->binary = g_settings_get_boolean (EPHY_SETTINGS_MAIN,
+                                         EPHY_PREFS_RESTORE_SESSION_BINARY_FORMAT);
 
   windows = gtk_application_get_windows (GTK_APPLICATION (shell));
   for (w = windows; w != NULL; w = w->next) {
@@ -822,6 +827,248 @@ write_ephy_window (xmlTextWriterPtr writer,
   return ret;
 }
 
+/* The binary session format is a fixed header followed by a stream of
+ * length-prefixed records. All integers are little-endian. Strings and
+ * the serialized WebKit session state are stored as a guint32 length
+ * followed by the raw bytes, so nothing needs to be escaped or base64
+ * encoded and the reader can hand the state bytes to WebKit untouched.
+ *
+ *   header: "EPHYSESS" guint32 version, guint32 flags
+ *   record: guint8 type, guint32 payload length, payload
+ *
+ * If SESSION_BINARY_FLAG_COMPRESSED is set, everything after the header is
+ * a zlib stream.
+ */
+#define SESSION_BINARY_MAGIC            "EPHYSESS"
+#define SESSION_BINARY_MAGIC_LEN        8
+#define SESSION_BINARY_HEADER_LEN       (SESSION_BINARY_MAGIC_LEN + 8)
+#define SESSION_BINARY_RECORD_HEADER_LEN 5
+#define SESSION_BINARY_VERSION          1
+
+#define SESSION_BINARY_FLAG_COMPRESSED  (1 << 0)
+
+typedef enum {
+  SESSION_RECORD_WINDOW = 1,
+  SESSION_RECORD_TAB,
+  SESSION_RECORD_WINDOW_END
+} SessionRecordType;
+
+typedef enum {
+  SESSION_TAB_LOADING = 1 << 0,
+  SESSION_TAB_PINNED  = 1 << 1,
+  SESSION_TAB_CRASHED = 1 << 2
+} SessionTabFlags;
+
+/* Receives the contents of a binary session as it is parsed. The tab
+ * callback takes ownership of @state, the serialized
+ * WebKitWebViewSessionState of the tab, if any.
+ */
+typedef void (*SessionBinaryWindowFunc)    (gpointer      user_data,
+                                            GdkRectangle *geometry,
+                                            const char   *role,
+                                            int           active_tab);
+typedef void (*SessionBinaryTabFunc)       (gpointer         user_data,
+                                            const char      *url,
+                                            const char      *title,
+                                            GBytes          *state,
+                                            SessionTabFlags  flags);
+typedef void (*SessionBinaryWindowEndFunc) (gpointer user_data);
+
+typedef struct {
+  SessionBinaryWindowFunc window;
+  SessionBinaryTabFunc tab;
+  SessionBinaryWindowEndFunc window_end;
+} SessionBinaryHandler;
+
+typedef struct {
+  const SessionBinaryHandler *handler;
+  gpointer user_data;
+
+  /* Data read but not parsed yet, the start of an incomplete record. */
+  GByteArray *pending;
+  gboolean in_window;
+} SessionBinaryParser;
+
+static SessionBinaryParser *
+session_binary_parser_new (const SessionBinaryHandler *handler,
+                           gpointer                    user_data)
+{
+  SessionBinaryParser *parser;
+
+  parser = g_new0 (SessionBinaryParser, 1);
+  parser->handler = handler;
+  parser->user_data = user_data;
+  parser->pending = g_byte_array_new ();
+
+  return parser;
+}
+
+static void
+session_binary_parser_free (SessionBinaryParser *parser)
+{
+  g_byte_array_unref (parser->pending);
+  g_free (parser);
+}
+
+static void
+binary_append_uint32 (GByteArray *array,
+                      guint32     value)
+{
+  guint32 le_value = GUINT32_TO_LE (value);
+
+  g_byte_array_append (array, (const guint8 *)&le_value, sizeof (le_value));
+}
+
+static void
+binary_append_data (GByteArray   *array,
+                    gconstpointer data,
+                    gsize         length)
+{
+  binary_append_uint32 (array, length);
+  if (length > 0)
+    g_byte_array_append (array, data, length);
+}
+
+static void
+binary_append_string (GByteArray *array,
+                      const char *str)
+{
+  binary_append_data (array, str, str ? strlen (str) : 0);
+}
+
+static guint
+binary_start_record (GByteArray       *array,
+                     SessionRecordType type)
+{
+  guint8 record_type = type;
+
+  g_byte_array_append (array, &record_type, 1);
+  /* Placeholder for the payload length, see binary_end_record(). */
+  binary_append_uint32 (array, 0);
+
+  return array->len;
+}
+
+static void
+binary_end_record (GByteArray *array,
+                   guint       payload_start)
+{
+  guint32 length = GUINT32_TO_LE (array->len - payload_start);
+
+  memcpy (array->data + payload_start - sizeof (length), &length, sizeof (length));
+}
+
+static void
+write_binary_tab (GByteArray *array,
+                  SessionTab *tab)
+{
+  guint8 flags = 0;
+  guint start;
+
+  start = binary_start_record (array, SESSION_RECORD_TAB);
+
+  if (tab->loading)
+    flags |= SESSION_TAB_LOADING;
+  if (tab->pinned)
+    flags |= SESSION_TAB_PINNED;
+  if (tab->crashed)
+    flags |= SESSION_TAB_CRASHED;
+  g_byte_array_append (array, &flags, 1);
+
+  binary_append_string (array, tab->url);
+  binary_append_string (array, tab->title);
+
+  if (tab->state) {
+    GBytes *bytes;
+
+    bytes = webkit_web_view_session_state_serialize (tab->state);
+    if (bytes) {
+      gconstpointer data;
+      gsize data_length;
+
+      data = g_bytes_get_data (bytes, &data_length);
+      binary_append_data (array, data, data_length);
+      g_bytes_unref (bytes);
+    } else {
+      binary_append_data (array, NULL, 0);
+    }
+  } else {
+    binary_append_data (array, NULL, 0);
+  }
+
+  binary_end_record (array, start);
+}
+
+static void
+write_binary_window (GByteArray    *array,
+                     SessionWindow *window)
+{
+  guint start;
+
+  start = binary_start_record (array, SESSION_RECORD_WINDOW);
+  binary_append_uint32 (array, (guint32)window->geometry.x);
+  binary_append_uint32 (array, (guint32)window->geometry.y);
+  binary_append_uint32 (array, (guint32)window->geometry.width);
+  binary_append_uint32 (array, (guint32)window->geometry.height);
+  binary_append_uint32 (array, (guint32)window->active_tab);
+  binary_append_string (array, window->role);
+  binary_end_record (array, start);
+
+  for (GList *l = window->tabs; l != NULL; l = l->next)
+    write_binary_tab (array, (SessionTab *)l->data);
+
+  start = binary_start_record (array, SESSION_RECORD_WINDOW_END);
+  binary_end_record (array, start);
+}
+
+static GBytes *
+write_binary_session (GList        *windows,
+                      GCancellable *cancellable,
+                      GError      **error)
+{
+  GByteArray *body;
+  GOutputStream *memory_stream;
+  GOutputStream *stream;
+  GZlibCompressor *compressor;
+  guint8 header[SESSION_BINARY_HEADER_LEN];
+  guint32 value;
+  gboolean success;
+
+  body = g_byte_array_new ();
+  for (GList *w = windows; w != NULL; w = w->next)
+    write_binary_window (body, (SessionWindow *)w->data);
+
+  memcpy (header, SESSION_BINARY_MAGIC, SESSION_BINARY_MAGIC_LEN);
+  value = GUINT32_TO_LE (SESSION_BINARY_VERSION);
+  memcpy (header + SESSION_BINARY_MAGIC_LEN, &value, sizeof (value));
+  value = GUINT32_TO_LE (SESSION_BINARY_FLAG_COMPRESSED);
+  memcpy (header + SESSION_BINARY_MAGIC_LEN + 4, &value, sizeof (value));
+
+  memory_stream = g_memory_output_stream_new_resizable ();
+  success = g_output_stream_write_all (memory_stream, header, sizeof (header), NULL, cancellable, error);
+  if (success) {
+    /* Favor speed over ratio: the session is rewritten on every tab change,
+     * and the serialized states already shrink a lot at the lowest level.
+     */
+    compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB, 1);
+    stream = g_converter_output_stream_new (memory_stream, G_CONVERTER (compressor));
+    g_filter_output_stream_set_close_base_stream (G_FILTER_OUTPUT_STREAM (stream), FALSE);
+    success = g_output_stream_write_all (stream, body->data, body->len, NULL, cancellable, error) &&
+              g_output_stream_close (stream, cancellable, error);
+    g_object_unref (stream);
+    g_object_unref (compressor);
+  }
+
+  g_byte_array_unref (body);
+
+  if (!success || !g_output_stream_close (memory_stream, cancellable, error)) {
+    g_object_unref (memory_stream);
+    return NULL;
+  }
+
+  return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (memory_stream));
+}
+
 static void
 save_session_in_thread_finished_cb (GObject      *source_object,
                                     GAsyncResult *res,
@@ -874,27 +1121,14 @@ session_seems_sane (GList *windows)
   return TRUE;
 }
 
-static void
-save_session_sync (GTask        *task,
-                   gpointer      source_object,
-                   gpointer      task_data,
-                   GCancellable *cancellable)
+static int
+write_xml_session (xmlBufferPtr buffer,
+                   GList       *windows)
 {
-  SaveData *data = (SaveData *)g_task_get_task_data (task);
-  xmlBufferPtr buffer;
   xmlTextWriterPtr writer;
   GList *w;
   int ret = -1;
 
-  /* If any web view has an insane URL, then something has probably gone wrong
-   * inside WebKit. For instance, if the web process is nonfunctional, the UI
-   * process could have an invalid URI property. Yes, this would be a WebKit
-   * bug, but Epiphany should be robust to such issues. Do not clobber an
-   * existing good session file with our new bogus state. Bug #768250. */
-  if (!session_seems_sane (data->windows))
-    return;
-
-  buffer = xmlBufferCreate ();
   writer = xmlNewTextWriterMemory (buffer, 0);
   if (writer == NULL)
     goto out;
@@ -907,8 +1141,6 @@ save_session_sync (GTask        *task,
   if (ret < 0)
     goto out;
 
-  START_PROFILER ("Saving session")
-
   ret = xmlTextWriterStartDocument (writer, "1.0", NULL, NULL);
   if (ret < 0)
     goto out;
@@ -919,7 +1151,7 @@ save_session_sync (GTask        *task,
     goto out;
 
   /* iterate through all the windows */
-  for (w = data->windows; w != NULL && ret >= 0; w = w->next) {
+  for (w = windows; w != NULL && ret >= 0; w = w->next) {
     ret = write_ephy_window (writer, (SessionWindow *)w->data);
   }
   if (ret < 0)
@@ -935,31 +1167,79 @@ save_session_sync (GTask        *task,
   if (writer)
     xmlFreeTextWriter (writer);
 
-  if (ret >= 0 && !g_cancellable_is_cancelled (cancellable)) {
-    GError *error = NULL;
+  return ret;
+}
+
+static void
+save_session_sync (GTask        *task,
+                   gpointer      source_object,
+                   gpointer      task_data,
+                   GCancellable *cancellable)
+{
+  SaveData *data = (SaveData *)g_task_get_task_data (task);
+  xmlBufferPtr buffer = NULL;
+  GBytes *bytes = NULL;
+  const char *contents = NULL;
+  gsize length = 0;
+  GError *error = NULL;
+  gint64 begin_time = g_get_monotonic_time ();
+  EPHY_TRACE_SPAN ("session", "save");
+
+  /* If any web view has an insane URL, then something has probably gone wrong
+   * inside WebKit. For instance, if the web process is nonfunctional, the UI
+   * process could have an invalid URI property. Yes, this would be a WebKit
+   * bug, but Epiphany should be robust to such issues. Do not clobber an
+   * existing good session file with our new bogus state. Bug #768250. */
+  if (!session_seems_sane (data->windows))
+    return;
+
+  if (data->binary) {
+    bytes = write_binary_session (data->windows, cancellable, &error);
+    if (bytes) {
+      contents = g_bytes_get_data (bytes, &length);
+    } else {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Error saving session: %s", error->message);
+      g_clear_error (&error);
+    }
+  } else {
+    buffer = xmlBufferCreate ();
+    if (write_xml_session (buffer, data->windows) >= 0) {
+      contents = (const char *)buffer->content;
+      length = buffer->use;
+    }
+  }
+
+  if (contents && !g_cancellable_is_cancelled (cancellable)) {
     GFile *session_file;
 
     session_file = get_session_file (SESSION_STATE);
 
     if (!g_file_replace_contents (session_file,
-                                  (const char *)buffer->content,
-                                  buffer->use,
+                                  contents,
+                                  length,
                                   NULL, TRUE, 0, NULL,
                                   cancellable, &error)) {
       if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
         g_warning ("Error saving session: %s", error->message);
       }
       g_error_free (error);
+    } else {
+      ephy_metrics_set_gauge ("session", "size-bytes", length);
+      ephy_metrics_add_count ("session", "bytes-written", length);
     }
 
     g_object_unref (session_file);
   }
 
-  xmlBufferFree (buffer);
+  if (buffer)
+    xmlBufferFree (buffer);
+  if (bytes)
+    g_bytes_unref (bytes);
 
   g_task_return_boolean (task, TRUE);
 
-  STOP_PROFILER ("Saving session")
+  ephy_metrics_add_duration ("session", "save", g_get_monotonic_time () - begin_time);
 }
 
 static EphySession *
@@ -1071,6 +1351,9 @@ typedef struct {
   gint active_tab;
 
   gboolean is_first_tab;
+
+  gboolean delay_loading;
+  EphyTabRestoreScheduler *scheduler;
 } SessionParserContext;
 
 static SessionParserContext *
@@ -1078,12 +1361,31 @@ session_parser_context_new (EphySession *session,
                             guint32      user_time)
 {
   SessionParserContext *context;
+  EphyEmbedShellMode mode;
 
   context = g_new0 (SessionParserContext, 1);
   context->session = g_object_ref (session);
   context->user_time = user_time;
   context->is_first_window = TRUE;
 
+  mode = ephy_embed_shell_get_mode (ephy_embed_shell_get_default ());
+  if (mode == EPHY_EMBED_SHELL_MODE_BROWSER ||
+      mode == EPHY_EMBED_SHELL_MODE_STANDALONE) {
+    context->delay_loading = g_settings_get_boolean (EPHY_SETTINGS_MAIN,
+                                                     EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
+
+    /* Tabs that are not delayed until shown are still not loaded all at
+     * once, but throttled by the restore scheduler.
+     */
+    if (!context->delay_loading) {
+      guint max_loads = g_settings_get_uint (EPHY_SETTINGS_MAIN,
+                                             EPHY_PREFS_RESTORE_SESSION_MAX_CONCURRENT_LOADS);
+
+      context->scheduler = ephy_tab_restore_scheduler_new (max_loads);
+      g_set_object (&session->restore_scheduler, context->scheduler);
+    }
+  }
+
   return context;
 }
 
@@ -1091,20 +1393,37 @@ static void
 session_parser_context_free (SessionParserContext *context)
 {
   g_object_unref (context->session);
+  g_clear_object (&context->scheduler);
 
   g_free (context);
 }
 
+static void
+session_restore_window (SessionParserContext *context,
+                        GdkRectangle         *geometry,
+                        const char           *role,
+                        int                   active_tab)
+{
+  context->window = ephy_window_new ();
+  context->active_tab = active_tab;
+  context->is_first_tab = TRUE;
+
+  if (role)
+    gtk_window_set_role (GTK_WINDOW (context->window), role);
+
+  restore_geometry (GTK_WINDOW (context->window), geometry);
+}
+
 static void
 session_parse_window (SessionParserContext *context,
                       const gchar         **names,
                       const gchar         **values)
 {
   GdkRectangle geometry = { -1, -1, 0, 0 };
+  const char *role = NULL;
+  int active_tab = 0;
   guint i;
 
-  context->window = ephy_window_new ();
-
   for (i = 0; names[i]; i++) {
     gulong int_value;
 
@@ -1121,51 +1440,65 @@ session_parse_window (SessionParserContext *context,
       ephy_string_to_int (values[i], &int_value);
       geometry.height = int_value;
     } else if (strcmp (names[i], "role") == 0) {
-      gtk_window_set_role (GTK_WINDOW (context->window), values[i]);
+      role = values[i];
     } else if (strcmp (names[i], "active-tab") == 0) {
       ephy_string_to_int (values[i], &int_value);
-      context->active_tab = int_value;
+      active_tab = int_value;
     }
   }
 
-  restore_geometry (GTK_WINDOW (context->window), &geometry);
+  session_restore_window (context, &geometry, role, active_tab);
 }
 
 static void
-session_parse_embed (SessionParserContext *context,
-                     const gchar         **names,
-                     const gchar         **values)
+session_finish_window (SessionParserContext *context)
 {
   GtkWidget *notebook;
-  const char *url = NULL;
-  const char *title = NULL;
-  const char *history = NULL;
-  gboolean was_loading = FALSE;
-  gboolean crashed = FALSE;
-  gboolean is_blank_page = FALSE;
-  gboolean is_pin = FALSE;
-  guint i;
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
 
   notebook = ephy_window_get_notebook (context->window);
+  gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook), context->active_tab);
 
-  for (i = 0; names[i]; i++) {
-    if (strcmp (names[i], "url") == 0) {
-      url = values[i];
-      is_blank_page = (strcmp (url, "about:blank") == 0 ||
-                       strcmp (url, "about:overview") == 0);
-    } else if (strcmp (names[i], "title") == 0) {
-      title = values[i];
-    } else if (strcmp (names[i], "loading") == 0) {
-      was_loading = strcmp (values[i], "true") == 0;
-    } else if (strcmp (names[i], "crashed") == 0) {
-      crashed = strcmp (values[i], "true") == 0;
-    } else if (strcmp (names[i], "history") == 0) {
-      history = values[i];
-    } else if (strcmp (names[i], "pinned") == 0) {
-      is_pin = strcmp (values[i], "true") == 0;
-    }
+  if (ephy_embed_shell_get_mode (ephy_embed_shell_get_default ()) != EPHY_EMBED_SHELL_MODE_TEST) {
+    EphyEmbed *active_child;
+
+    active_child = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (context->window));
+    gtk_widget_grab_focus (GTK_WIDGET (active_child));
+    gtk_widget_show (GTK_WIDGET (context->window));
   }
 
+  if (context->scheduler)
+    ephy_tab_restore_scheduler_add_window (context->scheduler, context->window);
+
+  ephy_embed_shell_restored_window (shell);
+
+  context->window = NULL;
+  context->active_tab = 0;
+  context->is_first_window = FALSE;
+}
+
+/* Takes ownership of @history_data, the serialized WebKitWebViewSessionState
+ * of the tab, if any. When the load is delayed the state is only decoded once
+ * the tab is actually shown.
+ */
+static void
+session_restore_tab (SessionParserContext *context,
+                     const char           *url,
+                     const char           *title,
+                     GBytes               *history_data,
+                     gboolean              was_loading,
+                     gboolean              crashed,
+                     gboolean              is_pin)
+{
+  GtkWidget *notebook;
+  gboolean is_blank_page = FALSE;
+
+  notebook = ephy_window_get_notebook (context->window);
+
+  if (url)
+    is_blank_page = (strcmp (url, "about:blank") == 0 ||
+                     strcmp (url, "about:overview") == 0);
+
   /* In the case that crash happens before we receive the URL from the server,
    * this will open an about:blank tab.
    * See http://bugzilla.gnome.org/show_bug.cgi?id=591294
@@ -1173,21 +1506,8 @@ session_parse_embed (SessionParserContext *context,
    */
   if ((!was_loading || is_blank_page) && !crashed) {
     EphyNewTabFlags flags;
-    EphyEmbedShell *shell;
-    EphyEmbedShellMode mode;
     EphyEmbed *embed;
     EphyWebView *web_view;
-    gboolean delay_loading = FALSE;
-    WebKitWebViewSessionState *state = NULL;
-
-    shell = ephy_embed_shell_get_default ();
-    mode = ephy_embed_shell_get_mode (shell);
-
-    if (mode == EPHY_EMBED_SHELL_MODE_BROWSER ||
-        mode == EPHY_EMBED_SHELL_MODE_STANDALONE) {
-      delay_loading = g_settings_get_boolean (EPHY_SETTINGS_MAIN,
-                                              EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
-    }
 
     flags = EPHY_NEW_TAB_APPEND_LAST;
 
@@ -1199,29 +1519,25 @@ session_parse_embed (SessionParserContext *context,
     ephy_notebook_tab_set_pinned (EPHY_NOTEBOOK (notebook), GTK_WIDGET (embed), is_pin);
 
     web_view = ephy_embed_get_web_view (embed);
-    if (history) {
-      guchar *data;
-      gsize data_length;
-      GBytes *history_data;
 
-      data = g_base64_decode (history, &data_length);
-      history_data = g_bytes_new_take (data, data_length);
-      state = webkit_web_view_session_state_new (history_data);
-      g_bytes_unref (history_data);
-    }
-
-    if (delay_loading) {
+    if (context->delay_loading || context->scheduler) {
       WebKitURIRequest *request = webkit_uri_request_new (url);
 
-      ephy_embed_set_delayed_load_request (embed, request, state);
+      ephy_embed_set_delayed_load_request_with_serialized_state (embed, request, history_data);
       ephy_web_view_set_placeholder (web_view, url, title);
       g_object_unref (request);
     } else {
       WebKitBackForwardList *bf_list;
       WebKitBackForwardListItem *item;
 
-      if (state) {
-        webkit_web_view_restore_session_state (WEBKIT_WEB_VIEW (web_view), state);
+      if (history_data) {
+        WebKitWebViewSessionState *state;
+
+        state = webkit_web_view_session_state_new (history_data);
+        if (state) {
+          webkit_web_view_restore_session_state (WEBKIT_WEB_VIEW (web_view), state);
+          webkit_web_view_session_state_unref (state);
+        }
       }
 
       bf_list = webkit_web_view_get_back_forward_list (WEBKIT_WEB_VIEW (web_view));
@@ -1232,10 +1548,6 @@ session_parse_embed (SessionParserContext *context,
         ephy_web_view_load_url (web_view, url);
       }
     }
-
-    if (state) {
-      webkit_web_view_session_state_unref (state);
-    }
   } else if (url && (was_loading || crashed)) {
     /* This page was loading during a UI process crash
      * (was_loading == TRUE) or a web process crash
@@ -1243,6 +1555,47 @@ session_parse_embed (SessionParserContext *context,
      */
     confirm_before_recover (context->window, url, title);
   }
+
+  if (history_data)
+    g_bytes_unref (history_data);
+}
+
+static void
+session_parse_embed (SessionParserContext *context,
+                     const gchar         **names,
+                     const gchar         **values)
+{
+  const char *url = NULL;
+  const char *title = NULL;
+  GBytes *history_data = NULL;
+  gboolean was_loading = FALSE;
+  gboolean crashed = FALSE;
+  gboolean is_pin = FALSE;
+  guint i;
+
+  for (i = 0; names[i]; i++) {
+    if (strcmp (names[i], "url") == 0) {
+      url = values[i];
+    } else if (strcmp (names[i], "title") == 0) {
+      title = values[i];
+    } else if (strcmp (names[i], "loading") == 0) {
+      was_loading = strcmp (values[i], "true") == 0;
+    } else if (strcmp (names[i], "crashed") == 0) {
+      crashed = strcmp (values[i], "true") == 0;
+    } else if (strcmp (names[i], "history") == 0) {
+      guchar *data;
+      gsize data_length;
+
+      if (history_data)
+        g_bytes_unref (history_data);
+      data = g_base64_decode (values[i], &data_length);
+      history_data = g_bytes_new_take (data, data_length);
+    } else if (strcmp (names[i], "pinned") == 0) {
+      is_pin = strcmp (values[i], "true") == 0;
+    }
+  }
+
+  session_restore_tab (context, url, title, history_data, was_loading, crashed, is_pin);
 }
 
 static void
@@ -1257,7 +1610,6 @@ session_start_element (GMarkupParseContext *ctx,
 
   if (strcmp (element_name, "window") == 0) {
     session_parse_window (context, names, values);
-    context->is_first_tab = TRUE;
   } else if (strcmp (element_name, "embed") == 0) {
     session_parse_embed (context, names, values);
   }
@@ -1272,25 +1624,7 @@ session_end_element (GMarkupParseContext *ctx,
   SessionParserContext *context = (SessionParserContext *)user_data;
 
   if (strcmp (element_name, "window") == 0) {
-    GtkWidget *notebook;
-    EphyEmbedShell *shell = ephy_embed_shell_get_default ();
-
-    notebook = ephy_window_get_notebook (context->window);
-    gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook), context->active_tab);
-
-    if (ephy_embed_shell_get_mode (ephy_embed_shell_get_default ()) != EPHY_EMBED_SHELL_MODE_TEST) {
-      EphyEmbed *active_child;
-
-      active_child = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (context->window));
-      gtk_widget_grab_focus (GTK_WIDGET (active_child));
-      gtk_widget_show (GTK_WIDGET (context->window));
-    }
-
-    ephy_embed_shell_restored_window (shell);
-
-    context->window = NULL;
-    context->active_tab = 0;
-    context->is_first_window = FALSE;
+    session_finish_window (context);
   } else if (strcmp (element_name, "embed") == 0) {
     context->is_first_tab = FALSE;
   }
@@ -1306,18 +1640,30 @@ static const GMarkupParser session_parser = {
 
 typedef struct {
   EphyShell *shell;
+  SessionParserContext *context;
+  GInputStream *stream;
+
+  /* XML format. */
   GMarkupParseContext *parser;
-  char buffer[1024];
+
+  /* Binary format. */
+  SessionBinaryParser *binary;
+
+  char buffer[4096];
+
+  gint64 begin_time;
 } LoadFromStreamAsyncData;
 
 static LoadFromStreamAsyncData *
-load_from_stream_async_data_new (GMarkupParseContext *parser)
+load_from_stream_async_data_new (SessionParserContext *context,
+                                 GInputStream         *stream)
 {
   LoadFromStreamAsyncData *data;
 
-  data = g_new (LoadFromStreamAsyncData, 1);
+  data = g_new0 (LoadFromStreamAsyncData, 1);
   data->shell = g_object_ref (ephy_shell_get_default ());
-  data->parser = parser;
+  data->context = context;
+  data->stream = G_INPUT_STREAM (g_buffered_input_stream_new (stream));
 
   return data;
 }
@@ -1326,7 +1672,12 @@ static void
 load_from_stream_async_data_free (LoadFromStreamAsyncData *data)
 {
   g_object_unref (data->shell);
-  g_markup_parse_context_free (data->parser);
+  g_object_unref (data->stream);
+  if (data->parser)
+    g_markup_parse_context_free (data->parser);
+  if (data->binary)
+    session_binary_parser_free (data->binary);
+  session_parser_context_free (data->context);
 
   g_free (data);
 }
@@ -1335,6 +1686,11 @@ static void
 load_stream_complete (GTask *task)
 {
   EphySession *session;
+  LoadFromStreamAsyncData *data;
+
+  data = g_task_get_task_data (task);
+  ephy_trace_mark ("session", "load", data->begin_time);
+  ephy_metrics_add_duration ("session", "load", g_get_monotonic_time () - data->begin_time);
 
   g_task_return_boolean (task, TRUE);
 
@@ -1354,7 +1710,10 @@ load_stream_complete_error (GTask  *task,
 {
   EphySession *session;
   LoadFromStreamAsyncData *data;
-  SessionParserContext *context;
+
+  data = g_task_get_task_data (task);
+  ephy_trace_mark ("session", "load", data->begin_time);
+  ephy_metrics_add_duration ("session", "load", g_get_monotonic_time () - data->begin_time);
 
   g_task_return_error (task, error);
 
@@ -1365,15 +1724,304 @@ load_stream_complete_error (GTask  *task,
    */
   session_delete (session);
 
-  data = g_task_get_task_data (task);
-  context = (SessionParserContext *)g_markup_parse_context_get_user_data (data->parser);
-  session_maybe_open_window (session, context->user_time);
+  session_maybe_open_window (session, data->context->user_time);
 
   g_object_unref (task);
 
   g_application_release (G_APPLICATION (ephy_shell_get_default ()));
 }
 
+typedef struct {
+  const guint8 *data;
+  gsize length;
+  gsize offset;
+} BinaryReader;
+
+static gboolean
+binary_read_uint32 (BinaryReader *reader,
+                    guint32      *value)
+{
+  guint32 le_value;
+
+  if (reader->length - reader->offset < sizeof (le_value))
+    return FALSE;
+
+  memcpy (&le_value, reader->data + reader->offset, sizeof (le_value));
+  reader->offset += sizeof (le_value);
+  *value = GUINT32_FROM_LE (le_value);
+
+  return TRUE;
+}
+
+static gboolean
+binary_read_int (BinaryReader *reader,
+                 int          *value)
+{
+  guint32 uint_value;
+
+  if (!binary_read_uint32 (reader, &uint_value))
+    return FALSE;
+
+  *value = (gint32)uint_value;
+  return TRUE;
+}
+
+static gboolean
+binary_read_data (BinaryReader  *reader,
+                  const guint8 **data,
+                  guint32       *length)
+{
+  if (!binary_read_uint32 (reader, length))
+    return FALSE;
+
+  if (reader->length - reader->offset < *length)
+    return FALSE;
+
+  *data = reader->data + reader->offset;
+  reader->offset += *length;
+
+  return TRUE;
+}
+
+static gboolean
+binary_read_string (BinaryReader *reader,
+                    char        **str)
+{
+  const guint8 *data;
+  guint32 length;
+
+  if (!binary_read_data (reader, &data, &length))
+    return FALSE;
+
+  *str = g_strndup ((const char *)data, length);
+  return TRUE;
+}
+
+static gboolean
+session_parse_binary_window (SessionBinaryParser *parser,
+                             BinaryReader        *reader)
+{
+  GdkRectangle geometry;
+  int active_tab;
+  char *role = NULL;
+
+  if (parser->in_window)
+    return FALSE;
+
+  if (!binary_read_int (reader, &geometry.x) ||
+      !binary_read_int (reader, &geometry.y) ||
+      !binary_read_int (reader, &geometry.width) ||
+      !binary_read_int (reader, &geometry.height) ||
+      !binary_read_int (reader, &active_tab) ||
+      !binary_read_string (reader, &role))
+    return FALSE;
+
+  parser->handler->window (parser->user_data, &geometry, *role ? role : NULL, active_tab);
+  parser->in_window = TRUE;
+  g_free (role);
+
+  return TRUE;
+}
+
+static gboolean
+session_parse_binary_tab (SessionBinaryParser *parser,
+                          BinaryReader        *reader)
+{
+  guint8 flags;
+  char *url = NULL;
+  char *title = NULL;
+  const guint8 *state_data;
+  guint32 state_length;
+  gboolean retval = FALSE;
+
+  if (!parser->in_window || reader->length - reader->offset < 1)
+    return FALSE;
+
+  flags = reader->data[reader->offset++];
+
+  if (binary_read_string (reader, &url) &&
+      binary_read_string (reader, &title) &&
+      binary_read_data (reader, &state_data, &state_length)) {
+    /* Copying the raw bytes is all the work done here, the state is only
+     * deserialized by WebKit when the tab is actually loaded.
+     */
+    parser->handler->tab (parser->user_data, url, title,
+                          state_length > 0 ? g_bytes_new (state_data, state_length) : NULL,
+                          flags);
+    retval = TRUE;
+  }
+
+  g_free (url);
+  g_free (title);
+
+  return retval;
+}
+
+static gboolean
+session_parse_binary_record (SessionBinaryParser *parser,
+                             SessionRecordType    type,
+                             const guint8        *payload,
+                             gsize                length,
+                             GError             **error)
+{
+  BinaryReader reader = { payload, length, 0 };
+  gboolean success;
+
+  switch (type) {
+    case SESSION_RECORD_WINDOW:
+      success = session_parse_binary_window (parser, &reader);
+      break;
+    case SESSION_RECORD_TAB:
+      success = session_parse_binary_tab (parser, &reader);
+      break;
+    case SESSION_RECORD_WINDOW_END:
+      success = parser->in_window;
+      if (success) {
+        parser->handler->window_end (parser->user_data);
+        parser->in_window = FALSE;
+      }
+      break;
+    default:
+      /* Unknown records are skipped, so that minor additions to the format
+       * do not require bumping the version.
+       */
+      success = TRUE;
+  }
+
+  if (!success)
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "Invalid session record of type %d", type);
+
+  return success;
+}
+
+/* Parses the records that are complete in the data read so far, and keeps
+ * the rest for the next chunk.
+ */
+static gboolean
+session_binary_parser_feed (SessionBinaryParser *parser,
+                            const char          *buffer,
+                            gsize                length,
+                            GError             **error)
+{
+  GByteArray *pending = parser->pending;
+  gsize offset = 0;
+  gboolean success = TRUE;
+
+  g_byte_array_append (pending, (const guint8 *)buffer, length);
+
+  while (pending->len - offset >= SESSION_BINARY_RECORD_HEADER_LEN) {
+    guint8 type = pending->data[offset];
+    guint32 record_length;
+
+    memcpy (&record_length, pending->data + offset + 1, sizeof (record_length));
+    record_length = GUINT32_FROM_LE (record_length);
+    if (pending->len - offset - SESSION_BINARY_RECORD_HEADER_LEN < record_length)
+      break;
+
+    success = session_parse_binary_record (parser, type,
+                                           pending->data + offset + SESSION_BINARY_RECORD_HEADER_LEN,
+                                           record_length, error);
+    if (!success)
+      break;
+
+    offset += SESSION_BINARY_RECORD_HEADER_LEN + record_length;
+  }
+
+  if (offset > 0)
+    g_byte_array_remove_range (pending, 0, offset);
+
+  return success;
+}
+
+static gboolean
+session_binary_parser_end (SessionBinaryParser *parser,
+                           GError             **error)
+{
+  if (parser->pending->len > 0 || parser->in_window) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                         "Session file is truncated");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Checks the header of a binary session, which must start with the magic. */
+static gboolean
+session_binary_parse_header (const guint8 *header,
+                             guint32      *flags,
+                             GError      **error)
+{
+  guint32 version;
+
+  memcpy (&version, header + SESSION_BINARY_MAGIC_LEN, sizeof (version));
+  version = GUINT32_FROM_LE (version);
+  memcpy (flags, header + SESSION_BINARY_MAGIC_LEN + 4, sizeof (*flags));
+  *flags = GUINT32_FROM_LE (*flags);
+
+  if (version > SESSION_BINARY_VERSION) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "Unsupported session file version %u", version);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Returns a stream reading the records that follow the header in @stream. */
+static GInputStream *
+session_binary_open_records (GInputStream *stream,
+                             guint32       flags)
+{
+  GZlibDecompressor *decompressor;
+  GInputStream *records;
+
+  if (!(flags & SESSION_BINARY_FLAG_COMPRESSED))
+    return g_object_ref (stream);
+
+  decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
+  records = g_converter_input_stream_new (stream, G_CONVERTER (decompressor));
+  g_object_unref (decompressor);
+
+  return records;
+}
+
+static void
+session_binary_window_cb (SessionParserContext *context,
+                          GdkRectangle         *geometry,
+                          const char           *role,
+                          int                   active_tab)
+{
+  session_restore_window (context, geometry, role, active_tab);
+}
+
+static void
+session_binary_tab_cb (SessionParserContext *context,
+                       const char           *url,
+                       const char           *title,
+                       GBytes               *state,
+                       SessionTabFlags       flags)
+{
+  session_restore_tab (context, url, title, state,
+                       flags & SESSION_TAB_LOADING,
+                       flags & SESSION_TAB_CRASHED,
+                       flags & SESSION_TAB_PINNED);
+  context->is_first_tab = FALSE;
+}
+
+static void
+session_binary_window_end_cb (SessionParserContext *context)
+{
+  session_finish_window (context);
+}
+
+static const SessionBinaryHandler session_binary_handler = {
+  (SessionBinaryWindowFunc)session_binary_window_cb,
+  (SessionBinaryTabFunc)session_binary_tab_cb,
+  (SessionBinaryWindowEndFunc)session_binary_window_end_cb
+};
+
 static void
 load_stream_read_cb (GObject      *object,
                      GAsyncResult *result,
@@ -1383,7 +2031,9 @@ load_stream_read_cb (GObject      *object,
   GTask *task = G_TASK (user_data);
   LoadFromStreamAsyncData *data;
   gssize bytes_read;
+  gboolean success;
   GError *error = NULL;
+  gint64 parse_time;
 
   bytes_read = g_input_stream_read_finish (stream, result, &error);
   if (bytes_read < 0) {
@@ -1394,7 +2044,12 @@ load_stream_read_cb (GObject      *object,
 
   data = g_task_get_task_data (task);
   if (bytes_read == 0) {
-    if (!g_markup_parse_context_end_parse (data->parser, &error)) {
+    if (data->binary)
+      success = session_binary_parser_end (data->binary, &error);
+    else
+      success = g_markup_parse_context_end_parse (data->parser, &error);
+
+    if (!success) {
       load_stream_complete_error (task, error);
     } else {
       load_stream_complete (task);
@@ -1403,7 +2058,14 @@ load_stream_read_cb (GObject      *object,
     return;
   }
 
-  if (!g_markup_parse_context_parse (data->parser, data->buffer, bytes_read, &error)) {
+  parse_time = EPHY_TRACE_NOW ();
+  if (data->binary)
+    success = session_binary_parser_feed (data->binary, data->buffer, bytes_read, &error);
+  else
+    success = g_markup_parse_context_parse (data->parser, data->buffer, bytes_read, &error);
+  ephy_trace_mark ("session", "parse", parse_time);
+
+  if (!success) {
     load_stream_complete_error (task, error);
 
     return;
@@ -1415,6 +2077,67 @@ load_stream_read_cb (GObject      *object,
                              load_stream_read_cb, task);
 }
 
+static gboolean
+load_stream_setup_binary (LoadFromStreamAsyncData *data,
+                          const guint8            *header,
+                          GError                 **error)
+{
+  GInputStream *records;
+  guint32 flags;
+
+  if (!session_binary_parse_header (header, &flags, error))
+    return FALSE;
+
+  /* The header is already buffered, so this does not block. */
+  if (g_input_stream_skip (data->stream, SESSION_BINARY_HEADER_LEN, NULL, error) != SESSION_BINARY_HEADER_LEN)
+    return FALSE;
+
+  records = session_binary_open_records (data->stream, flags);
+  g_object_unref (data->stream);
+  data->stream = records;
+
+  data->binary = session_binary_parser_new (&session_binary_handler, data->context);
+
+  return TRUE;
+}
+
+static void
+load_stream_sniff_cb (GObject      *object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  GBufferedInputStream *stream = G_BUFFERED_INPUT_STREAM (object);
+  GTask *task = G_TASK (user_data);
+  LoadFromStreamAsyncData *data;
+  const guint8 *header;
+  gsize available;
+  GError *error = NULL;
+
+  if (g_buffered_input_stream_fill_finish (stream, result, &error) < 0) {
+    load_stream_complete_error (task, error);
+
+    return;
+  }
+
+  data = g_task_get_task_data (task);
+  header = g_buffered_input_stream_peek_buffer (stream, &available);
+  if (available >= SESSION_BINARY_HEADER_LEN &&
+      memcmp (header, SESSION_BINARY_MAGIC, SESSION_BINARY_MAGIC_LEN) == 0) {
+    if (!load_stream_setup_binary (data, header, &error)) {
+      load_stream_complete_error (task, error);
+
+      return;
+    }
+  } else {
+    data->parser = g_markup_parse_context_new (&session_parser, 0, data->context, NULL);
+  }
+
+  g_input_stream_read_async (data->stream, data->buffer, sizeof (data->buffer),
+                             g_task_get_priority (task),
+                             g_task_get_cancellable (task),
+                             load_stream_read_cb, task);
+}
+
 /**
  * ephy_session_load_from_stream:
  * @session: an #EphySession
@@ -1426,7 +2149,9 @@ load_stream_read_cb (GObject      *object,
  * @user_data: (closure): the data to pass to callback function
  *
  * Asynchronously loads the session reading the session data from @stream,
- * restoring windows and their state.
+ * restoring windows and their state. Both the XML and the binary session
+ * formats are accepted, the format is detected from the first bytes of
+ * @stream.
  *
  * When the operation is finished, @callback will be called. You can
  * then call ephy_session_load_from_stream_finish() to get the result of
@@ -1442,7 +2167,6 @@ ephy_session_load_from_stream (EphySession        *session,
 {
   GTask *task;
   SessionParserContext *context;
-  GMarkupParseContext *parser;
   LoadFromStreamAsyncData *data;
 
   g_assert (EPHY_IS_SESSION (session));
@@ -1459,13 +2183,14 @@ ephy_session_load_from_stream (EphySession        *session,
   g_task_set_priority (task, G_PRIORITY_HIGH_IDLE + 30);
 
   context = session_parser_context_new (session, user_time);
-  parser = g_markup_parse_context_new (&session_parser, 0, context, (GDestroyNotify)session_parser_context_free);
-  data = load_from_stream_async_data_new (parser);
+  data = load_from_stream_async_data_new (context, stream);
+  data->begin_time = g_get_monotonic_time ();
   g_task_set_task_data (task, data, (GDestroyNotify)load_from_stream_async_data_free);
 
-  g_input_stream_read_async (stream, data->buffer, sizeof (data->buffer),
-                             g_task_get_priority (task), cancellable,
-                             load_stream_read_cb, task);
+  g_buffered_input_stream_fill_async (G_BUFFERED_INPUT_STREAM (data->stream),
+                                      SESSION_BINARY_HEADER_LEN,
+                                      g_task_get_priority (task), cancellable,
+                                      load_stream_sniff_cb, task);
 }
 
 /**
@@ -1731,3 +2456,111 @@ ephy_session_clear (EphySession *session)
 
   ephy_session_save (session);
 }
+
+GBytes *
+ephy_session_write_binary_for_testing (GList   *windows,
+                                       GError **error)
+{
+  return write_binary_session (windows, NULL, error);
+}
+
+void
+ephy_session_free_windows_for_testing (GList *windows)
+{
+  g_list_free_full (windows, (GDestroyNotify)session_window_free);
+}
+
+static void
+read_binary_window_cb (GList        **windows,
+                       GdkRectangle  *geometry,
+                       const char    *role,
+                       int            active_tab)
+{
+  SessionWindow *window;
+
+  window = g_new0 (SessionWindow, 1);
+  window->geometry = *geometry;
+  window->role = g_strdup (role);
+  window->active_tab = active_tab;
+  *windows = g_list_prepend (*windows, window);
+}
+
+static void
+read_binary_tab_cb (GList          **windows,
+                    const char      *url,
+                    const char      *title,
+                    GBytes          *state,
+                    SessionTabFlags  flags)
+{
+  SessionWindow *window = (*windows)->data;
+  SessionTab *tab;
+
+  tab = g_new0 (SessionTab, 1);
+  tab->url = g_strdup (url);
+  tab->title = g_strdup (title);
+  tab->loading = !!(flags & SESSION_TAB_LOADING);
+  tab->crashed = !!(flags & SESSION_TAB_CRASHED);
+  tab->pinned = !!(flags & SESSION_TAB_PINNED);
+  if (state) {
+    tab->state = webkit_web_view_session_state_new (state);
+    g_bytes_unref (state);
+  }
+  window->tabs = g_list_append (window->tabs, tab);
+}
+
+static void
+read_binary_window_end_cb (GList **windows)
+{
+}
+
+static const SessionBinaryHandler read_binary_handler = {
+  (SessionBinaryWindowFunc)read_binary_window_cb,
+  (SessionBinaryTabFunc)read_binary_tab_cb,
+  (SessionBinaryWindowEndFunc)read_binary_window_end_cb
+};
+
+GList *
+ephy_session_read_binary_for_testing (GBytes  *bytes,
+                                      GError **error)
+{
+  g_autoptr(GBytes) body = NULL;
+  g_autoptr(GInputStream) stream = NULL;
+  g_autoptr(GInputStream) records = NULL;
+  SessionBinaryParser *parser;
+  GList *windows = NULL;
+  const guint8 *header;
+  gsize length;
+  guint32 flags;
+  /* Small reads split records across chunks, as when loading a file. */
+  char buffer[7];
+  gssize bytes_read = 0;
+  gboolean success = TRUE;
+
+  header = g_bytes_get_data (bytes, &length);
+  if (length < SESSION_BINARY_HEADER_LEN ||
+      memcmp (header, SESSION_BINARY_MAGIC, SESSION_BINARY_MAGIC_LEN) != 0) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Not a binary session");
+    return NULL;
+  }
+
+  if (!session_binary_parse_header (header, &flags, error))
+    return NULL;
+
+  body = g_bytes_new_from_bytes (bytes, SESSION_BINARY_HEADER_LEN, length - SESSION_BINARY_HEADER_LEN);
+  stream = g_memory_input_stream_new_from_bytes (body);
+  records = session_binary_open_records (stream, flags);
+
+  parser = session_binary_parser_new (&read_binary_handler, &windows);
+  while (success && (bytes_read = g_input_stream_read (records, buffer, sizeof (buffer), NULL, error)) > 0)
+    success = session_binary_parser_feed (parser, buffer, bytes_read, error);
+  success = success && bytes_read == 0 && session_binary_parser_end (parser, error);
+  session_binary_parser_free (parser);
+
+  if (!success) {
+    ephy_session_free_windows_for_testing (windows);
+    return NULL;
+  }
+
+  return g_list_reverse (windows);
+}
@@ -23,6 +23,7 @@
 #include "config.h"
 #include "ephy-shell.h"
 
+#include "ephy-completion-index-writer.h"
 #include "ephy-debug.h"
 #include "ephy-embed-container.h"
 #include "ephy-embed-utils.h"
@@ -36,6 +37,7 @@
 #include "ephy-session.h"
 #include "ephy-settings.h"
 #include "ephy-sync-utils.h"
+#include "ephy-tab-discarder.h"
 #include "ephy-title-box.h"
 #include "ephy-title-widget.h"
 #include "ephy-type-builtins.h"
@@ -58,6 +60,8 @@ struct _EphyShell {
   EphyHistoryManager *history_manager;
   EphyOpenTabsManager *open_tabs_manager;
   GNetworkMonitor *network_monitor;
+  EphyTabDiscarder *tab_discarder;
+  EphyCompletionIndexWriter *completion_index_writer;
   GtkWidget *history_dialog;
   GObject *prefs_dialog;
   EphyShellStartupContext *local_startup_context;
@@ -378,6 +382,13 @@ ephy_shell_startup (GApplication *application)
         ephy_shell_get_sync_service (shell);
       }
 
+      /* Only the browser profile is searched by the search provider. */
+      if (mode == EPHY_EMBED_SHELL_MODE_BROWSER) {
+        shell->completion_index_writer =
+          ephy_completion_index_writer_new (ephy_embed_shell_get_global_history_service (embed_shell),
+                                            ephy_shell_get_bookmarks_manager (shell));
+      }
+
       /* Actions that are disabled in app mode */
       set_accel_for_action (shell, "app.new-window", "<Primary>n");
       set_accel_for_action (shell, "app.new-incognito", "<Primary><Shift>n");
@@ -397,6 +408,9 @@ ephy_shell_startup (GApplication *application)
   set_accel_for_action (shell, "app.history", "<Primary>h");
   set_accel_for_action (shell, "app.preferences", "<Primary>e");
   set_accel_for_action (shell, "app.quit", "<Primary>q");
+
+  if (mode != EPHY_EMBED_SHELL_MODE_AUTOMATION)
+    shell->tab_discarder = ephy_tab_discarder_new ();
 }
 
 static GtkWidget *
@@ -684,6 +698,8 @@ ephy_shell_dispose (GObject *object)
   g_clear_pointer (&shell->history_dialog, gtk_widget_destroy);
   g_clear_object (&shell->prefs_dialog);
   g_clear_object (&shell->network_monitor);
+  g_clear_object (&shell->tab_discarder);
+  g_clear_object (&shell->completion_index_writer);
   g_clear_object (&shell->sync_service);
   g_clear_object (&shell->bookmarks_manager);
   g_clear_object (&shell->history_manager);
@@ -0,0 +1,42 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-tab-discarder.h"
+
+G_BEGIN_DECLS
+
+/* What the discarder needs to know about a tab to choose one. */
+typedef struct {
+  gboolean shown;
+  gboolean pinned;
+  gboolean playing_audio;
+  /* Loading, blank, showing an error, or already discarded. */
+  gboolean busy;
+  gint64   last_visible_time;
+} EphyTabDiscarderTab;
+
+gboolean ephy_tab_discarder_tab_is_discardable (const EphyTabDiscarderTab *tab,
+                                                gint64                     now);
+int      ephy_tab_discarder_compare_tabs       (const EphyTabDiscarderTab *a,
+                                                const EphyTabDiscarderTab *b);
+
+G_END_DECLS
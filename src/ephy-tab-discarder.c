@@ -0,0 +1,319 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-tab-discarder-private.h"
+
+#include "ephy-debug.h"
+#include "ephy-embed.h"
+#include "ephy-memory-pressure.h"
+#include "ephy-notebook.h"
+#include "ephy-prefs.h"
+#include "ephy-settings.h"
+#include "ephy-shell.h"
+#include "ephy-web-view.h"
+#include "ephy-window.h"
+
+/* While the system is under memory pressure, this discards one background
+ * tab at a time, the one hidden for the longest time first, pinned tabs after
+ * all the others. Tabs playing audio, tabs with modified forms and tabs that
+ * were hidden very recently are never discarded. A discarded tab keeps its
+ * history and is loaded again when it is switched to, see
+ * ephy_embed_discard().
+ */
+
+#define POLL_INTERVAL_SECONDS            10
+/* Do not discard the tab the user just switched away from. */
+#define MIN_HIDDEN_SECONDS               60
+/* Give up on a web process that does not answer whether forms were modified. */
+#define MODIFIED_FORMS_TIMEOUT_SECONDS   5
+
+typedef struct {
+  EphyEmbed *embed;
+  EphyTabDiscarderTab tab;
+} Candidate;
+
+struct _EphyTabDiscarder {
+  GObject parent_instance;
+
+  guint poll_source_id;
+
+  /* Candidates left to check for modified forms, most discardable last. */
+  GArray *candidates;
+  GCancellable *cancellable;
+  guint modified_forms_timeout_id;
+};
+
+G_DEFINE_TYPE (EphyTabDiscarder, ephy_tab_discarder, G_TYPE_OBJECT)
+
+static void ephy_tab_discarder_check_next_candidate (EphyTabDiscarder *discarder);
+
+static void
+candidate_clear (Candidate *candidate)
+{
+  g_clear_object (&candidate->embed);
+}
+
+gboolean
+ephy_tab_discarder_tab_is_discardable (const EphyTabDiscarderTab *tab,
+                                       gint64                     now)
+{
+  return !tab->shown && !tab->playing_audio && !tab->busy &&
+         now - tab->last_visible_time >= MIN_HIDDEN_SECONDS * G_USEC_PER_SEC;
+}
+
+/* Sorts the most discardable tabs last. */
+int
+ephy_tab_discarder_compare_tabs (const EphyTabDiscarderTab *a,
+                                 const EphyTabDiscarderTab *b)
+{
+  if (a->pinned != b->pinned)
+    return a->pinned ? -1 : 1;
+
+  if (a->last_visible_time != b->last_visible_time)
+    return a->last_visible_time > b->last_visible_time ? -1 : 1;
+
+  return 0;
+}
+
+static int
+compare_candidates (const Candidate *a,
+                    const Candidate *b)
+{
+  return ephy_tab_discarder_compare_tabs (&a->tab, &b->tab);
+}
+
+static void
+get_tab (EphyEmbed           *embed,
+         EphyNotebook        *notebook,
+         EphyTabDiscarderTab *tab)
+{
+  EphyWebView *view = ephy_embed_get_web_view (embed);
+
+  tab->shown = gtk_widget_get_mapped (GTK_WIDGET (embed));
+  tab->pinned = notebook && ephy_notebook_tab_is_pinned (notebook, embed);
+  tab->playing_audio = webkit_web_view_is_playing_audio (WEBKIT_WEB_VIEW (view));
+  tab->busy = ephy_embed_has_load_pending (embed) ||
+              ephy_web_view_is_loading (view) ||
+              ephy_web_view_get_is_blank (view) ||
+              ephy_web_view_is_overview (view) ||
+              ephy_web_view_get_error_page (view) != EPHY_WEB_VIEW_ERROR_PAGE_NONE;
+  tab->last_visible_time = ephy_embed_get_last_visible_time (embed);
+}
+
+static gboolean
+embed_can_be_discarded (EphyEmbed *embed,
+                        gint64     now)
+{
+  EphyTabDiscarderTab tab;
+
+  get_tab (embed, NULL, &tab);
+
+  return ephy_tab_discarder_tab_is_discardable (&tab, now);
+}
+
+static void
+collect_candidates (EphyTabDiscarder *discarder)
+{
+  gint64 now = g_get_monotonic_time ();
+  GList *windows;
+
+  windows = gtk_application_get_windows (GTK_APPLICATION (ephy_shell_get_default ()));
+  for (GList *l = windows; l; l = l->next) {
+    EphyNotebook *notebook;
+    int n_pages;
+
+    if (!EPHY_IS_WINDOW (l->data))
+      continue;
+
+    notebook = EPHY_NOTEBOOK (ephy_window_get_notebook (l->data));
+    n_pages = gtk_notebook_get_n_pages (GTK_NOTEBOOK (notebook));
+    for (int i = 0; i < n_pages; i++) {
+      EphyEmbed *embed = EPHY_EMBED (gtk_notebook_get_nth_page (GTK_NOTEBOOK (notebook), i));
+      Candidate candidate;
+
+      get_tab (embed, notebook, &candidate.tab);
+      if (!ephy_tab_discarder_tab_is_discardable (&candidate.tab, now))
+        continue;
+
+      candidate.embed = g_object_ref (embed);
+      g_array_append_val (discarder->candidates, candidate);
+    }
+  }
+
+  g_array_sort (discarder->candidates, (GCompareFunc)compare_candidates);
+}
+
+static void
+ephy_tab_discarder_finish_check (EphyTabDiscarder *discarder)
+{
+  g_clear_handle_id (&discarder->modified_forms_timeout_id, g_source_remove);
+  g_clear_object (&discarder->cancellable);
+}
+
+static void
+skip_candidate (EphyTabDiscarder *discarder)
+{
+  g_array_set_size (discarder->candidates, discarder->candidates->len - 1);
+  ephy_tab_discarder_check_next_candidate (discarder);
+}
+
+static void
+has_modified_forms_cb (EphyWebView      *view,
+                       GAsyncResult     *result,
+                       EphyTabDiscarder *discarder)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean has_modified_forms;
+  Candidate *candidate;
+
+  /* When the check is cancelled, the discarder has either moved on to the
+   * next candidate or been disposed.
+   */
+  has_modified_forms = ephy_web_view_has_modified_forms_finish (view, result, &error);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  ephy_tab_discarder_finish_check (discarder);
+
+  /* The tab may have been closed or shown in the meantime. */
+  candidate = &g_array_index (discarder->candidates, Candidate, discarder->candidates->len - 1);
+  if (error || has_modified_forms ||
+      !gtk_widget_get_parent (GTK_WIDGET (candidate->embed)) ||
+      !embed_can_be_discarded (candidate->embed, g_get_monotonic_time ())) {
+    skip_candidate (discarder);
+    return;
+  }
+
+  ephy_embed_discard (candidate->embed);
+  g_array_set_size (discarder->candidates, 0);
+}
+
+static gboolean
+modified_forms_timeout_cb (EphyTabDiscarder *discarder)
+{
+  discarder->modified_forms_timeout_id = 0;
+
+  LOG ("Web process did not tell whether a tab has modified forms, not discarding it");
+  g_cancellable_cancel (discarder->cancellable);
+  ephy_tab_discarder_finish_check (discarder);
+  skip_candidate (discarder);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_tab_discarder_check_next_candidate (EphyTabDiscarder *discarder)
+{
+  Candidate *candidate = NULL;
+
+  /* Skip the tabs that were closed since they were collected. */
+  while (discarder->candidates->len > 0) {
+    candidate = &g_array_index (discarder->candidates, Candidate, discarder->candidates->len - 1);
+    if (gtk_widget_get_parent (GTK_WIDGET (candidate->embed)))
+      break;
+    g_array_set_size (discarder->candidates, discarder->candidates->len - 1);
+  }
+
+  if (discarder->candidates->len == 0)
+    return;
+
+  discarder->cancellable = g_cancellable_new ();
+  discarder->modified_forms_timeout_id = g_timeout_add_seconds (MODIFIED_FORMS_TIMEOUT_SECONDS,
+                                                                (GSourceFunc)modified_forms_timeout_cb,
+                                                                discarder);
+  g_source_set_name_by_id (discarder->modified_forms_timeout_id, "[epiphany] modified_forms_timeout_cb");
+
+  ephy_web_view_has_modified_forms (ephy_embed_get_web_view (candidate->embed),
+                                    discarder->cancellable,
+                                    (GAsyncReadyCallback)has_modified_forms_cb,
+                                    discarder);
+}
+
+static gboolean
+poll_cb (EphyTabDiscarder *discarder)
+{
+  /* Still checking the candidates found last time. */
+  if (discarder->candidates->len > 0)
+    return G_SOURCE_CONTINUE;
+
+  if (!g_settings_get_boolean (EPHY_SETTINGS_MAIN, EPHY_PREFS_DISCARD_TABS_UNDER_MEMORY_PRESSURE) ||
+      !ephy_is_under_memory_pressure ())
+    return G_SOURCE_CONTINUE;
+
+  collect_candidates (discarder);
+  LOG ("Memory pressure is high, %u tabs can be discarded", discarder->candidates->len);
+  ephy_tab_discarder_check_next_candidate (discarder);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+ephy_tab_discarder_dispose (GObject *object)
+{
+  EphyTabDiscarder *discarder = EPHY_TAB_DISCARDER (object);
+
+  g_clear_handle_id (&discarder->poll_source_id, g_source_remove);
+
+  if (discarder->cancellable) {
+    g_cancellable_cancel (discarder->cancellable);
+    ephy_tab_discarder_finish_check (discarder);
+  }
+
+  if (discarder->candidates)
+    g_array_set_size (discarder->candidates, 0);
+
+  G_OBJECT_CLASS (ephy_tab_discarder_parent_class)->dispose (object);
+}
+
+static void
+ephy_tab_discarder_finalize (GObject *object)
+{
+  EphyTabDiscarder *discarder = EPHY_TAB_DISCARDER (object);
+
+  g_array_unref (discarder->candidates);
+
+  G_OBJECT_CLASS (ephy_tab_discarder_parent_class)->finalize (object);
+}
+
+static void
+ephy_tab_discarder_init (EphyTabDiscarder *discarder)
+{
+  discarder->candidates = g_array_new (FALSE, FALSE, sizeof (Candidate));
+  g_array_set_clear_func (discarder->candidates, (GDestroyNotify)candidate_clear);
+
+  discarder->poll_source_id = g_timeout_add_seconds (POLL_INTERVAL_SECONDS, (GSourceFunc)poll_cb, discarder);
+  g_source_set_name_by_id (discarder->poll_source_id, "[epiphany] tab_discarder_poll_cb");
+}
+
+static void
+ephy_tab_discarder_class_init (EphyTabDiscarderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_tab_discarder_dispose;
+  object_class->finalize = ephy_tab_discarder_finalize;
+}
+
+EphyTabDiscarder *
+ephy_tab_discarder_new (void)
+{
+  return g_object_new (EPHY_TYPE_TAB_DISCARDER, NULL);
+}
@@ -0,0 +1,330 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-tab-restore-scheduler.h"
+
+#include "ephy-debug.h"
+#include "ephy-embed.h"
+#include "ephy-memory-pressure.h"
+#include "ephy-notebook.h"
+
+/* Restoring a session loads its tabs through this scheduler when delayed
+ * loading is disabled. Instead of starting every load at once, tabs are
+ * queued by priority (the active tab of each window, then pinned tabs, then
+ * the others by distance to the active tab) and at most max_concurrent_loads
+ * of them are loading at any time. While the system is under memory pressure
+ * only one load is allowed to run.
+ *
+ * Tabs that the user switches to before their turn are loaded by EphyEmbed
+ * itself, and are then simply skipped here.
+ */
+
+/* Give up waiting for a load to finish after this long, so that a single
+ * hanging page does not stall the rest of the queue.
+ */
+#define LOAD_TIMEOUT_SECONDS        15
+#define MEMORY_PRESSURE_RETRY_MS    1000
+
+typedef enum {
+  TAB_TIER_ACTIVE,
+  TAB_TIER_PINNED,
+  TAB_TIER_OTHER
+} TabTier;
+
+typedef struct {
+  EphyTabRestoreScheduler *scheduler;
+  EphyEmbed *embed;
+  TabTier tier;
+  int distance;
+  guint serial;
+
+  WebKitWebView *web_view;
+  gulong load_changed_id;
+  guint timeout_id;
+} PendingTab;
+
+struct _EphyTabRestoreScheduler {
+  GObject parent_instance;
+
+  guint max_concurrent_loads;
+  guint serial;
+
+  GQueue *queue;
+  GList *loading;
+  guint retry_source_id;
+
+  gint64 start_time;
+  EphyEmbed *first_active_tab;
+};
+
+G_DEFINE_TYPE (EphyTabRestoreScheduler, ephy_tab_restore_scheduler, G_TYPE_OBJECT)
+
+static void ephy_tab_restore_scheduler_schedule (EphyTabRestoreScheduler *scheduler);
+
+static void embed_destroyed_cb (PendingTab *tab,
+                                GObject    *where_the_object_was);
+
+static void
+pending_tab_free (PendingTab *tab)
+{
+  /* The embed may have replaced its web view since the load started. */
+  if (tab->web_view) {
+    g_signal_handler_disconnect (tab->web_view, tab->load_changed_id);
+    g_object_remove_weak_pointer (G_OBJECT (tab->web_view), (gpointer *)&tab->web_view);
+  }
+
+  if (tab->embed)
+    g_object_weak_unref (G_OBJECT (tab->embed), (GWeakNotify)embed_destroyed_cb, tab);
+
+  if (tab->timeout_id)
+    g_source_remove (tab->timeout_id);
+
+  g_free (tab);
+}
+
+static int
+pending_tab_compare (PendingTab *a,
+                     PendingTab *b,
+                     gpointer    user_data)
+{
+  if (a->tier != b->tier)
+    return a->tier - b->tier;
+
+  if (a->distance != b->distance)
+    return a->distance - b->distance;
+
+  return a->serial - b->serial;
+}
+
+static void
+pending_tab_finished (PendingTab *tab)
+{
+  EphyTabRestoreScheduler *scheduler = tab->scheduler;
+
+  if (tab->embed && tab->embed == scheduler->first_active_tab) {
+    LOG ("Active tab restored in %.3f ms",
+         (g_get_monotonic_time () - scheduler->start_time) / 1000.0);
+    scheduler->first_active_tab = NULL;
+  }
+
+  scheduler->loading = g_list_remove (scheduler->loading, tab);
+  pending_tab_free (tab);
+
+  ephy_tab_restore_scheduler_schedule (scheduler);
+}
+
+static void
+embed_destroyed_cb (PendingTab *tab,
+                    GObject    *where_the_object_was)
+{
+  EphyTabRestoreScheduler *scheduler = tab->scheduler;
+
+  tab->embed = NULL;
+  if ((GObject *)scheduler->first_active_tab == where_the_object_was)
+    scheduler->first_active_tab = NULL;
+
+  /* A closed tab never finishes loading, do not keep the next one waiting.
+   * Queued tabs are skipped once their turn comes.
+   */
+  if (g_list_find (scheduler->loading, tab))
+    pending_tab_finished (tab);
+}
+
+static void
+load_changed_cb (WebKitWebView   *web_view,
+                 WebKitLoadEvent  load_event,
+                 PendingTab      *tab)
+{
+  if (load_event == WEBKIT_LOAD_FINISHED)
+    pending_tab_finished (tab);
+}
+
+static gboolean
+load_timeout_cb (PendingTab *tab)
+{
+  tab->timeout_id = 0;
+
+  LOG ("Restored tab took more than %d seconds to load, not waiting for it anymore",
+       LOAD_TIMEOUT_SECONDS);
+  pending_tab_finished (tab);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+pending_tab_start_load (PendingTab *tab)
+{
+  EphyTabRestoreScheduler *scheduler = tab->scheduler;
+
+  scheduler->loading = g_list_prepend (scheduler->loading, tab);
+
+  tab->web_view = WEBKIT_WEB_VIEW (ephy_embed_get_web_view (tab->embed));
+  g_object_add_weak_pointer (G_OBJECT (tab->web_view), (gpointer *)&tab->web_view);
+  tab->load_changed_id = g_signal_connect (tab->web_view, "load-changed",
+                                           G_CALLBACK (load_changed_cb), tab);
+  tab->timeout_id = g_timeout_add_seconds (LOAD_TIMEOUT_SECONDS, (GSourceFunc)load_timeout_cb, tab);
+  g_source_set_name_by_id (tab->timeout_id, "[epiphany] load_timeout_cb");
+
+  ephy_embed_load_delayed_request (tab->embed);
+}
+
+static gboolean
+retry_schedule_cb (EphyTabRestoreScheduler *scheduler)
+{
+  scheduler->retry_source_id = 0;
+  ephy_tab_restore_scheduler_schedule (scheduler);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_tab_restore_scheduler_schedule (EphyTabRestoreScheduler *scheduler)
+{
+  if (scheduler->retry_source_id)
+    return;
+
+  while (!g_queue_is_empty (scheduler->queue) &&
+         g_list_length (scheduler->loading) < scheduler->max_concurrent_loads) {
+    PendingTab *tab;
+
+    if (scheduler->loading && ephy_is_under_memory_pressure ()) {
+      LOG ("Memory pressure is high, throttling restored tab loads");
+      scheduler->retry_source_id = g_timeout_add (MEMORY_PRESSURE_RETRY_MS,
+                                                  (GSourceFunc)retry_schedule_cb,
+                                                  scheduler);
+      g_source_set_name_by_id (scheduler->retry_source_id, "[epiphany] retry_schedule_cb");
+      return;
+    }
+
+    tab = g_queue_pop_head (scheduler->queue);
+
+    /* Closed, or already loaded because the user switched to it. */
+    if (!tab->embed || !ephy_embed_has_load_pending (tab->embed)) {
+      if (tab->embed == scheduler->first_active_tab)
+        scheduler->first_active_tab = NULL;
+      pending_tab_free (tab);
+      continue;
+    }
+
+    pending_tab_start_load (tab);
+  }
+}
+
+static void
+ephy_tab_restore_scheduler_dispose (GObject *object)
+{
+  EphyTabRestoreScheduler *scheduler = EPHY_TAB_RESTORE_SCHEDULER (object);
+
+  if (scheduler->retry_source_id) {
+    g_source_remove (scheduler->retry_source_id);
+    scheduler->retry_source_id = 0;
+  }
+
+  if (scheduler->queue) {
+    g_queue_free_full (scheduler->queue, (GDestroyNotify)pending_tab_free);
+    scheduler->queue = NULL;
+  }
+
+  g_list_free_full (scheduler->loading, (GDestroyNotify)pending_tab_free);
+  scheduler->loading = NULL;
+
+  G_OBJECT_CLASS (ephy_tab_restore_scheduler_parent_class)->dispose (object);
+}
+
+static void
+ephy_tab_restore_scheduler_init (EphyTabRestoreScheduler *scheduler)
+{
+  scheduler->queue = g_queue_new ();
+  scheduler->start_time = g_get_monotonic_time ();
+}
+
+static void
+ephy_tab_restore_scheduler_class_init (EphyTabRestoreSchedulerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_tab_restore_scheduler_dispose;
+}
+
+EphyTabRestoreScheduler *
+ephy_tab_restore_scheduler_new (guint max_concurrent_loads)
+{
+  EphyTabRestoreScheduler *scheduler;
+
+  scheduler = g_object_new (EPHY_TYPE_TAB_RESTORE_SCHEDULER, NULL);
+  scheduler->max_concurrent_loads = MAX (max_concurrent_loads, 1);
+
+  return scheduler;
+}
+
+/**
+ * ephy_tab_restore_scheduler_add_window:
+ * @scheduler: an #EphyTabRestoreScheduler
+ * @window: a restored #EphyWindow
+ *
+ * Queues the tabs of @window that have a delayed load request and starts
+ * loading them as allowed by the concurrency limit. Must be called once the
+ * active tab of @window has been set.
+ */
+void
+ephy_tab_restore_scheduler_add_window (EphyTabRestoreScheduler *scheduler,
+                                       EphyWindow              *window)
+{
+  GtkNotebook *notebook;
+  int n_pages;
+  int active;
+
+  g_assert (EPHY_IS_TAB_RESTORE_SCHEDULER (scheduler));
+  g_assert (EPHY_IS_WINDOW (window));
+
+  notebook = GTK_NOTEBOOK (ephy_window_get_notebook (window));
+  n_pages = gtk_notebook_get_n_pages (notebook);
+  active = gtk_notebook_get_current_page (notebook);
+
+  for (int i = 0; i < n_pages; i++) {
+    EphyEmbed *embed = EPHY_EMBED (gtk_notebook_get_nth_page (notebook, i));
+    PendingTab *tab;
+
+    if (!ephy_embed_has_load_pending (embed))
+      continue;
+
+    tab = g_new0 (PendingTab, 1);
+    tab->scheduler = scheduler;
+    tab->embed = embed;
+    g_object_weak_ref (G_OBJECT (embed), (GWeakNotify)embed_destroyed_cb, tab);
+    tab->distance = ABS (i - active);
+    tab->serial = scheduler->serial++;
+
+    if (i == active)
+      tab->tier = TAB_TIER_ACTIVE;
+    else if (ephy_notebook_tab_is_pinned (EPHY_NOTEBOOK (notebook), embed))
+      tab->tier = TAB_TIER_PINNED;
+    else
+      tab->tier = TAB_TIER_OTHER;
+
+    if (i == active && !scheduler->first_active_tab)
+      scheduler->first_active_tab = embed;
+
+    g_queue_insert_sorted (scheduler->queue, tab, (GCompareDataFunc)pending_tab_compare, NULL);
+  }
+
+  ephy_tab_restore_scheduler_schedule (scheduler);
+}
@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-window.h"
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_TAB_RESTORE_SCHEDULER (ephy_tab_restore_scheduler_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyTabRestoreScheduler, ephy_tab_restore_scheduler, EPHY, TAB_RESTORE_SCHEDULER, GObject)
+
+EphyTabRestoreScheduler *ephy_tab_restore_scheduler_new        (guint                    max_concurrent_loads);
+void                     ephy_tab_restore_scheduler_add_window (EphyTabRestoreScheduler *scheduler,
+                                                                EphyWindow              *window);
+
+G_END_DECLS
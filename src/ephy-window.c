@@ -2665,6 +2665,26 @@ reader_mode_cb (EphyWebView *view,
   update_reader_mode (window, view);
 }
 
+static void
+connect_tab_web_view (EphyWindow *window,
+                      EphyEmbed  *embed)
+{
+  g_signal_connect_object (ephy_embed_get_web_view (embed), "download-only-load",
+                           G_CALLBACK (download_only_load_cb), window, G_CONNECT_AFTER);
+
+  g_signal_connect_object (ephy_embed_get_web_view (embed), "notify::reader-mode",
+                           G_CALLBACK (reader_mode_cb), window, G_CONNECT_AFTER);
+}
+
+/* A discarded tab gets a new web view, see ephy_embed_discard(). */
+static void
+tab_web_view_replaced_cb (EphyEmbed  *embed,
+                          GParamSpec *pspec,
+                          EphyWindow *window)
+{
+  connect_tab_web_view (window, embed);
+}
+
 static void
 notebook_page_added_cb (EphyNotebook *notebook,
                         EphyEmbed    *embed,
@@ -2675,11 +2695,9 @@ notebook_page_added_cb (EphyNotebook *notebook,
 
   g_assert (EPHY_IS_EMBED (embed));
 
-  g_signal_connect_object (ephy_embed_get_web_view (embed), "download-only-load",
-                           G_CALLBACK (download_only_load_cb), window, G_CONNECT_AFTER);
-
-  g_signal_connect_object (ephy_embed_get_web_view (embed), "notify::reader-mode",
-                           G_CALLBACK (reader_mode_cb), window, G_CONNECT_AFTER);
+  connect_tab_web_view (window, embed);
+  g_signal_connect_object (embed, "notify::web-view",
+                           G_CALLBACK (tab_web_view_replaced_cb), window, 0);
 
   if (window->present_on_insert) {
     window->present_on_insert = FALSE;
@@ -2704,6 +2722,7 @@ notebook_page_removed_cb (EphyNotebook *notebook,
 
   g_signal_handlers_disconnect_by_func
     (ephy_embed_get_web_view (embed), G_CALLBACK (download_only_load_cb), window);
+  g_signal_handlers_disconnect_by_func (embed, G_CALLBACK (tab_web_view_replaced_cb), window);
 
   tab_accels_update (window);
 }
@@ -23,6 +23,8 @@
 #include "ephy-search-provider.h"
 
 #include "ephy-bookmarks-manager.h"
+#include "ephy-completion-index.h"
+#include "ephy-debug.h"
 #include "ephy-file-helpers.h"
 #include "ephy-prefs.h"
 #include "ephy-profile-utils.h"
@@ -43,8 +45,13 @@ struct _EphySearchProvider {
   GCancellable             *cancellable;
 
   GSettings                *settings;
+  char                     *completion_index_filename;
+  EphyCompletionIndex      *completion_index;
   EphyBookmarksManager     *bookmarks_manager;
   EphySuggestionModel      *model;
+
+  /* The titles of the last results, by URI. */
+  GHashTable               *result_titles;
 };
 
 struct _EphySearchProviderClass {
@@ -54,6 +61,81 @@ struct _EphySearchProviderClass {
 G_DEFINE_TYPE (EphySearchProvider, ephy_search_provider, G_TYPE_APPLICATION)
 
 #define INACTIVITY_TIMEOUT 60 * 1000 /* One minute, in milliseconds */
+/* The number of history results of EphySuggestionModel. */
+#define MAX_HISTORY_RESULTS 8
+
+/* The browser keeps a completion index of its bookmarks and history, see
+ * EphyCompletionIndexWriter. Searching it is a scan of a mapped file, so
+ * the history database is only opened when there is no index yet.
+ */
+static EphyCompletionIndex *
+get_completion_index (EphySearchProvider *self)
+{
+  g_autoptr(GError) error = NULL;
+
+  if (self->completion_index && ephy_completion_index_is_current (self->completion_index))
+    return self->completion_index;
+
+  g_clear_pointer (&self->completion_index, ephy_completion_index_free);
+  self->completion_index = ephy_completion_index_new_for_file (self->completion_index_filename, &error);
+  if (!self->completion_index && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    g_warning ("Failed to load completion index: %s", error->message);
+
+  return self->completion_index;
+}
+
+static EphySuggestionModel *
+get_suggestion_model (EphySearchProvider *self)
+{
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+
+  if (!self->model) {
+    self->bookmarks_manager = ephy_bookmarks_manager_new ();
+    self->model = ephy_suggestion_model_new (ephy_embed_shell_get_global_history_service (shell),
+                                             self->bookmarks_manager);
+  }
+
+  return self->model;
+}
+
+static void
+add_result (EphySearchProvider *self,
+            GPtrArray          *results,
+            const char         *uri,
+            const char         *title)
+{
+  g_ptr_array_add (results, g_strdup (uri));
+  g_hash_table_replace (self->result_titles, g_strdup (uri), g_strdup (title));
+}
+
+static void
+add_search_engine_results (EphySearchProvider *self,
+                           GPtrArray          *results,
+                           const char         *search_string)
+{
+  EphySearchEngineManager *manager;
+  g_auto(GStrv) engines = NULL;
+
+  manager = ephy_embed_shell_get_search_engine_manager (ephy_embed_shell_get_default ());
+  engines = ephy_search_engine_manager_get_names (manager);
+
+  for (guint i = 0; engines[i]; i++) {
+    g_autofree char *address = NULL;
+
+    address = ephy_search_engine_manager_build_search_address (manager, engines[i], search_string);
+    add_result (self, results, address, engines[i]);
+  }
+}
+
+static char **
+finish_results (GPtrArray  *results,
+                const char *search_string)
+{
+  g_ptr_array_add (results, g_strdup_printf ("special:search:%s", search_string));
+  g_ptr_array_add (results, NULL);
+
+  return (char **)g_ptr_array_free (results, FALSE);
+}
 
 static void
 on_model_updated (GObject      *source_object,
@@ -74,7 +156,10 @@ on_model_updated (GObject      *source_object,
     n_items = g_list_model_get_n_items (G_LIST_MODEL (self->model));
     for (guint i = 0; i < n_items; i++) {
       suggestion = g_list_model_get_item (G_LIST_MODEL (self->model), i);
-      g_ptr_array_add (results, g_strdup (ephy_suggestion_get_uri (suggestion)));
+      add_result (self, results,
+                  ephy_suggestion_get_uri (suggestion),
+                  ephy_suggestion_get_unescaped_title (suggestion));
+      g_object_unref (suggestion);
     }
   } else {
     g_warning ("Failed to query suggestion model: %s", error->message);
@@ -82,12 +167,11 @@ on_model_updated (GObject      *source_object,
   }
 
   search_string = g_task_get_task_data (task);
-  g_ptr_array_add (results, g_strdup_printf ("special:search:%s", search_string));
-  g_ptr_array_add (results, NULL);
 
   g_task_return_pointer (task,
-                         g_ptr_array_free (results, FALSE),
+                         finish_results (results, search_string),
                          (GDestroyNotify)g_strfreev);
+  g_object_unref (task);
 }
 
 static char **
@@ -105,6 +189,7 @@ gather_results_async (EphySearchProvider *self,
                       GAsyncReadyCallback callback,
                       gpointer            user_data)
 {
+  EphyCompletionIndex *completion_index;
   GTask *task;
   char *search_string;
 
@@ -113,7 +198,36 @@ gather_results_async (EphySearchProvider *self,
   search_string = g_strjoinv (" ", terms);
   g_task_set_task_data (task, search_string, g_free);
 
-  ephy_suggestion_model_query_async (self->model,
+  g_hash_table_remove_all (self->result_titles);
+
+  completion_index = get_completion_index (self);
+  if (completion_index) {
+    g_autoptr(GPtrArray) matches = NULL;
+    GPtrArray *results;
+    gint64 start_time = g_get_monotonic_time ();
+
+    results = g_ptr_array_new ();
+    matches = ephy_completion_index_query (completion_index, search_string, MAX_HISTORY_RESULTS);
+    for (guint i = 0; i < matches->len; i++) {
+      EphyHistoryURL *url = g_ptr_array_index (matches, i);
+
+      add_result (self, results, url->url, url->title);
+    }
+
+    if (*search_string)
+      add_search_engine_results (self, results, search_string);
+
+    LOG ("Found %u completion index matches for '%s' in %" G_GINT64_FORMAT " µs",
+         matches->len, search_string, g_get_monotonic_time () - start_time);
+
+    g_task_return_pointer (task,
+                           finish_results (results, search_string),
+                           (GDestroyNotify)g_strfreev);
+    g_object_unref (task);
+    return;
+  }
+
+  ephy_suggestion_model_query_async (get_suggestion_model (self),
                                      search_string,
                                      cancellable,
                                      (GAsyncReadyCallback)on_model_updated,
@@ -199,18 +313,14 @@ handle_get_result_metas (EphyShellSearchProvider2 *skeleton,
                              "gicon", g_variant_new_string (APPLICATION_ID));
       g_variant_builder_close (&builder);
     } else {
-      EphySuggestion *suggestion;
       const char *title;
-      const char *uri;
       g_autofree char *decoded_uri = NULL;
 
-      suggestion = ephy_suggestion_model_get_suggestion_with_uri (self->model, results[i]);
-      if (!suggestion)
+      title = g_hash_table_lookup (self->result_titles, results[i]);
+      if (!title)
         continue;
 
-      title = ephy_suggestion_get_unescaped_title (suggestion);
-      uri = ephy_suggestion_get_uri (suggestion);
-      decoded_uri = ephy_uri_decode (uri);
+      decoded_uri = ephy_uri_decode (results[i]);
 
       g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
       g_variant_builder_add (&builder, "{sv}",
@@ -315,17 +425,12 @@ handle_launch_search (EphyShellSearchProvider2 *skeleton,
 static void
 ephy_search_provider_init (EphySearchProvider *self)
 {
-  g_autofree char *filename = NULL;
-  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
-
   g_application_set_flags (G_APPLICATION (self), G_APPLICATION_IS_SERVICE);
 
   self->settings = g_settings_new (EPHY_PREFS_SCHEMA);
 
-  filename = g_build_filename (ephy_profile_dir (), EPHY_HISTORY_FILE, NULL);
-  self->bookmarks_manager = ephy_bookmarks_manager_new ();
-  self->model = ephy_suggestion_model_new (ephy_embed_shell_get_global_history_service (shell),
-                                           self->bookmarks_manager);
+  self->completion_index_filename = g_build_filename (ephy_profile_dir (), EPHY_COMPLETION_INDEX_FILE, NULL);
+  self->result_titles = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
   self->cancellable = g_cancellable_new ();
 
@@ -395,10 +500,22 @@ ephy_search_provider_dispose (GObject *object)
   g_clear_object (&self->cancellable);
   g_clear_object (&self->model);
   g_clear_object (&self->bookmarks_manager);
+  g_clear_pointer (&self->completion_index, ephy_completion_index_free);
+  g_clear_pointer (&self->result_titles, g_hash_table_unref);
 
   G_OBJECT_CLASS (ephy_search_provider_parent_class)->dispose (object);
 }
 
+static void
+ephy_search_provider_finalize (GObject *object)
+{
+  EphySearchProvider *self = EPHY_SEARCH_PROVIDER (object);
+
+  g_free (self->completion_index_filename);
+
+  G_OBJECT_CLASS (ephy_search_provider_parent_class)->finalize (object);
+}
+
 static void
 ephy_search_provider_class_init (EphySearchProviderClass *klass)
 {
@@ -406,6 +523,7 @@ ephy_search_provider_class_init (EphySearchProviderClass *klass)
   GApplicationClass *application_class = G_APPLICATION_CLASS (klass);
 
   object_class->dispose = ephy_search_provider_dispose;
+  object_class->finalize = ephy_search_provider_finalize;
 
   application_class->dbus_register = ephy_search_provider_dbus_register;
   application_class->dbus_unregister = ephy_search_provider_dbus_unregister;
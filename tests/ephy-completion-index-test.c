@@ -0,0 +1,216 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-completion-index.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+static GList *
+make_url_list (const char *first_url,
+               ...)
+{
+  GList *urls = NULL;
+  const char *url;
+  va_list args;
+
+  va_start (args, first_url);
+  for (url = first_url; url; url = va_arg (args, const char *)) {
+    const char *title = va_arg (args, const char *);
+
+    urls = g_list_prepend (urls, ephy_history_url_new (url, title, 0, 0, 0));
+  }
+  va_end (args);
+
+  return g_list_reverse (urls);
+}
+
+static char *
+write_index (GList *bookmarks,
+             GList *history)
+{
+  g_autofree char *dir = NULL;
+  char *filename;
+  GError *error = NULL;
+
+  dir = g_dir_make_tmp ("ephy-completion-index-test-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  filename = g_build_filename (dir, "completion-index", NULL);
+  ephy_completion_index_write (filename, bookmarks, history, &error);
+  g_assert_no_error (error);
+
+  return filename;
+}
+
+static void
+remove_index (const char *filename)
+{
+  g_autofree char *dir = g_path_get_dirname (filename);
+
+  g_unlink (filename);
+  g_rmdir (dir);
+}
+
+static void
+assert_matches (GPtrArray   *matches,
+                const char **expected_urls)
+{
+  guint i;
+
+  for (i = 0; expected_urls[i]; i++) {
+    EphyHistoryURL *url;
+
+    g_assert_cmpuint (i, <, matches->len);
+    url = g_ptr_array_index (matches, i);
+    g_assert_cmpstr (url->url, ==, expected_urls[i]);
+  }
+
+  g_assert_cmpuint (i, ==, matches->len);
+}
+
+static void
+test_ephy_completion_index_query (void)
+{
+  g_autoptr(EphyCompletionIndex) index = NULL;
+  g_autoptr(GPtrArray) matches = NULL;
+  g_autofree char *filename = NULL;
+  GList *bookmarks;
+  GList *history;
+  GError *error = NULL;
+  EphyHistoryURL *url;
+
+  bookmarks = make_url_list ("https://wiki.gnome.org/Apps/Web", "GNOME Web",
+                             "https://www.example.com/", "Example",
+                             NULL);
+  history = make_url_list ("https://www.gnome.org/", "GNOME",
+                           "https://wiki.gnome.org/Apps/Web", "GNOME Web",
+                           "https://gitlab.gnome.org/GNOME/epiphany", "",
+                           "https://www.webkitgtk.org/", "WebKitGTK",
+                           NULL);
+  filename = write_index (bookmarks, history);
+  ephy_history_url_list_free (bookmarks);
+  ephy_history_url_list_free (history);
+
+  index = ephy_completion_index_new_for_file (filename, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (index);
+
+  /* Bookmarks come first, and each URL is returned once. */
+  matches = ephy_completion_index_query (index, "gnome", 10);
+  assert_matches (matches, (const char *[]){ "https://wiki.gnome.org/Apps/Web",
+                                             "https://www.gnome.org/",
+                                             "https://gitlab.gnome.org/GNOME/epiphany",
+                                             NULL });
+  g_clear_pointer (&matches, g_ptr_array_unref);
+
+  /* The URL is used as the title when there is none. */
+  matches = ephy_completion_index_query (index, "epiphany", 10);
+  g_assert_cmpuint (matches->len, ==, 1);
+  url = g_ptr_array_index (matches, 0);
+  g_assert_cmpstr (url->title, ==, "https://gitlab.gnome.org/GNOME/epiphany");
+  g_clear_pointer (&matches, g_ptr_array_unref);
+
+  /* Every word must match the address or the title, ignoring case. */
+  matches = ephy_completion_index_query (index, "  WEB  gnome ", 10);
+  assert_matches (matches, (const char *[]){ "https://wiki.gnome.org/Apps/Web", NULL });
+  g_clear_pointer (&matches, g_ptr_array_unref);
+
+  /* Only history results are limited. */
+  matches = ephy_completion_index_query (index, "https", 1);
+  assert_matches (matches, (const char *[]){ "https://wiki.gnome.org/Apps/Web",
+                                             "https://www.example.com/",
+                                             "https://www.gnome.org/",
+                                             NULL });
+  g_clear_pointer (&matches, g_ptr_array_unref);
+
+  matches = ephy_completion_index_query (index, " ", 10);
+  g_assert_cmpuint (matches->len, ==, 0);
+
+  remove_index (filename);
+}
+
+static void
+test_ephy_completion_index_is_current (void)
+{
+  g_autoptr(EphyCompletionIndex) index = NULL;
+  g_autoptr(EphyCompletionIndex) new_index = NULL;
+  g_autoptr(GPtrArray) matches = NULL;
+  g_autofree char *filename = NULL;
+  GList *history;
+  GError *error = NULL;
+
+  history = make_url_list ("https://www.gnome.org/", "GNOME", NULL);
+  filename = write_index (NULL, history);
+  ephy_history_url_list_free (history);
+
+  index = ephy_completion_index_new_for_file (filename, &error);
+  g_assert_no_error (error);
+  g_assert_true (ephy_completion_index_is_current (index));
+
+  history = make_url_list ("https://www.webkitgtk.org/", "WebKitGTK", NULL);
+  ephy_completion_index_write (filename, NULL, history, &error);
+  g_assert_no_error (error);
+  ephy_history_url_list_free (history);
+
+  /* The old index is still usable, but no longer current. */
+  g_assert_false (ephy_completion_index_is_current (index));
+  matches = ephy_completion_index_query (index, "gnome", 10);
+  g_assert_cmpuint (matches->len, ==, 1);
+  g_clear_pointer (&matches, g_ptr_array_unref);
+
+  new_index = ephy_completion_index_new_for_file (filename, &error);
+  g_assert_no_error (error);
+  g_assert_true (ephy_completion_index_is_current (new_index));
+  matches = ephy_completion_index_query (new_index, "gnome", 10);
+  g_assert_cmpuint (matches->len, ==, 0);
+
+  remove_index (filename);
+  g_assert_false (ephy_completion_index_is_current (new_index));
+}
+
+static void
+test_ephy_completion_index_missing (void)
+{
+  EphyCompletionIndex *index;
+  GError *error = NULL;
+
+  index = ephy_completion_index_new_for_file ("/nonexistent/completion-index", &error);
+  g_assert_null (index);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_error_free (error);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lib/ephy-completion-index/query",
+                   test_ephy_completion_index_query);
+  g_test_add_func ("/lib/ephy-completion-index/is_current",
+                   test_ephy_completion_index_is_current);
+  g_test_add_func ("/lib/ephy-completion-index/missing",
+                   test_ephy_completion_index_missing);
+
+  return g_test_run ();
+}
@@ -0,0 +1,157 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-completion-index-writer-private.h"
+
+#include "ephy-completion-index.h"
+#include "ephy-file-helpers.h"
+#include "ephy-profile-utils.h"
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#define TEST_URL "https://www.example.com/"
+
+static void
+job_done_cb (EphyHistoryService *service,
+             gboolean            success,
+             gpointer            result_data,
+             GMainLoop          *loop)
+{
+  g_assert_true (success);
+  g_main_loop_quit (loop);
+}
+
+static void
+add_visit (EphyHistoryService *service)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryPageVisit *visit;
+
+  visit = ephy_history_page_visit_new (TEST_URL, g_get_real_time () / G_USEC_PER_SEC, EPHY_PAGE_VISIT_TYPED);
+  ephy_history_service_add_visit (service, visit, NULL, (EphyHistoryJobCallback)job_done_cb, loop);
+  ephy_history_page_visit_free (visit);
+
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+}
+
+/* Returns the number of matches of the test URL in the index, or -1 if there
+ * is no index.
+ */
+static int
+count_matches (const char *filename)
+{
+  g_autoptr(EphyCompletionIndex) index = NULL;
+  g_autoptr(GPtrArray) matches = NULL;
+
+  index = ephy_completion_index_new_for_file (filename, NULL);
+  if (!index)
+    return -1;
+
+  matches = ephy_completion_index_query (index, "example", 10);
+
+  return matches->len;
+}
+
+static gboolean
+quit_cb (GMainLoop *loop)
+{
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Waits up to @timeout_ms for the index to have @n_matches matches. */
+static void
+wait_for_matches (const char *filename,
+                  int         n_matches,
+                  guint       timeout_ms)
+{
+  gint64 deadline = g_get_monotonic_time () + timeout_ms * 1000;
+
+  while (count_matches (filename) != n_matches) {
+    GMainLoop *loop;
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+
+    loop = g_main_loop_new (NULL, FALSE);
+    g_timeout_add (50, (GSourceFunc)quit_cb, loop);
+    g_main_loop_run (loop);
+    g_main_loop_unref (loop);
+  }
+}
+
+static void
+test_ephy_completion_index_writer_clear_during_update (void)
+{
+  EphyHistoryService *history_service;
+  EphyBookmarksManager *bookmarks_manager;
+  EphyCompletionIndexWriter *writer;
+  g_autofree char *history_filename = NULL;
+  g_autofree char *index_filename = NULL;
+
+  history_filename = g_build_filename (ephy_profile_dir (), EPHY_HISTORY_FILE, NULL);
+  index_filename = g_build_filename (ephy_profile_dir (), EPHY_COMPLETION_INDEX_FILE, NULL);
+
+  history_service = ephy_history_service_new (history_filename, EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+  bookmarks_manager = ephy_bookmarks_manager_new ();
+  writer = ephy_completion_index_writer_new (history_service, bookmarks_manager);
+
+  add_visit (history_service);
+  ephy_completion_index_writer_update_for_testing (writer);
+  wait_for_matches (index_filename, 1, 5000);
+
+  /* The history query of the update runs before the clear, so the update
+   * still sees the visit, and is discarded once the history is cleared.
+   * The index is then rewritten right away rather than after the usual
+   * batching delay.
+   */
+  ephy_completion_index_writer_update_for_testing (writer);
+  ephy_history_service_clear (history_service, NULL, NULL, NULL);
+  wait_for_matches (index_filename, 0, 5000);
+
+  g_object_unref (writer);
+  g_object_unref (bookmarks_manager);
+  g_object_unref (history_service);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/ephy-completion-index-writer/clear_during_update",
+                   test_ephy_completion_index_writer_clear_during_update);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
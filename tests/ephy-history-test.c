@@ -95,11 +95,51 @@ test_create_history_entry (void)
   gtk_main ();
 }
 
+static void
+history_service_ready_cb (EphyHistoryService *service,
+                          gboolean           *ready)
+{
+  *ready = TRUE;
+  gtk_main_quit ();
+}
+
+static void
+wait_for_history_service_ready (EphyHistoryService *service)
+{
+  gboolean ready = FALSE;
+  gulong id;
+
+  if (ephy_history_service_is_ready (service))
+    return;
+
+  id = g_signal_connect (service, "ready", G_CALLBACK (history_service_ready_cb), &ready);
+  while (!ready)
+    gtk_main ();
+  g_signal_handler_disconnect (service, id);
+
+  g_assert_true (ephy_history_service_is_ready (service));
+}
+
+static void
+test_ready (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+
+  /* Construction does not wait for the database to be opened. */
+  wait_for_history_service_ready (service);
+
+  g_object_unref (service);
+}
+
 static void
 test_readonly_mode (void)
 {
   EphyHistoryService *service = ensure_empty_history (test_db_filename ());
-  EphyHistoryService *readonly_service = ephy_history_service_new (test_db_filename (), EPHY_SQLITE_CONNECTION_MODE_READ_ONLY);
+  EphyHistoryService *readonly_service;
+
+  /* The read-only service can only open the database once it exists. */
+  wait_for_history_service_ready (service);
+  readonly_service = ephy_history_service_new (test_db_filename (), EPHY_SQLITE_CONNECTION_MODE_READ_ONLY);
 
   /* Having the database open read-only should not break normal connections.
    * https://bugzilla.gnome.org/show_bug.cgi?id=778649 */
@@ -501,6 +541,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/embed/history/test_create_history_service", test_create_history_service);
   g_test_add_func ("/embed/history/test_create_history_service_and_destroy_later", test_create_history_service_and_destroy_later);
   g_test_add_func ("/embed/history/test_create_history_entry", test_create_history_entry);
+  g_test_add_func ("/embed/history/test_ready", test_ready);
   g_test_add_func ("/embed/history/test_readonly_mode", test_readonly_mode);
   g_test_add_func ("/embed/history/test_create_history_entries", test_create_history_entries);
   g_test_add_func ("/embed/history/test_set_url_title", test_set_url_title);
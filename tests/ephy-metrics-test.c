@@ -0,0 +1,204 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-metrics.h"
+
+#include <glib.h>
+#include <string.h>
+
+typedef struct {
+  EphyMetricKind kind;
+  guint64 count;
+  gint64 value;
+  gint64 max;
+  gint64 p50;
+  gint64 p90;
+  gint64 p99;
+} MetricValues;
+
+static gboolean
+get_metric (const char   *category,
+            const char   *name,
+            MetricValues *values)
+{
+  g_autoptr(GVariant) snapshot = g_variant_ref_sink (ephy_metrics_get_snapshot ());
+  GVariantIter iter;
+  const char *metric_category;
+  const char *metric_name;
+  guint32 kind;
+
+  g_assert_true (g_variant_is_of_type (snapshot, EPHY_METRICS_SNAPSHOT_TYPE));
+
+  g_variant_iter_init (&iter, snapshot);
+  while (g_variant_iter_next (&iter, "(&s&sutxxxxx)", &metric_category, &metric_name, &kind,
+                              &values->count, &values->value, &values->max,
+                              &values->p50, &values->p90, &values->p99)) {
+    if (strcmp (metric_category, category) == 0 && strcmp (metric_name, name) == 0) {
+      values->kind = kind;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static void
+test_ephy_metrics_duration (void)
+{
+  MetricValues values;
+  gint64 i;
+
+  g_assert_false (get_metric ("test-duration", "operation", &values));
+
+  for (i = 1; i <= 1000; i++)
+    ephy_metrics_add_duration ("test-duration", "operation", i);
+
+  g_assert_true (get_metric ("test-duration", "operation", &values));
+  g_assert_cmpint (values.kind, ==, EPHY_METRIC_DURATION);
+  g_assert_cmpuint (values.count, ==, 1000);
+  g_assert_cmpint (values.value, ==, 500500);
+  g_assert_cmpint (values.max, ==, 1000);
+
+  /* Percentiles are bucket upper bounds, accurate within 25%. */
+  g_assert_cmpint (values.p50, >=, 500);
+  g_assert_cmpint (values.p50, <=, 625);
+  g_assert_cmpint (values.p90, >=, 900);
+  g_assert_cmpint (values.p90, <=, 1000);
+  g_assert_cmpint (values.p99, >=, 990);
+  g_assert_cmpint (values.p99, <=, 1000);
+}
+
+static void
+test_ephy_metrics_small_durations (void)
+{
+  MetricValues values;
+
+  ephy_metrics_add_duration ("test-small-durations", "operation", 0);
+  ephy_metrics_add_duration ("test-small-durations", "operation", 3);
+  ephy_metrics_add_duration ("test-small-durations", "operation", 7);
+
+  g_assert_true (get_metric ("test-small-durations", "operation", &values));
+  g_assert_cmpint (values.p50, ==, 3);
+  g_assert_cmpint (values.p99, ==, 7);
+  g_assert_cmpint (values.max, ==, 7);
+}
+
+static void
+test_ephy_metrics_histogram (void)
+{
+  EphyHistogram *histogram = ephy_histogram_new ();
+  int i;
+
+  g_assert_cmpint (ephy_histogram_get_percentile (histogram, 50), ==, 0);
+
+  /* Percentiles never fall outside of the recorded values. */
+  for (i = 0; i < 10; i++)
+    ephy_histogram_add (histogram, 1000);
+  g_assert_cmpint (ephy_histogram_get_percentile (histogram, 1), ==, 1000);
+  g_assert_cmpint (ephy_histogram_get_percentile (histogram, 99), ==, 1000);
+
+  ephy_histogram_add (histogram, -5);
+  g_assert_cmpuint (histogram->count, ==, 11);
+  g_assert_cmpint (histogram->sum, ==, 9995);
+  g_assert_cmpint (histogram->min, ==, -5);
+  g_assert_cmpint (histogram->max, ==, 1000);
+  g_assert_cmpint (ephy_histogram_get_percentile (histogram, 1), ==, 0);
+
+  ephy_histogram_free (histogram);
+}
+
+static void
+test_ephy_metrics_counter (void)
+{
+  MetricValues values;
+
+  ephy_metrics_add_count ("test-counter", "bytes", 100);
+  ephy_metrics_add_count ("test-counter", "bytes", 23);
+
+  g_assert_true (get_metric ("test-counter", "bytes", &values));
+  g_assert_cmpint (values.kind, ==, EPHY_METRIC_COUNTER);
+  g_assert_cmpuint (values.count, ==, 2);
+  g_assert_cmpint (values.value, ==, 123);
+  g_assert_cmpint (values.p50, ==, 0);
+}
+
+static void
+test_ephy_metrics_gauge (void)
+{
+  MetricValues values;
+
+  ephy_metrics_set_gauge ("test-gauge", "queue-length", 4);
+  ephy_metrics_set_gauge ("test-gauge", "queue-length", 9);
+  ephy_metrics_set_gauge ("test-gauge", "queue-length", 2);
+
+  g_assert_true (get_metric ("test-gauge", "queue-length", &values));
+  g_assert_cmpint (values.kind, ==, EPHY_METRIC_GAUGE);
+  g_assert_cmpuint (values.count, ==, 3);
+  g_assert_cmpint (values.value, ==, 2);
+  g_assert_cmpint (values.max, ==, 9);
+}
+
+static void
+test_ephy_metrics_sorted (void)
+{
+  g_autoptr(GVariant) snapshot = NULL;
+  g_autofree char *previous = NULL;
+  GVariantIter iter;
+  const char *category;
+  const char *name;
+
+  ephy_metrics_add_count ("test-sorted-b", "b", 1);
+  ephy_metrics_add_count ("test-sorted-a", "b", 1);
+  ephy_metrics_add_count ("test-sorted-a", "a", 1);
+
+  snapshot = g_variant_ref_sink (ephy_metrics_get_snapshot ());
+  g_variant_iter_init (&iter, snapshot);
+  while (g_variant_iter_next (&iter, "(&s&sutxxxxx)", &category, &name,
+                              NULL, NULL, NULL, NULL, NULL, NULL, NULL)) {
+    char *key = g_strdup_printf ("%s/%s", category, name);
+
+    if (previous)
+      g_assert_cmpstr (previous, <, key);
+    g_free (previous);
+    previous = key;
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lib/ephy-metrics/duration",
+                   test_ephy_metrics_duration);
+  g_test_add_func ("/lib/ephy-metrics/small_durations",
+                   test_ephy_metrics_small_durations);
+  g_test_add_func ("/lib/ephy-metrics/histogram",
+                   test_ephy_metrics_histogram);
+  g_test_add_func ("/lib/ephy-metrics/counter",
+                   test_ephy_metrics_counter);
+  g_test_add_func ("/lib/ephy-metrics/gauge",
+                   test_ephy_metrics_gauge);
+  g_test_add_func ("/lib/ephy-metrics/sorted",
+                   test_ephy_metrics_sorted);
+
+  return g_test_run ();
+}
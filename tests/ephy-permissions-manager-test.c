@@ -0,0 +1,143 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-permissions-manager.h"
+
+#include "ephy-file-helpers.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+#define PERMISSIONS_GROUP_PREFIX "org/gnome/epiphany/permissions/"
+
+static void
+test_ephy_permissions_manager_round_trip (void)
+{
+  EphyPermissionsManager *manager;
+  g_autoptr(GKeyFile) key_file = NULL;
+  g_autofree char *filename = NULL;
+  g_autofree char *value = NULL;
+  g_auto(GStrv) groups = NULL;
+  WebKitSecurityOrigin *origin;
+  GList *origins;
+
+  manager = ephy_permissions_manager_new ();
+  ephy_permissions_manager_set_permission (manager, EPHY_PERMISSION_TYPE_SHOW_NOTIFICATIONS,
+                                           "https://example.com", EPHY_PERMISSION_PERMIT);
+  ephy_permissions_manager_set_permission (manager, EPHY_PERMISSION_TYPE_ACCESS_LOCATION,
+                                           "https://example.com", EPHY_PERMISSION_DENY);
+  ephy_permissions_manager_set_permission (manager, EPHY_PERMISSION_TYPE_SHOW_ADS,
+                                           "http://example.org:8080", EPHY_PERMISSION_DENY);
+  ephy_permissions_manager_set_permission (manager, EPHY_PERMISSION_TYPE_SAVE_PASSWORD,
+                                           "https://example.net", EPHY_PERMISSION_PERMIT);
+  ephy_permissions_manager_set_permission (manager, EPHY_PERMISSION_TYPE_SAVE_PASSWORD,
+                                           "https://example.net", EPHY_PERMISSION_UNDECIDED);
+  /* The pending save is written when the manager goes away. */
+  g_object_unref (manager);
+
+  /* The file keeps the format of the keyfile settings backend, without the
+   * origins that have no decision left.
+   */
+  filename = g_build_filename (ephy_profile_dir (), "permissions.ini", NULL);
+  key_file = g_key_file_new ();
+  g_assert_true (g_key_file_load_from_file (key_file, filename, G_KEY_FILE_NONE, NULL));
+  groups = g_key_file_get_groups (key_file, NULL);
+  g_assert_cmpuint (g_strv_length (groups), ==, 2);
+  value = g_key_file_get_value (key_file, PERMISSIONS_GROUP_PREFIX "http/example.org/8080",
+                                "advertisement-permission", NULL);
+  g_assert_cmpstr (value, ==, "'deny'");
+
+  /* The bitmap index is rebuilt from the file. */
+  manager = ephy_permissions_manager_new ();
+  g_assert_cmpint (ephy_permissions_manager_get_permission (manager, EPHY_PERMISSION_TYPE_SHOW_NOTIFICATIONS,
+                                                            "https://example.com"), ==, EPHY_PERMISSION_PERMIT);
+  g_assert_cmpint (ephy_permissions_manager_get_permission (manager, EPHY_PERMISSION_TYPE_ACCESS_LOCATION,
+                                                            "https://example.com"), ==, EPHY_PERMISSION_DENY);
+  g_assert_cmpint (ephy_permissions_manager_get_permission (manager, EPHY_PERMISSION_TYPE_ACCESS_WEBCAM,
+                                                            "https://example.com"), ==, EPHY_PERMISSION_UNDECIDED);
+  g_assert_cmpint (ephy_permissions_manager_get_permission (manager, EPHY_PERMISSION_TYPE_SHOW_ADS,
+                                                            "http://example.org:8080"), ==, EPHY_PERMISSION_DENY);
+  g_assert_cmpint (ephy_permissions_manager_get_permission (manager, EPHY_PERMISSION_TYPE_SAVE_PASSWORD,
+                                                            "https://example.net"), ==, EPHY_PERMISSION_UNDECIDED);
+
+  g_assert_null (ephy_permissions_manager_get_permitted_origins (manager, EPHY_PERMISSION_TYPE_SHOW_ADS));
+  origins = ephy_permissions_manager_get_denied_origins (manager, EPHY_PERMISSION_TYPE_SHOW_ADS);
+  g_assert_cmpuint (g_list_length (origins), ==, 1);
+  origin = origins->data;
+  g_assert_cmpstr (webkit_security_origin_get_host (origin), ==, "example.org");
+  g_assert_cmpuint (webkit_security_origin_get_port (origin), ==, 8080);
+
+  g_object_unref (manager);
+  g_unlink (filename);
+}
+
+static void
+test_ephy_permissions_manager_many_origins (void)
+{
+  EphyPermissionsManager *manager;
+  g_autofree char *filename = NULL;
+
+  manager = ephy_permissions_manager_new ();
+  ephy_permissions_manager_set_permission (manager, EPHY_PERMISSION_TYPE_ACCESS_WEBCAM,
+                                           "https://example.com", EPHY_PERMISSION_PERMIT);
+
+  /* Looking up more origins than are cached must not lose any decision. */
+  for (int i = 0; i < 2000; i++) {
+    g_autofree char *url = g_strdup_printf ("https://host%d.example.com", i);
+
+    g_assert_cmpint (ephy_permissions_manager_get_permission (manager, EPHY_PERMISSION_TYPE_ACCESS_WEBCAM, url),
+                     ==, EPHY_PERMISSION_UNDECIDED);
+  }
+
+  g_assert_cmpint (ephy_permissions_manager_get_permission (manager, EPHY_PERMISSION_TYPE_ACCESS_WEBCAM,
+                                                            "https://example.com"), ==, EPHY_PERMISSION_PERMIT);
+
+  g_object_unref (manager);
+
+  filename = g_build_filename (ephy_profile_dir (), "permissions.ini", NULL);
+  g_unlink (filename);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/lib/ephy-permissions-manager/round_trip",
+                   test_ephy_permissions_manager_round_trip);
+  g_test_add_func ("/lib/ephy-permissions-manager/many_origins",
+                   test_ephy_permissions_manager_many_origins);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
@@ -0,0 +1,205 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-session-private.h"
+
+#include <glib.h>
+#include <string.h>
+
+static SessionTab *
+session_tab_new (const char *url,
+                 const char *title)
+{
+  SessionTab *tab = g_new0 (SessionTab, 1);
+
+  tab->url = g_strdup (url);
+  tab->title = g_strdup (title);
+
+  return tab;
+}
+
+static SessionWindow *
+session_window_new (int         x,
+                    int         y,
+                    const char *role,
+                    int         active_tab)
+{
+  SessionWindow *window = g_new0 (SessionWindow, 1);
+
+  window->geometry.x = x;
+  window->geometry.y = y;
+  window->geometry.width = 1024;
+  window->geometry.height = 768;
+  window->role = g_strdup (role);
+  window->active_tab = active_tab;
+
+  return window;
+}
+
+static GList *
+build_windows (guint n_extra_tabs)
+{
+  SessionWindow *window;
+  SessionTab *tab;
+  GList *windows = NULL;
+
+  window = session_window_new (10, 20, "epiphany-window-67c6e8a5", 1);
+  tab = session_tab_new ("https://example.com/", "Example");
+  tab->pinned = TRUE;
+  window->tabs = g_list_append (window->tabs, tab);
+  tab = session_tab_new ("about:overview", "");
+  tab->loading = TRUE;
+  window->tabs = g_list_append (window->tabs, tab);
+  tab = session_tab_new ("https://example.org/ünïcode?q=<&>", "Ünïcode \"quoted\"");
+  tab->crashed = TRUE;
+  window->tabs = g_list_append (window->tabs, tab);
+  windows = g_list_append (windows, window);
+
+  /* Geometry that was never set is negative, and a role is optional. */
+  window = session_window_new (-1, -1, NULL, 0);
+  for (guint i = 0; i < n_extra_tabs; i++) {
+    g_autofree char *url = g_strdup_printf ("https://example.net/%u", i);
+
+    window->tabs = g_list_append (window->tabs, session_tab_new (url, "Example"));
+  }
+  windows = g_list_append (windows, window);
+
+  return windows;
+}
+
+static void
+assert_windows_equal (GList *expected,
+                      GList *actual)
+{
+  g_assert_cmpuint (g_list_length (actual), ==, g_list_length (expected));
+
+  for (GList *e = expected, *a = actual; e && a; e = e->next, a = a->next) {
+    SessionWindow *expected_window = e->data;
+    SessionWindow *actual_window = a->data;
+
+    g_assert_cmpint (actual_window->geometry.x, ==, expected_window->geometry.x);
+    g_assert_cmpint (actual_window->geometry.y, ==, expected_window->geometry.y);
+    g_assert_cmpint (actual_window->geometry.width, ==, expected_window->geometry.width);
+    g_assert_cmpint (actual_window->geometry.height, ==, expected_window->geometry.height);
+    g_assert_cmpstr (actual_window->role, ==, expected_window->role);
+    g_assert_cmpint (actual_window->active_tab, ==, expected_window->active_tab);
+    g_assert_cmpuint (g_list_length (actual_window->tabs), ==, g_list_length (expected_window->tabs));
+
+    for (GList *et = expected_window->tabs, *at = actual_window->tabs; et && at; et = et->next, at = at->next) {
+      SessionTab *expected_tab = et->data;
+      SessionTab *actual_tab = at->data;
+
+      g_assert_cmpstr (actual_tab->url, ==, expected_tab->url);
+      g_assert_cmpstr (actual_tab->title, ==, expected_tab->title);
+      g_assert_cmpint (actual_tab->loading, ==, expected_tab->loading);
+      g_assert_cmpint (actual_tab->crashed, ==, expected_tab->crashed);
+      g_assert_cmpint (actual_tab->pinned, ==, expected_tab->pinned);
+      g_assert_null (actual_tab->state);
+    }
+  }
+}
+
+static void
+test_ephy_session_binary_round_trip (void)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  GList *windows;
+  GList *read_windows;
+  const guint8 *data;
+  gsize length;
+  guint32 flags;
+  GError *error = NULL;
+
+  windows = build_windows (3);
+  bytes = ephy_session_write_binary_for_testing (windows, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (bytes);
+
+  /* The records are written compressed. */
+  data = g_bytes_get_data (bytes, &length);
+  g_assert_cmpuint (length, >, 16);
+  g_assert_cmpint (memcmp (data, "EPHYSESS", 8), ==, 0);
+  memcpy (&flags, data + 12, sizeof (flags));
+  g_assert_cmpuint (GUINT32_FROM_LE (flags) & 1, ==, 1);
+
+  read_windows = ephy_session_read_binary_for_testing (bytes, &error);
+  g_assert_no_error (error);
+  assert_windows_equal (windows, read_windows);
+
+  ephy_session_free_windows_for_testing (read_windows);
+  ephy_session_free_windows_for_testing (windows);
+}
+
+static void
+test_ephy_session_binary_many_tabs (void)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  GList *windows;
+  GList *read_windows;
+  GError *error = NULL;
+
+  /* Enough tabs for records to span many reads of the decompressed data. */
+  windows = build_windows (2000);
+  bytes = ephy_session_write_binary_for_testing (windows, &error);
+  g_assert_no_error (error);
+
+  read_windows = ephy_session_read_binary_for_testing (bytes, &error);
+  g_assert_no_error (error);
+  assert_windows_equal (windows, read_windows);
+
+  ephy_session_free_windows_for_testing (read_windows);
+  ephy_session_free_windows_for_testing (windows);
+}
+
+static void
+test_ephy_session_binary_truncated (void)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GBytes) truncated = NULL;
+  GList *windows;
+  GError *error = NULL;
+
+  windows = build_windows (3);
+  bytes = ephy_session_write_binary_for_testing (windows, &error);
+  g_assert_no_error (error);
+
+  truncated = g_bytes_new_from_bytes (bytes, 0, g_bytes_get_size (bytes) - 8);
+  g_assert_null (ephy_session_read_binary_for_testing (truncated, &error));
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+
+  ephy_session_free_windows_for_testing (windows);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/src/ephy-session/binary_round_trip",
+                   test_ephy_session_binary_round_trip);
+  g_test_add_func ("/src/ephy-session/binary_many_tabs",
+                   test_ephy_session_binary_many_tabs);
+  g_test_add_func ("/src/ephy-session/binary_truncated",
+                   test_ephy_session_binary_truncated);
+
+  return g_test_run ();
+}
@@ -56,14 +56,12 @@ load_from_stream_cb (GObject      *object,
 }
 
 static gboolean
-load_session_from_string (EphySession *session,
-                          const char  *data)
+load_session_from_stream (EphySession  *session,
+                          GInputStream *stream)
 {
   GMainLoop *loop;
-  GInputStream *stream;
 
   loop = g_main_loop_new (NULL, FALSE);
-  stream = g_memory_input_stream_new_from_data (data, -1, NULL);
   ephy_session_load_from_stream (session, stream, 0, NULL, load_from_stream_cb, loop);
   g_main_loop_run (loop);
   g_main_loop_unref (loop);
@@ -71,6 +69,20 @@ load_session_from_string (EphySession *session,
   return load_stream_retval;
 }
 
+static gboolean
+load_session_from_string (EphySession *session,
+                          const char  *data)
+{
+  GInputStream *stream;
+  gboolean retval;
+
+  stream = g_memory_input_stream_new_from_data (data, -1, NULL);
+  retval = load_session_from_stream (session, stream);
+  g_object_unref (stream);
+
+  return retval;
+}
+
 static void
 enable_delayed_loading (void)
 {
@@ -124,6 +136,108 @@ test_ephy_session_load (void)
   enable_delayed_loading ();
 }
 
+static void
+append_uint32 (GByteArray *array,
+               guint32     value)
+{
+  guint32 le_value = GUINT32_TO_LE (value);
+
+  g_byte_array_append (array, (const guint8 *)&le_value, sizeof (le_value));
+}
+
+static void
+append_string (GByteArray *array,
+               const char *str)
+{
+  append_uint32 (array, strlen (str));
+  g_byte_array_append (array, (const guint8 *)str, strlen (str));
+}
+
+static void
+append_record_header (GByteArray *array,
+                      guint8      type,
+                      guint32     length)
+{
+  g_byte_array_append (array, &type, 1);
+  append_uint32 (array, length);
+}
+
+/* Equivalent to session_data, in the uncompressed binary format. */
+static GBytes *
+build_binary_session_data (void)
+{
+  GByteArray *array = g_byte_array_new ();
+  const char *role = "epiphany-window-67c6e8a5";
+  const char *url = "about:memory";
+  const char *title = "Memory usage";
+  guint8 tab_flags = 0;
+
+  g_byte_array_append (array, (const guint8 *)"EPHYSESS", 8);
+  append_uint32 (array, 1);     /* version */
+  append_uint32 (array, 0);     /* flags */
+
+  append_record_header (array, 1, 5 * 4 + 4 + strlen (role));
+  append_uint32 (array, 94);
+  append_uint32 (array, 48);
+  append_uint32 (array, 1132);
+  append_uint32 (array, 684);
+  append_uint32 (array, 0);
+  append_string (array, role);
+
+  append_record_header (array, 2, 1 + 4 + strlen (url) + 4 + strlen (title) + 4);
+  g_byte_array_append (array, &tab_flags, 1);
+  append_string (array, url);
+  append_string (array, title);
+  append_uint32 (array, 0);     /* no session state */
+
+  append_record_header (array, 3, 0);
+
+  return g_byte_array_free_to_bytes (array);
+}
+
+static void
+test_ephy_session_load_binary (void)
+{
+  EphySession *session;
+  gboolean ret;
+  GList *l;
+  EphyEmbed *embed;
+  EphyWebView *view;
+  GMainLoop *loop;
+  GInputStream *stream;
+  GBytes *bytes;
+
+  disable_delayed_loading ();
+
+  session = ephy_shell_get_session (ephy_shell_get_default ());
+  g_assert_nonnull (session);
+
+  loop = ephy_test_utils_setup_ensure_web_views_are_loaded ();
+
+  bytes = build_binary_session_data ();
+  stream = g_memory_input_stream_new_from_bytes (bytes);
+  ret = load_session_from_stream (session, stream);
+  g_object_unref (stream);
+  g_bytes_unref (bytes);
+  g_assert_true (ret);
+
+  ephy_test_utils_ensure_web_views_are_loaded (loop);
+
+  l = gtk_application_get_windows (GTK_APPLICATION (ephy_shell_get_default ()));
+  g_assert_nonnull (l);
+  g_assert_cmpint (g_list_length (l), ==, 1);
+
+  embed = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (l->data));
+  g_assert_nonnull (embed);
+  view = ephy_embed_get_web_view (embed);
+  g_assert_nonnull (view);
+  ephy_test_utils_check_ephy_web_view_address (view, "ephy-about:memory");
+
+  ephy_session_clear (session);
+
+  enable_delayed_loading ();
+}
+
 const char *session_data_many_windows =
   "<?xml version=\"1.0\"?>"
   "<session>"
@@ -361,6 +475,9 @@ main (int argc, char *argv[])
   g_test_add_func ("/src/ephy-session/load",
                    test_ephy_session_load);
 
+  g_test_add_func ("/src/ephy-session/load-binary",
+                   test_ephy_session_load_binary);
+
   g_test_add_func ("/src/ephy-session/clear",
                    test_ephy_session_clear);
 
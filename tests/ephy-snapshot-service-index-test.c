@@ -0,0 +1,156 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-snapshot-service-private.h"
+
+#include "ephy-file-helpers.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#define TEST_URL_A "https://a.example.com/"
+#define TEST_URL_B "https://b.example.com/"
+#define TEST_URL_C "https://c.example.com/"
+
+/* The index only looks at the size and modification time of thumbnails, so
+ * any contents will do.
+ */
+static void
+write_thumbnail (const char *url,
+                 gsize       size)
+{
+  g_autofree char *path = ephy_snapshot_service_get_thumbnail_path_for_testing (url);
+  g_autofree char *dirname = g_path_get_dirname (path);
+  g_autofree char *contents = g_malloc0 (size);
+
+  g_assert_cmpint (g_mkdir_with_parents (dirname, 0700), ==, 0);
+  g_assert_true (g_file_set_contents (path, contents, size, NULL));
+}
+
+static gboolean
+thumbnail_exists (const char *url)
+{
+  g_autofree char *path = ephy_snapshot_service_get_thumbnail_path_for_testing (url);
+
+  return g_file_test (path, G_FILE_TEST_EXISTS);
+}
+
+static EphySnapshotService *
+snapshot_service_new (void)
+{
+  return g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+}
+
+static void
+snapshot_service_free (EphySnapshotService *service)
+{
+  /* Let the evictions drop the references they hold. */
+  while (g_main_context_iteration (NULL, FALSE));
+
+  g_object_unref (service);
+}
+
+static void
+test_ephy_snapshot_service_index_round_trip (void)
+{
+  EphySnapshotService *service;
+
+  service = snapshot_service_new ();
+  ephy_snapshot_service_delete_all_snapshots (service);
+  write_thumbnail (TEST_URL_A, 100);
+  ephy_snapshot_service_index_thumbnail_for_testing (service, TEST_URL_A, 180, 135);
+  write_thumbnail (TEST_URL_B, 100);
+  ephy_snapshot_service_index_thumbnail_for_testing (service, TEST_URL_B, 180, 135);
+  /* The pending save is flushed when the service goes away. */
+  snapshot_service_free (service);
+
+  /* Thumbnails found on disk but not in the index have no URL, so they can
+   * only be validated if the index was loaded back.
+   */
+  service = snapshot_service_new ();
+  g_assert_true (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_A));
+  g_assert_true (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_B));
+  g_assert_false (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_C));
+
+  /* Entries of thumbnails modified behind the index's back are stale. */
+  write_thumbnail (TEST_URL_B, 200);
+  g_assert_false (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_B));
+
+  ephy_snapshot_service_delete_all_snapshots (service);
+  snapshot_service_free (service);
+}
+
+static void
+test_ephy_snapshot_service_index_expiry (void)
+{
+  EphySnapshotService *service;
+
+  service = snapshot_service_new ();
+  ephy_snapshot_service_delete_all_snapshots (service);
+  ephy_snapshot_service_set_max_size_for_testing (service, 250);
+
+  write_thumbnail (TEST_URL_A, 100);
+  ephy_snapshot_service_index_thumbnail_for_testing (service, TEST_URL_A, 180, 135);
+  g_usleep (1000);
+  write_thumbnail (TEST_URL_B, 100);
+  ephy_snapshot_service_index_thumbnail_for_testing (service, TEST_URL_B, 180, 135);
+  g_usleep (1000);
+
+  /* Looking up A makes B the least recently used thumbnail. */
+  g_assert_true (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_A));
+  g_usleep (1000);
+
+  write_thumbnail (TEST_URL_C, 100);
+  ephy_snapshot_service_index_thumbnail_for_testing (service, TEST_URL_C, 180, 135);
+
+  g_assert_false (thumbnail_exists (TEST_URL_B));
+  g_assert_false (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_B));
+  g_assert_true (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_A));
+  g_assert_true (ephy_snapshot_service_thumbnail_is_indexed_for_testing (service, TEST_URL_C));
+
+  ephy_snapshot_service_delete_all_snapshots (service);
+  snapshot_service_free (service);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/lib/ephy-snapshot-service/index_round_trip",
+                   test_ephy_snapshot_service_index_round_trip);
+  g_test_add_func ("/lib/ephy-snapshot-service/index_expiry",
+                   test_ephy_snapshot_service_index_expiry);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
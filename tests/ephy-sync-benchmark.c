@@ -0,0 +1,289 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the throughput of EphySyncService against the local storage
+ * server of ephy-sync-mock-server.c: an initial sync downloading N records,
+ * an incremental sync of N / 10 new records and the upload of N local
+ * records, for bookmarks, history and passwords. Run with
+ * `meson test --benchmark`, or directly with the number of records as
+ * argument.
+ */
+
+#include "config.h"
+
+#include "ephy-bookmark.h"
+#include "ephy-history-record.h"
+#include "ephy-password-record.h"
+#include "ephy-sync-crypto.h"
+#include "ephy-sync-mock-server.h"
+#include "ephy-sync-service-private.h"
+#include "ephy-sync-test-manager.h"
+#include "ephy-sync-utils.h"
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#define DEFAULT_N_RECORDS 10000
+#define SYNC_TIMEOUT_SECONDS 600
+
+typedef struct {
+  const char           *collection;
+  GType               (*get_type) (void);
+  EphySynchronizable *(*create)   (guint index);
+} BenchmarkCollection;
+
+static EphySynchronizable *
+create_bookmark (guint index)
+{
+  EphyBookmark *bookmark;
+  char *id = ephy_sync_utils_get_random_sync_id ();
+  char *url = g_strdup_printf ("https://www.example.com/bookmarks/%u", index);
+  char *title = g_strdup_printf ("Bookmark number %u", index);
+
+  bookmark = ephy_bookmark_new (url, title, g_sequence_new (g_free), id);
+
+  g_free (id);
+  g_free (url);
+  g_free (title);
+
+  return EPHY_SYNCHRONIZABLE (bookmark);
+}
+
+static EphySynchronizable *
+create_history_record (guint index)
+{
+  EphyHistoryRecord *record;
+  char *id = ephy_sync_utils_get_random_sync_id ();
+  char *url = g_strdup_printf ("https://www.example.com/history/%u", index);
+  char *title = g_strdup_printf ("Visited page number %u", index);
+
+  record = ephy_history_record_new (id, title, url, g_get_real_time () - index * G_USEC_PER_SEC);
+
+  g_free (id);
+  g_free (url);
+  g_free (title);
+
+  return EPHY_SYNCHRONIZABLE (record);
+}
+
+static EphySynchronizable *
+create_password_record (guint index)
+{
+  EphyPasswordRecord *record;
+  char *uuid = g_uuid_string_random ();
+  char *id = g_strdup_printf ("{%s}", uuid);
+  char *origin = g_strdup_printf ("https://site%u.example.com", index);
+  char *username = g_strdup_printf ("user%u", index);
+  guint64 now = g_get_real_time () / 1000;
+
+  record = ephy_password_record_new (id, origin, origin, username, "correct horse battery staple",
+                                     "username", "password", now, now);
+
+  g_free (uuid);
+  g_free (id);
+  g_free (origin);
+  g_free (username);
+
+  return EPHY_SYNCHRONIZABLE (record);
+}
+
+static const BenchmarkCollection collections[] = {
+  { "bookmarks", ephy_bookmark_get_type, create_bookmark },
+  { "history", ephy_history_record_get_type, create_history_record },
+  { "passwords", ephy_password_record_get_type, create_password_record },
+};
+
+static glong
+get_peak_rss (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  return usage.ru_maxrss;
+}
+
+static gboolean
+sync_timeout_cb (GMainLoop *loop)
+{
+  g_warning ("Sync did not finish in %d seconds", SYNC_TIMEOUT_SECONDS);
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static double
+run_sync (EphySyncService *service)
+{
+  GMainLoop *loop;
+  gint64 start;
+  gulong handler_id;
+  guint timeout_id;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  handler_id = g_signal_connect_swapped (service, "sync-finished",
+                                         G_CALLBACK (g_main_loop_quit), loop);
+  timeout_id = g_timeout_add_seconds (SYNC_TIMEOUT_SECONDS, (GSourceFunc)sync_timeout_cb, loop);
+
+  start = g_get_monotonic_time ();
+  ephy_sync_service_sync (service);
+  g_main_loop_run (loop);
+
+  g_source_remove (timeout_id);
+  g_signal_handler_disconnect (service, handler_id);
+  g_main_loop_unref (loop);
+
+  return (g_get_monotonic_time () - start) / 1000.0;
+}
+
+static void
+add_server_records (EphySyncMockServer        *server,
+                    const BenchmarkCollection *collection,
+                    SyncCryptoKeyBundle       *bundle,
+                    guint                      first,
+                    guint                      n_records)
+{
+  for (guint i = first; i < first + n_records; i++) {
+    EphySynchronizable *synchronizable = collection->create (i);
+    JsonNode *bso = ephy_synchronizable_to_bso (synchronizable, bundle);
+    JsonObject *object = json_node_get_object (bso);
+
+    ephy_sync_mock_server_add_record (server, collection->collection,
+                                      json_object_get_string_member (object, "id"),
+                                      json_object_get_string_member (object, "payload"));
+
+    json_node_unref (bso);
+    g_object_unref (synchronizable);
+  }
+}
+
+static void
+benchmark_collection (EphySyncService           *service,
+                      EphySyncMockServer        *server,
+                      const BenchmarkCollection *collection,
+                      SyncCryptoKeyBundle       *bundle,
+                      guint                      n_records)
+{
+  EphySyncTestManager *manager;
+  guint n_new_records = MAX (n_records / 10, 1);
+  double ms;
+
+  /* Initial sync, everything comes from the server. */
+  ephy_sync_mock_server_clear_collection (server, collection->collection);
+  add_server_records (server, collection, bundle, 0, n_records);
+
+  manager = ephy_sync_test_manager_new (collection->collection, collection->get_type ());
+  ephy_sync_service_register_manager (service, EPHY_SYNCHRONIZABLE_MANAGER (manager));
+
+  ms = run_sync (service);
+  g_print ("%-10s initial sync      %7u records %10.1f ms %8.0f records/s\n",
+           collection->collection, ephy_sync_test_manager_get_n_records (manager),
+           ms, n_records / (ms / 1000));
+
+  /* Incremental sync of a few new records. */
+  add_server_records (server, collection, bundle, n_records, n_new_records);
+
+  ms = run_sync (service);
+  g_print ("%-10s incremental sync  %7u records %10.1f ms %8.0f records/s\n",
+           collection->collection, ephy_sync_test_manager_get_n_records (manager),
+           ms, n_new_records / (ms / 1000));
+
+  ephy_sync_service_unregister_manager (service, EPHY_SYNCHRONIZABLE_MANAGER (manager));
+  g_object_unref (manager);
+
+  /* Upload of local records to an empty collection. */
+  ephy_sync_mock_server_clear_collection (server, collection->collection);
+
+  manager = ephy_sync_test_manager_new (collection->collection, collection->get_type ());
+  for (guint i = 0; i < n_records; i++) {
+    EphySynchronizable *synchronizable = collection->create (i);
+
+    ephy_sync_test_manager_add_record (manager, synchronizable);
+    g_object_unref (synchronizable);
+  }
+  ephy_sync_service_register_manager (service, EPHY_SYNCHRONIZABLE_MANAGER (manager));
+
+  ms = run_sync (service);
+  g_print ("%-10s upload            %7u records %10.1f ms %8.0f records/s\n",
+           collection->collection,
+           ephy_sync_mock_server_get_n_records (server, collection->collection),
+           ms, n_records / (ms / 1000));
+
+  ephy_sync_service_unregister_manager (service, EPHY_SYNCHRONIZABLE_MANAGER (manager));
+  g_object_unref (manager);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  EphySyncMockServer *server;
+  EphySyncService *service;
+  SyncCryptoKeyBundle *bundle;
+  JsonNode *node;
+  JsonArray *keys;
+  GError *error = NULL;
+  char *crypto_keys;
+  guint n_records = DEFAULT_N_RECORDS;
+
+  /* Signing in writes the sync user setting. */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  if (argc > 1)
+    n_records = MAX (strtoul (argv[1], NULL, 10), 1);
+
+  server = ephy_sync_mock_server_new (&error);
+  if (!server) {
+    g_printerr ("Failed to start the storage server: %s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+
+  crypto_keys = ephy_sync_crypto_generate_crypto_keys ();
+  node = json_from_string (crypto_keys, NULL);
+  keys = json_object_get_array_member (json_node_get_object (node), "default");
+  bundle = ephy_sync_crypto_key_bundle_new (json_array_get_string_element (keys, 0),
+                                            json_array_get_string_element (keys, 1));
+  json_node_unref (node);
+
+  /* Signing in after creating the service keeps it away from libsecret. */
+  service = ephy_sync_service_new (FALSE);
+  ephy_sync_utils_set_sync_user ("benchmark@example.com");
+  ephy_sync_service_set_storage_for_testing (service,
+                                             ephy_sync_mock_server_get_storage_endpoint (server),
+                                             crypto_keys);
+
+  for (guint i = 0; i < G_N_ELEMENTS (collections); i++)
+    benchmark_collection (service, server, &collections[i], bundle, n_records);
+
+  g_print ("%u requests served\n", ephy_sync_mock_server_get_n_requests (server));
+  /* A high-water mark of the whole run, not of any single phase. */
+  g_print ("Peak RSS of the process: %ld KiB\n", get_peak_rss ());
+
+  ephy_sync_utils_set_sync_user (NULL);
+  g_object_unref (service);
+  ephy_sync_crypto_key_bundle_free (bundle);
+  ephy_sync_mock_server_free (server);
+  g_free (crypto_keys);
+
+  return 0;
+}
@@ -0,0 +1,589 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-sync-mock-server.h"
+
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STORAGE_PATH "/1.5/1/storage/"
+
+typedef struct {
+  char   *id;
+  char   *payload;
+  double  modified;
+} MockRecord;
+
+typedef struct {
+  GHashTable *records;
+  GHashTable *batches;
+  double      last_modified;
+} MockCollection;
+
+struct _EphySyncMockServer {
+  SoupServer *server;
+  char       *storage_endpoint;
+  GHashTable *collections;
+  double      last_timestamp;
+  guint       next_batch_id;
+  guint       n_requests;
+  gboolean    fail_uploads;
+};
+
+static MockRecord *
+mock_record_new (const char *id,
+                 const char *payload,
+                 double      modified)
+{
+  MockRecord *record = g_new (MockRecord, 1);
+
+  record->id = g_strdup (id);
+  record->payload = g_strdup (payload);
+  record->modified = modified;
+
+  return record;
+}
+
+static void
+mock_record_free (MockRecord *record)
+{
+  g_free (record->id);
+  g_free (record->payload);
+  g_free (record);
+}
+
+static MockCollection *
+mock_collection_new (void)
+{
+  MockCollection *collection = g_new0 (MockCollection, 1);
+
+  collection->records = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               NULL, (GDestroyNotify)mock_record_free);
+  collection->batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, (GDestroyNotify)g_ptr_array_unref);
+
+  return collection;
+}
+
+static void
+mock_collection_free (MockCollection *collection)
+{
+  g_hash_table_unref (collection->records);
+  g_hash_table_unref (collection->batches);
+  g_free (collection);
+}
+
+static MockCollection *
+get_collection (EphySyncMockServer *self,
+                const char         *name)
+{
+  MockCollection *collection = g_hash_table_lookup (self->collections, name);
+
+  if (!collection) {
+    collection = mock_collection_new ();
+    g_hash_table_insert (self->collections, g_strdup (name), collection);
+  }
+
+  return collection;
+}
+
+/* Server timestamps have a 10 ms resolution and never go backwards. */
+static double
+get_timestamp (EphySyncMockServer *self)
+{
+  double now = floor (g_get_real_time () / 10000.0) / 100.0;
+
+  if (now <= self->last_timestamp)
+    now = self->last_timestamp + 0.01;
+  self->last_timestamp = now;
+
+  return now;
+}
+
+static void
+store_record (MockCollection *collection,
+              MockRecord     *record)
+{
+  g_hash_table_replace (collection->records, record->id, record);
+  collection->last_modified = MAX (collection->last_modified, record->modified);
+}
+
+static void
+set_response (SoupMessage *msg,
+              guint        status,
+              char        *body)
+{
+  soup_message_set_status (msg, status);
+  if (body)
+    soup_message_set_response (msg, "application/json", SOUP_MEMORY_TAKE, body, strlen (body));
+}
+
+static void
+set_last_modified (SoupMessage *msg,
+                   double       modified)
+{
+  char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_ascii_formatd (buffer, sizeof (buffer), "%.2f", modified);
+  soup_message_headers_replace (msg->response_headers, "X-Last-Modified", buffer);
+}
+
+static gboolean
+check_unmodified_since (SoupMessage *msg,
+                        double       modified)
+{
+  const char *header;
+
+  header = soup_message_headers_get_one (msg->request_headers, "X-If-Unmodified-Since");
+  if (header && modified > g_ascii_strtod (header, NULL)) {
+    set_response (msg, SOUP_STATUS_PRECONDITION_FAILED, NULL);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static JsonNode *
+record_to_json (MockRecord *record)
+{
+  JsonNode *node = json_node_new (JSON_NODE_OBJECT);
+  JsonObject *object = json_object_new ();
+
+  json_object_set_string_member (object, "id", record->id);
+  json_object_set_string_member (object, "payload", record->payload);
+  json_object_set_double_member (object, "modified", record->modified);
+  json_node_take_object (node, object);
+
+  return node;
+}
+
+static int
+compare_records (MockRecord **a,
+                 MockRecord **b)
+{
+  if ((*a)->modified != (*b)->modified)
+    return (*a)->modified < (*b)->modified ? -1 : 1;
+
+  return strcmp ((*a)->id, (*b)->id);
+}
+
+static void
+handle_get_collection (EphySyncMockServer *self,
+                       SoupMessage        *msg,
+                       MockCollection     *collection,
+                       GHashTable         *query)
+{
+  GPtrArray *records;
+  JsonNode *node;
+  JsonArray *array;
+  GHashTableIter iter;
+  MockRecord *record;
+  const char *value;
+  gboolean full = FALSE;
+  double newer = -1;
+  guint offset = 0;
+  guint limit = 0;
+  guint end;
+
+  if (!check_unmodified_since (msg, collection->last_modified))
+    return;
+
+  if (query) {
+    full = g_hash_table_contains (query, "full");
+    if ((value = g_hash_table_lookup (query, "newer")))
+      newer = g_ascii_strtod (value, NULL);
+    if ((value = g_hash_table_lookup (query, "offset")))
+      offset = strtoul (value, NULL, 10);
+    if ((value = g_hash_table_lookup (query, "limit")))
+      limit = strtoul (value, NULL, 10);
+  }
+
+  /* Sorting keeps the offsets meaningful from one page to the next. */
+  records = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, collection->records);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&record)) {
+    if (record->modified > newer)
+      g_ptr_array_add (records, record);
+  }
+  g_ptr_array_sort (records, (GCompareFunc)compare_records);
+
+  offset = MIN (offset, records->len);
+  end = limit ? MIN (offset + limit, records->len) : records->len;
+
+  array = json_array_new ();
+  for (guint i = offset; i < end; i++) {
+    record = g_ptr_array_index (records, i);
+    if (full)
+      json_array_add_element (array, record_to_json (record));
+    else
+      json_array_add_string_element (array, record->id);
+  }
+
+  if (end < records->len) {
+    char *next_offset = g_strdup_printf ("%u", end);
+
+    soup_message_headers_replace (msg->response_headers, "X-Weave-Next-Offset", next_offset);
+    g_free (next_offset);
+  }
+
+  node = json_node_new (JSON_NODE_ARRAY);
+  json_node_take_array (node, array);
+  set_last_modified (msg, collection->last_modified);
+  set_response (msg, SOUP_STATUS_OK, json_to_string (node, FALSE));
+
+  json_node_unref (node);
+  g_ptr_array_unref (records);
+}
+
+static MockRecord *
+record_from_json (JsonNode *node,
+                  double    modified)
+{
+  JsonObject *object;
+  const char *id;
+  const char *payload;
+
+  object = json_node_get_object (node);
+  if (!object)
+    return NULL;
+
+  id = json_object_get_string_member (object, "id");
+  payload = json_object_get_string_member (object, "payload");
+  if (!id || !payload)
+    return NULL;
+
+  return mock_record_new (id, payload, modified);
+}
+
+static void
+handle_post_collection (EphySyncMockServer *self,
+                        SoupMessage        *msg,
+                        MockCollection     *collection,
+                        GHashTable         *query)
+{
+  JsonNode *node;
+  JsonNode *response;
+  JsonObject *object;
+  JsonArray *array;
+  JsonArray *success;
+  GPtrArray *batch = NULL;
+  const char *batch_id = NULL;
+  char *new_batch_id = NULL;
+  gboolean commit = FALSE;
+  double modified;
+
+  if (!check_unmodified_since (msg, collection->last_modified))
+    return;
+
+  if (query) {
+    batch_id = g_hash_table_lookup (query, "batch");
+    commit = g_hash_table_contains (query, "commit");
+  }
+
+  node = json_from_string (msg->request_body->data, NULL);
+  if (!node || !JSON_NODE_HOLDS_ARRAY (node)) {
+    set_response (msg, SOUP_STATUS_BAD_REQUEST, NULL);
+    goto out;
+  }
+
+  if (!g_strcmp0 (batch_id, "true")) {
+    batch = g_ptr_array_new_with_free_func ((GDestroyNotify)mock_record_free);
+    new_batch_id = g_strdup_printf ("%u", ++self->next_batch_id);
+    g_hash_table_insert (collection->batches, g_strdup (new_batch_id), batch);
+  } else if (batch_id) {
+    batch = g_hash_table_lookup (collection->batches, batch_id);
+    if (!batch) {
+      set_response (msg, SOUP_STATUS_BAD_REQUEST, NULL);
+      goto out;
+    }
+  }
+
+  /* Records in a batch get their final timestamp once committed. */
+  modified = get_timestamp (self);
+  array = json_node_get_array (node);
+  success = json_array_new ();
+  for (guint i = 0; i < json_array_get_length (array); i++) {
+    MockRecord *record = record_from_json (json_array_get_element (array, i), modified);
+
+    if (!record)
+      continue;
+
+    json_array_add_string_element (success, record->id);
+    if (batch)
+      g_ptr_array_add (batch, record);
+    else
+      store_record (collection, record);
+  }
+
+  if (batch && commit) {
+    for (guint i = 0; i < batch->len; i++) {
+      MockRecord *record = g_ptr_array_index (batch, i);
+
+      record->modified = modified;
+      store_record (collection, record);
+    }
+
+    /* The records now belong to the collection. */
+    g_ptr_array_set_free_func (batch, NULL);
+    g_hash_table_remove (collection->batches, new_batch_id ? new_batch_id : batch_id);
+    batch = NULL;
+  }
+
+  response = json_node_new (JSON_NODE_OBJECT);
+  object = json_object_new ();
+  json_object_set_array_member (object, "success", success);
+  json_object_set_object_member (object, "failed", json_object_new ());
+  if (new_batch_id)
+    json_object_set_string_member (object, "batch", new_batch_id);
+  if (!batch) {
+    json_object_set_double_member (object, "modified", modified);
+    set_last_modified (msg, collection->last_modified);
+  }
+  json_node_take_object (response, object);
+  set_response (msg, batch ? SOUP_STATUS_ACCEPTED : SOUP_STATUS_OK,
+                json_to_string (response, FALSE));
+  json_node_unref (response);
+
+out:
+  g_free (new_batch_id);
+  if (node)
+    json_node_unref (node);
+}
+
+static void
+handle_record (EphySyncMockServer *self,
+               SoupMessage        *msg,
+               MockCollection     *collection,
+               const char         *id)
+{
+  MockRecord *record = g_hash_table_lookup (collection->records, id);
+  JsonNode *node;
+  char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  if (msg->method == SOUP_METHOD_GET) {
+    if (!record) {
+      set_response (msg, SOUP_STATUS_NOT_FOUND, NULL);
+      return;
+    }
+
+    node = record_to_json (record);
+    set_last_modified (msg, record->modified);
+    set_response (msg, SOUP_STATUS_OK, json_to_string (node, FALSE));
+    json_node_unref (node);
+  } else if (msg->method == SOUP_METHOD_PUT) {
+    if (!check_unmodified_since (msg, record ? record->modified : 0))
+      return;
+
+    node = json_from_string (msg->request_body->data, NULL);
+    record = node ? record_from_json (node, get_timestamp (self)) : NULL;
+    if (node)
+      json_node_unref (node);
+    if (!record) {
+      set_response (msg, SOUP_STATUS_BAD_REQUEST, NULL);
+      return;
+    }
+
+    /* The id in the path wins over the one in the body. */
+    g_free (record->id);
+    record->id = g_strdup (id);
+    store_record (collection, record);
+
+    g_ascii_formatd (buffer, sizeof (buffer), "%.2f", record->modified);
+    set_last_modified (msg, record->modified);
+    set_response (msg, SOUP_STATUS_OK, g_strdup (buffer));
+  } else if (msg->method == SOUP_METHOD_DELETE) {
+    g_hash_table_remove (collection->records, id);
+    set_last_modified (msg, get_timestamp (self));
+    set_response (msg, SOUP_STATUS_OK, g_strdup ("{}"));
+  } else {
+    set_response (msg, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+  }
+}
+
+static void
+server_callback (SoupServer        *server,
+                 SoupMessage       *msg,
+                 const char        *path,
+                 GHashTable        *query,
+                 SoupClientContext *client,
+                 gpointer           user_data)
+{
+  EphySyncMockServer *self = user_data;
+  MockCollection *collection;
+  char **components;
+
+  self->n_requests++;
+
+  if (!g_str_has_prefix (path, STORAGE_PATH)) {
+    set_response (msg, SOUP_STATUS_NOT_FOUND, NULL);
+    return;
+  }
+
+  components = g_strsplit (path + strlen (STORAGE_PATH), "/", 2);
+  if (!components[0] || !*components[0]) {
+    set_response (msg, SOUP_STATUS_NOT_FOUND, NULL);
+    goto out;
+  }
+
+  collection = get_collection (self, components[0]);
+
+  if (components[1]) {
+    char *id = soup_uri_decode (components[1]);
+
+    handle_record (self, msg, collection, id);
+    g_free (id);
+  } else if (msg->method == SOUP_METHOD_GET) {
+    handle_get_collection (self, msg, collection, query);
+  } else if (msg->method == SOUP_METHOD_POST && self->fail_uploads) {
+    set_response (msg, SOUP_STATUS_SERVICE_UNAVAILABLE, NULL);
+  } else if (msg->method == SOUP_METHOD_POST) {
+    handle_post_collection (self, msg, collection, query);
+  } else if (msg->method == SOUP_METHOD_DELETE) {
+    g_hash_table_remove_all (collection->records);
+    collection->last_modified = get_timestamp (self);
+    set_last_modified (msg, collection->last_modified);
+    set_response (msg, SOUP_STATUS_OK, g_strdup ("{}"));
+  } else {
+    set_response (msg, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+  }
+
+out:
+  g_strfreev (components);
+}
+
+EphySyncMockServer *
+ephy_sync_mock_server_new (GError **error)
+{
+  EphySyncMockServer *self;
+  GSList *uris;
+
+  self = g_new0 (EphySyncMockServer, 1);
+  self->collections = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, (GDestroyNotify)mock_collection_free);
+  self->server = soup_server_new (NULL, NULL);
+  soup_server_add_handler (self->server, NULL, server_callback, self, NULL);
+
+  if (!soup_server_listen_local (self->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, error)) {
+    ephy_sync_mock_server_free (self);
+    return NULL;
+  }
+
+  uris = soup_server_get_uris (self->server);
+  self->storage_endpoint = g_strdup_printf ("http://127.0.0.1:%u/1.5/1",
+                                            soup_uri_get_port (uris->data));
+  g_slist_free_full (uris, (GDestroyNotify)soup_uri_free);
+
+  return self;
+}
+
+void
+ephy_sync_mock_server_free (EphySyncMockServer *self)
+{
+  g_assert (self);
+
+  soup_server_disconnect (self->server);
+  g_object_unref (self->server);
+  g_hash_table_unref (self->collections);
+  g_free (self->storage_endpoint);
+  g_free (self);
+}
+
+const char *
+ephy_sync_mock_server_get_storage_endpoint (EphySyncMockServer *self)
+{
+  g_assert (self);
+
+  return self->storage_endpoint;
+}
+
+void
+ephy_sync_mock_server_add_record (EphySyncMockServer *self,
+                                  const char         *collection,
+                                  const char         *id,
+                                  const char         *payload)
+{
+  g_assert (self);
+  g_assert (collection);
+  g_assert (id);
+  g_assert (payload);
+
+  store_record (get_collection (self, collection),
+                mock_record_new (id, payload, get_timestamp (self)));
+}
+
+void
+ephy_sync_mock_server_clear_collection (EphySyncMockServer *self,
+                                        const char         *collection)
+{
+  g_assert (self);
+  g_assert (collection);
+
+  g_hash_table_remove (self->collections, collection);
+}
+
+guint
+ephy_sync_mock_server_get_n_records (EphySyncMockServer *self,
+                                     const char         *collection)
+{
+  MockCollection *mock_collection;
+
+  g_assert (self);
+  g_assert (collection);
+
+  mock_collection = g_hash_table_lookup (self->collections, collection);
+
+  return mock_collection ? g_hash_table_size (mock_collection->records) : 0;
+}
+
+guint
+ephy_sync_mock_server_get_n_requests (EphySyncMockServer *self)
+{
+  g_assert (self);
+
+  return self->n_requests;
+}
+
+/* Makes the collection POSTs, which the batch uploads use, fail until unset. */
+void
+ephy_sync_mock_server_set_fail_uploads (EphySyncMockServer *self,
+                                        gboolean            fail_uploads)
+{
+  g_assert (self);
+
+  self->fail_uploads = fail_uploads;
+}
+
+double
+ephy_sync_mock_server_get_last_modified (EphySyncMockServer *self,
+                                         const char         *collection)
+{
+  MockCollection *mock_collection;
+
+  g_assert (self);
+  g_assert (collection);
+
+  mock_collection = g_hash_table_lookup (self->collections, collection);
+
+  return mock_collection ? mock_collection->last_modified : 0;
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An in-process stand-in for a Sync 1.5 storage server, implementing the
+ * storage endpoints used by EphySyncService: collection and record GETs with
+ * paging, record PUTs, batch uploads and X-If-Unmodified-Since checks. Hawk
+ * authorization is not verified.
+ */
+typedef struct _EphySyncMockServer EphySyncMockServer;
+
+EphySyncMockServer *ephy_sync_mock_server_new                  (GError            **error);
+void                ephy_sync_mock_server_free                 (EphySyncMockServer *self);
+const char         *ephy_sync_mock_server_get_storage_endpoint (EphySyncMockServer *self);
+void                ephy_sync_mock_server_add_record           (EphySyncMockServer *self,
+                                                                const char         *collection,
+                                                                const char         *id,
+                                                                const char         *payload);
+void                ephy_sync_mock_server_clear_collection     (EphySyncMockServer *self,
+                                                                const char         *collection);
+guint               ephy_sync_mock_server_get_n_records        (EphySyncMockServer *self,
+                                                                const char         *collection);
+guint               ephy_sync_mock_server_get_n_requests       (EphySyncMockServer *self);
+void                ephy_sync_mock_server_set_fail_uploads     (EphySyncMockServer *self,
+                                                                gboolean            fail_uploads);
+double              ephy_sync_mock_server_get_last_modified    (EphySyncMockServer *self,
+                                                                const char         *collection);
+
+G_END_DECLS
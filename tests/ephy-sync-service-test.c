@@ -0,0 +1,226 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "ephy-bookmark.h"
+#include "ephy-sync-crypto.h"
+#include "ephy-sync-dirty-set.h"
+#include "ephy-sync-mock-server.h"
+#include "ephy-sync-service-private.h"
+#include "ephy-sync-test-manager.h"
+#include "ephy-sync-utils.h"
+
+#include <glib.h>
+#include <math.h>
+
+typedef struct {
+  EphySyncMockServer  *server;
+  EphySyncService     *service;
+  EphySyncTestManager *manager;
+} SyncTest;
+
+static void
+sync_test_setup (SyncTest *test,
+                 gboolean  is_initial)
+{
+  GError *error = NULL;
+  char *crypto_keys;
+
+  test->server = ephy_sync_mock_server_new (&error);
+  g_assert_no_error (error);
+
+  /* Signing in after creating the service keeps it away from libsecret. */
+  crypto_keys = ephy_sync_crypto_generate_crypto_keys ();
+  test->service = ephy_sync_service_new (FALSE);
+  ephy_sync_utils_set_sync_user ("test@example.com");
+  ephy_sync_service_set_storage_for_testing (test->service,
+                                             ephy_sync_mock_server_get_storage_endpoint (test->server),
+                                             crypto_keys);
+  g_free (crypto_keys);
+
+  test->manager = ephy_sync_test_manager_new ("bookmarks", EPHY_TYPE_BOOKMARK);
+  ephy_synchronizable_manager_set_is_initial_sync (EPHY_SYNCHRONIZABLE_MANAGER (test->manager),
+                                                   is_initial);
+  ephy_sync_service_register_manager (test->service, EPHY_SYNCHRONIZABLE_MANAGER (test->manager));
+}
+
+static void
+sync_test_teardown (SyncTest *test)
+{
+  ephy_sync_service_unregister_manager (test->service, EPHY_SYNCHRONIZABLE_MANAGER (test->manager));
+  ephy_sync_utils_set_sync_user (NULL);
+  g_object_unref (test->manager);
+  g_object_unref (test->service);
+  ephy_sync_mock_server_free (test->server);
+}
+
+static gboolean
+sync_timeout_cb (gpointer user_data)
+{
+  g_assert_not_reached ();
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+run_sync (SyncTest *test)
+{
+  GMainLoop *loop;
+  gulong handler_id;
+  guint timeout_id;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  handler_id = g_signal_connect_swapped (test->service, "sync-finished",
+                                         G_CALLBACK (g_main_loop_quit), loop);
+  timeout_id = g_timeout_add_seconds (30, sync_timeout_cb, NULL);
+
+  ephy_sync_service_sync (test->service);
+  g_main_loop_run (loop);
+
+  g_source_remove (timeout_id);
+  g_signal_handler_disconnect (test->service, handler_id);
+  g_main_loop_unref (loop);
+}
+
+static EphySynchronizable *
+add_bookmark (SyncTest *test)
+{
+  EphyBookmark *bookmark;
+  char *id = ephy_sync_utils_get_random_sync_id ();
+
+  bookmark = ephy_bookmark_new ("https://www.example.com/", "Example", g_sequence_new (g_free), id);
+  ephy_sync_test_manager_add_record (test->manager, EPHY_SYNCHRONIZABLE (bookmark));
+  g_signal_emit_by_name (test->manager, "synchronizable-modified", bookmark, FALSE);
+
+  g_free (id);
+
+  return EPHY_SYNCHRONIZABLE (bookmark);
+}
+
+static guint
+get_n_dirty_entries (SyncTest *test)
+{
+  EphySyncDirtySet *dirty_set = ephy_sync_service_get_dirty_set_for_testing (test->service);
+  GPtrArray *entries = ephy_sync_dirty_set_get_entries (dirty_set, "bookmarks");
+  guint n_entries = entries->len;
+
+  g_ptr_array_unref (entries);
+
+  return n_entries;
+}
+
+static void
+test_ephy_sync_service_upload_failed (void)
+{
+  SyncTest test;
+  EphySynchronizable *bookmark;
+
+  sync_test_setup (&test, FALSE);
+  bookmark = add_bookmark (&test);
+  g_assert_cmpuint (get_n_dirty_entries (&test), ==, 1);
+
+  ephy_sync_mock_server_set_fail_uploads (test.server, TRUE);
+  run_sync (&test);
+
+  /* The change waits for the next sync. */
+  g_assert_cmpuint (ephy_sync_mock_server_get_n_records (test.server, "bookmarks"), ==, 0);
+  g_assert_cmpuint (get_n_dirty_entries (&test), ==, 1);
+  g_assert_cmpint (ephy_synchronizable_get_server_time_modified (bookmark), ==, 0);
+  g_assert_cmpuint (ephy_sync_test_manager_get_n_saves (test.manager), ==, 0);
+
+  ephy_sync_mock_server_set_fail_uploads (test.server, FALSE);
+  run_sync (&test);
+
+  g_assert_cmpuint (ephy_sync_mock_server_get_n_records (test.server, "bookmarks"), ==, 1);
+  g_assert_cmpuint (get_n_dirty_entries (&test), ==, 0);
+
+  g_object_unref (bookmark);
+  sync_test_teardown (&test);
+}
+
+static void
+test_ephy_sync_service_upload_committed (void)
+{
+  SyncTest test;
+  EphySynchronizable *bookmark;
+  double last_modified;
+
+  sync_test_setup (&test, FALSE);
+  bookmark = add_bookmark (&test);
+
+  run_sync (&test);
+
+  last_modified = ephy_sync_mock_server_get_last_modified (test.server, "bookmarks");
+  g_assert_cmpuint (ephy_sync_mock_server_get_n_records (test.server, "bookmarks"), ==, 1);
+  g_assert_cmpuint (get_n_dirty_entries (&test), ==, 0);
+  g_assert_cmpint (ephy_synchronizable_get_server_time_modified (bookmark), ==, ceil (last_modified));
+  g_assert_cmpuint (ephy_sync_test_manager_get_n_saves (test.manager), ==, 1);
+
+  g_object_unref (bookmark);
+  sync_test_teardown (&test);
+}
+
+static void
+test_ephy_sync_service_upload_merged (void)
+{
+  SyncTest test;
+  EphySynchronizable *bookmark;
+  double last_modified;
+
+  /* The initial merge uploads the record itself, the change stays in the
+   * dirty set until that upload is committed.
+   */
+  sync_test_setup (&test, TRUE);
+  bookmark = add_bookmark (&test);
+
+  ephy_sync_mock_server_set_fail_uploads (test.server, TRUE);
+  run_sync (&test);
+  g_assert_cmpuint (get_n_dirty_entries (&test), ==, 1);
+
+  ephy_sync_mock_server_set_fail_uploads (test.server, FALSE);
+  run_sync (&test);
+
+  last_modified = ephy_sync_mock_server_get_last_modified (test.server, "bookmarks");
+  g_assert_cmpuint (ephy_sync_mock_server_get_n_records (test.server, "bookmarks"), ==, 1);
+  g_assert_cmpuint (get_n_dirty_entries (&test), ==, 0);
+  g_assert_cmpint (ephy_synchronizable_get_server_time_modified (bookmark), ==, ceil (last_modified));
+
+  g_object_unref (bookmark);
+  sync_test_teardown (&test);
+}
+
+int
+main (int argc, char *argv[])
+{
+  /* Signing in writes the sync user setting. */
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lib/sync/ephy-sync-service/upload_failed",
+                   test_ephy_sync_service_upload_failed);
+  g_test_add_func ("/lib/sync/ephy-sync-service/upload_committed",
+                   test_ephy_sync_service_upload_committed);
+  g_test_add_func ("/lib/sync/ephy-sync-service/upload_merged",
+                   test_ephy_sync_service_upload_merged);
+
+  return g_test_run ();
+}
@@ -0,0 +1,219 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-sync-test-manager.h"
+
+struct _EphySyncTestManager {
+  GObject     parent_instance;
+
+  char       *collection;
+  GType       type;
+  GHashTable *records;
+  gboolean    is_initial;
+  gint64      sync_time;
+  guint       n_saves;
+};
+
+static void ephy_sync_test_manager_iface_init (EphySynchronizableManagerInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EphySyncTestManager, ephy_sync_test_manager, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (EPHY_TYPE_SYNCHRONIZABLE_MANAGER,
+                                                ephy_sync_test_manager_iface_init))
+
+static void
+ephy_sync_test_manager_finalize (GObject *object)
+{
+  EphySyncTestManager *self = EPHY_SYNC_TEST_MANAGER (object);
+
+  g_free (self->collection);
+  g_hash_table_unref (self->records);
+
+  G_OBJECT_CLASS (ephy_sync_test_manager_parent_class)->finalize (object);
+}
+
+static void
+ephy_sync_test_manager_class_init (EphySyncTestManagerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = ephy_sync_test_manager_finalize;
+}
+
+static void
+ephy_sync_test_manager_init (EphySyncTestManager *self)
+{
+  self->records = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  self->is_initial = TRUE;
+}
+
+EphySyncTestManager *
+ephy_sync_test_manager_new (const char *collection,
+                            GType       type)
+{
+  EphySyncTestManager *self = g_object_new (EPHY_TYPE_SYNC_TEST_MANAGER, NULL);
+
+  self->collection = g_strdup (collection);
+  self->type = type;
+
+  return self;
+}
+
+void
+ephy_sync_test_manager_add_record (EphySyncTestManager *self,
+                                   EphySynchronizable  *synchronizable)
+{
+  g_assert (EPHY_IS_SYNC_TEST_MANAGER (self));
+
+  g_hash_table_replace (self->records,
+                        g_strdup (ephy_synchronizable_get_id (synchronizable)),
+                        g_object_ref (synchronizable));
+}
+
+static const char *
+synchronizable_manager_get_collection_name (EphySynchronizableManager *manager)
+{
+  return EPHY_SYNC_TEST_MANAGER (manager)->collection;
+}
+
+static GType
+synchronizable_manager_get_synchronizable_type (EphySynchronizableManager *manager)
+{
+  return EPHY_SYNC_TEST_MANAGER (manager)->type;
+}
+
+static gboolean
+synchronizable_manager_is_initial_sync (EphySynchronizableManager *manager)
+{
+  return EPHY_SYNC_TEST_MANAGER (manager)->is_initial;
+}
+
+static void
+synchronizable_manager_set_is_initial_sync (EphySynchronizableManager *manager,
+                                            gboolean                   is_initial)
+{
+  EPHY_SYNC_TEST_MANAGER (manager)->is_initial = is_initial;
+}
+
+static gint64
+synchronizable_manager_get_sync_time (EphySynchronizableManager *manager)
+{
+  return EPHY_SYNC_TEST_MANAGER (manager)->sync_time;
+}
+
+static void
+synchronizable_manager_set_sync_time (EphySynchronizableManager *manager,
+                                      gint64                     sync_time)
+{
+  EPHY_SYNC_TEST_MANAGER (manager)->sync_time = sync_time;
+}
+
+static void
+synchronizable_manager_add (EphySynchronizableManager *manager,
+                            EphySynchronizable        *synchronizable)
+{
+  ephy_sync_test_manager_add_record (EPHY_SYNC_TEST_MANAGER (manager), synchronizable);
+}
+
+static void
+synchronizable_manager_remove (EphySynchronizableManager *manager,
+                               EphySynchronizable        *synchronizable)
+{
+  g_hash_table_remove (EPHY_SYNC_TEST_MANAGER (manager)->records,
+                       ephy_synchronizable_get_id (synchronizable));
+}
+
+static void
+synchronizable_manager_save (EphySynchronizableManager *manager,
+                             EphySynchronizable        *synchronizable)
+{
+  EPHY_SYNC_TEST_MANAGER (manager)->n_saves++;
+}
+
+static void
+synchronizable_manager_merge (EphySynchronizableManager              *manager,
+                              gboolean                                is_initial,
+                              GList                                  *remotes_deleted,
+                              GList                                  *remotes_updated,
+                              EphySynchronizableManagerMergeCallback  callback,
+                              gpointer                                user_data)
+{
+  EphySyncTestManager *self = EPHY_SYNC_TEST_MANAGER (manager);
+  GPtrArray *to_upload;
+
+  to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+
+  /* Local records unknown to the server are uploaded on the initial sync. */
+  if (is_initial) {
+    GHashTable *remote_ids = g_hash_table_new (g_str_hash, g_str_equal);
+    GHashTableIter iter;
+    EphySynchronizable *local;
+
+    for (GList *l = remotes_updated; l && l->data; l = l->next)
+      g_hash_table_add (remote_ids, (gpointer)ephy_synchronizable_get_id (l->data));
+
+    g_hash_table_iter_init (&iter, self->records);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&local)) {
+      if (!g_hash_table_contains (remote_ids, ephy_synchronizable_get_id (local)))
+        g_ptr_array_add (to_upload, g_object_ref (local));
+    }
+
+    g_hash_table_unref (remote_ids);
+  }
+
+  for (GList *l = remotes_deleted; l && l->data; l = l->next)
+    g_hash_table_remove (self->records, ephy_synchronizable_get_id (l->data));
+
+  for (GList *l = remotes_updated; l && l->data; l = l->next)
+    ephy_sync_test_manager_add_record (self, l->data);
+
+  callback (to_upload, user_data);
+}
+
+static void
+ephy_sync_test_manager_iface_init (EphySynchronizableManagerInterface *iface)
+{
+  iface->get_collection_name = synchronizable_manager_get_collection_name;
+  iface->get_synchronizable_type = synchronizable_manager_get_synchronizable_type;
+  iface->is_initial_sync = synchronizable_manager_is_initial_sync;
+  iface->set_is_initial_sync = synchronizable_manager_set_is_initial_sync;
+  iface->get_sync_time = synchronizable_manager_get_sync_time;
+  iface->set_sync_time = synchronizable_manager_set_sync_time;
+  iface->add = synchronizable_manager_add;
+  iface->remove = synchronizable_manager_remove;
+  iface->save = synchronizable_manager_save;
+  iface->merge = synchronizable_manager_merge;
+}
+
+guint
+ephy_sync_test_manager_get_n_records (EphySyncTestManager *self)
+{
+  g_assert (EPHY_IS_SYNC_TEST_MANAGER (self));
+
+  return g_hash_table_size (self->records);
+}
+
+guint
+ephy_sync_test_manager_get_n_saves (EphySyncTestManager *self)
+{
+  g_assert (EPHY_IS_SYNC_TEST_MANAGER (self));
+
+  return self->n_saves;
+}
@@ -0,0 +1,42 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-synchronizable-manager.h"
+
+G_BEGIN_DECLS
+
+/* A synchronizable manager keeping its records in memory, for the tests and
+ * benchmarks of the sync service. Its merge uploads the local records unknown
+ * to the server on the initial sync.
+ */
+#define EPHY_TYPE_SYNC_TEST_MANAGER (ephy_sync_test_manager_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphySyncTestManager, ephy_sync_test_manager, EPHY, SYNC_TEST_MANAGER, GObject)
+
+EphySyncTestManager *ephy_sync_test_manager_new           (const char          *collection,
+                                                           GType                type);
+void                 ephy_sync_test_manager_add_record    (EphySyncTestManager *self,
+                                                           EphySynchronizable  *synchronizable);
+guint                ephy_sync_test_manager_get_n_records (EphySyncTestManager *self);
+guint                ephy_sync_test_manager_get_n_saves   (EphySyncTestManager *self);
+
+G_END_DECLS
@@ -0,0 +1,122 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-tab-discarder-private.h"
+
+#include "ephy-memory-pressure.h"
+
+#include <glib.h>
+
+#define NOW (1000 * G_USEC_PER_SEC)
+#define HIDDEN_LONG_AGO (NOW - 600 * G_USEC_PER_SEC)
+
+static void
+test_ephy_tab_discarder_pressure_threshold (void)
+{
+  const char *meminfo_short = "MemTotal:       16000000 kB\n"
+                              "MemFree:          100000 kB\n"
+                              "MemAvailable:    1500000 kB\n";
+  const char *meminfo_plenty = "MemTotal:       16000000 kB\n"
+                               "MemFree:         4000000 kB\n"
+                               "MemAvailable:    8000000 kB\n";
+
+  /* PSI wins over the available memory when present. */
+  g_assert_true (ephy_memory_pressure_parse ("some avg10=12.50 avg60=3.00 avg300=1.00 total=100\n"
+                                             "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n",
+                                             meminfo_plenty));
+  g_assert_true (ephy_memory_pressure_parse ("some avg10=10.00 avg60=0.00 avg300=0.00 total=0\n", NULL));
+  g_assert_false (ephy_memory_pressure_parse ("some avg10=9.99 avg60=40.00 avg300=40.00 total=100\n",
+                                              meminfo_short));
+
+  /* Without PSI, less than 10% of the memory must be available. */
+  g_assert_true (ephy_memory_pressure_parse (NULL, meminfo_short));
+  g_assert_false (ephy_memory_pressure_parse (NULL, meminfo_plenty));
+  g_assert_false (ephy_memory_pressure_parse ("garbage", meminfo_plenty));
+  g_assert_false (ephy_memory_pressure_parse (NULL, "MemTotal: 16000000 kB\n"));
+  g_assert_false (ephy_memory_pressure_parse (NULL, NULL));
+}
+
+static void
+test_ephy_tab_discarder_skipped_tabs (void)
+{
+  EphyTabDiscarderTab tab = { FALSE, FALSE, FALSE, FALSE, HIDDEN_LONG_AGO };
+
+  g_assert_true (ephy_tab_discarder_tab_is_discardable (&tab, NOW));
+
+  /* The active tab. */
+  tab.shown = TRUE;
+  g_assert_false (ephy_tab_discarder_tab_is_discardable (&tab, NOW));
+  tab.shown = FALSE;
+
+  /* A tab playing audio. */
+  tab.playing_audio = TRUE;
+  g_assert_false (ephy_tab_discarder_tab_is_discardable (&tab, NOW));
+  tab.playing_audio = FALSE;
+
+  /* A tab that is loading, or already discarded. */
+  tab.busy = TRUE;
+  g_assert_false (ephy_tab_discarder_tab_is_discardable (&tab, NOW));
+  tab.busy = FALSE;
+
+  /* A tab the user just switched away from. */
+  tab.last_visible_time = NOW - 10 * G_USEC_PER_SEC;
+  g_assert_false (ephy_tab_discarder_tab_is_discardable (&tab, NOW));
+}
+
+static void
+test_ephy_tab_discarder_order (void)
+{
+  EphyTabDiscarderTab tabs[] = {
+    { FALSE, FALSE, FALSE, FALSE, HIDDEN_LONG_AGO + 100 * G_USEC_PER_SEC },
+    { FALSE, TRUE, FALSE, FALSE, HIDDEN_LONG_AGO - 100 * G_USEC_PER_SEC },
+    { FALSE, FALSE, FALSE, FALSE, HIDDEN_LONG_AGO },
+  };
+  GArray *array = g_array_new (FALSE, FALSE, sizeof (EphyTabDiscarderTab));
+  EphyTabDiscarderTab *last;
+
+  g_array_append_vals (array, tabs, G_N_ELEMENTS (tabs));
+  g_array_sort (array, (GCompareFunc)ephy_tab_discarder_compare_tabs);
+
+  /* The pinned tab is skipped while another one was hidden, even if more
+   * recently. The most discardable tab comes last.
+   */
+  last = &g_array_index (array, EphyTabDiscarderTab, 2);
+  g_assert_false (last->pinned);
+  g_assert_cmpint (last->last_visible_time, ==, HIDDEN_LONG_AGO);
+  g_assert_true (g_array_index (array, EphyTabDiscarderTab, 0).pinned);
+
+  g_array_unref (array);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/src/ephy-tab-discarder/pressure_threshold",
+                   test_ephy_tab_discarder_pressure_threshold);
+  g_test_add_func ("/src/ephy-tab-discarder/skipped_tabs",
+                   test_ephy_tab_discarder_skipped_tabs);
+  g_test_add_func ("/src/ephy-tab-discarder/order",
+                   test_ephy_tab_discarder_order);
+
+  return g_test_run ();
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2019 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the time needed to encode a thumbnail and its size on disk for
+ * each PNG compression level, to pick THUMBNAIL_PNG_COMPRESSION_LEVEL in
+ * ephy-snapshot-service.c. Run with `meson test --benchmark`.
+ */
+
+#include "config.h"
+#include "ephy-snapshot-service.h"
+
+#include <cairo.h>
+#include <gdk/gdk.h>
+#include <glib.h>
+
+#define ITERATIONS 200
+
+/* Something that looks vaguely like a web page: a colored header, blocks of
+ * "text" and a gradient standing for a picture.
+ */
+static GdkPixbuf *
+create_thumbnail (void)
+{
+  cairo_surface_t *surface;
+  cairo_pattern_t *gradient;
+  GdkPixbuf *pixbuf;
+  cairo_t *cr;
+  GRand *rand;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, EPHY_THUMBNAIL_WIDTH, EPHY_THUMBNAIL_HEIGHT);
+  cr = cairo_create (surface);
+  rand = g_rand_new_with_seed (42);
+
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_paint (cr);
+
+  cairo_set_source_rgb (cr, 0.2, 0.4, 0.7);
+  cairo_rectangle (cr, 0, 0, EPHY_THUMBNAIL_WIDTH, 18);
+  cairo_fill (cr);
+
+  cairo_set_source_rgb (cr, 0.25, 0.25, 0.25);
+  for (int y = 26; y < EPHY_THUMBNAIL_HEIGHT - 10; y += 4) {
+    for (int x = 8; x < 100; x += 4) {
+      int width = g_rand_int_range (rand, 1, 4);
+
+      if (g_rand_boolean (rand))
+        cairo_rectangle (cr, x, y, width, 2);
+    }
+  }
+  cairo_fill (cr);
+
+  gradient = cairo_pattern_create_linear (110, 26, 170, 100);
+  cairo_pattern_add_color_stop_rgb (gradient, 0, 0.9, 0.6, 0.2);
+  cairo_pattern_add_color_stop_rgb (gradient, 1, 0.1, 0.5, 0.3);
+  cairo_set_source (cr, gradient);
+  cairo_rectangle (cr, 110, 26, 60, 74);
+  cairo_fill (cr);
+
+  cairo_pattern_destroy (gradient);
+  cairo_destroy (cr);
+  g_rand_free (rand);
+
+  pixbuf = gdk_pixbuf_get_from_surface (surface, 0, 0, EPHY_THUMBNAIL_WIDTH, EPHY_THUMBNAIL_HEIGHT);
+  cairo_surface_destroy (surface);
+
+  return pixbuf;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GdkPixbuf *pixbuf;
+
+  pixbuf = create_thumbnail ();
+
+  g_print ("%-8s %14s %10s\n", "Level", "Encode (µs)", "Bytes");
+
+  for (int level = 0; level <= 9; level++) {
+    g_autofree char *level_str = g_strdup_printf ("%d", level);
+    gsize size = 0;
+    gint64 start;
+    gint64 elapsed;
+
+    start = g_get_monotonic_time ();
+    for (int i = 0; i < ITERATIONS; i++) {
+      g_autofree char *buffer = NULL;
+      GError *error = NULL;
+
+      if (!gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &size, "png", &error,
+                                      "tEXt::Thumb::URI", "https://www.gnome.org/",
+                                      "tEXt::Software", "GNOME::Epiphany::ThumbnailFactory",
+                                      "compression", level_str,
+                                      NULL)) {
+        g_printerr ("Failed to encode thumbnail: %s\n", error->message);
+        g_error_free (error);
+        return 1;
+      }
+    }
+    elapsed = g_get_monotonic_time () - start;
+
+    g_print ("%-8d %14.1f %10" G_GSIZE_FORMAT "\n", level, elapsed / (double)ITERATIONS, size);
+  }
+
+  g_object_unref (pixbuf);
+
+  return 0;
+}
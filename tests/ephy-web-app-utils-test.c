@@ -138,6 +138,52 @@ test_web_app_lifetime (void)
   }
 }
 
+static gboolean
+application_list_has_name (const char *name)
+{
+  GList *apps;
+  gboolean found;
+
+  apps = ephy_web_application_get_application_list ();
+  found = apps && g_strcmp0 (((EphyWebApplication *)apps->data)->name, name) == 0;
+  ephy_web_application_free_application_list (apps);
+
+  return found;
+}
+
+static void
+test_web_app_list_monitor (void)
+{
+  g_autofree char *id = NULL;
+  g_autofree char *desktop_file = NULL;
+  g_autoptr(GKeyFile) key_file = NULL;
+  gint64 deadline;
+  guint wakeup_id;
+
+  id = ephy_web_application_get_app_id_from_name ("Monitored");
+  desktop_file = ephy_web_application_create (id, "http://www.gnome.org/", "Monitored", NULL);
+  g_assert_true (application_list_has_name ("Monitored"));
+
+  /* Rename the application behind the back of the cached list, like the
+   * preferences of the web application process do.
+   */
+  key_file = g_key_file_new ();
+  g_assert_true (g_key_file_load_from_file (key_file, desktop_file, G_KEY_FILE_NONE, NULL));
+  g_key_file_set_string (key_file, "Desktop Entry", "Name", "Renamed");
+  g_assert_true (g_key_file_save_to_file (key_file, desktop_file, NULL));
+
+  wakeup_id = g_timeout_add (100, (GSourceFunc)gtk_true, NULL);
+  deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+  while (!application_list_has_name ("Renamed") && g_get_monotonic_time () < deadline)
+    g_main_context_iteration (NULL, TRUE);
+  g_source_remove (wakeup_id);
+
+  g_assert_true (application_list_has_name ("Renamed"));
+
+  g_assert_true (ephy_web_application_delete (id));
+  g_assert_false (application_list_has_name ("Renamed"));
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -160,6 +206,8 @@ main (int argc, char *argv[])
 
   g_test_add_func ("/embed/ephy-web-app-utils/lifetime",
                    test_web_app_lifetime);
+  g_test_add_func ("/embed/ephy-web-app-utils/list-monitor",
+                   test_web_app_list_monitor);
 
   ret = g_test_run ();
 